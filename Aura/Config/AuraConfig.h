@@ -28,6 +28,12 @@
 // #define ORBIS_TASK_MANAGER
 #endif
 
+//	Debug builds check at load that the CPU propagation gives the same bits on task managers of 1 to this many workers,
+//	see verifyCPUPropagationDeterminism, and that the coarse to fine mode keeps the far field, see compareCPUCoarseToFine
+#if defined(ENABLE_CPU_PROPAGATION) && defined(_DEBUG)
+#define AURA_DETERMINISM_TEST_WORKERS 4
+#endif
+
 #if USE_COMPUTE_SHADERS
 #define RESOURCE_STATE_LPV RESOURCE_STATE_UNORDERED_ACCESS
 #else
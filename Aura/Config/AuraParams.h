@@ -15,6 +15,7 @@
 #include "../Math/AuraMath.h"
 
 #define NUM_GRIDS_PER_CASCADE 3U
+#define MAX_CASCADE_COUNT     8U
 
 namespace aura
 {
@@ -40,14 +41,14 @@ struct LightPropagationVolumeParams
 {
     bool     bUseMultipleReflections;
     bool     bUseCPUPropagation;
-    bool     bAlternateGPUUpdates; //	TODO: Igor: remove this from the LPV library, since this is the client who is responcible for this.
+    bool     bAlternateGPUUpdates; //	Limits the update scheduler to a single cascade per frame
     float    fPropagationScale;    //	TODO: Igor: remove this debug attribute
     bool     bDebugLight;
     bool     bDebugOccluder;
     float    fGIStrength;
     uint32_t iPropagationSteps;
     uint32_t iSpecularQuality;
-    float    fLightScale[3];
+    float    fLightScale[MAX_CASCADE_COUNT];
     float    fSpecScale;
     float    fSpecPow;
     float    fFresnel;
@@ -63,8 +64,22 @@ struct ScreenSpaceGIParams
 
 struct CPUPropagationParams
 {
-    MTTypes eMTMode;
-    bool    bDecoupled;
+    MTTypes  eMTMode;
+    bool     bDecoupled;
+    bool     bCoarseToFine; //	Propagates the far field on a half resolution grid, after the fine steps
+    uint32_t iFineSteps;    //	Full resolution steps of the coarse to fine mode. 0 means default
+    float    fPropagationBudgetMs; //	Propagation stops after this much time and resumes next frame. 0 means unlimited
+    bool     bTiledLayout;         //	Propagates on 4x4x4 cell tiles, neighbours share cache lines more often
+    uint32_t iBounceCount;         //	Extra bounces when bUseMultipleReflections is set. 0 means one
+    bool     bSeedCascadeBorders;  //	Fills the faded border of a cascade with the light of the next coarser one
+    bool     bDeterministic;       //	Same light on the same frame for the same input: no budget, fences or measured costs
+};
+
+struct UpdateSchedulerParams
+{
+    float    fCPUBudgetMs;             //	0 means unlimited
+    float    fGPUBudgetMs;             //	0 means unlimited
+    uint32_t iMaxFramesBetweenUpdates; //	Starvation guard. 0 means default
 };
 
 struct Params
@@ -72,6 +87,7 @@ struct Params
     LightPropagationVolumeParams LPVParams;
     ScreenSpaceGIParams          SSGIParams;
     CPUPropagationParams         CPUParams;
+    UpdateSchedulerParams        SchedulerParams;
 };
 
 const char* const MT_STRINGS[] = {
@@ -38,9 +38,21 @@ public:
     virtual void waitForTaskSet(ITASKSETHANDLE hTaskSet) = 0;
     virtual bool isTaskDone(ITASKSETHANDLE hTaskSet) = 0;
     virtual void waitAll() = 0;
+    //	Lets tuneCPUPropagation re-tune when the thread pool changed. 0 means unknown, tuning then happens once.
+    virtual uint32_t getWorkerCount() { return 0; }
+    //	Runs the set on the workers of a domain of getCPUTopology, see LightPropagation/LightPropagationTopology.h, so that memory
+    //	first touched by a set stays local to the sets that follow. Aura does not pin any threads itself: the placement only
+    //	pays off with task managers whose workers are pinned to the CPUs of the domains. Others ignore the domain.
+    virtual bool createTaskSetInDomain(uint32_t domain, uint32_t group, ITASKSETFUNC pFunc, void* pArg, uint32_t uTaskCount,
+                                       ITASKSETHANDLE* pDepends, uint32_t nDepends, const char* setName, ITASKSETHANDLE* pOutHandle)
+    {
+        return createTaskSet(group, pFunc, pArg, uTaskCount, pDepends, nDepends, setName, pOutHandle);
+    }
 };
 
 void initTaskManager(ITaskManager** ppTaskManager);
+//	A task manager with exactly workerCount worker threads, for verifyCPUPropagationDeterminism
+void initTaskManager(ITaskManager** ppTaskManager, uint32_t workerCount);
 void removeTaskManager(ITaskManager* pTaskManager);
 } // namespace aura
 
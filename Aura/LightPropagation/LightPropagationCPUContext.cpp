@@ -10,6 +10,8 @@
 
 #include "LightPropagationCPUContext.h"
 
+#include "../../../The-Forge/Common_3/Utilities/Interfaces/ITime.h"
+
 #include "../../../The-Forge/Common_3/Resources/ResourceLoader/ThirdParty/OpenSource/tinyimageformat/tinyimageformat_apis.h"
 #include "../../../The-Forge/Common_3/Resources/ResourceLoader/ThirdParty/OpenSource/tinyimageformat/tinyimageformat_query.h"
 
@@ -24,6 +26,9 @@
 #include "../Shaders/FSL/lpvCommon.h"
 #include "../Shaders/FSL/lpvSHMaths.h"
 
+#include "LightPropagationGridLayout.h"
+#include "LightPropagationTopology.h"
+
 #if !defined(__linux__) && !defined(NX64) && !defined(__aarch64__)
 // #ifndef __linux__
 #define INTRIN_USE
@@ -56,9 +61,29 @@ namespace aura
 
 static void cmdCopyResource(Cmd* pCmd, const TextureDesc* pDesc, Texture* pSrc, Buffer* pDst);
 static void queryTextureFootprint(const Renderer* pRenderer, const RenderTarget* pRT, TextureFootprint* pFootprint);
+static void tileGrid(const vec4* __restrict src, vec4* __restrict dst);
 
 const uint32_t lpvElementCount = GridRes * GridRes * GridRes * 4;
 
+static const int      CoarseGridRes = GridRes / 2;
+static const uint32_t coarseCellCount = CoarseGridRes * CoarseGridRes * CoarseGridRes;
+static const int      DEFAULT_FINE_STEPS = 4;
+
+//	Granularity of the sliced propagation until the partition is tuned. The deadline is checked after each slab.
+static const int SLICED_PROPAGATION_SLAB = 4;
+static const int DEFAULT_TASKS_PER_STEP = 32;
+
+//	Partition tuning: candidate task counts, slices are split evenly between the tasks
+static const uint32_t tuningTaskCounts[] = { 1, 2, 4, 8, 16, 32 };
+static const int      TUNING_REPEATS = 3;
+//	More tasks have to be at least this much faster to be picked, the workers are shared with the rest of the frame
+static const float    TUNING_TASK_GAIN = 0.95f;
+//	The sliced propagation checks the deadline about this often
+static const int64_t  TUNING_SLAB_USEC = 100;
+
+//	Fraction of the light reflected by the occluders, same as for the analytic lights
+static const float BOUNCE_ALBEDO = 0.5f;
+
 void LightPropagationCPUContext::readData(Cmd* pCmd, Renderer* pRenderer, RenderTarget* m_LightGrids[3], uint32_t numGrids)
 {
     // Transition textures into copyable resource states.
@@ -92,25 +117,217 @@ void LightPropagationCPUContext::readData(Cmd* pCmd, Renderer* pRenderer, Render
     cmdResourceBarrier(pCmd, 0, NULL, 0, NULL, numBarriers, rtBarriers);
 }
 
-void LightPropagationCPUContext::processData(Renderer* pRenderer, ITaskManager* pTaskManager, MTTypes propagationMTType)
+void LightPropagationCPUContext::setReadbackTag(uint64_t frame, Fence* pFence)
+{
+    m_CaptureFrame = frame;
+    m_pCaptureFence = pFence;
+}
+
+bool LightPropagationCPUContext::isReadbackComplete(Renderer* pRenderer, uint64_t frame, uint32_t maxFramesInFlight) const
+{
+    //	Not submitted before the end of the frame it was recorded in
+    if (frame <= m_CaptureFrame)
+        return false;
+
+    //	The client waited for the fence of the capture frame before reusing its resources
+    if (frame - m_CaptureFrame >= maxFramesInFlight)
+        return true;
+
+    if (!m_pCaptureFence)
+        return false;
+
+    //	The fence is not reused before maxFramesInFlight frames, not submitted means it was waited for since
+    FenceStatus status = FENCE_STATUS_INCOMPLETE;
+    getFenceStatus(pRenderer, m_pCaptureFence, &status);
+    return status != FENCE_STATUS_INCOMPLETE;
+}
+
+void LightPropagationCPUContext::prepareCapturedLight(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params)
 {
+    m_bTiledLayout = params.bTiledLayout && !m_bSHL2Propagation;
+
     convertGPUtoCPU(pRenderer);
 
-    switch (propagationMTType)
+    if (m_pBorderSeed)
+    {
+        seedBorder(m_pBorderSeed, m_BorderSeedScale);
+        m_pBorderSeed = NULL;
+    }
+
+    //	The step grid is free until the propagation starts
+    if (m_bHasOccluders && m_bTiledLayout)
+    {
+        tileGrid(m_pOccluders, m_CPUGrids[3]);
+
+        vec4* pTmp = m_pOccluders;
+        m_pOccluders = m_CPUGrids[3];
+        m_CPUGrids[3] = pTmp;
+    }
+
+    if (m_pLightBatch)
+        injectLights(m_pLightBatch, pTaskManager, m_CPUGrids, m_bHasOccluders ? m_pOccluders : NULL, m_bTiledLayout);
+
+    //	Bounces need something to reflect off
+    m_BounceCount = (m_bHasOccluders && !m_bSHL2Propagation) ? (int)params.iBounceCount : 0;
+    if (m_BounceCount > 0)
+    {
+        //	Kept to tell the captured light apart from the gathered one
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!m_pBounceGrids[i])
+                m_pBounceGrids[i] = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
+            memcpy(m_pBounceGrids[i], m_CPUGrids[i], lpvElementCount * sizeof(float));
+        }
+    }
+}
+
+void LightPropagationCPUContext::processData(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params)
+{
+    prepareCapturedLight(pRenderer, params.eMTMode == MT_None ? NULL : pTaskManager, params);
+
+    const int64_t startTime = getUSec(false);
+
+    if (m_bSHL2Propagation)
+    {
+        propagateSHL2Grids(params.eMTMode == MT_None ? NULL : pTaskManager);
+        m_PropagationUSec = getUSec(false) - startTime;
+        return;
+    }
+
+    const int totalSteps = m_nPropagationSteps;
+    int       coarseSteps = 0;
+    m_nPropagationSteps = setupPropagationSteps(params, &coarseSteps);
+
+    switch (params.eMTMode)
     {
     case MT_None:
         doPropagate();
         break;
     case MT_ExtremeTasks:
-        launchPropagateMultiTask(pTaskManager, 32);
+        launchPropagateMultiTask(pTaskManager, (int)m_Partition.mTasksPerStep);
         break;
     default:
+        break;
+    }
+
+    m_nPropagationSteps = totalSteps;
+
+    if (coarseSteps > 0)
+        propagateCoarse(coarseSteps);
+
+    if (m_BounceCount > 0)
+        propagateBounces(params.eMTMode == MT_None ? NULL : pTaskManager);
+
+    m_PropagationUSec = getUSec(false) - startTime;
+}
+
+int LightPropagationCPUContext::setupPropagationSteps(const CPUPropagationParams& params, int* pCoarseSteps) const
+{
+    *pCoarseSteps = 0;
+    if (!params.bCoarseToFine)
+        return m_nPropagationSteps;
+
+    //	Coarse to fine: the near field is propagated at full resolution, the rest of the distance is covered
+    //	by the half resolution grid which moves the light two cells per step. The coarse grid starts from the light of the
+    //	last fine step, so it runs after the fine steps rather than before them as in multigrid: started from the captured
+    //	light it also carries the near field, which the fine steps already have, and 12 steps overshoot the far field
+    //	energy by half. See compareCoarseToFine.
+    const int fineSteps = min((int)(params.iFineSteps ? params.iFineSteps : DEFAULT_FINE_STEPS), m_nPropagationSteps);
+    *pCoarseSteps = (m_nPropagationSteps - fineSteps + 1) / 2;
+    return fineSteps;
+}
+
+void LightPropagationCPUContext::beginPropagation(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params)
+{
+    const int64_t startTime = getUSec(false);
+
+    prepareCapturedLight(pRenderer, pTaskManager, params);
+
+    //	Not sliced, done at once and continuePropagation returns true right away
+    if (m_bSHL2Propagation)
+    {
+        propagateSHL2Grids(pTaskManager);
+        m_PropagationUSec = getUSec(false) - startTime;
+        eState = PROPAGATING_LIGHT;
         return;
     }
+
+    int       coarseSteps = 0;
+    const int fineSteps = setupPropagationSteps(params, &coarseSteps);
+    resetPropagationCursor(fineSteps, coarseSteps);
+
+    m_PropagationUSec = getUSec(false) - startTime;
+    eState = PROPAGATING_LIGHT;
+}
+
+bool LightPropagationCPUContext::continuePropagation(int64_t deadlineUSec)
+{
+    if (m_bSHL2Propagation)
+    {
+        eState = PROPAGATED_LIGHT;
+        return true;
+    }
+
+    const int64_t startTime = getUSec(false);
+
+    const bool bDone = advancePropagation(deadlineUSec);
+    if (bDone && m_Cursor.mCoarseSteps > 0)
+        propagateCoarse(m_Cursor.mCoarseSteps);
+    //	Bounces are not sliced, they run single threaded once the main propagation is done
+    if (bDone && m_BounceCount > 0)
+        propagateBounces(NULL);
+
+    m_PropagationUSec += getUSec(false) - startTime;
+
+    if (bDone)
+        eState = PROPAGATED_LIGHT;
+    return bDone;
 }
 
 void LightPropagationCPUContext::applyData(Cmd* pCmd, Renderer* pRenderer, RenderTarget* m_LightGrids[3])
 {
+    packAppliedLight();
+    reapplyData(pCmd, m_LightGrids);
+}
+
+//	Texels of the grids in the format of the light grid textures, rows GridRes texels apart
+void LightPropagationCPUContext::packAppliedLight()
+{
+    const uint32_t texelCount = GridRes * GridRes * GridRes * 4;
+    if (!m_pAppliedTexels)
+        m_pAppliedTexels = (half*)aura::alloc(NUM_GRIDS_PER_CASCADE * texelCount * sizeof(half));
+
+    for (uint32_t i = 0; i < NUM_GRIDS_PER_CASCADE; i++)
+    {
+        half* dstData = m_pAppliedTexels + texelCount * i;
+        if (!m_bTiledLayout)
+        {
+            const float* srcData = &m_CPUGrids[i][0].x;
+            for (uint32_t c = 0; c < texelCount; ++c)
+                dstData[c] = srcData[c];
+            continue;
+        }
+
+        for (uint32_t z = 0; z < GridRes; ++z)
+        {
+            for (uint32_t y = 0; y < GridRes; ++y)
+            {
+                half* dstRowData = dstData + (z * GridRes + y) * GridRes * 4;
+                for (uint32_t x = 0; x < GridRes; ++x)
+                {
+                    const float* srcCell = &m_CPUGrids[i][getTiledCellOffset(z, y, x)].x;
+                    for (uint32_t c = 0; c < 4; ++c)
+                        dstRowData[x * 4 + c] = srcCell[c];
+                }
+            }
+        }
+    }
+}
+
+void LightPropagationCPUContext::reapplyData(Cmd* pCmd, RenderTarget* m_LightGrids[3])
+{
+    ASSERT(m_pAppliedTexels);
+
     cmdBeginDebugMarker(pCmd, 1.0, 0.0, 0.0, "Copy Barriers");
     RenderTargetBarrier rtBarriers[NUM_GRIDS_PER_CASCADE] = {};
     for (uint32_t i = 0; i < 3; ++i)
@@ -121,6 +338,7 @@ void LightPropagationCPUContext::applyData(Cmd* pCmd, Renderer* pRenderer, Rende
     cmdEndDebugMarker(pCmd);
 
     cmdBeginDebugMarker(pCmd, 1.0, 0.0, 0.0, "Copy to Light Grid Texture");
+    const uint32_t rowSize = GridRes * 4 * sizeof(half);
     for (uint32_t i = 0; i < NUM_GRIDS_PER_CASCADE; i++)
     {
         TextureUpdateDesc updateDesc = { m_LightGrids[i]->pTexture };
@@ -129,22 +347,12 @@ void LightPropagationCPUContext::applyData(Cmd* pCmd, Renderer* pRenderer, Rende
         beginUpdateResource(&updateDesc);
         TextureSubresourceUpdate subresource = updateDesc.getSubresourceUpdateDesc(0, 0);
 
-        const uint32_t srcRowSize = GridRes * 4 * sizeof(float);
-        const uint32_t srcSliceSize = srcRowSize * GridRes;
-
+        const uint8_t* srcData = (const uint8_t*)(m_pAppliedTexels + GridRes * GridRes * GridRes * 4 * i);
         for (uint32_t z = 0; z < GridRes; ++z)
         {
             uint8_t* dstSliceData = subresource.pMappedData + subresource.mDstSliceStride * z;
-            uint8_t* srcSliceData = (uint8_t*)m_CPUGrids[i] + srcSliceSize * z;
             for (uint32_t r = 0; r < subresource.mRowCount; ++r)
-            {
-                half*  dstRowData = (half*)(dstSliceData + subresource.mDstRowStride * r);
-                float* srcRowData = (float*)(srcSliceData + srcRowSize * r);
-                for (uint32_t c = 0; c < GridRes * 4; ++c)
-                {
-                    dstRowData[c] = srcRowData[c];
-                }
-            }
+                memcpy(dstSliceData + subresource.mDstRowStride * r, srcData + rowSize * (z * GridRes + r), rowSize);
         }
 
         endUpdateResource(&updateDesc);
@@ -165,8 +373,7 @@ void LightPropagationCPUContext::convertGPUtoCPU(Renderer* pRenderer)
 {
     for (uint32_t i = 0; i < NUM_GRIDS_PER_CASCADE; i++)
     {
-        ReadRange range = { 0, m_ReadbackFootprint.mTotalByteCount };
-        mapBuffer(pRenderer, m_ReadbackLightGrids[i], &range);
+        //	Only called for complete readbacks, see isReadbackComplete
         half* lightPropagationGridData = (half*)m_ReadbackLightGrids[i]->pCpuMappedAddress;
         if (lightPropagationGridData != NULL)
         {
@@ -175,13 +382,22 @@ void LightPropagationCPUContext::convertGPUtoCPU(Renderer* pRenderer)
             for (uint64_t yz = 0; yz < GridRes * GridRes; ++yz) // Y * Z
             {
                 const half* src = lightPropagationGridData + yz * rowItemCount;
+                if (m_bTiledLayout)
+                {
+                    for (uint32_t x = 0; x < GridRes; ++x)
+                    {
+                        float* dstCell = &m_CPUGrids[i][getTiledCellOffset((int)(yz / GridRes), (int)(yz % GridRes), x)].x;
+                        for (uint32_t c = 0; c < 4; ++c)
+                            dstCell[c] = *src++;
+                    }
+                    continue;
+                }
+
                 for (uint32_t x = 0; x < GridRes * 4; ++x) // X * ChannelCount
                 {
                     *floatBuf++ = *src++;
                 }
             }
-
-            unmapBuffer(pRenderer, m_ReadbackLightGrids[i]);
         }
     }
 }
@@ -190,6 +406,26 @@ bool LightPropagationCPUContext::load(Renderer* pRenderer, RenderTarget* m_Light
 {
     m_hLastTask = ITASKSETHANDLE_INVALID;
     m_nPropagationSteps = 12;
+    m_CaptureFrame = 0;
+    m_pCaptureFence = NULL;
+    m_bTiledLayout = false;
+    m_BounceCount = 0;
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_pBounceGrids); ++i)
+        m_pBounceGrids[i] = NULL;
+
+    m_bSHL2Propagation = false;
+    m_pSHL2Grids = NULL;
+    m_pAppliedTexels = NULL;
+    m_pBorderSeed = NULL;
+    m_BorderSeedScale = 0.0f;
+    m_Domain = 0;
+    m_bGridsPlaced = false;
+
+    m_Partition.mTasksPerStep = DEFAULT_TASKS_PER_STEP;
+    m_Partition.mSlabSize = SLICED_PROPAGATION_SLAB;
+    m_Partition.mWorkerCount = 0;
+    m_Partition.bTuned = false;
 
     for (uint32_t i = 0; i < ARRAY_COUNT(m_CPUGrids); ++i)
         m_CPUGrids[i] = 0;
@@ -202,7 +438,7 @@ bool LightPropagationCPUContext::load(Renderer* pRenderer, RenderTarget* m_Light
     {
         BufferDesc readbackDesc = {};
         readbackDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_TO_CPU;
-        readbackDesc.mFlags = BUFFER_CREATION_FLAG_OWN_MEMORY_BIT;
+        readbackDesc.mFlags = BUFFER_CREATION_FLAG_OWN_MEMORY_BIT | BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
         readbackDesc.mStartState = ::RESOURCE_STATE_COPY_DEST;
         readbackDesc.mSize = m_ReadbackFootprint.mTotalByteCount;
         readbackDesc.mAlignment = 65536;
@@ -214,6 +450,14 @@ bool LightPropagationCPUContext::load(Renderer* pRenderer, RenderTarget* m_Light
     for (uint32_t i = 0; i < ARRAY_COUNT(m_CPUGrids); ++i)
         m_CPUGrids[i] = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
 
+    //	Allocated on first use
+    m_pOccluders = NULL;
+    m_bHasOccluders = false;
+    m_pLightBatch = NULL;
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_pCoarseGrids); ++i)
+        m_pCoarseGrids[i] = NULL;
+
     return true;
 }
 
@@ -230,14 +474,7 @@ void LightPropagationCPUContext::unload(Renderer* pRenderer, ITaskManager* pTask
 
     SyncToLastTask(pTaskManager);
 
-    for (uint32_t i = 0; i < ARRAY_COUNT(m_ReadbackLightGrids); i++)
-    {
-        mapBuffer(pRenderer, m_ReadbackLightGrids[i], NULL);
-        void* readbackBuffer = m_ReadbackLightGrids[i]->pCpuMappedAddress;
-        if (readbackBuffer != nullptr)
-            unmapBuffer(pRenderer, m_ReadbackLightGrids[i]);
-    }
-
+    //	Persistent mappings go away with the buffers. The client waits for the GPU before unloading.
     for (uint32_t i = 0; i < ARRAY_COUNT(m_ReadbackLightGrids); ++i)
     {
         removeBuffer(pRenderer, m_ReadbackLightGrids[i]);
@@ -245,21 +482,407 @@ void LightPropagationCPUContext::unload(Renderer* pRenderer, ITaskManager* pTask
 
     for (uint32_t i = 0; i < ARRAY_COUNT(m_CPUGrids); ++i)
         aura::dealloc(m_CPUGrids[i]);
+
+    aura::dealloc(m_pOccluders);
+    aura::dealloc(m_pAppliedTexels);
+    m_pAppliedTexels = NULL;
+
+    if (m_pLightBatch)
+        removeLightInjectionBatch(m_pLightBatch);
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_pCoarseGrids); ++i)
+        aura::dealloc(m_pCoarseGrids[i]);
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_pBounceGrids); ++i)
+        aura::dealloc(m_pBounceGrids[i]);
+
+    if (m_pSHL2Grids)
+        removeSHL2PropagationGrids(m_pSHL2Grids);
+}
+
+void LightPropagationCPUContext::setOccluders(const vec4* pOccluders)
+{
+    m_bHasOccluders = pOccluders != NULL;
+    if (!m_bHasOccluders)
+        return;
+
+    //	The occluders keep being updated while the captured light waits for propagation, keep a copy matching the capture
+    if (!m_pOccluders)
+        m_pOccluders = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
+
+    memcpy(m_pOccluders, pOccluders, lpvElementCount * sizeof(float));
+}
+
+void LightPropagationCPUContext::setAnalyticLights(const AnalyticLightDesc* pLights, uint32_t lightCount)
+{
+    if (!m_pLightBatch)
+    {
+        if (!lightCount)
+            return;
+
+        addLightInjectionBatch(&m_pLightBatch);
+    }
+
+    //	Lights are converted to the cell space of the captured grid
+    prepareLightInjectionBatch(m_pLightBatch, m_applyState, pLights, lightCount);
+}
+
+struct PlacementContext
+{
+    vec4*       pGrids[10];
+    const vec4* pSources[10];
+    uint32_t    mGridCount;
+};
+
+//	Same slices as the propagation tasks
+static void TaskPlaceGrids(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount)
+{
+    const PlacementContext* pContext = (const PlacementContext*)pvInfo;
+    const size_t            sliceBytes = GridRes * GridRes * 4 * sizeof(float);
+    const size_t            offset = uTaskId * GridRes / uTaskCount * sliceBytes;
+    const size_t            size = (uTaskId + 1) * GridRes / uTaskCount * sliceBytes - offset;
+
+    for (uint32_t i = 0; i < pContext->mGridCount; ++i)
+        memcpy((uint8_t*)pContext->pGrids[i] + offset, (const uint8_t*)pContext->pSources[i] + offset, size);
+}
+
+//	Pages belong to the NUMA node of the thread writing them first. The first capture already wrote the grids
+//	on the render thread, so they are moved into new memory written by workers of the domain of the context,
+//	slice by slice like the propagation tasks of the current split.
+//	Placement is only a hint: whether the workers of the domain really run on its CPUs is up to the task manager, and
+//	the propagation gives the same result wherever the pages are. With a single domain there is nowhere better to move
+//	them, so nothing is reallocated.
+void LightPropagationCPUContext::placeGrids(ITaskManager* pTaskManager)
+{
+    m_bGridsPlaced = true;
+    if (!pTaskManager || getCPUTopology()->mDomainCount <= 1)
+        return;
+
+    PlacementContext context = {};
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_CPUGrids); ++i)
+    {
+        context.pSources[context.mGridCount] = m_CPUGrids[i];
+        context.pGrids[context.mGridCount++] = m_CPUGrids[i] = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
+    }
+
+    //	The occluders are allocated on first use, before that the new memory is only touched
+    vec4* pOldOccluders = m_pOccluders;
+    context.pSources[context.mGridCount] = pOldOccluders ? pOldOccluders : context.pGrids[0];
+    context.pGrids[context.mGridCount++] = m_pOccluders = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
+
+    ITASKSETHANDLE hTask = ITASKSETHANDLE_INVALID;
+    pTaskManager->createTaskSetInDomain(m_Domain, 0, TaskPlaceGrids, &context, m_Partition.mTasksPerStep, NULL, 0, "Place grids",
+                                        &hTask);
+    pTaskManager->waitForTaskSet(hTask);
+#if !defined(ORBIS_TASK_MANAGER)
+    pTaskManager->releaseTask(hTask);
+#endif
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(m_CPUGrids); ++i)
+        aura::dealloc((void*)context.pSources[i]);
+    if (pOldOccluders)
+        aura::dealloc(pOldOccluders);
+}
+
+void LightPropagationCPUContext::updatePartition(ITaskManager* pTaskManager, const PropagationPartition* pPartition)
+{
+    //	The defaults of load until tunePartition ran. The grids follow the slices of the split, so a new split places them again.
+    if (pPartition->bTuned)
+    {
+        m_bGridsPlaced &= pPartition->mTasksPerStep == m_Partition.mTasksPerStep;
+        m_Partition = *pPartition;
+    }
+
+    if (!m_bGridsPlaced)
+        placeGrids(pTaskManager);
+}
+
+//	Times real propagation steps with every candidate split. Runs on grids of its own, the ones of the context
+//	may hold light waiting for propagation.
+void LightPropagationCPUContext::tunePartition(ITaskManager* pTaskManager, PropagationPartition* pPartition)
+{
+    //	Zeroed, denormals would skew the timings
+    vec4* pGrids[9] = {};
+    for (uint32_t i = 0; i < ARRAY_COUNT(pGrids); ++i)
+    {
+        pGrids[i] = (vec4*)aura::alloc(lpvElementCount * sizeof(float));
+        memset(pGrids[i], 0, lpvElementCount * sizeof(float));
+    }
+
+    pPartition->mWorkerCount = pTaskManager ? pTaskManager->getWorkerCount() : 0;
+
+    //	Single threaded slice cost sets the slab of the sliced propagation
+    int64_t stepUSec = INT64_MAX;
+    for (int r = 0; r < TUNING_REPEATS; ++r)
+    {
+        const int64_t startTime = getUSec(false);
+        propagateStep<false>(pGrids[0], pGrids[3], pGrids[6], NULL, 0, GridRes);
+        stepUSec = min(stepUSec, getUSec(false) - startTime);
+    }
+
+    const int64_t sliceUSec = max(stepUSec / (int64_t)GridRes, (int64_t)1);
+    uint32_t      slabSize = 1;
+    while (slabSize < GridRes / 4 && (int64_t)(slabSize * 2) * sliceUSec <= TUNING_SLAB_USEC)
+        slabSize *= 2;
+
+    pPartition->mSlabSize = slabSize;
+    pPartition->mTasksPerStep = DEFAULT_TASKS_PER_STEP;
+    pPartition->bTuned = true;
+
+    //	The three channels run side by side, same as in launchPropagateMultiTask
+    StepContext stepContexts[3] = {};
+    for (int j = 0; j < 3; ++j)
+    {
+        stepContexts[j].pContext = this;
+        stepContexts[j].src = pGrids[j];
+        stepContexts[j].targetStep = pGrids[3 + j];
+        stepContexts[j].targetAccum = pGrids[6 + j];
+        stepContexts[j].occluders = NULL;
+    }
+
+    int64_t bestUSec = INT64_MAX;
+    for (uint32_t c = 0; pTaskManager && c < ARRAY_COUNT(tuningTaskCounts); ++c)
+    {
+        int64_t candidateUSec = INT64_MAX;
+        for (int r = 0; r < TUNING_REPEATS; ++r)
+        {
+            ITASKSETHANDLE hTasks[3];
+
+            const int64_t startTime = getUSec(false);
+            for (int j = 0; j < 3; ++j)
+                pTaskManager->createTaskSetInDomain(m_Domain, j, TaskStepN, &stepContexts[j], tuningTaskCounts[c], NULL, 0,
+                                                    "Tune propagation", &hTasks[j]);
+
+            for (int j = 0; j < 3; ++j)
+                pTaskManager->waitForTaskSet(hTasks[j]);
+            candidateUSec = min(candidateUSec, getUSec(false) - startTime);
+
+#if !defined(ORBIS_TASK_MANAGER)
+            pTaskManager->releaseTasks(hTasks, 3);
+#endif
+        }
+
+        if ((float)candidateUSec < (float)bestUSec * TUNING_TASK_GAIN)
+        {
+            bestUSec = candidateUSec;
+            pPartition->mTasksPerStep = tuningTaskCounts[c];
+        }
+    }
+
+    for (uint32_t i = 0; i < ARRAY_COUNT(pGrids); ++i)
+        aura::dealloc(pGrids[i]);
+}
+
+//	Mostly positive light with some directionality, the same for every run with the same seed
+static void fillVerificationGrid(vec4* pGrid, uint32_t seed)
+{
+    float* pValues = &pGrid[0].x;
+    for (uint32_t i = 0; i < lpvElementCount; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        pValues[i] = (float)(seed >> 8) / 16777216.0f * 1.25f - 0.25f;
+    }
+}
+
+bool LightPropagationCPUContext::matchesGrids(const vec4* pReference) const
+{
+    bool bIdentical = true;
+    for (uint32_t c = 0; c < 3; ++c)
+        bIdentical &= memcmp(m_CPUGrids[c], pReference + c * (lpvElementCount / 4), lpvElementCount * sizeof(float)) == 0;
+    return bIdentical;
+}
+
+//	Every cell is owned by exactly one task and sums its neighbours in a fixed order, so no split may change a bit.
+//	Compares against the single threaded propagation: the sliced one, every tuning task count on every task manager
+//	and both layouts.
+bool LightPropagationCPUContext::verifyDeterminism(ITaskManager** ppTaskManagers, uint32_t taskManagerCount)
+{
+    const int                  stepCount = 8;
+    const int                  savedSteps = m_nPropagationSteps;
+    const bool                 bSavedTiled = m_bTiledLayout;
+    const PropagationPartition savedPartition = m_Partition;
+
+    vec4* pReference = (vec4*)aura::alloc(3 * lpvElementCount * sizeof(float));
+    fillVerificationGrid(pReference, 0x5eed);
+    setOccluders(pReference);
+
+    bool bIdentical = true;
+    m_nPropagationSteps = stepCount;
+
+    for (int layout = 0; layout < 2; ++layout)
+    {
+        m_bTiledLayout = layout != 0;
+
+        for (uint32_t c = 0; c < 3; ++c)
+            fillVerificationGrid(m_CPUGrids[c], c + 1);
+        doPropagate();
+        for (uint32_t c = 0; c < 3; ++c)
+            memcpy(pReference + c * (lpvElementCount / 4), m_CPUGrids[c], lpvElementCount * sizeof(float));
+
+        //	A deadline in the past stops after every slab
+        m_Partition.mSlabSize = 1;
+        for (uint32_t c = 0; c < 3; ++c)
+            fillVerificationGrid(m_CPUGrids[c], c + 1);
+        resetPropagationCursor(stepCount, 0);
+        while (!advancePropagation(1))
+        {
+        }
+        bIdentical &= matchesGrids(pReference);
+
+        for (uint32_t m = 0; m < taskManagerCount; ++m)
+        {
+            for (uint32_t t = 0; t < ARRAY_COUNT(tuningTaskCounts); ++t)
+            {
+                for (uint32_t c = 0; c < 3; ++c)
+                    fillVerificationGrid(m_CPUGrids[c], c + 1);
+                launchPropagateMultiTask(ppTaskManagers[m], (int)tuningTaskCounts[t]);
+                bIdentical &= matchesGrids(pReference);
+            }
+        }
+    }
+
+    //	Second order propagation, linear layout only
+    m_bTiledLayout = false;
+    if (!m_pSHL2Grids)
+        addSHL2PropagationGrids(&m_pSHL2Grids);
+
+    for (uint32_t c = 0; c < 3; ++c)
+        fillVerificationGrid(m_CPUGrids[c], c + 1);
+    propagateSHL2(m_pSHL2Grids, NULL, m_Domain, 1, m_CPUGrids, m_pOccluders, stepCount);
+    for (uint32_t c = 0; c < 3; ++c)
+        memcpy(pReference + c * (lpvElementCount / 4), m_CPUGrids[c], lpvElementCount * sizeof(float));
+
+    for (uint32_t m = 0; m < taskManagerCount; ++m)
+    {
+        for (uint32_t t = 0; t < ARRAY_COUNT(tuningTaskCounts); ++t)
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+                fillVerificationGrid(m_CPUGrids[c], c + 1);
+            propagateSHL2(m_pSHL2Grids, ppTaskManagers[m], m_Domain, tuningTaskCounts[t], m_CPUGrids, m_pOccluders, stepCount);
+            bIdentical &= matchesGrids(pReference);
+        }
+    }
+
+    aura::dealloc(pReference);
+    setOccluders(NULL);
+    m_nPropagationSteps = savedSteps;
+    m_bTiledLayout = bSavedTiled;
+    m_Partition = savedPartition;
+
+    return bIdentical;
+}
+
+//	Far field of the coarse to fine mode against the full resolution propagation of the same step count, on point lights
+//	in an empty grid. The far field are the cells further than the fine steps from every light, which only the coarse
+//	grid reaches.
+float LightPropagationCPUContext::compareCoarseToFine(int stepCount, float* pFarEnergy)
+{
+    const int  savedSteps = m_nPropagationSteps;
+    const bool bSavedTiled = m_bTiledLayout;
+
+    CPUPropagationParams params = {};
+    params.bCoarseToFine = true;
+    m_nPropagationSteps = stepCount;
+    int       coarseSteps = 0;
+    const int fineSteps = setupPropagationSteps(params, &coarseSteps);
+
+    //	Away from the border, which would clip the far field of the full resolution propagation
+    const uint32_t lightCount = 6;
+    int            lights[lightCount][3];
+    uint32_t       seed = 0x5eed;
+    for (uint32_t l = 0; l < lightCount; ++l)
+    {
+        for (uint32_t a = 0; a < 3; ++a)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            lights[l][a] = (int)(GridRes / 4 + (seed >> 8) % (GridRes / 2));
+        }
+    }
+
+    vec4* pReference = (vec4*)aura::alloc(3 * lpvElementCount * sizeof(float));
+    setOccluders(NULL);
+    m_bTiledLayout = false;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            memset(m_CPUGrids[c], 0, lpvElementCount * sizeof(float));
+            for (uint32_t l = 0; l < lightCount; ++l)
+            {
+                const int cell = (lights[l][0] * GridRes + lights[l][1]) * GridRes + lights[l][2];
+                m_CPUGrids[c][cell] = float4((float)(c + l + 1), 0.0f, 0.0f, 0.0f);
+            }
+        }
+
+        if (pass == 0)
+        {
+            doPropagate();
+            for (uint32_t c = 0; c < 3; ++c)
+                memcpy(pReference + c * (lpvElementCount / 4), m_CPUGrids[c], lpvElementCount * sizeof(float));
+        }
+        else
+        {
+            m_nPropagationSteps = fineSteps;
+            doPropagate();
+            propagateCoarse(coarseSteps);
+        }
+    }
+
+    double errorSum = 0.0, referenceSum = 0.0, energy = 0.0, referenceEnergy = 0.0;
+    for (int i = 0; i < (int)GridRes; ++i)
+    {
+        for (int j = 0; j < (int)GridRes; ++j)
+        {
+            for (int k = 0; k < (int)GridRes; ++k)
+            {
+                int distance = 3 * (int)GridRes;
+                for (uint32_t l = 0; l < lightCount; ++l)
+                    distance = min(distance, abs(i - lights[l][0]) + abs(j - lights[l][1]) + abs(k - lights[l][2]));
+                if (distance <= fineSteps)
+                    continue;
+
+                const int cell = (i * GridRes + j) * GridRes + k;
+                for (uint32_t c = 0; c < 3; ++c)
+                {
+                    const float4 value = m_CPUGrids[c][cell];
+                    const float4 reference = pReference[c * (lpvElementCount / 4) + cell];
+                    const float4 error = value - reference;
+                    errorSum += dot(error, error);
+                    referenceSum += dot(reference, reference);
+                    energy += value.x;
+                    referenceEnergy += reference.x;
+                }
+            }
+        }
+    }
+
+    aura::dealloc(pReference);
+    m_nPropagationSteps = savedSteps;
+    m_bTiledLayout = bSavedTiled;
+
+    if (pFarEnergy)
+        *pFarEnergy = (float)(energy / referenceEnergy);
+    return (float)sqrt(errorSum / referenceSum);
 }
 
 void LightPropagationCPUContext::launchPropagateSingleTask(ITaskManager* pTaskManager)
 {
-    pTaskManager->createTaskSet(0, TaskDoPropagate, this, 1, NULL, 0, "Single Task Propagate", &m_hLastTask);
+    pTaskManager->createTaskSetInDomain(m_Domain, 0, TaskDoPropagate, this, 1, NULL, 0, "Single Task Propagate", &m_hLastTask);
 }
 
 void LightPropagationCPUContext::launchPropagateMultiTask(ITaskManager* pTaskManager, const int iTasksPerStep /*= 1*/)
 {
     if (m_nPropagationSteps == 0)
     {
+        for (int i = 0; i < 3; ++i)
+            m_pFrontier[i] = m_CPUGrids[i];
         return;
     }
     ITASKSETHANDLE m_hTask[m_nMaxPropagationSteps][3];
 
+    const vec4* occluders = m_bHasOccluders ? m_pOccluders : NULL;
+
     int iSrc = 0;
     int iTargetStep = 1;
     int iTsrgetAccum = 2;
@@ -270,8 +893,10 @@ void LightPropagationCPUContext::launchPropagateMultiTask(ITaskManager* pTaskMan
             m_Contexts[0][j].src = m_CPUGrids[iSrc * 3 + j];
             m_Contexts[0][j].targetStep = m_CPUGrids[iTargetStep * 3 + j];
             m_Contexts[0][j].targetAccum = m_CPUGrids[iTsrgetAccum * 3 + j];
+            m_Contexts[0][j].occluders = occluders;
 
-            pTaskManager->createTaskSet(j, TaskStep1, &m_Contexts[0][j], iTasksPerStep, NULL, 0, "Propagate first step", &m_hTask[0][j]);
+            pTaskManager->createTaskSetInDomain(m_Domain, j, TaskStep1, &m_Contexts[0][j], iTasksPerStep, NULL, 0, "Propagate first step",
+                                                &m_hTask[0][j]);
         }
 
         int pTmp;
@@ -280,21 +905,31 @@ void LightPropagationCPUContext::launchPropagateMultiTask(ITaskManager* pTaskMan
         iTargetStep = pTmp;
     }
 
-    static char taskLabel[m_nMaxPropagationSteps][256];
+    //	Shared by all the contexts of all the Aura instances, filled once
+    struct TaskLabels
+    {
+        char mLabels[m_nMaxPropagationSteps][32];
+
+        TaskLabels()
+        {
+            for (int i = 0; i < m_nMaxPropagationSteps; ++i)
+                snprintf(mLabels[i], ARRAY_COUNT(mLabels[i]), "Propagate step: %d", i);
+        }
+    };
+    static const TaskLabels taskLabels;
 
     for (int i = 1; i < m_nPropagationSteps; ++i)
     {
-        snprintf(taskLabel[i], ARRAY_COUNT(taskLabel[i]), "Propagate step: %d", i);
-
         for (int j = 0; j < 3; ++j)
         {
             m_Contexts[i][j].pContext = this;
             m_Contexts[i][j].src = m_CPUGrids[iSrc * 3 + j];
             m_Contexts[i][j].targetStep = m_CPUGrids[iTargetStep * 3 + j];
             m_Contexts[i][j].targetAccum = m_CPUGrids[iTsrgetAccum * 3 + j];
+            m_Contexts[i][j].occluders = occluders;
 
-            pTaskManager->createTaskSet(i - 1, TaskStepN, &m_Contexts[i][j], iTasksPerStep, &m_hTask[i - 1][j], 1, taskLabel[i],
-                                        &m_hTask[i][j]);
+            pTaskManager->createTaskSetInDomain(m_Domain, i - 1, TaskStepN, &m_Contexts[i][j], iTasksPerStep, &m_hTask[i - 1][j], 1,
+                                                taskLabels.mLabels[i], &m_hTask[i][j]);
         }
 
         int pTmp;
@@ -306,47 +941,123 @@ void LightPropagationCPUContext::launchPropagateMultiTask(ITaskManager* pTaskMan
     //	Swap src and accum
     for (int i = 0; i < 3; ++i)
     {
+        m_pFrontier[i] = m_CPUGrids[iSrc * 3 + i];
+
         vec4* pTmp;
         pTmp = m_CPUGrids[i];
         m_CPUGrids[i] = m_CPUGrids[i + 2 * 3];
         m_CPUGrids[i + 2 * 3] = pTmp;
     }
 
-    pTaskManager->waitAll();
+    //	The last step of a channel depends on all the steps before it. Other Aura instances may share the task manager,
+    //	so only the own tasks are waited for.
+    for (int j = 0; j < 3; ++j)
+        pTaskManager->waitForTaskSet(m_hTask[m_nPropagationSteps - 1][j]);
 
 #if !defined(ORBIS_TASK_MANAGER)
     pTaskManager->releaseTasks(m_hTask[0], 3 * m_nPropagationSteps);
 #endif
 }
 
+void LightPropagationCPUContext::propagateSHL2Grids(ITaskManager* pTaskManager)
+{
+    if (!m_pSHL2Grids)
+        addSHL2PropagationGrids(&m_pSHL2Grids);
+
+    //	Writes the result back to the captured light grids, which are the ones applyData uploads
+    propagateSHL2(m_pSHL2Grids, pTaskManager, m_Domain, m_Partition.mTasksPerStep, m_CPUGrids, m_bHasOccluders ? m_pOccluders : NULL,
+                  m_nPropagationSteps);
+}
+
 void LightPropagationCPUContext::doPropagate()
 {
-    for (int iChan = 0; iChan < 3; ++iChan)
+    resetPropagationCursor(m_nPropagationSteps, 0);
+    advancePropagation(0);
+
+    // convertCPUtoGPU();
+}
+
+void LightPropagationCPUContext::resetPropagationCursor(int stepCount, int coarseSteps)
+{
+    //	Same grid usage as the multi-task propagation: src, step and accum grids per channel
+    m_Cursor.mChannel = 0;
+    m_Cursor.mStep = 0;
+    m_Cursor.mSlice = 0;
+    m_Cursor.mStepCount = stepCount;
+    m_Cursor.mCoarseSteps = coarseSteps;
+    m_Cursor.pSrc = m_CPUGrids[0];
+    m_Cursor.pStep = m_CPUGrids[3];
+    m_Cursor.pAccum = m_CPUGrids[6];
+}
+
+bool LightPropagationCPUContext::advancePropagation(int64_t deadlineUSec)
+{
+    const vec4*        occluders = m_bHasOccluders ? m_pOccluders : NULL;
+    PropagationCursor& cursor = m_Cursor;
+
+    //	At least one slab per call, so that every cascade makes progress even when the budget is exhausted
+    bool bProgressed = false;
+
+    while (cursor.mChannel < 3)
     {
-        propagateStep<true>(m_CPUGrids[iChan], m_CPUGrids[3], m_CPUGrids[4], 0, GridRes);
+        const int iChan = cursor.mChannel;
 
-        vec4* pTmp;
-        pTmp = m_CPUGrids[iChan];
-        m_CPUGrids[iChan] = m_CPUGrids[4];
-        m_CPUGrids[4] = pTmp;
+        if (cursor.mStep < cursor.mStepCount)
+        {
+            if (deadlineUSec && bProgressed && getUSec(false) >= deadlineUSec)
+                return false;
+
+            //	Without a deadline the whole step is done at once
+            const int iMaxSlice = deadlineUSec ? min(cursor.mSlice + (int)m_Partition.mSlabSize, (int)GridRes) : (int)GridRes;
+
+            if (cursor.mStep == 0)
+                propagateStep<true>(cursor.pSrc, cursor.pStep, cursor.pAccum, occluders, cursor.mSlice, iMaxSlice);
+            else //	Use ping-pong rt changes to propagate only previous step light
+                propagateStep<false>(cursor.pStep, cursor.pSrc, cursor.pAccum, occluders, cursor.mSlice, iMaxSlice);
 
-        const int nPropagationSteps = m_nPropagationSteps;
-        // const int nPropagationSteps = 16;
+            bProgressed = true;
+            cursor.mSlice = iMaxSlice;
+            if (cursor.mSlice < (int)GridRes)
+                continue;
 
-        //	Use ping-pong rt changes to propagate only previous step light
-        for (int i = 1; i < nPropagationSteps; ++i)
+            if (cursor.mStep > 0)
+            {
+                vec4* pTmp;
+                pTmp = cursor.pSrc;
+                cursor.pSrc = cursor.pStep;
+                cursor.pStep = pTmp;
+            }
+
+            cursor.mSlice = 0;
+            ++cursor.mStep;
+            continue;
+        }
+
+        if (cursor.mStepCount == 0)
+        {
+            m_pFrontier[iChan] = cursor.pSrc;
+        }
+        else
         {
-            propagateStep<false>(m_CPUGrids[3], m_CPUGrids[4], m_CPUGrids[iChan], 0, GridRes);
+            m_pFrontier[iChan] = cursor.pStep;
 
-            vec4* pTmp;
-            pTmp = m_CPUGrids[3];
-            m_CPUGrids[3] = m_CPUGrids[4];
-            m_CPUGrids[4] = pTmp;
+            m_CPUGrids[iChan] = cursor.pAccum;
+            m_CPUGrids[3 + iChan] = cursor.pSrc;
+            m_CPUGrids[6 + iChan] = cursor.pStep;
+        }
+
+        if (++cursor.mChannel < 3)
+        {
+            cursor.mStep = 0;
+            cursor.pSrc = m_CPUGrids[cursor.mChannel];
+            cursor.pStep = m_CPUGrids[3 + cursor.mChannel];
+            cursor.pAccum = m_CPUGrids[6 + cursor.mChannel];
         }
     }
 
-    // convertCPUtoGPU();
+    return true;
 }
+
 /************************************************************************/
 // Math
 /************************************************************************/
@@ -400,6 +1111,22 @@ DEFINE_ALIGNED(static const float4 vCone90Degree[], 16) = {
     Cone90Degree(-vConeDirs[3]), Cone90Degree(-vConeDirs[4]), Cone90Degree(-vConeDirs[5]),
 };
 
+inline float4 SHEvaluateBasis(const float3& vcDir) { return float4(1.0f, vcDir.y, vcDir.z, vcDir.x) * SHBasis; }
+
+//	Dotting the occluder with these evaluates it in the direction of the neighbour cell.
+//	dirIndex ^ 1 is the opposite direction.
+DEFINE_ALIGNED(static const float4 vOccluderBasis[], 16) = {
+    SHEvaluateBasis(vConeDirs[0]), SHEvaluateBasis(vConeDirs[1]), SHEvaluateBasis(vConeDirs[2]),
+    SHEvaluateBasis(vConeDirs[3]), SHEvaluateBasis(vConeDirs[4]), SHEvaluateBasis(vConeDirs[5]),
+};
+
+//	Same as the GPU: saturate(1 - occluder(dir)) in both directions, the smaller one wins
+__forceinline float getOcclusion(const float4& occluder, int dirIndex)
+{
+    const float occlusion = max(dot(occluder, vOccluderBasis[dirIndex]), dot(occluder, vOccluderBasis[dirIndex ^ 1]));
+    return clamp(1.0f - occlusion, 0.0f, 1.0f);
+}
+
 #ifdef INTRIN_USE
 inline float4 SHRotate(__m128 vcDirMM, const float2& vZHCoeffs)
 {
@@ -443,6 +1170,25 @@ __declspec(noalias) __forceinline __m128 IVPropagateDirIntrin(const float4& src,
     return _mm_mul_ps(vDot, shIncomingDirFunction);
 }
 
+//	Same as the GPU: saturate(1 - occluder(dir)) in both directions, the smaller one wins
+__declspec(noalias) __forceinline __m128 getOcclusionIntrin(const float4& occluder, int dirIndex)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 vOccluder = _mm_load_ps(&occluder.x);
+    const __m128 front = _mm_dp_ps(vOccluder, _mm_load_ps(&vOccluderBasis[dirIndex].x), 0xFF);
+    const __m128 back = _mm_dp_ps(vOccluder, _mm_load_ps(&vOccluderBasis[dirIndex ^ 1].x), 0xFF);
+
+    return _mm_max_ps(_mm_min_ps(_mm_sub_ps(one, _mm_max_ps(front, back)), one), _mm_setzero_ps());
+}
+
+template<bool bOccluded>
+__declspec(noalias) __forceinline __m128 IVPropagateOccludedDirIntrin(const vec4* __restrict src, const vec4* __restrict occluders,
+                                                                      const int neighbourOffset, int dirIndex)
+{
+    const __m128 res = IVPropagateDirIntrin(src[neighbourOffset], dirIndex);
+    return bOccluded ? _mm_mul_ps(res, getOcclusionIntrin(occluders[neighbourOffset], dirIndex)) : res;
+}
+
 #if defined(USE_VIRTUAL_DIRECTIONS)
 
 __declspec(noalias) inline float getSolidAngle(const __m128& dir, const __m128& faceDir)
@@ -549,61 +1295,62 @@ __declspec(noalias) inline __m128 IVPropagateDirAdvancedIntrin(const float4& src
 
 #endif // USE_VIRTUAL_DIRECTIONS
 
-template<bool bFirstStep, bool isIMin, bool isIMax, bool isJMin, bool isJMax, bool isKMin, bool isKMax>
+template<bool bFirstStep, bool bOccluded, bool isIMin, bool isIMax, bool isJMin, bool isJMax, bool isKMin, bool isKMax>
 __declspec(noalias) __forceinline void propagateCell(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
-                                                     const int i, const int j, const int k, const int readOffset)
+                                                     const vec4* __restrict occluders, const int* __restrict neighbourOffsets,
+                                                     const int readOffset)
 {
     __m128 res = _mm_setzero_ps();
 
 #if defined(USE_VIRTUAL_DIRECTIONS)
     // if (k<GridRes-1)
     if (!isKMax)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[0]], 0));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[0]], 0));
     //	float3(-1, 0, 0),
     // if (k>0)
     if (!isKMin)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[1]], 1));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[1]], 1));
     // float3( 0, 1, 0),
     // if (j<GridRes-1)
     if (!isJMax)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[2]], 2));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[2]], 2));
     // float3( 0, -1, 0),
     // if (j>0)
     if (!isJMin)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[3]], 3));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[3]], 3));
     // float3( 0, 0, 1),
     // if (i<GridRes-1)
     if (!isIMax)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[4]], 4));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[4]], 4));
     // float3( 0, 0, -1),
     // if (i>0)
     if (!isIMin)
-        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + inputOffset[5]], 5));
+        res = _mm_add_ps(res, IVPropagateDirAdvancedIntrin(src[readOffset + neighbourOffsets[5]], 5));
 #endif
 #if !defined(USE_VIRTUAL_DIRECTIONS)
     // if (k<GridRes-1)
     if (!isKMax)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[0]], 0));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[0], 0));
     //	float3(-1, 0, 0),
     // if (k>0)
     if (!isKMin)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[1]], 1));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[1], 1));
     // float3( 0, 1, 0),
     // if (j<GridRes-1)
     if (!isJMax)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[2]], 2));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[2], 2));
     // float3( 0, -1, 0),
     // if (j>0)
     if (!isJMin)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[3]], 3));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[3], 3));
     // float3( 0, 0, 1),
     // if (i<GridRes-1)
     if (!isIMax)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[4]], 4));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[4], 4));
     // float3( 0, 0, -1),
     // if (i>0)
     if (!isIMin)
-        res = _mm_add_ps(res, IVPropagateDirIntrin(src[readOffset + inputOffset[5]], 5));
+        res = _mm_add_ps(res, IVPropagateOccludedDirIntrin<bOccluded>(src, occluders, readOffset + neighbourOffsets[5], 5));
 #endif
 
     _mm_store_ps((float*)(targetStep + readOffset), res);
@@ -636,6 +1383,14 @@ __forceinline float4 IVPropagateDir(const float4& src, int dirIndex)
     return shIncomingDirFunction * incidentLuminance;
 }
 
+template<bool bOccluded>
+__forceinline float4 IVPropagateOccludedDir(const vec4* __restrict src, const vec4* __restrict occluders, const int neighbourOffset,
+                                            int dirIndex)
+{
+    const float4 res = IVPropagateDir(src[neighbourOffset], dirIndex);
+    return bOccluded ? res * getOcclusion(occluders[neighbourOffset], dirIndex) : res;
+}
+
 inline float getSolidAngle(const float3& dir, const float3& faceDir)
 {
     //	4 faces of this kind
@@ -710,57 +1465,58 @@ __forceinline float4 IVPropagateDirAdvanced(const float4& src, int dirIndex)
     return res;
 }
 
-template<bool bFirstStep, bool isIMin, bool isIMax, bool isJMin, bool isJMax, bool isKMin, bool isKMax>
+template<bool bFirstStep, bool bOccluded, bool isIMin, bool isIMax, bool isJMin, bool isJMax, bool isKMin, bool isKMax>
 __declspec(noalias) __forceinline void propagateCell(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
-                                                     const int i, const int j, const int k, const int readOffset)
+                                                     const vec4* __restrict occluders, const int* __restrict neighbourOffsets,
+                                                     const int readOffset)
 {
     float4 res = float4(0.0f, 0.0f, 0.0f, 0.0f);
 
 #if defined(USE_VIRTUAL_DIRECTIONS)
     // VIRTUAL DIRECTIONS
     if (!isKMax)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[0]], 0);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[0]], 0);
     //	float3(-1, 0, 0),
     if (!isKMin)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[1]], 1);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[1]], 1);
     // float3( 0, 1, 0),
     if (!isJMax)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[2]], 2);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[2]], 2);
     // float3( 0, -1, 0),
     if (!isJMin)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[3]], 3);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[3]], 3);
     // float3( 0, 0, 1),
     if (!isIMax)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[4]], 4);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[4]], 4);
     // float3( 0, 0, -1),
     if (!isIMin)
-        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + inputOffset[5]], 5);
+        res += IVPropagateDirAdvanced<isIMin, isIMax, isJMin, isJMax, isKMin, isKMax>(src[readOffset + neighbourOffsets[5]], 5);
 #endif
 #if !defined(USE_VIRTUAL_DIRECTIONS)
 
     // if (k<GridRes-1)
     if (!isKMax)
-        res += IVPropagateDir(src[readOffset + inputOffset[0]], 0);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[0], 0);
     //	float3(-1, 0, 0),
     // if (k>0)
     if (!isKMin)
-        res += IVPropagateDir(src[readOffset + inputOffset[1]], 1);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[1], 1);
     // float3( 0, 1, 0),
     // if (j<GridRes-1)
     if (!isJMax)
-        res += IVPropagateDir(src[readOffset + inputOffset[2]], 2);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[2], 2);
     // float3( 0, -1, 0),
     // if (j>0)
     if (!isJMin)
-        res += IVPropagateDir(src[readOffset + inputOffset[3]], 3);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[3], 3);
     // float3( 0, 0, 1),
     // if (i<GridRes-1)
     if (!isIMax)
-        res += IVPropagateDir(src[readOffset + inputOffset[4]], 4);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[4], 4);
     // float3( 0, 0, -1),
     // if (i>0)
     if (!isIMin)
-        res += IVPropagateDir(src[readOffset + inputOffset[5]], 5);
+        res += IVPropagateOccludedDir<bOccluded>(src, occluders, readOffset + neighbourOffsets[5], 5);
 #endif
 
     targetStep[readOffset] = res;
@@ -786,44 +1542,464 @@ void LightPropagationCPUContext::SyncToLastTask(ITaskManager* pTaskManager)
         m_hLastTask = ITASKSETHANDLE_INVALID;
     }
 }
+/************************************************************************/
+// Tiled layout
+/************************************************************************/
+static void tileGrid(const vec4* __restrict src, vec4* __restrict dst)
+{
+    const vec4* pSrcCell = src;
+    for (int i = 0; i < (int)GridRes; ++i)
+        for (int j = 0; j < (int)GridRes; ++j)
+            for (int k = 0; k < (int)GridRes; ++k)
+                dst[getTiledCellOffset(i, j, k)] = *pSrcCell++;
+}
+
+//	Offset to the neighbour along one axis. Crossing into the next tile skips the rest of the current one.
+static inline int getTiledNeighbourOffset(int cellInTile, int cellStride, int tileStride, bool bForward)
+{
+    const int tileCrossing = tileStride - (GRID_TILE_SIZE - 1) * cellStride;
+    if (bForward)
+        return cellInTile == GRID_TILE_SIZE - 1 ? tileCrossing : cellStride;
+    return cellInTile == 0 ? -tileCrossing : -cellStride;
+}
+
+/************************************************************************/
+// Coarse propagation
+/************************************************************************/
+//	Sums 2x2x2 blocks of the full resolution grid
+static void downsampleGrid(const vec4* __restrict src, vec4* __restrict dst, float scale, bool bTiled)
+{
+    for (int i = 0; i < CoarseGridRes; ++i)
+    {
+        for (int j = 0; j < CoarseGridRes; ++j)
+        {
+            for (int k = 0; k < CoarseGridRes; ++k)
+            {
+                float4 sum = float4(0.0f, 0.0f, 0.0f, 0.0f);
+                for (int c = 0; c < 8; ++c)
+                {
+                    const int fi = 2 * i + ((c >> 2) & 1);
+                    const int fj = 2 * j + ((c >> 1) & 1);
+                    const int fk = 2 * k + (c & 1);
+                    sum += src[getCellOffset(fi, fj, fk, bTiled)];
+                }
+
+                dst[(i * CoarseGridRes + j) * CoarseGridRes + k] = sum * scale;
+            }
+        }
+    }
+}
+
+//	Two nearest coarse cells along one axis, weighted 3/4 and 1/4 by the trilinear filter
+static inline void getUpsampleTaps(int fine, int taps[2])
+{
+    taps[0] = fine >> 1;
+    taps[1] = (fine & 1) ? min(taps[0] + 1, CoarseGridRes - 1) : max(taps[0] - 1, 0);
+}
+
+//	Each coarse cell holds the light of 8 fine cells, the 1/8 keeps the energy
+static void upsampleAddGrid(const vec4* __restrict src, vec4* __restrict dst, bool bTiled)
+{
+    const float weights[2] = { 0.75f, 0.25f };
+
+    int is[2], js[2], ks[2];
+    for (int i = 0; i < (int)GridRes; ++i)
+    {
+        getUpsampleTaps(i, is);
+
+        for (int j = 0; j < (int)GridRes; ++j)
+        {
+            getUpsampleTaps(j, js);
+
+            for (int k = 0; k < (int)GridRes; ++k)
+            {
+                getUpsampleTaps(k, ks);
+
+                float4 sum = float4(0.0f, 0.0f, 0.0f, 0.0f);
+                for (int c = 0; c < 8; ++c)
+                {
+                    const int a = (c >> 2) & 1;
+                    const int b = (c >> 1) & 1;
+                    const int d = c & 1;
+                    sum += src[(is[a] * CoarseGridRes + js[b]) * CoarseGridRes + ks[d]] * (weights[a] * weights[b] * weights[d]);
+                }
+
+                dst[getCellOffset(i, j, k, bTiled)] += sum * (1.0f / 8.0f);
+            }
+        }
+    }
+}
+
+//	The coarse grid is 8 times smaller, a plain loop with bounds checks is good enough here
+static void propagateCoarseStep(const vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
+                                const vec4* __restrict occluders)
+{
+    const int coarseOffset[] = {
+        +1, -1, CoarseGridRes, -CoarseGridRes, CoarseGridRes * CoarseGridRes, -(CoarseGridRes * CoarseGridRes),
+    };
+
+    int readOffset = 0;
+    for (int i = 0; i < CoarseGridRes; ++i)
+    {
+        for (int j = 0; j < CoarseGridRes; ++j)
+        {
+            for (int k = 0; k < CoarseGridRes; ++k, ++readOffset)
+            {
+                const int coords[3] = { k, j, i };
+                float4    res = float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+                for (int dirIndex = 0; dirIndex < 6; ++dirIndex)
+                {
+                    const int neighbour = coords[dirIndex >> 1] + ((dirIndex & 1) ? -1 : 1);
+                    if (neighbour < 0 || neighbour >= CoarseGridRes)
+                        continue;
+
+                    const int     neighbourOffset = readOffset + coarseOffset[dirIndex];
+                    const float4& shIncomingDirFunction = vCone90Degree[dirIndex];
+                    float         incidentLuminance = max(0.0f, dot(src[neighbourOffset], shIncomingDirFunction));
+                    if (occluders)
+                        incidentLuminance *= getOcclusion(occluders[neighbourOffset], dirIndex);
+
+                    res += shIncomingDirFunction * incidentLuminance;
+                }
+
+                targetStep[readOffset] = res;
+                targetAccum[readOffset] += res;
+            }
+        }
+    }
+}
+
+void LightPropagationCPUContext::propagateCoarse(int coarseSteps)
+{
+    if (!m_pCoarseGrids[0])
+    {
+        for (uint32_t i = 0; i < ARRAY_COUNT(m_pCoarseGrids); ++i)
+            m_pCoarseGrids[i] = (vec4*)aura::alloc(coarseCellCount * sizeof(vec4));
+    }
+
+    //	A wall crossing a coarse cell only covers half of its children
+    vec4* coarseOccluders = NULL;
+    if (m_bHasOccluders)
+    {
+        coarseOccluders = m_pCoarseGrids[3 * 3];
+        downsampleGrid(m_pOccluders, coarseOccluders, 0.25f, m_bTiledLayout);
+    }
+
+    for (int iChan = 0; iChan < 3; ++iChan)
+    {
+        vec4* pSrc = m_pCoarseGrids[iChan * 3 + 0];
+        vec4* pStep = m_pCoarseGrids[iChan * 3 + 1];
+        vec4* pAccum = m_pCoarseGrids[iChan * 3 + 2];
+
+        //	The frontier itself is already part of the full resolution result
+        downsampleGrid(m_pFrontier[iChan], pSrc, 1.0f, m_bTiledLayout);
+        memset(pAccum, 0, coarseCellCount * sizeof(vec4));
+
+        for (int i = 0; i < coarseSteps; ++i)
+        {
+            propagateCoarseStep(pSrc, pStep, pAccum, coarseOccluders);
+
+            vec4* pTmp = pSrc;
+            pSrc = pStep;
+            pStep = pTmp;
+        }
+
+        upsampleAddGrid(pAccum, m_CPUGrids[iChan], m_bTiledLayout);
+    }
+}
+
+/************************************************************************/
+// Multiple reflections
+/************************************************************************/
+//	Same reflection as for the analytic lights: the lit side of the occluder re-emits along its lobe, light hitting the
+//	back side is reflected by the flipped lobe
+static void reflectOffOccluders(const vec4* __restrict gathered, const vec4* __restrict occluders, vec4* __restrict dst)
+{
+    const float zhBand0 = SHProjectionScale * 0.25f;
+
+    for (uint32_t i = 0; i < GridRes * GridRes * GridRes; ++i)
+    {
+        const float4& occluder = occluders[i];
+        if (occluder.x <= 0.0f)
+        {
+            dst[i] = float4(0.0f, 0.0f, 0.0f, 0.0f);
+            continue;
+        }
+
+        //	Occluders are cosine lobes scaled by the coverage, the coverage is applied once by the reflected lobe
+        const float4 lobe = occluder * (zhBand0 / occluder.x);
+        const float  front = max(dot(gathered[i], float4(lobe.x, -lobe.y, -lobe.z, -lobe.w)), 0.0f);
+        const float  back = max(dot(gathered[i], lobe), 0.0f);
+        const float  facing = front - back;
+
+        dst[i] = float4(occluder.x * (front + back), occluder.y * facing, occluder.z * facing, occluder.w * facing) * BOUNCE_ALBEDO;
+    }
+}
+
+static void addGrid(vec4* __restrict dst, const vec4* __restrict src, float scale)
+{
+    for (uint32_t i = 0; i < GridRes * GridRes * GridRes; ++i)
+        dst[i] += src[i] * scale;
+}
+
+void LightPropagationCPUContext::propagateBounces(ITaskManager* pTaskManager)
+{
+    //	Secondary light is dimmer and more diffuse, half the distance is enough
+    const int stepCount = min(max(m_nPropagationSteps / 2, 1), m_nMaxPropagationSteps);
+
+    vec4* pSources[3];
+    vec4* pSteps[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        pSources[i] = m_CPUGrids[3 + i];
+        pSteps[i] = m_CPUGrids[6 + i];
+
+        //	Light gathered by the main propagation, without the captured light itself
+        for (uint32_t c = 0; c < GridRes * GridRes * GridRes; ++c)
+            m_pBounceGrids[i][c] = m_CPUGrids[i][c] - m_pBounceGrids[i][c];
+    }
+
+    for (int bounce = 0; bounce < m_BounceCount; ++bounce)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            reflectOffOccluders(m_pBounceGrids[i], m_pOccluders, pSources[i]);
+            addGrid(m_CPUGrids[i], pSources[i], 1.0f);
+
+            memset(m_pBounceGrids[i], 0, lpvElementCount * sizeof(float));
+        }
+
+        propagateGathered(pTaskManager, pSources, pSteps, m_pBounceGrids, stepCount);
+
+        for (int i = 0; i < 3; ++i)
+            addGrid(m_CPUGrids[i], m_pBounceGrids[i], 1.0f);
+    }
+}
+
+//	Propagates the sources without adding them to the gathered light
+void LightPropagationCPUContext::propagateGathered(ITaskManager* pTaskManager, vec4* const pSources[3], vec4* const pSteps[3],
+                                                   vec4* const pGathered[3], int stepCount)
+{
+    ITASKSETHANDLE hTasks[m_nMaxPropagationSteps][3];
+
+    for (int i = 0; i < stepCount; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            //	Ping-pong between the source and the step grid. The first step is not occluded, same as the main propagation.
+            StepContext& context = m_Contexts[i][j];
+            context.pContext = this;
+            context.src = (i & 0x1) ? pSteps[j] : pSources[j];
+            context.targetStep = (i & 0x1) ? pSources[j] : pSteps[j];
+            context.targetAccum = pGathered[j];
+            context.occluders = i ? m_pOccluders : NULL;
+
+            if (pTaskManager)
+                pTaskManager->createTaskSetInDomain(m_Domain, i, TaskStepN, &context, m_Partition.mTasksPerStep,
+                                                    i ? &hTasks[i - 1][j] : NULL, i ? 1 : 0, "Propagate bounce", &hTasks[i][j]);
+            else
+                TaskStepN(&context, 0, 0, 1);
+        }
+    }
+
+    if (pTaskManager)
+    {
+        //	The last step of a channel depends on all the steps before it
+        for (int j = 0; j < 3; ++j)
+            pTaskManager->waitForTaskSet(hTasks[stepCount - 1][j]);
+#if !defined(ORBIS_TASK_MANAGER)
+        pTaskManager->releaseTasks(hTasks[0], 3 * stepCount);
+#endif
+    }
+}
+
+/************************************************************************/
+// Cascade border seeding
+/************************************************************************/
+//	CPU side of calculateBorderFadeout, per axis. The fade of a cell is sqrt of the product of its three axes.
+static void getBorderFadeout(float* pFade)
+{
+    const float borderSize = 4.0f / GridRes;
+    for (int c = 0; c < (int)GridRes; ++c)
+    {
+        const float p = (c + 0.5f) / GridRes;
+        const float inner = clamp(p / borderSize, 0.0f, 1.0f);
+        const float outer = clamp((1.0f - p) / borderSize, 0.0f, 1.0f);
+        pFade[c] = inner * inner * (3.0f - 2.0f * inner) * outer * outer * (3.0f - 2.0f * outer);
+    }
+}
+
+static float4 sampleGridTrilinear(const vec4* __restrict src, bool bTiled, const float* pCell)
+{
+    int   taps[3][2];
+    float weights[3][2];
+    for (int a = 0; a < 3; ++a)
+    {
+        const float c = clamp(pCell[a], 0.0f, (float)(GridRes - 1));
+        const int   c0 = min((int)c, (int)GridRes - 2);
+        taps[a][0] = c0;
+        taps[a][1] = c0 + 1;
+        weights[a][1] = c - (float)c0;
+        weights[a][0] = 1.0f - weights[a][1];
+    }
+
+    //	pCell is x, y, z which are k, j, i of the grid
+    float4 sum = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int c = 0; c < 8; ++c)
+    {
+        const int x = c & 1;
+        const int y = (c >> 1) & 1;
+        const int z = (c >> 2) & 1;
+        sum += src[getCellOffset(taps[2][z], taps[1][y], taps[0][x], bTiled)] * (weights[0][x] * weights[1][y] * weights[2][z]);
+    }
+
+    return sum;
+}
+
+void LightPropagationCPUContext::setBorderSeed(const LightPropagationCPUContext* pCoarse, float lightScale)
+{
+    m_pBorderSeed = pCoarse;
+    m_BorderSeedScale = lightScale;
+}
+
+//	The injection fades the light out towards the grid border, light there would be cut off by the grid.
+//	The coarser cascade does not cut it off, so the faded part is filled in with its propagated light,
+//	which also brings in the light coming from outside of this cascade.
+void LightPropagationCPUContext::seedBorder(const LightPropagationCPUContext* pCoarse, float lightScale)
+{
+    float fade[GridRes];
+    getBorderFadeout(fade);
+
+    //	Both grids are axis aligned: coarse cell = fine cell * cellScale + cellOffset, cell centers at + 0.5
+    const float* fineScale = &m_applyState.mWorldToGridScale.x;
+    const float* fineTranslate = &m_applyState.mWorldToGridTranslate.x;
+    const float* coarseScale = &pCoarse->m_applyState.mWorldToGridScale.x;
+    const float* coarseTranslate = &pCoarse->m_applyState.mWorldToGridTranslate.x;
+
+    float cellScale[3], cellOffset[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        cellScale[a] = coarseScale[a] / fineScale[a];
+        cellOffset[a] = ((0.5f / GridRes - fineTranslate[a]) / fineScale[a] * coarseScale[a] + coarseTranslate[a]) * GridRes - 0.5f;
+    }
+
+    for (int i = 0; i < (int)GridRes; ++i)
+    {
+        for (int j = 0; j < (int)GridRes; ++j)
+        {
+            for (int k = 0; k < (int)GridRes; ++k)
+            {
+                const float weight = (1.0f - sqrtf(fade[i] * fade[j] * fade[k])) * lightScale;
+                if (weight <= 0.0f)
+                    continue;
+
+                const float coarseCell[3] = { k * cellScale[0] + cellOffset[0], j * cellScale[1] + cellOffset[1],
+                                              i * cellScale[2] + cellOffset[2] };
+
+                //	Cells outside of the coarse cascade keep their light
+                bool bInside = true;
+                for (int a = 0; a < 3; ++a)
+                    bInside &= coarseCell[a] >= -0.5f && coarseCell[a] <= (float)GridRes - 0.5f;
+                if (!bInside)
+                    continue;
+
+                const int cell = getCellOffset(i, j, k, m_bTiledLayout);
+                for (int c = 0; c < 3; ++c)
+                    m_CPUGrids[c][cell] += sampleGridTrilinear(pCoarse->m_CPUGrids[c], pCoarse->m_bTiledLayout, coarseCell) * weight;
+            }
+        }
+    }
+}
+
 /************************************************************************/
 // Templates
 /************************************************************************/
-template<bool bFirstStep, bool isIMin, bool isIMax, bool isJMin, bool isJMax>
+template<bool bFirstStep, bool bOccluded, bool isIMin, bool isIMax, bool isJMin, bool isJMax>
 __declspec(noalias) __forceinline void propagateRow(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
-                                                    const int i, const int j, int& readOffset)
+                                                    const vec4* __restrict occluders, const int i, const int j, int& readOffset)
 {
     //	Igor: partially unroll the loop. This unroll ifs too.
-    propagateCell<bFirstStep, isIMin, isIMax, isJMin, isJMax, true, false>(src, targetStep, targetAccum, i, j, 0, readOffset);
+    propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, true, false>(src, targetStep, targetAccum, occluders, inputOffset,
+                                                                                      readOffset);
     ++readOffset;
 
     for (int k = 1; k < static_cast<int>(GridRes - 1); ++k, ++readOffset)
     {
-        propagateCell<bFirstStep, isIMin, isIMax, isJMin, isJMax, false, false>(src, targetStep, targetAccum, i, j, k, readOffset);
+        propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, false, false>(src, targetStep, targetAccum, occluders,
+                                                                                           inputOffset, readOffset);
     }
 
-    propagateCell<bFirstStep, isIMin, isIMax, isJMin, isJMax, false, true>(src, targetStep, targetAccum, i, j, GridRes - 1, readOffset);
+    propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, false, true>(src, targetStep, targetAccum, occluders, inputOffset,
+                                                                                      readOffset);
     ++readOffset;
 }
 
-template<bool bFirstStep, bool isIMin, bool isIMax>
+template<bool bFirstStep, bool bOccluded, bool isIMin, bool isIMax, bool isJMin, bool isJMax>
+__declspec(noalias) __forceinline void propagateRowTiled(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
+                                                         const vec4* __restrict occluders, const int i, const int j)
+{
+    const int tileStrideY = GRID_TILE_CELLS * GRID_TILES_PER_AXIS;
+    const int tileStrideZ = tileStrideY * GRID_TILES_PER_AXIS;
+
+    //	Only the x neighbours change along the row, one set of offsets per position inside of the tile
+    int offsets[GRID_TILE_SIZE][6];
+    for (int k = 0; k < GRID_TILE_SIZE; ++k)
+    {
+        offsets[k][0] = getTiledNeighbourOffset(k, 1, GRID_TILE_CELLS, true);
+        offsets[k][1] = getTiledNeighbourOffset(k, 1, GRID_TILE_CELLS, false);
+        offsets[k][2] = getTiledNeighbourOffset(j % GRID_TILE_SIZE, GRID_TILE_SIZE, tileStrideY, true);
+        offsets[k][3] = getTiledNeighbourOffset(j % GRID_TILE_SIZE, GRID_TILE_SIZE, tileStrideY, false);
+        offsets[k][4] = getTiledNeighbourOffset(i % GRID_TILE_SIZE, GRID_TILE_SIZE * GRID_TILE_SIZE, tileStrideZ, true);
+        offsets[k][5] = getTiledNeighbourOffset(i % GRID_TILE_SIZE, GRID_TILE_SIZE * GRID_TILE_SIZE, tileStrideZ, false);
+    }
+
+    const int rowOffset = getTiledCellOffset(i, j, 0);
+
+    propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, true, false>(src, targetStep, targetAccum, occluders, offsets[0],
+                                                                                      rowOffset);
+
+    for (int k = 1; k < static_cast<int>(GridRes - 1); ++k)
+    {
+        propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, false, false>(
+            src, targetStep, targetAccum, occluders, offsets[k % GRID_TILE_SIZE], rowOffset + getTiledCellOffset(0, 0, k));
+    }
+
+    propagateCell<bFirstStep, bOccluded, isIMin, isIMax, isJMin, isJMax, false, true>(
+        src, targetStep, targetAccum, occluders, offsets[GRID_TILE_SIZE - 1], rowOffset + getTiledCellOffset(0, 0, GridRes - 1));
+}
+
+template<bool bFirstStep, bool bOccluded, bool bTiled, bool isIMin, bool isIMax>
 __declspec(noalias) __forceinline void propagateSlice(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
-                                                      const int i, int& readOffset)
+                                                      const vec4* __restrict occluders, const int i, int& readOffset)
 {
-    propagateRow<bFirstStep, isIMin, isIMax, true, false>(src, targetStep, targetAccum, i, 0, readOffset);
+    if (bTiled)
+    {
+        //	Tiled rows find their own offsets
+        propagateRowTiled<bFirstStep, bOccluded, isIMin, isIMax, true, false>(src, targetStep, targetAccum, occluders, i, 0);
+
+        for (int j = 1; j < static_cast<int>(GridRes - 1); ++j)
+        {
+            propagateRowTiled<bFirstStep, bOccluded, isIMin, isIMax, false, false>(src, targetStep, targetAccum, occluders, i, j);
+        }
+
+        propagateRowTiled<bFirstStep, bOccluded, isIMin, isIMax, false, true>(src, targetStep, targetAccum, occluders, i, GridRes - 1);
+        return;
+    }
+
+    propagateRow<bFirstStep, bOccluded, isIMin, isIMax, true, false>(src, targetStep, targetAccum, occluders, i, 0, readOffset);
 
     for (int j = 1; j < static_cast<int>(GridRes - 1); ++j)
     {
-        propagateRow<bFirstStep, isIMin, isIMax, false, false>(src, targetStep, targetAccum, i, j, readOffset);
+        propagateRow<bFirstStep, bOccluded, isIMin, isIMax, false, false>(src, targetStep, targetAccum, occluders, i, j, readOffset);
     }
 
-    propagateRow<bFirstStep, isIMin, isIMax, false, true>(src, targetStep, targetAccum, i, GridRes - 1, readOffset);
+    propagateRow<bFirstStep, bOccluded, isIMin, isIMax, false, true>(src, targetStep, targetAccum, occluders, i, GridRes - 1, readOffset);
 }
 
-template<bool bFirstStep>
-__declspec(noalias) void LightPropagationCPUContext::propagateStep(vec4* __restrict src, vec4* __restrict targetStep,
-                                                                   vec4* __restrict targetAccum, int iMinSlice /*=0*/,
-                                                                   int iMaxSlice /*=GridRes*/)
+template<bool bFirstStep, bool bOccluded, bool bTiled>
+__declspec(noalias) void propagateSlices(vec4* __restrict src, vec4* __restrict targetStep, vec4* __restrict targetAccum,
+                                         const vec4* __restrict occluders, int iMinSlice, int iMaxSlice)
 {
     int readOffset = iMinSlice * (GridRes * GridRes);
 
@@ -838,17 +2014,41 @@ __declspec(noalias) void LightPropagationCPUContext::propagateStep(vec4* __restr
     if (iMinSlice == 0)
     {
         ++iMinSlice;
-        propagateSlice<bFirstStep, true, false>(src, targetStep, targetAccum, 0, readOffset);
+        propagateSlice<bFirstStep, bOccluded, bTiled, true, false>(src, targetStep, targetAccum, occluders, 0, readOffset);
     }
 
     for (int i = iMinSlice; i < iMaxSlice; ++i)
     {
-        propagateSlice<bFirstStep, false, false>(src, targetStep, targetAccum, i, readOffset);
+        propagateSlice<bFirstStep, bOccluded, bTiled, false, false>(src, targetStep, targetAccum, occluders, i, readOffset);
     }
 
     if (bLastSlice)
     {
-        propagateSlice<bFirstStep, false, true>(src, targetStep, targetAccum, GridRes - 1, readOffset);
+        propagateSlice<bFirstStep, bOccluded, bTiled, false, true>(src, targetStep, targetAccum, occluders, GridRes - 1, readOffset);
+    }
+}
+
+template<bool bFirstStep>
+__declspec(noalias) void LightPropagationCPUContext::propagateStep(vec4* __restrict src, vec4* __restrict targetStep,
+                                                                   vec4* __restrict targetAccum, const vec4* __restrict occluders,
+                                                                   int iMinSlice /*=0*/, int iMaxSlice /*=GridRes*/)
+{
+    //	Same as on the GPU: the first step is not occluded, otherwise the light injected on the surfaces could not leave them
+    const bool bOccluded = !bFirstStep && occluders;
+
+    if (m_bTiledLayout)
+    {
+        if (bOccluded)
+            propagateSlices<bFirstStep, true, true>(src, targetStep, targetAccum, occluders, iMinSlice, iMaxSlice);
+        else
+            propagateSlices<bFirstStep, false, true>(src, targetStep, targetAccum, occluders, iMinSlice, iMaxSlice);
+    }
+    else
+    {
+        if (bOccluded)
+            propagateSlices<bFirstStep, true, false>(src, targetStep, targetAccum, occluders, iMinSlice, iMaxSlice);
+        else
+            propagateSlices<bFirstStep, false, false>(src, targetStep, targetAccum, occluders, iMinSlice, iMaxSlice);
     }
 }
 
@@ -866,7 +2066,8 @@ void LightPropagationCPUContext::TaskStep1(void* pvInfo, int32_t iContext, uint3
     int iMaxSlice = (uTaskId + 1) * GridRes / uTaskCount;
 
     StepContext* pContext = (StepContext*)pvInfo;
-    pContext->pContext->propagateStep<true>(pContext->src, pContext->targetStep, pContext->targetAccum, iMinSlice, iMaxSlice);
+    pContext->pContext->propagateStep<true>(pContext->src, pContext->targetStep, pContext->targetAccum, pContext->occluders, iMinSlice,
+                                            iMaxSlice);
 }
 
 void LightPropagationCPUContext::TaskStepN(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount)
@@ -875,7 +2076,8 @@ void LightPropagationCPUContext::TaskStepN(void* pvInfo, int32_t iContext, uint3
     int iMaxSlice = (uTaskId + 1) * GridRes / uTaskCount;
 
     StepContext* pContext = (StepContext*)pvInfo;
-    pContext->pContext->propagateStep<false>(pContext->src, pContext->targetStep, pContext->targetAccum, iMinSlice, iMaxSlice);
+    pContext->pContext->propagateStep<false>(pContext->src, pContext->targetStep, pContext->targetAccum, pContext->occluders, iMinSlice,
+                                             iMaxSlice);
 }
 
 static void queryTextureFootprint(const Renderer* pRenderer, const RenderTarget* pRT, TextureFootprint* pFootprint)
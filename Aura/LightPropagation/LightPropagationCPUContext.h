@@ -16,11 +16,22 @@
 #include "../Math/AuraVector.h"
 
 #include "LightPropagationCascade.h"
+#include "LightPropagationLightInjector.h"
 #include "LightPropagationRenderer.h"
+#include "LightPropagationSHL2.h"
 
 namespace aura
 {
 
+//	Work split of the CPU propagation, measured on the running machine. Shared by all the contexts of an Aura.
+struct PropagationPartition
+{
+    uint32_t mTasksPerStep; //	Tasks per propagation step and channel
+    uint32_t mSlabSize;     //	Slices propagated between the deadline checks of the sliced propagation
+    uint32_t mWorkerCount;  //	Worker count the partition was tuned for
+    bool     bTuned;
+};
+
 struct TextureFootprint
 {
     uint64_t mTotalByteCount;
@@ -36,19 +47,61 @@ public:
         vec4*                       src;
         vec4*                       targetStep;
         vec4*                       targetAccum;
+        const vec4*                 occluders;
+    };
+
+    //	Where a sliced propagation stopped. Grids are the ones of mChannel.
+    struct PropagationCursor
+    {
+        int   mChannel;
+        int   mStep;
+        int   mSlice;
+        int   mStepCount;
+        int   mCoarseSteps;
+        vec4* pSrc;
+        vec4* pStep;
+        vec4* pAccum;
     };
 
     enum LP_STATE
     {
         CAPTURED_LIGHT,
+        PROPAGATING_LIGHT, //	Sliced propagation in progress, see continuePropagation
         PROPAGATED_LIGHT,
         APPLIED_PROPAGATION
     } eState;
 
 public:
     void readData(Cmd* pCmd, Renderer* pRenderer, RenderTarget* m_LightGrids[3], uint32_t numGrids);
-    void processData(Renderer* pRenderer, ITaskManager* pTaskManager, MTTypes propagationMTType);
+    //	Frame the readback was recorded in and the fence its submission signals, NULL if unknown
+    void     setReadbackTag(uint64_t frame, Fence* pFence);
+    uint64_t getCaptureFrame() const { return m_CaptureFrame; }
+    //	Polls the fence. Without one the copy is done once maxFramesInFlight frames have passed.
+    bool     isReadbackComplete(Renderer* pRenderer, uint64_t frame, uint32_t maxFramesInFlight) const;
+    //	Call before processData or beginPropagation. Takes the partition over once it is tuned and places the grids for its split.
+    void updatePartition(ITaskManager* pTaskManager, const PropagationPartition* pPartition);
+    //	Measures the split for the worker count of pTaskManager on scratch grids. Takes a while, not meant for a frame.
+    void tunePartition(ITaskManager* pTaskManager, PropagationPartition* pPartition);
+    //	Domain of getCPUTopology the tasks of this context run in. Set right after load.
+    void setDomain(uint32_t domain) { m_Domain = domain; }
+    void processData(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params);
     void applyData(Cmd* pCmd, Renderer* pRenderer, RenderTarget* m_LightGrids[3]);
+    //	Uploads the light of the last applyData again in the frame pCmd records, without converting it again
+    void reapplyData(Cmd* pCmd, RenderTarget* m_LightGrids[3]);
+
+    //	Sliced alternative to processData. continuePropagation returns true once the light is propagated,
+    //	deadlineUSec of 0 means no limit.
+    void beginPropagation(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params);
+    bool continuePropagation(int64_t deadlineUSec);
+    //	Propagates synthetic light in every mode and task split, on each of the task managers, and compares the results
+    //	bit for bit. Overwrites the grids and the occluders, only for contexts not in use.
+    bool verifyDeterminism(ITaskManager** ppTaskManagers, uint32_t taskManagerCount);
+    //	Relative error of the light the coarse to fine mode spreads beyond its fine steps, against the full resolution
+    //	propagation with stepCount steps. pFarEnergy gets the ratio of that light to the full resolution one.
+    //	Same restrictions as verifyDeterminism.
+    float compareCoarseToFine(int stepCount, float* pFarEnergy);
+    //	CPU time spent on the last propagation, across all the slices
+    float getPropagationTimeMs() const { return (float)m_PropagationUSec / 1000.0f; }
 
     bool load(Renderer* pRenderer, RenderTarget* m_LightGrids[3]);
     void unload(Renderer* pRenderer, ITaskManager* pTaskManager);
@@ -62,19 +115,46 @@ public:
     const LightPropagationCascade::State& getApplyState() const { return m_applyState; }
     void                                  setApplyState(const LightPropagationCascade::State& val) { m_applyState = val; }
 
+    //	Copies the occluders used for the captured light. NULL disables occlusion.
+    void setOccluders(const vec4* pOccluders);
+    //	Lights are added to the captured light before propagation. Call after setApplyState.
+    void setAnalyticLights(const AnalyticLightDesc* pLights, uint32_t lightCount);
+    //	Next propagation blends the faded border cells of the captured light with the propagated light of pCoarse,
+    //	scaled by lightScale. pCoarse has to keep its grids until then.
+    void setBorderSeed(const LightPropagationCPUContext* pCoarse, float lightScale);
+    //	Propagates with second order SH. Ignores the tiled layout, coarse to fine, bounces and slicing.
+    void setSHL2Propagation(bool bEnabled) { m_bSHL2Propagation = bEnabled; }
+
 private:
+    //	Converts the readback into the grid layout of the propagation and adds the analytic lights
+    void prepareCapturedLight(Renderer* pRenderer, ITaskManager* pTaskManager, const CPUPropagationParams& params);
     void convertGPUtoCPU(Renderer* pRenderer);
+    void packAppliedLight();
+    void seedBorder(const LightPropagationCPUContext* pCoarse, float lightScale);
     void convertCPUtoGPU();
 
+    void placeGrids(ITaskManager* pTaskManager);
+    bool matchesGrids(const vec4* pReference) const;
+
     void launchPropagateSingleTask(ITaskManager* pTaskManager);
     void launchPropagateMultiTask(ITaskManager* pTaskManager, const int iTasksPerStep = 1);
 
     void doPropagate();
+    int  setupPropagationSteps(const CPUPropagationParams& params, int* pCoarseSteps) const;
+    void resetPropagationCursor(int stepCount, int coarseSteps);
+    bool advancePropagation(int64_t deadlineUSec);
+    //	Continues propagating the last step light on a half resolution grid and adds the upsampled result
+    void propagateCoarse(int coarseSteps);
+    //	Reflects the gathered light off the occluders and propagates it again, once per bounce
+    void propagateBounces(ITaskManager* pTaskManager);
+    void propagateSHL2Grids(ITaskManager* pTaskManager);
+    void propagateGathered(ITaskManager* pTaskManager, vec4* const pSources[3], vec4* const pSteps[3], vec4* const pGathered[3],
+                           int stepCount);
 
     void SyncToLastTask(ITaskManager* pTaskManager);
 
     template<bool bFirstStep>
-    void propagateStep(vec4* src, vec4* targetStep, vec4* targetAccum, int iMinSlice, int iMaxSlice);
+    void propagateStep(vec4* src, vec4* targetStep, vec4* targetAccum, const vec4* occluders, int iMinSlice, int iMaxSlice);
 
     //	Task handlers
     static void TaskDoPropagate(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount);
@@ -84,12 +164,35 @@ private:
 private:
     static const int m_nMaxPropagationSteps = 64;
 
-    Buffer*                        m_ReadbackLightGrids[3];
+    Buffer*                        m_ReadbackLightGrids[3]; //	Persistently mapped
+    uint64_t                       m_CaptureFrame;
+    Fence*                         m_pCaptureFence;
     TextureFootprint               m_ReadbackFootprint;
     vec4*                          m_CPUGrids[9];
     ITASKSETHANDLE                 m_hLastTask;
     int                            m_nPropagationSteps;
     StepContext                    m_Contexts[m_nMaxPropagationSteps][3];
     LightPropagationCascade::State m_applyState;
+    vec4*                          m_pOccluders;
+    bool                           m_bHasOccluders;
+    LightInjectionBatch*           m_pLightBatch;
+    vec4*                          m_pFrontier[3]; //	Light of the last propagation step of each channel
+    vec4*                          m_pCoarseGrids[3 * 3 + 1];
+    PropagationCursor              m_Cursor;
+    int64_t                        m_PropagationUSec;
+    bool                           m_bTiledLayout; //	Grids and occluders use the layout of LightPropagationGridLayout.h
+    PropagationPartition           m_Partition;
+    int                            m_BounceCount;
+    vec4*                          m_pBounceGrids[3]; //	Captured light, then the light gathered by the last bounce
+    bool                           m_bSHL2Propagation;
+    SHL2PropagationGrids*          m_pSHL2Grids; //	Allocated on first use
+    half*                          m_pAppliedTexels; //	Light of the last applyData in the grid texture format, see reapplyData
+
+    //	Set until the next prepareCapturedLight, see setBorderSeed
+    const LightPropagationCPUContext* m_pBorderSeed;
+    float                             m_BorderSeedScale;
+
+    uint32_t m_Domain;
+    bool     m_bGridsPlaced; //	First touched by the workers of m_Domain
 };
 } // namespace aura
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#define NO_FSL_DEFINITIONS
+#include "../Shaders/FSL/lightPropagation.h"
+
+namespace aura
+{
+//	Tiled layout of the CPU grids: 4x4x4 cell tiles stored one after another in x, y, z order, cells inside of a tile
+//	in the same order. Neighbours along y and z are 4 and 16 cells away inside a tile instead of 32 and 1024.
+static const int GRID_TILE_SIZE = 4;
+static const int GRID_TILE_CELLS = GRID_TILE_SIZE * GRID_TILE_SIZE * GRID_TILE_SIZE;
+static const int GRID_TILES_PER_AXIS = GridRes / GRID_TILE_SIZE;
+
+//	i, j, k are the z, y, x cell coordinates, same as for the linear layout
+inline int getTiledCellOffset(int i, int j, int k)
+{
+    const int tile = ((i / GRID_TILE_SIZE) * GRID_TILES_PER_AXIS + (j / GRID_TILE_SIZE)) * GRID_TILES_PER_AXIS + (k / GRID_TILE_SIZE);
+    const int cell = ((i % GRID_TILE_SIZE) * GRID_TILE_SIZE + (j % GRID_TILE_SIZE)) * GRID_TILE_SIZE + (k % GRID_TILE_SIZE);
+    return tile * GRID_TILE_CELLS + cell;
+}
+
+inline int getCellOffset(int i, int j, int k, bool bTiled)
+{
+    return bTiled ? getTiledCellOffset(i, j, k) : (i * (int)GridRes + j) * (int)GridRes + k;
+}
+} // namespace aura
@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "LightPropagationLightInjector.h"
+
+#include <string.h>
+
+#include "../Interfaces/IAuraMemoryManager.h"
+
+#define NO_FSL_DEFINITIONS
+#include "../Shaders/FSL/lightPropagation.h"
+#include "../Shaders/FSL/lpvSHMaths.h"
+
+#include "LightPropagationGridLayout.h"
+
+#if !defined(__linux__) && !defined(NX64) && !defined(__aarch64__)
+#define INTRIN_USE
+#endif
+
+#if defined(INTRIN_USE)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+namespace aura
+{
+static const uint32_t BRICK_SIZE = 4;
+static const uint32_t BRICKS_PER_AXIS = GridRes / BRICK_SIZE;
+static const uint32_t BRICK_COUNT = BRICKS_PER_AXIS * BRICKS_PER_AXIS * BRICKS_PER_AXIS;
+
+static const uint32_t INJECTION_TASK_COUNT = 16;
+
+//	Lights of a brick are copied to the stack in chunks of this size
+static const uint32_t LIGHT_CHUNK_SIZE = 64;
+
+//	Fraction of the light reflected by the occluders
+static const float BOUNCE_ALBEDO = 0.5f;
+
+enum LightAttribute
+{
+    LIGHT_POS_X = 0,
+    LIGHT_POS_Y,
+    LIGHT_POS_Z,
+    LIGHT_INV_RADIUS_SQ,
+    LIGHT_DIR_X,
+    LIGHT_DIR_Y,
+    LIGHT_DIR_Z,
+    LIGHT_CONE_BIAS,
+    LIGHT_CONE_SCALE,
+    LIGHT_COLOR_R,
+    LIGHT_COLOR_G,
+    LIGHT_COLOR_B,
+    LIGHT_ATTRIBUTE_COUNT
+};
+
+struct InjectionTaskContext
+{
+    const LightInjectionBatch* pBatch;
+    vec4*                      pGrids[3];
+    const vec4*                pOccluders;
+    bool                       bTiledLayout;
+};
+
+void addLightInjectionBatch(LightInjectionBatch** ppBatch)
+{
+    LightInjectionBatch* pBatch = (LightInjectionBatch*)aura::alloc(sizeof(*pBatch));
+    memset(pBatch, 0, sizeof(*pBatch));
+
+    pBatch->pBrickOffsets = (uint32_t*)aura::alloc((BRICK_COUNT + 1) * sizeof(uint32_t));
+    memset(pBatch->pBrickOffsets, 0, (BRICK_COUNT + 1) * sizeof(uint32_t));
+
+    *ppBatch = pBatch;
+}
+
+void removeLightInjectionBatch(LightInjectionBatch* pBatch)
+{
+    aura::dealloc(pBatch->pLightData);
+    aura::dealloc(pBatch->pBrickOffsets);
+    aura::dealloc(pBatch->pBrickLights);
+    aura::dealloc(pBatch);
+}
+
+static inline float* getLightAttribute(const LightInjectionBatch* pBatch, LightAttribute attribute)
+{
+    return pBatch->pLightData + attribute * pBatch->mLightCapacity;
+}
+
+static void reserveLights(LightInjectionBatch* pBatch, uint32_t lightCount)
+{
+    //	One extra light with no influence pads the SIMD groups
+    const uint32_t required = lightCount + 1;
+    if (required <= pBatch->mLightCapacity)
+        return;
+
+    pBatch->mLightCapacity = (required + 63) & ~63u;
+    aura::dealloc(pBatch->pLightData);
+    pBatch->pLightData = (float*)aura::alloc(LIGHT_ATTRIBUTE_COUNT * pBatch->mLightCapacity * sizeof(float));
+}
+
+static bool getLightBrickRange(const LightInjectionBatch* pBatch, uint32_t light, int32_t brickMin[3], int32_t brickMax[3])
+{
+    const float radius = 1.0f / sqrtf(getLightAttribute(pBatch, LIGHT_INV_RADIUS_SQ)[light]);
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        //	Clamped before the conversion, far lights and huge radii do not fit into an int. NaN fails the test as well.
+        const float pos = getLightAttribute(pBatch, (LightAttribute)(LIGHT_POS_X + c))[light];
+        const float cellMin = floorf(pos - radius);
+        const float cellMax = floorf(pos + radius);
+        if (!(cellMax >= 0.0f && cellMin <= (float)(GridRes - 1)))
+            return false;
+
+        brickMin[c] = (int32_t)max(cellMin, 0.0f) / (int32_t)BRICK_SIZE;
+        brickMax[c] = (int32_t)min(cellMax, (float)(GridRes - 1)) / (int32_t)BRICK_SIZE;
+    }
+
+    return true;
+}
+
+void prepareLightInjectionBatch(LightInjectionBatch* pBatch, const LightPropagationCascade::State& state, const AnalyticLightDesc* pLights,
+                                uint32_t lightCount)
+{
+    reserveLights(pBatch, lightCount);
+
+    const float cellSize = 1.0f / (state.mWorldToGridScale.x * GridRes);
+    //	Falloff is computed in cells, this brings it back to world units
+    const float invCellSizeSq = 1.0f / (cellSize * cellSize);
+    const mat4  worldToCell = scale((float)GridRes, (float)GridRes, (float)GridRes) * state.mWorldToGrid;
+
+    pBatch->mCellSize = cellSize;
+    pBatch->mLightCount = lightCount;
+
+    float* pData[LIGHT_ATTRIBUTE_COUNT];
+    for (uint32_t a = 0; a < LIGHT_ATTRIBUTE_COUNT; ++a)
+        pData[a] = getLightAttribute(pBatch, (LightAttribute)a);
+
+    for (uint32_t i = 0; i < lightCount; ++i)
+    {
+        const AnalyticLightDesc& light = pLights[i];
+        const vec3               pos = (worldToCell * float4(light.mPosition, 1.0f)).xyz();
+        const float              radius = max(light.mRadius / cellSize, 1e-3f);
+
+        //	Spot cone, a point light never fades and an area light has a cosine emission profile
+        float coneBias = -2.0f;
+        float coneScale = 1.0f;
+        float intensity = light.mIntensity * invCellSizeSq;
+        if (light.mType == ANALYTIC_LIGHT_SPOT)
+        {
+            coneBias = light.mSpotCosOuter;
+            coneScale = 1.0f / max(light.mSpotCosInner - light.mSpotCosOuter, 1e-4f);
+        }
+        else if (light.mType == ANALYTIC_LIGHT_AREA)
+        {
+            coneBias = 0.0f;
+            intensity *= light.mArea;
+        }
+
+        pData[LIGHT_POS_X][i] = pos.x;
+        pData[LIGHT_POS_Y][i] = pos.y;
+        pData[LIGHT_POS_Z][i] = pos.z;
+        pData[LIGHT_INV_RADIUS_SQ][i] = 1.0f / (radius * radius);
+        pData[LIGHT_DIR_X][i] = light.mDirection.x;
+        pData[LIGHT_DIR_Y][i] = light.mDirection.y;
+        pData[LIGHT_DIR_Z][i] = light.mDirection.z;
+        pData[LIGHT_CONE_BIAS][i] = coneBias;
+        pData[LIGHT_CONE_SCALE][i] = coneScale;
+        pData[LIGHT_COLOR_R][i] = light.mColor.x * intensity;
+        pData[LIGHT_COLOR_G][i] = light.mColor.y * intensity;
+        pData[LIGHT_COLOR_B][i] = light.mColor.z * intensity;
+    }
+
+    //	Padding light: black and far away
+    for (uint32_t a = 0; a < LIGHT_ATTRIBUTE_COUNT; ++a)
+        pData[a][lightCount] = 0.0f;
+    pData[LIGHT_POS_X][lightCount] = -1e6f;
+    pData[LIGHT_INV_RADIUS_SQ][lightCount] = 1.0f;
+
+    //	Count, prefix sum, fill
+    uint32_t* pOffsets = pBatch->pBrickOffsets;
+    memset(pOffsets, 0, (BRICK_COUNT + 1) * sizeof(uint32_t));
+
+    int32_t brickMin[3];
+    int32_t brickMax[3];
+    for (uint32_t l = 0; l < lightCount; ++l)
+    {
+        if (!getLightBrickRange(pBatch, l, brickMin, brickMax))
+            continue;
+
+        for (int32_t bz = brickMin[2]; bz <= brickMax[2]; ++bz)
+            for (int32_t by = brickMin[1]; by <= brickMax[1]; ++by)
+                for (int32_t bx = brickMin[0]; bx <= brickMax[0]; ++bx)
+                    ++pOffsets[(bz * BRICKS_PER_AXIS + by) * BRICKS_PER_AXIS + bx];
+    }
+
+    uint32_t total = 0;
+    for (uint32_t b = 0; b < BRICK_COUNT; ++b)
+    {
+        const uint32_t count = pOffsets[b];
+        pOffsets[b] = total;
+        total += count;
+    }
+    pOffsets[BRICK_COUNT] = total;
+
+    if (total > pBatch->mBrickLightCapacity)
+    {
+        pBatch->mBrickLightCapacity = max(total, 2 * pBatch->mBrickLightCapacity);
+        aura::dealloc(pBatch->pBrickLights);
+        pBatch->pBrickLights = (uint32_t*)aura::alloc(pBatch->mBrickLightCapacity * sizeof(uint32_t));
+    }
+
+    //	Offsets are advanced while filling and end up pointing to the start of the next brick
+    for (uint32_t l = 0; l < lightCount; ++l)
+    {
+        if (!getLightBrickRange(pBatch, l, brickMin, brickMax))
+            continue;
+
+        for (int32_t bz = brickMin[2]; bz <= brickMax[2]; ++bz)
+            for (int32_t by = brickMin[1]; by <= brickMax[1]; ++by)
+                for (int32_t bx = brickMin[0]; bx <= brickMax[0]; ++bx)
+                    pBatch->pBrickLights[pOffsets[(bz * BRICKS_PER_AXIS + by) * BRICKS_PER_AXIS + bx]++] = l;
+    }
+
+    for (uint32_t b = BRICK_COUNT; b > 0; --b)
+        pOffsets[b] = pOffsets[b - 1];
+    pOffsets[0] = 0;
+}
+
+/************************************************************************/
+// Injection
+/************************************************************************/
+//	Per channel sums. Emitters: (S, Vx, Vy, Vz) with V the light direction weighted by S.
+//	Bounce: (A, B) with A the reflected luminance and B the same with the sign of the facing.
+struct LightSums
+{
+    float mSums[3][4];
+};
+
+static inline float4 getInjectedCoeffs(const LightSums& sums, uint32_t channel, const vec4* pOccluder)
+{
+    const float* s = sums.mSums[channel];
+    if (pOccluder)
+    {
+        //	Light hitting the back side of the occluder is reflected by the flipped lobe
+        return float4(pOccluder->x * s[0], pOccluder->y * s[1], pOccluder->z * s[1], pOccluder->w * s[1]) * BOUNCE_ALBEDO;
+    }
+
+    //	Cosine lobe in the direction the light travels
+    const float2 vZHCoeffs = SHProjectionScale * float2(0.25f, 0.5f);
+    return float4(vZHCoeffs.x * s[0], -vZHCoeffs.y * s[2], vZHCoeffs.y * s[3], -vZHCoeffs.y * s[1]);
+}
+
+#if defined(INTRIN_USE)
+static inline float horizontalSum(__m128 v)
+{
+    const __m128 hi = _mm_movehl_ps(v, v);
+    const __m128 sum = _mm_add_ps(v, hi);
+    return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+//	Four lights at once. lightCount is a multiple of 4.
+static void sumLights(const float (*pLights)[LIGHT_CHUNK_SIZE], uint32_t lightCount, const vec3& cell, const vec4* pOccluder,
+                      LightSums* pSums)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 cx = _mm_set1_ps(cell.x);
+    const __m128 cy = _mm_set1_ps(cell.y);
+    const __m128 cz = _mm_set1_ps(cell.z);
+
+    //	SH evaluation of the occluder towards the light, -l
+    const vec4   basis = SHBasis;
+    const __m128 o0 = _mm_set1_ps(pOccluder ? pOccluder->x * basis.x : 0.0f);
+    const __m128 ox = _mm_set1_ps(pOccluder ? -pOccluder->w * basis.w : 0.0f);
+    const __m128 oy = _mm_set1_ps(pOccluder ? -pOccluder->y * basis.y : 0.0f);
+    const __m128 oz = _mm_set1_ps(pOccluder ? -pOccluder->z * basis.z : 0.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    __m128 acc[3][4];
+    for (uint32_t c = 0; c < 3; ++c)
+        for (uint32_t i = 0; i < 4; ++i)
+            acc[c][i] = zero;
+
+    for (uint32_t l = 0; l < lightCount; l += 4)
+    {
+        const __m128 dx = _mm_sub_ps(cx, _mm_load_ps(&pLights[LIGHT_POS_X][l]));
+        const __m128 dy = _mm_sub_ps(cy, _mm_load_ps(&pLights[LIGHT_POS_Y][l]));
+        const __m128 dz = _mm_sub_ps(cz, _mm_load_ps(&pLights[LIGHT_POS_Z][l]));
+        const __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+        //	Closer than a cell the light is treated as being one cell away
+        const __m128 clampedDistSq = _mm_max_ps(distSq, one);
+        //	Exact square root and division like the scalar path, the estimate of _mm_rsqrt_ps differs between CPUs
+        const __m128 dist = _mm_sqrt_ps(clampedDistSq);
+        const __m128 lx = _mm_div_ps(dx, dist);
+        const __m128 ly = _mm_div_ps(dy, dist);
+        const __m128 lz = _mm_div_ps(dz, dist);
+
+        const __m128 cosAngle = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_load_ps(&pLights[LIGHT_DIR_X][l])),
+                                                      _mm_mul_ps(ly, _mm_load_ps(&pLights[LIGHT_DIR_Y][l]))),
+                                           _mm_mul_ps(lz, _mm_load_ps(&pLights[LIGHT_DIR_Z][l])));
+        __m128       cone = _mm_mul_ps(_mm_sub_ps(cosAngle, _mm_load_ps(&pLights[LIGHT_CONE_BIAS][l])),
+                                       _mm_load_ps(&pLights[LIGHT_CONE_SCALE][l]));
+        cone = _mm_min_ps(_mm_max_ps(cone, zero), one);
+
+        __m128 window = _mm_sub_ps(one, _mm_mul_ps(distSq, _mm_load_ps(&pLights[LIGHT_INV_RADIUS_SQ][l])));
+        window = _mm_max_ps(window, zero);
+
+        const __m128 weight = _mm_div_ps(_mm_mul_ps(cone, _mm_mul_ps(window, window)), clampedDistSq);
+
+        if (pOccluder)
+        {
+            const __m128 facing =
+                _mm_add_ps(_mm_add_ps(o0, _mm_mul_ps(ox, lx)), _mm_add_ps(_mm_mul_ps(oy, ly), _mm_mul_ps(oz, lz)));
+            const __m128 facingAbs = _mm_andnot_ps(signMask, facing);
+
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                const __m128 w = _mm_mul_ps(weight, _mm_load_ps(&pLights[LIGHT_COLOR_R + c][l]));
+                acc[c][0] = _mm_add_ps(acc[c][0], _mm_mul_ps(w, facingAbs));
+                acc[c][1] = _mm_add_ps(acc[c][1], _mm_mul_ps(w, facing));
+            }
+        }
+        else
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                const __m128 w = _mm_mul_ps(weight, _mm_load_ps(&pLights[LIGHT_COLOR_R + c][l]));
+                acc[c][0] = _mm_add_ps(acc[c][0], w);
+                acc[c][1] = _mm_add_ps(acc[c][1], _mm_mul_ps(w, lx));
+                acc[c][2] = _mm_add_ps(acc[c][2], _mm_mul_ps(w, ly));
+                acc[c][3] = _mm_add_ps(acc[c][3], _mm_mul_ps(w, lz));
+            }
+        }
+    }
+
+    for (uint32_t c = 0; c < 3; ++c)
+        for (uint32_t i = 0; i < 4; ++i)
+            pSums->mSums[c][i] = horizontalSum(acc[c][i]);
+}
+#else
+static void sumLights(const float (*pLights)[LIGHT_CHUNK_SIZE], uint32_t lightCount, const vec3& cell, const vec4* pOccluder,
+                      LightSums* pSums)
+{
+    const vec4 basis = SHBasis;
+    memset(pSums, 0, sizeof(*pSums));
+
+    for (uint32_t l = 0; l < lightCount; ++l)
+    {
+        const vec3  d = cell - vec3(pLights[LIGHT_POS_X][l], pLights[LIGHT_POS_Y][l], pLights[LIGHT_POS_Z][l]);
+        const float distSq = dot(d, d);
+
+        //	Closer than a cell the light is treated as being one cell away
+        const float clampedDistSq = max(distSq, 1.0f);
+        const vec3  dir = d / sqrtf(clampedDistSq);
+
+        const float cosAngle = dot(dir, vec3(pLights[LIGHT_DIR_X][l], pLights[LIGHT_DIR_Y][l], pLights[LIGHT_DIR_Z][l]));
+        const float cone = clamp((cosAngle - pLights[LIGHT_CONE_BIAS][l]) * pLights[LIGHT_CONE_SCALE][l], 0.0f, 1.0f);
+        const float window = max(1.0f - distSq * pLights[LIGHT_INV_RADIUS_SQ][l], 0.0f);
+        const float weight = cone * window * window / clampedDistSq;
+        if (weight <= 0.0f)
+            continue;
+
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            const float w = weight * pLights[LIGHT_COLOR_R + c][l];
+            float*      s = pSums->mSums[c];
+
+            if (pOccluder)
+            {
+                const float facing = pOccluder->x * basis.x - pOccluder->w * basis.w * dir.x - pOccluder->y * basis.y * dir.y -
+                                     pOccluder->z * basis.z * dir.z;
+                s[0] += w * fabsf(facing);
+                s[1] += w * facing;
+            }
+            else
+            {
+                s[0] += w;
+                s[1] += w * dir.x;
+                s[2] += w * dir.y;
+                s[3] += w * dir.z;
+            }
+        }
+    }
+}
+#endif
+
+static void injectBrick(const InjectionTaskContext* pContext, uint32_t brick)
+{
+    const LightInjectionBatch* pBatch = pContext->pBatch;
+    const uint32_t             first = pBatch->pBrickOffsets[brick];
+    const uint32_t             last = pBatch->pBrickOffsets[brick + 1];
+    if (first == last)
+        return;
+
+    const uint32_t bx = (brick % BRICKS_PER_AXIS) * BRICK_SIZE;
+    const uint32_t by = ((brick / BRICKS_PER_AXIS) % BRICKS_PER_AXIS) * BRICK_SIZE;
+    const uint32_t bz = (brick / (BRICKS_PER_AXIS * BRICKS_PER_AXIS)) * BRICK_SIZE;
+
+    DEFINE_ALIGNED(float lights[LIGHT_ATTRIBUTE_COUNT][LIGHT_CHUNK_SIZE], 16);
+
+    for (uint32_t chunk = first; chunk < last; chunk += LIGHT_CHUNK_SIZE)
+    {
+        const uint32_t lightCount = min(last - chunk, LIGHT_CHUNK_SIZE);
+        //	Pad to the SIMD width with the black light
+        const uint32_t paddedCount = (lightCount + 3) & ~3u;
+
+        for (uint32_t a = 0; a < LIGHT_ATTRIBUTE_COUNT; ++a)
+        {
+            const float* pAttribute = getLightAttribute(pBatch, (LightAttribute)a);
+            for (uint32_t l = 0; l < paddedCount; ++l)
+                lights[a][l] = pAttribute[l < lightCount ? pBatch->pBrickLights[chunk + l] : pBatch->mLightCount];
+        }
+
+        for (uint32_t i = bz; i < bz + BRICK_SIZE; ++i)
+        {
+            for (uint32_t j = by; j < by + BRICK_SIZE; ++j)
+            {
+                for (uint32_t k = bx; k < bx + BRICK_SIZE; ++k)
+                {
+                    const uint32_t cell = getCellOffset(i, j, k, pContext->bTiledLayout);
+
+                    const vec4* pOccluder = pContext->pOccluders ? &pContext->pOccluders[cell] : NULL;
+                    //	Nothing to bounce off
+                    if (pOccluder && pOccluder->x <= 0.0f)
+                        continue;
+
+                    LightSums sums;
+                    sumLights(lights, paddedCount, vec3(k + 0.5f, j + 0.5f, i + 0.5f), pOccluder, &sums);
+
+                    for (uint32_t c = 0; c < 3; ++c)
+                        pContext->pGrids[c][cell] += getInjectedCoeffs(sums, c, pOccluder);
+                }
+            }
+        }
+    }
+}
+
+static void TaskInjectLights(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount)
+{
+    const uint32_t firstBrick = uTaskId * BRICK_COUNT / uTaskCount;
+    const uint32_t lastBrick = (uTaskId + 1) * BRICK_COUNT / uTaskCount;
+
+    for (uint32_t b = firstBrick; b < lastBrick; ++b)
+        injectBrick((const InjectionTaskContext*)pvInfo, b);
+}
+
+void injectLights(const LightInjectionBatch* pBatch, ITaskManager* pTaskManager, vec4* const pGrids[3], const vec4* pOccluders,
+                  bool bTiledLayout)
+{
+    if (!pBatch->mLightCount)
+        return;
+
+    InjectionTaskContext context = { pBatch, { pGrids[0], pGrids[1], pGrids[2] }, pOccluders, bTiledLayout };
+
+    if (!pTaskManager)
+    {
+        TaskInjectLights(&context, 0, 0, 1);
+        return;
+    }
+
+    ITASKSETHANDLE hTask = ITASKSETHANDLE_INVALID;
+    pTaskManager->createTaskSet(0, TaskInjectLights, &context, INJECTION_TASK_COUNT, NULL, 0, "Inject analytic lights", &hTask);
+    pTaskManager->waitForTaskSet(hTask);
+#if !defined(ORBIS_TASK_MANAGER)
+    pTaskManager->releaseTask(hTask);
+#endif
+}
+} // namespace aura
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../Interfaces/IAuraTaskManager.h"
+
+#include "../Math/AuraVector.h"
+
+#include "LightPropagationCascade.h"
+
+namespace aura
+{
+enum AnalyticLightType
+{
+    ANALYTIC_LIGHT_POINT = 0,
+    ANALYTIC_LIGHT_SPOT,
+    ANALYTIC_LIGHT_AREA, //	One-sided emitter, mDirection is the normal
+};
+
+typedef struct AnalyticLightDesc
+{
+    float3            mPosition;
+    float             mRadius; //	Light has no influence past this distance
+    float3            mColor;
+    float             mIntensity;
+    float3            mDirection;
+    float             mSpotCosOuter;
+    float             mSpotCosInner;
+    float             mArea; //	Area lights only
+    AnalyticLightType mType;
+} AnalyticLightDesc;
+
+//	Lights converted to cell space of one cascade and binned into 4x4x4 cell bricks.
+//	Light attributes are stored as SoA to be processed several lights at once.
+typedef struct LightInjectionBatch
+{
+    float*    pLightData;
+    uint32_t  mLightCount;
+    uint32_t  mLightCapacity;
+    uint32_t* pBrickOffsets; //	Brick b owns pBrickLights[pBrickOffsets[b]..pBrickOffsets[b + 1])
+    uint32_t* pBrickLights;
+    uint32_t  mBrickLightCapacity;
+    float     mCellSize;
+} LightInjectionBatch;
+
+void addLightInjectionBatch(LightInjectionBatch** ppBatch);
+void removeLightInjectionBatch(LightInjectionBatch* pBatch);
+
+void prepareLightInjectionBatch(LightInjectionBatch* pBatch, const LightPropagationCascade::State& state, const AnalyticLightDesc* pLights,
+                                uint32_t lightCount);
+
+//	Adds the light to the RGB grids. If occluders are provided the light is bounced off them, otherwise the lights
+//	are injected as emitters. Grids and occluders are in the tiled layout when bTiledLayout is set.
+void injectLights(const LightInjectionBatch* pBatch, ITaskManager* pTaskManager, vec4* const pGrids[3], const vec4* pOccluders,
+                  bool bTiledLayout);
+} // namespace aura
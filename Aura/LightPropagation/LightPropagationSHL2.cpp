@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "LightPropagationSHL2.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "../Interfaces/IAuraMemoryManager.h"
+
+#define NO_FSL_DEFINITIONS
+#include "../Shaders/FSL/lightPropagation.h"
+#include "../Shaders/FSL/lpvSHMaths.h"
+
+#if !defined(__linux__) && !defined(NX64) && !defined(__aarch64__)
+#define INTRIN_USE
+#endif
+
+//	8 cells of a row at once with AVX, 4 in the default SSE build. Other targets use the scalar loop.
+#if defined(INTRIN_USE) && defined(__AVX__)
+#include <immintrin.h>
+#define SH_L2_AVX
+#elif defined(INTRIN_USE)
+#include <xmmintrin.h>
+#define SH_L2_SSE
+#endif
+
+namespace aura
+{
+static const uint32_t SH_L2_CELL_COUNT = GridRes * GridRes * GridRes;
+static const uint32_t SH_L2_PLANE_COUNT = 3 * (2 * SH_L2_COEFF_COUNT + SH_L1_COEFF_COUNT);
+static const int      SH_L2_MAX_STEPS = 64;
+
+struct SHL2Cone
+{
+    float c[SH_L2_COEFF_COUNT];
+};
+
+struct SHL2StepContext
+{
+    SHL2PropagationGrids* pGrids;
+    const vec4*           pOccluders;
+    int                   mChannel;
+    int                   mStep;
+};
+
+//	Same order as vConeDirs of the first order propagation
+static const float coneDirs[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+};
+
+static const int inputOffset[] = {
+    +1, -1, GridRes, -(int)GridRes, GridRes* GridRes, -(int)(GridRes* GridRes),
+};
+
+//	Same signs as SHBasis for the first band
+static void evaluateSHL2Basis(const float* dir, float* basis)
+{
+    const float x = dir[0], y = dir[1], z = dir[2];
+    basis[0] = 0.282095f;
+    basis[1] = -0.488603f * y;
+    basis[2] = 0.488603f * z;
+    basis[3] = -0.488603f * x;
+    basis[4] = 1.092548f * x * y;
+    basis[5] = -1.092548f * y * z;
+    basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    basis[7] = -1.092548f * x * z;
+    basis[8] = 0.546274f * (x * x - y * y);
+}
+
+//	90 degree cone around -dir. The first two bands match Cone90Degree of the first order propagation.
+//	Band 2 keeps the ratio to band 1 of the exact cone projection, which is cos(angle).
+static SHL2Cone makeCone90Degree(const float* dir)
+{
+    const float angle = (float)PI / 4.0f;
+    const float zh0 = SHProjectionScale * 0.5f * (1.0f - cosf(angle));
+    const float zh1 = SHProjectionScale * 0.75f * sinf(angle) * sinf(angle);
+
+    const float bandScale[3] = { zh0 / 0.282095f, zh1 / 0.488603f, zh1 / 0.488603f * cosf(angle) };
+
+    const float negDir[3] = { -dir[0], -dir[1], -dir[2] };
+    SHL2Cone    cone;
+    evaluateSHL2Basis(negDir, cone.c);
+    for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+        cone.c[c] *= bandScale[c == 0 ? 0 : (c < SH_L1_COEFF_COUNT ? 1 : 2)];
+    return cone;
+}
+
+static const SHL2Cone vCone90DegreeL2[6] = {
+    makeCone90Degree(coneDirs[0]), makeCone90Degree(coneDirs[1]), makeCone90Degree(coneDirs[2]),
+    makeCone90Degree(coneDirs[3]), makeCone90Degree(coneDirs[4]), makeCone90Degree(coneDirs[5]),
+};
+
+//	Occluders stay first order: saturate(1 - occluder(dir)) in both directions, the smaller one wins
+static float getNeighbourOcclusion(const vec4& occluder, int dirIndex)
+{
+    const float* o = &occluder.x;
+    float        occlusion = 0.0f;
+    for (int side = 0; side < 2; ++side)
+    {
+        const float* dir = coneDirs[dirIndex ^ side];
+        const float  value = o[0] * 0.282095f - o[1] * 0.488603f * dir[1] + o[2] * 0.488603f * dir[2] - o[3] * 0.488603f * dir[0];
+        occlusion = side ? max(occlusion, value) : value;
+    }
+    return clamp(1.0f - occlusion, 0.0f, 1.0f);
+}
+
+static bool hasNeighbourRow(int dirIndex, int i, int j)
+{
+    switch (dirIndex)
+    {
+    case 2:
+        return j < (int)GridRes - 1;
+    case 3:
+        return j > 0;
+    case 4:
+        return i < (int)GridRes - 1;
+    case 5:
+        return i > 0;
+    default:
+        return true;
+    }
+}
+
+//	res += cone * max(0, dot(neighbour, cone)) * occlusion for a whole row
+static void propagateRowDir(const float* const neighbour[SH_L2_COEFF_COUNT], const SHL2Cone& cone, const float* occlusion,
+                            float res[SH_L2_COEFF_COUNT][GridRes])
+{
+#if defined(SH_L2_AVX)
+    const __m256 zero = _mm256_setzero_ps();
+    for (uint32_t k = 0; k < GridRes; k += 8)
+    {
+        __m256 lum = zero;
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+            lum = _mm256_add_ps(lum, _mm256_mul_ps(_mm256_set1_ps(cone.c[c]), _mm256_loadu_ps(neighbour[c] + k)));
+
+        lum = _mm256_max_ps(lum, zero);
+        if (occlusion)
+            lum = _mm256_mul_ps(lum, _mm256_load_ps(occlusion + k));
+
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+            _mm256_store_ps(res[c] + k, _mm256_add_ps(_mm256_load_ps(res[c] + k), _mm256_mul_ps(_mm256_set1_ps(cone.c[c]), lum)));
+    }
+#elif defined(SH_L2_SSE)
+    const __m128 zero = _mm_setzero_ps();
+    for (uint32_t k = 0; k < GridRes; k += 4)
+    {
+        __m128 lum = zero;
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+            lum = _mm_add_ps(lum, _mm_mul_ps(_mm_set1_ps(cone.c[c]), _mm_loadu_ps(neighbour[c] + k)));
+
+        lum = _mm_max_ps(lum, zero);
+        if (occlusion)
+            lum = _mm_mul_ps(lum, _mm_load_ps(occlusion + k));
+
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+            _mm_store_ps(res[c] + k, _mm_add_ps(_mm_load_ps(res[c] + k), _mm_mul_ps(_mm_set1_ps(cone.c[c]), lum)));
+    }
+#else
+    DEFINE_ALIGNED(float lum[GridRes], 32);
+    for (uint32_t k = 0; k < GridRes; ++k)
+        lum[k] = 0.0f;
+
+    for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+        for (uint32_t k = 0; k < GridRes; ++k)
+            lum[k] += cone.c[c] * neighbour[c][k];
+
+    for (uint32_t k = 0; k < GridRes; ++k)
+        lum[k] = max(lum[k], 0.0f) * (occlusion ? occlusion[k] : 1.0f);
+
+    for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+        for (uint32_t k = 0; k < GridRes; ++k)
+            res[c][k] += cone.c[c] * lum[k];
+#endif
+}
+
+static void propagateSlicesSHL2(const SHL2StepContext* pContext, int iMinSlice, int iMaxSlice)
+{
+    SHL2PropagationGrids* pGrids = pContext->pGrids;
+    const int             channel = pContext->mChannel;
+    const bool            bFirstStep = pContext->mStep == 0;
+
+    //	Ping-pong between the source and the step planes. The first step is not occluded, same as the first order propagation.
+    float* const* src = (pContext->mStep & 0x1) ? pGrids->pStep[channel] : pGrids->pSrc[channel];
+    float* const* dst = (pContext->mStep & 0x1) ? pGrids->pSrc[channel] : pGrids->pStep[channel];
+    float* const* accum = pGrids->pAccum[channel];
+    const vec4*   occluders = bFirstStep ? NULL : pContext->pOccluders;
+
+    DEFINE_ALIGNED(float res[SH_L2_COEFF_COUNT][GridRes], 32);
+    DEFINE_ALIGNED(float occlusion[6][GridRes], 32);
+    //	Zero padded copy of the row, the x neighbours of the first and the last cell read the padding
+    float paddedRow[SH_L2_COEFF_COUNT][GridRes + 2];
+
+    for (int i = iMinSlice; i < iMaxSlice; ++i)
+    {
+        for (int j = 0; j < (int)GridRes; ++j)
+        {
+            const int rowOffset = (i * (int)GridRes + j) * (int)GridRes;
+
+            memset(res, 0, sizeof(res));
+            for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+            {
+                paddedRow[c][0] = 0.0f;
+                memcpy(paddedRow[c] + 1, src[c] + rowOffset, GridRes * sizeof(float));
+                paddedRow[c][GridRes + 1] = 0.0f;
+            }
+
+            for (int d = 0; d < 6; ++d)
+            {
+                if (!hasNeighbourRow(d, i, j))
+                    continue;
+
+                const float* neighbour[SH_L2_COEFF_COUNT];
+                for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+                    neighbour[c] = d < 2 ? paddedRow[c] + 1 + inputOffset[d] : src[c] + rowOffset + inputOffset[d];
+
+                if (occluders)
+                {
+                    //	The padding cells carry no light, their occlusion does not matter
+                    for (int k = 0; k < (int)GridRes; ++k)
+                    {
+                        const int n = k + (d < 2 ? inputOffset[d] : 0);
+                        occlusion[d][k] =
+                            (n < 0 || n >= (int)GridRes) ? 0.0f : getNeighbourOcclusion(occluders[rowOffset + k + inputOffset[d]], d);
+                    }
+                }
+
+                propagateRowDir(neighbour, vCone90DegreeL2[d], occluders ? occlusion[d] : NULL, res);
+            }
+
+            for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c)
+                memcpy(dst[c] + rowOffset, res[c], GridRes * sizeof(float));
+
+            for (uint32_t c = 0; c < SH_L1_COEFF_COUNT; ++c)
+            {
+                float* pAccum = accum[c] + rowOffset;
+                if (bFirstStep)
+                {
+                    const float* pSrc = src[c] + rowOffset;
+                    for (uint32_t k = 0; k < GridRes; ++k)
+                        pAccum[k] = pSrc[k] + res[c][k];
+                }
+                else
+                {
+                    for (uint32_t k = 0; k < GridRes; ++k)
+                        pAccum[k] += res[c][k];
+                }
+            }
+        }
+    }
+}
+
+static void TaskStepSHL2(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount)
+{
+    const int iMinSlice = (int)(uTaskId * GridRes / uTaskCount);
+    const int iMaxSlice = (int)((uTaskId + 1) * GridRes / uTaskCount);
+    propagateSlicesSHL2((const SHL2StepContext*)pvInfo, iMinSlice, iMaxSlice);
+}
+
+void addSHL2PropagationGrids(SHL2PropagationGrids** ppGrids)
+{
+    SHL2PropagationGrids* pGrids = (SHL2PropagationGrids*)aura::alloc(sizeof(*pGrids));
+    memset(pGrids, 0, sizeof(*pGrids));
+
+    pGrids->pMemory = (float*)aura::alloc(SH_L2_PLANE_COUNT * SH_L2_CELL_COUNT * sizeof(float));
+
+    float* pPlane = pGrids->pMemory;
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c, pPlane += SH_L2_CELL_COUNT)
+            pGrids->pSrc[i][c] = pPlane;
+        for (uint32_t c = 0; c < SH_L2_COEFF_COUNT; ++c, pPlane += SH_L2_CELL_COUNT)
+            pGrids->pStep[i][c] = pPlane;
+        for (uint32_t c = 0; c < SH_L1_COEFF_COUNT; ++c, pPlane += SH_L2_CELL_COUNT)
+            pGrids->pAccum[i][c] = pPlane;
+    }
+
+    *ppGrids = pGrids;
+}
+
+void removeSHL2PropagationGrids(SHL2PropagationGrids* pGrids)
+{
+    aura::dealloc(pGrids->pMemory);
+    aura::dealloc(pGrids);
+}
+
+void propagateSHL2(SHL2PropagationGrids* pGrids, ITaskManager* pTaskManager, uint32_t domain, uint32_t tasksPerStep,
+                   vec4* const pRGBGrids[3], const vec4* pOccluders, int stepCount)
+{
+    stepCount = min(stepCount, SH_L2_MAX_STEPS);
+    if (stepCount <= 0)
+        return;
+
+    //	Captured light is first order, the second band starts empty
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        const float* pCell = &pRGBGrids[i][0].x;
+        for (uint32_t n = 0; n < SH_L2_CELL_COUNT; ++n, pCell += 4)
+        {
+            for (uint32_t c = 0; c < SH_L1_COEFF_COUNT; ++c)
+                pGrids->pSrc[i][c][n] = pCell[c];
+        }
+        for (uint32_t c = SH_L1_COEFF_COUNT; c < SH_L2_COEFF_COUNT; ++c)
+            memset(pGrids->pSrc[i][c], 0, SH_L2_CELL_COUNT * sizeof(float));
+    }
+
+    SHL2StepContext contexts[SH_L2_MAX_STEPS][3];
+    ITASKSETHANDLE  hTasks[SH_L2_MAX_STEPS][3];
+
+    for (int i = 0; i < stepCount; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            SHL2StepContext& context = contexts[i][j];
+            context.pGrids = pGrids;
+            context.pOccluders = pOccluders;
+            context.mChannel = j;
+            context.mStep = i;
+
+            if (pTaskManager)
+                pTaskManager->createTaskSetInDomain(domain, i, TaskStepSHL2, &context, max(tasksPerStep, 1U), i ? &hTasks[i - 1][j] : NULL,
+                                                    i ? 1 : 0, "Propagate L2", &hTasks[i][j]);
+            else
+                TaskStepSHL2(&context, 0, 0, 1);
+        }
+    }
+
+    if (pTaskManager)
+    {
+        //	The last step of a channel depends on all the steps before it
+        for (int j = 0; j < 3; ++j)
+            pTaskManager->waitForTaskSet(hTasks[stepCount - 1][j]);
+#if !defined(ORBIS_TASK_MANAGER)
+        pTaskManager->releaseTasks(hTasks[0], 3 * stepCount);
+#endif
+    }
+
+    //	Only the first order part is uploaded, the apply shader is first order. The second band did its work during the
+    //	steps: it keeps the light from spreading sideways, which the first order coefficients of the result still show.
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        float* pCell = &pRGBGrids[i][0].x;
+        for (uint32_t n = 0; n < SH_L2_CELL_COUNT; ++n, pCell += 4)
+        {
+            for (uint32_t c = 0; c < SH_L1_COEFF_COUNT; ++c)
+                pCell[c] = pGrids->pAccum[i][c][n];
+        }
+    }
+}
+} // namespace aura
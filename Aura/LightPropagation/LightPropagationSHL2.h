@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../Interfaces/IAuraTaskManager.h"
+
+#include "../Math/AuraVector.h"
+
+namespace aura
+{
+static const uint32_t SH_L2_COEFF_COUNT = 9;
+//	The result is uploaded to the first order grids, only these coefficients are accumulated
+static const uint32_t SH_L1_COEFF_COUNT = 4;
+
+//	Second order SH grids of one cascade. Every coefficient of every channel is a separate plane of GridRes^3 floats,
+//	so that 8 cells of a row can be processed at once.
+typedef struct SHL2PropagationGrids
+{
+    float* pMemory;
+    float* pSrc[3][SH_L2_COEFF_COUNT];
+    float* pStep[3][SH_L2_COEFF_COUNT];
+    float* pAccum[3][SH_L1_COEFF_COUNT];
+} SHL2PropagationGrids;
+
+void addSHL2PropagationGrids(SHL2PropagationGrids** ppGrids);
+void removeSHL2PropagationGrids(SHL2PropagationGrids* pGrids);
+
+//	Propagates the first order RGB grids with second order SH and writes the first order part of the result back.
+//	Second order coefficients start at zero and sharpen the light as it travels. Grids use the linear layout.
+//	Tasks run in the given domain of getCPUTopology.
+void propagateSHL2(SHL2PropagationGrids* pGrids, ITaskManager* pTaskManager, uint32_t domain, uint32_t tasksPerStep,
+                   vec4* const pRGBGrids[3], const vec4* pOccluders, int stepCount);
+} // namespace aura
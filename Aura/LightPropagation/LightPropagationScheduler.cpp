@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "LightPropagationScheduler.h"
+
+#include "../Interfaces/IAuraMemoryManager.h"
+
+namespace aura
+{
+static const uint32_t DEFAULT_MAX_FRAMES_BETWEEN_UPDATES = 8;
+
+//	Initial guesses used until real timings are reported
+static const float DEFAULT_CPU_COST_MS = 1.0f;
+static const float DEFAULT_GPU_COST_MS = 0.3f;
+
+//	Weight of the latest timing in the running average
+static const float COST_SMOOTHING = 0.1f;
+
+static const float MOTION_WEIGHT = 1.0f;
+static const float LIGHT_CHANGE_WEIGHT = 4.0f;
+
+void addLightPropagationScheduler(uint32_t cascadeCount, LightPropagationScheduler** ppScheduler)
+{
+    LightPropagationScheduler* pScheduler = (LightPropagationScheduler*)aura::alloc(sizeof(*pScheduler));
+
+    pScheduler->mCascadeCount = cascadeCount;
+    pScheduler->mUpdateMask = 0;
+    pScheduler->pCascadeStats = (CascadeUpdateStats*)aura::alloc(cascadeCount * sizeof(*pScheduler->pCascadeStats));
+
+    for (uint32_t i = 0; i < cascadeCount; ++i)
+    {
+        CascadeUpdateStats& stats = pScheduler->pCascadeStats[i];
+        stats.mLastUpdateCenter = vec3(0.0f);
+        stats.mPendingLightChange = 0.0f;
+        stats.mCPUCostMs = DEFAULT_CPU_COST_MS;
+        stats.mGPUCostMs = DEFAULT_GPU_COST_MS;
+        stats.mFramesSinceUpdate = 0;
+        stats.bEverUpdated = false;
+    }
+
+    *ppScheduler = pScheduler;
+}
+
+void removeLightPropagationScheduler(LightPropagationScheduler* pScheduler)
+{
+    aura::dealloc(pScheduler->pCascadeStats);
+    aura::dealloc(pScheduler);
+}
+
+static float getUpdatePriority(const CascadeUpdateStats& stats, const CascadeUpdateRequest& request)
+{
+    const float urgency = 1.0f + MOTION_WEIGHT * request.mMotionCells + LIGHT_CHANGE_WEIGHT * stats.mPendingLightChange;
+
+    //	Aging makes sure low priority cascades still get their turn
+    return request.mDistanceWeight * urgency * (1.0f + (float)stats.mFramesSinceUpdate);
+}
+
+static bool fitsBudget(float used, float cost, float budget) { return budget <= 0.0f || used + cost <= budget; }
+
+uint32_t scheduleCascadeUpdates(LightPropagationScheduler* pScheduler, const UpdateSchedulerParams& params,
+                                const CascadeUpdateRequest* pRequests, uint32_t maxCascadesPerFrame, uint32_t blockedMask)
+{
+    const uint32_t cascadeCount = pScheduler->mCascadeCount;
+    const uint32_t maxFramesBetweenUpdates =
+        params.iMaxFramesBetweenUpdates ? params.iMaxFramesBetweenUpdates : DEFAULT_MAX_FRAMES_BETWEEN_UPDATES;
+
+    if (!maxCascadesPerFrame || maxCascadesPerFrame > cascadeCount)
+        maxCascadesPerFrame = cascadeCount;
+
+    //	Sort cascades by priority. Cascade count is tiny, insertion sort is fine.
+    uint32_t* pOrder = (uint32_t*)alloca(cascadeCount * sizeof(uint32_t));
+    float*    pPriority = (float*)alloca(cascadeCount * sizeof(float));
+    for (uint32_t i = 0; i < cascadeCount; ++i)
+    {
+        pPriority[i] = getUpdatePriority(pScheduler->pCascadeStats[i], pRequests[i]);
+
+        uint32_t j = i;
+        for (; j > 0 && pPriority[pOrder[j - 1]] < pPriority[i]; --j)
+            pOrder[j] = pOrder[j - 1];
+        pOrder[j] = i;
+    }
+
+    uint32_t mask = 0;
+    uint32_t count = 0;
+    float    cpuUsed = 0.0f;
+    float    gpuUsed = 0.0f;
+
+    //	Starving cascades go first and ignore the budget
+    for (uint32_t i = 0; i < cascadeCount && count < maxCascadesPerFrame; ++i)
+    {
+        const uint32_t            cascade = pOrder[i];
+        const CascadeUpdateStats& stats = pScheduler->pCascadeStats[cascade];
+        if ((blockedMask & (0x0001 << cascade)) || (stats.bEverUpdated && stats.mFramesSinceUpdate < maxFramesBetweenUpdates))
+            continue;
+
+        mask |= (0x0001 << cascade);
+        cpuUsed += stats.mCPUCostMs;
+        gpuUsed += stats.mGPUCostMs;
+        ++count;
+    }
+
+    for (uint32_t i = 0; i < cascadeCount && count < maxCascadesPerFrame; ++i)
+    {
+        const uint32_t            cascade = pOrder[i];
+        const CascadeUpdateStats& stats = pScheduler->pCascadeStats[cascade];
+        if ((mask | blockedMask) & (0x0001 << cascade))
+            continue;
+
+        //	Always update at least one cascade per frame
+        if (count && (!fitsBudget(cpuUsed, stats.mCPUCostMs, params.fCPUBudgetMs) ||
+                      !fitsBudget(gpuUsed, stats.mGPUCostMs, params.fGPUBudgetMs)))
+            continue;
+
+        mask |= (0x0001 << cascade);
+        cpuUsed += stats.mCPUCostMs;
+        gpuUsed += stats.mGPUCostMs;
+        ++count;
+    }
+
+    //	Blocked cascades are still being worked on, they do not age
+    for (uint32_t i = 0; i < cascadeCount; ++i)
+    {
+        if (!((mask | blockedMask) & (0x0001 << i)))
+            ++pScheduler->pCascadeStats[i].mFramesSinceUpdate;
+    }
+
+    pScheduler->mUpdateMask = mask;
+    return mask;
+}
+
+void commitCascadeUpdate(LightPropagationScheduler* pScheduler, uint32_t cascade, const vec3& center)
+{
+    CascadeUpdateStats& stats = pScheduler->pCascadeStats[cascade];
+    stats.mLastUpdateCenter = center;
+    stats.mPendingLightChange = 0.0f;
+    stats.mFramesSinceUpdate = 0;
+    stats.bEverUpdated = true;
+}
+
+void notifyCascadeLightChange(LightPropagationScheduler* pScheduler, uint32_t cascade, float amount)
+{
+    pScheduler->pCascadeStats[cascade].mPendingLightChange += amount;
+}
+
+void reportCascadeUpdateCost(LightPropagationScheduler* pScheduler, uint32_t cascade, float cpuMs, float gpuMs)
+{
+    CascadeUpdateStats& stats = pScheduler->pCascadeStats[cascade];
+
+    if (cpuMs >= 0.0f)
+        stats.mCPUCostMs = lerp(stats.mCPUCostMs, cpuMs, COST_SMOOTHING);
+    if (gpuMs >= 0.0f)
+        stats.mGPUCostMs = lerp(stats.mGPUCostMs, gpuMs, COST_SMOOTHING);
+}
+} // namespace aura
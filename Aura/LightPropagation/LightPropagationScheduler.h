@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../Config/AuraParams.h"
+#include "../Math/AuraVector.h"
+
+namespace aura
+{
+struct CascadeUpdateRequest
+{
+    float mMotionCells;    //	How far the cascade wants to move since its last update, in cells
+    float mDistanceWeight; //	Importance of the cascade for the current view, 1 is the most important
+};
+
+typedef struct CascadeUpdateStats
+{
+    vec3     mLastUpdateCenter;
+    float    mPendingLightChange;
+    float    mCPUCostMs;
+    float    mGPUCostMs;
+    uint32_t mFramesSinceUpdate;
+    bool     bEverUpdated;
+} CascadeUpdateStats;
+
+typedef struct LightPropagationScheduler
+{
+    CascadeUpdateStats* pCascadeStats;
+    uint32_t            mCascadeCount;
+    uint32_t            mUpdateMask;
+} LightPropagationScheduler;
+
+void addLightPropagationScheduler(uint32_t cascadeCount, LightPropagationScheduler** ppScheduler);
+void removeLightPropagationScheduler(LightPropagationScheduler* pScheduler);
+
+//	Ranks the cascades and picks as many as fit into the CPU and GPU budgets.
+//	Cascades which were not updated for too long are always picked, unless they are in blockedMask.
+uint32_t scheduleCascadeUpdates(LightPropagationScheduler* pScheduler, const UpdateSchedulerParams& params,
+                                const CascadeUpdateRequest* pRequests, uint32_t maxCascadesPerFrame, uint32_t blockedMask);
+void     commitCascadeUpdate(LightPropagationScheduler* pScheduler, uint32_t cascade, const vec3& center);
+
+void notifyCascadeLightChange(LightPropagationScheduler* pScheduler, uint32_t cascade, float amount);
+//	Negative values leave the corresponding estimate untouched
+void reportCascadeUpdateCost(LightPropagationScheduler* pScheduler, uint32_t cascade, float cpuMs, float gpuMs);
+} // namespace aura
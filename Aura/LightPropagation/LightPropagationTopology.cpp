@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "LightPropagationTopology.h"
+
+#include <string.h>
+
+#include "../../../The-Forge/Common_3/Utilities/Threading/Atomics.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+namespace aura
+{
+#if defined(__linux__)
+static const uint32_t MAX_TOPOLOGY_NODES = 64;
+static const uint32_t MAX_CACHE_INDEX = 8;
+
+//	Parses lists like "0-7,16-23" into the mask. Returns false if the file is missing.
+static bool readCPUList(const char* path, uint64_t* pMask)
+{
+    FILE* pFile = fopen(path, "r");
+    if (!pFile)
+        return false;
+
+    char line[1024] = {};
+    const bool bRead = fgets(line, sizeof(line), pFile) != NULL;
+    fclose(pFile);
+    if (!bRead)
+        return false;
+
+    memset(pMask, 0, MAX_TOPOLOGY_CPUS / 8);
+    for (const char* p = line; *p >= '0' && *p <= '9';)
+    {
+        char*               pEnd = NULL;
+        const unsigned long first = strtoul(p, &pEnd, 10);
+        unsigned long       last = first;
+        if (*pEnd == '-')
+            last = strtoul(pEnd + 1, &pEnd, 10);
+
+        for (unsigned long cpu = first; cpu <= last && cpu < MAX_TOPOLOGY_CPUS; ++cpu)
+            pMask[cpu / 64] |= 1ull << (cpu % 64);
+
+        p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+    }
+
+    return true;
+}
+
+static bool readUInt(const char* path, uint32_t* pValue)
+{
+    FILE* pFile = fopen(path, "r");
+    if (!pFile)
+        return false;
+
+    const bool bRead = fscanf(pFile, "%u", pValue) == 1;
+    fclose(pFile);
+    return bRead;
+}
+
+static uint32_t countCPUs(const uint64_t* pMask)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < MAX_TOPOLOGY_CPUS; ++i)
+        count += (pMask[i / 64] >> (i % 64)) & 1;
+    return count;
+}
+
+//	Every CPU of the node is put into the domain of its last level cache. Nodes without cache information
+//	become a single domain.
+static void readCPUTopology(CPUTopology* pTopology)
+{
+    char path[256];
+
+    for (uint32_t node = 0; node < MAX_TOPOLOGY_NODES && pTopology->mDomainCount < MAX_TOPOLOGY_DOMAINS; ++node)
+    {
+        uint64_t nodeMask[MAX_TOPOLOGY_CPUS / 64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        if (!readCPUList(path, nodeMask) || !countCPUs(nodeMask))
+            continue;
+
+        ++pTopology->mNodeCount;
+
+        uint64_t remaining[MAX_TOPOLOGY_CPUS / 64];
+        memcpy(remaining, nodeMask, sizeof(remaining));
+
+        for (uint32_t cpu = 0; cpu < MAX_TOPOLOGY_CPUS && pTopology->mDomainCount < MAX_TOPOLOGY_DOMAINS; ++cpu)
+        {
+            if (!(remaining[cpu / 64] & (1ull << (cpu % 64))))
+                continue;
+
+            CPUDomain& domain = pTopology->mDomains[pTopology->mDomainCount++];
+            domain.mNode = node;
+            memcpy(domain.mCPUMask, remaining, sizeof(remaining));
+
+            //	The highest cache level reported for the CPU wins
+            uint32_t bestLevel = 0;
+            for (uint32_t index = 0; index < MAX_CACHE_INDEX; ++index)
+            {
+                uint32_t level = 0;
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, index);
+                if (!readUInt(path, &level) || level <= bestLevel)
+                    continue;
+
+                uint64_t cacheMask[MAX_TOPOLOGY_CPUS / 64];
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", cpu, index);
+                if (!readCPUList(path, cacheMask))
+                    continue;
+
+                bestLevel = level;
+                for (uint32_t i = 0; i < MAX_TOPOLOGY_CPUS / 64; ++i)
+                    domain.mCPUMask[i] = cacheMask[i] & remaining[i];
+            }
+
+            //	The CPU itself is always part of its domain, even if the cache lists disagree with the node list
+            domain.mCPUMask[cpu / 64] |= 1ull << (cpu % 64);
+            for (uint32_t i = 0; i < MAX_TOPOLOGY_CPUS / 64; ++i)
+                remaining[i] &= ~domain.mCPUMask[i];
+            domain.mCPUCount = countCPUs(domain.mCPUMask);
+        }
+    }
+}
+#endif
+
+static CPUTopology* createCPUTopology()
+{
+    static CPUTopology topology;
+    memset(&topology, 0, sizeof(topology));
+
+#if defined(__linux__)
+    readCPUTopology(&topology);
+#endif
+
+    if (!topology.mDomainCount)
+    {
+        topology.mNodeCount = 1;
+        topology.mDomainCount = 1;
+    }
+
+    return &topology;
+}
+
+const CPUTopology* getCPUTopology()
+{
+    //	Thread safe, initialized on first use
+    static const CPUTopology* pTopology = createCPUTopology();
+    return pTopology;
+}
+
+uint32_t assignPropagationDomain()
+{
+    static tfrg_atomic32_t nextDomain = 0;
+    return tfrg_atomic32_add_relaxed(&nextDomain, 1) % getCPUTopology()->mDomainCount;
+}
+} // namespace aura
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace aura
+{
+static const uint32_t MAX_TOPOLOGY_CPUS = 256;
+static const uint32_t MAX_TOPOLOGY_DOMAINS = 32;
+
+//	CPUs sharing a last level cache, all of them on one NUMA node
+typedef struct CPUDomain
+{
+    uint64_t mCPUMask[MAX_TOPOLOGY_CPUS / 64];
+    uint32_t mCPUCount;
+    uint32_t mNode;
+} CPUDomain;
+
+typedef struct CPUTopology
+{
+    uint32_t  mNodeCount;
+    uint32_t  mDomainCount;
+    CPUDomain mDomains[MAX_TOPOLOGY_DOMAINS];
+} CPUTopology;
+
+//	Read from /sys/devices/system once. One domain with no CPUs where the topology is unknown, e.g. outside of Linux.
+const CPUTopology* getCPUTopology();
+
+//	Round robin over the domains, shared by all the Aura instances of the process so that their cascades spread out
+uint32_t assignPropagationDomain();
+
+inline bool isCPUInDomain(const CPUDomain& domain, uint32_t cpu)
+{
+    return cpu < MAX_TOPOLOGY_CPUS && (domain.mCPUMask[cpu / 64] & (1ull << (cpu % 64))) != 0;
+}
+} // namespace aura
@@ -10,6 +10,8 @@
 
 #include "LightPropagationVolume.h"
 
+#include "../../../The-Forge/Common_3/Utilities/Interfaces/ITime.h"
+
 #include "../Math/AuraVector.h"
 
 using aura::float4;
@@ -26,13 +28,16 @@ using aura::float4;
 #include "../Shaders/FSL/lpvSHMaths.h"
 
 #include "LightPropagationGrid.h"
+#include "LightPropagationTopology.h"
 
 static const int QuadVertexCount = 6;
+//	Readback slots per cascade until the observed GPU latency asks for more
+static const uint32_t READBACK_INITIAL_SLOTS = 2;
+
+static_assert(MAX_CASCADE_COUNT == LPV_MAX_CASCADES, "Cascade count limit must match the apply shader bindings");
 
 namespace aura
 {
-Aura* pAura = NULL;
-
 float getCellSize(LightPropagationCascade* pCascade) { return pCascade->mGridSpan / GridRes; }
 
 float getSideHalf(LightPropagationCascade* pCascade) { return pCascade->mGridSpan / 2.0f; }
@@ -95,7 +100,14 @@ void setGridCenter(LightPropagationCascade* pCascade, vec3 gridCenter)
                                                  .xyz();
 }
 
-void beginFrame(LightPropagationCascade* pCascade, const vec3& camPos, const vec3& camDir)
+vec3 getGridCenter(LightPropagationCascade* pCascade)
+{
+    return (pCascade->mInjectState.mGridToWorld * float4(0.5f, 0.5f, 0.5f, 1.0f)).xyz();
+}
+
+bool isGridMoving(LightPropagationCascade* pCascade) { return !(pCascade->mFlags & CASCADE_NOT_MOVING); }
+
+vec3 getGridTargetCenter(LightPropagationCascade* pCascade, const vec3& camPos, const vec3& camDir)
 {
     const float cellSize = getCellSize(pCascade);
     const float sideHalf = getSideHalf(pCascade);
@@ -108,8 +120,14 @@ void beginFrame(LightPropagationCascade* pCascade, const vec3& camPos, const vec
     // offset *= (sideHalf-8*cellSize);
     //	Leave some cells behind to allow light behind the camera to propagate forward
     offset *= (sideHalf - 4 * cellSize);
-    if ((!pCascade->mFlags) & CASCADE_NOT_MOVING)
-        setGridCenter(pCascade, camPos + offset);
+
+    return camPos + offset;
+}
+
+void beginFrame(LightPropagationCascade* pCascade, const vec3& camPos, const vec3& camDir)
+{
+    if (isGridMoving(pCascade))
+        setGridCenter(pCascade, getGridTargetCenter(pCascade, camPos, camDir));
 
     pCascade->mOccludersInjected = false;
 }
@@ -120,7 +138,7 @@ void beginFrame(LightPropagationCascade* pCascade, const vec3& camPos, const vec
 void initAura(Renderer* pRenderer, uint32_t rtWidth, uint32_t rtHeight, LightPropagationVolumeParams params, uint32_t inFlightFrameCount,
               uint32_t cascadeCount, LightPropagationCascadeDesc* pCascades, Aura** ppAura)
 {
-    pAura = (Aura*)aura::alloc(sizeof(*pAura));
+    Aura* pAura = (Aura*)aura::alloc(sizeof(*pAura));
     memset(pAura, 0, sizeof(*pAura));
 
     pAura->mParams = params;
@@ -131,14 +149,23 @@ void initAura(Renderer* pRenderer, uint32_t rtWidth, uint32_t rtHeight, LightPro
     pAura->mInFlightFrameCount = inFlightFrameCount;
 #endif
 
+    ASSERT(cascadeCount > 0 && cascadeCount <= MAX_CASCADE_COUNT);
+
     pAura->mCascadeCount = cascadeCount;
+    pAura->mEnabledCascadeMask = (0x0001 << cascadeCount) - 1;
     pAura->pCascades = (LightPropagationCascade**)aura::alloc(pAura->mCascadeCount * sizeof(*pAura->pCascades));
     for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
         addLightPropagationCascade(pAura->pRenderer, pCascades[i].mGridSpan, pCascades[i].mGridIntensity, pCascades[i].mFlags,
                                    &pAura->pCascades[i]);
+
+        if (pCascades[i].mFlags & CASCADE_NOT_MOVING)
+            setGridCenter(pAura->pCascades[i], pCascades[i].mCenter);
     }
 
+    addLightPropagationScheduler(pAura->mCascadeCount, &pAura->pScheduler);
+    addLightPropagationVoxelizer(pAura->mCascadeCount, &pAura->pVoxelizer);
+
     for (uint32_t i = 0; i < 6; ++i)
         addLightPropagationGrid(pAura->pRenderer, &pAura->pWorkingGrids[i], "LPV Working Grid RT");
         /************************************************************************/
@@ -153,7 +180,6 @@ void initAura(Renderer* pRenderer, uint32_t rtWidth, uint32_t rtHeight, LightPro
 #ifdef ENABLE_CPU_PROPAGATION
     pAura->mCPUPropagationCurrentContext = -2;
 #endif
-    pAura->mGPUPropagationCurrentGrid = 0;
     pAura->mParams.bDebugLight = false;
     pAura->mParams.bDebugOccluder = false;
     /************************************************************************/
@@ -190,23 +216,58 @@ void initAura(Renderer* pRenderer, uint32_t rtWidth, uint32_t rtHeight, LightPro
         ubDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
         ubDesc.mSize = sizeof(VisualizationData);
         addBuffer(pRenderer, &ubDesc, &pAura->pUniformBufferVisualizationData[i]);
+
+        BufferDesc sbDesc = {};
+        sbDesc.mDescriptors = (::DescriptorType)(DESCRIPTOR_TYPE_BUFFER);
+        sbDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+        sbDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        sbDesc.mStructStride = sizeof(LightApplyCascadeData);
+        sbDesc.mElementCount = MAX_CASCADE_COUNT;
+        sbDesc.mSize = sbDesc.mStructStride * sbDesc.mElementCount;
+        sbDesc.pName = "LPV Light Apply Cascades";
+        addBuffer(pRenderer, &sbDesc, &pAura->pBufferLightApplyCascades[i]);
     }
 
     *ppAura = pAura;
 }
 
+#ifdef ENABLE_CPU_PROPAGATION
+void loadReadbackSlot(Renderer* pRenderer, Aura* pAura, uint32_t slot)
+{
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+    {
+        pAura->m_CPUContexts[i][slot].load(pRenderer, pAura->pCascades[0]->pLightGrids);
+        pAura->m_CPUContexts[i][slot].setSHL2Propagation((pAura->pCascades[i]->mFlags & CASCADE_SH_L2_PROPAGATION) != 0);
+        pAura->m_CPUContexts[i][slot].setDomain(pAura->mCascadeDomains[i]);
+    }
+}
+#endif
+
 void loadCPUPropagationResources(Renderer* pRenderer, Aura* pAura)
 {
 #ifdef ENABLE_CPU_PROPAGATION
     pAura->m_CPUContexts = (LightPropagationCPUContext**)aura::alloc(pAura->mCascadeCount * sizeof(LightPropagationCPUContext*));
     for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
-        pAura->m_CPUContexts[i] = (LightPropagationCPUContext*)aura::alloc(NUM_GRIDS_PER_CASCADE * sizeof(LightPropagationCPUContext));
-        for (uint32_t j = 0; j < NUM_GRIDS_PER_CASCADE; ++j)
-        {
-            pAura->m_CPUContexts[i][j].load(pRenderer, pAura->pCascades[0]->pLightGrids);
-        }
+        pAura->m_CPUContexts[i] = (LightPropagationCPUContext*)aura::alloc(MAX_READBACK_SLOTS * sizeof(LightPropagationCPUContext));
+        pAura->pLastAppliedContexts[i] = NULL;
+        pAura->mCascadeDomains[i] = assignPropagationDomain();
     }
+
+    //	Enough when the fence is signalled within a frame, grows when the GPU lags behind
+    pAura->mReadbackSlotCount = READBACK_INITIAL_SLOTS;
+    for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
+        loadReadbackSlot(pRenderer, pAura, j);
+
+#ifdef AURA_DETERMINISM_TEST_WORKERS
+    const bool bDeterministic = verifyCPUPropagationDeterminism(pAura, AURA_DETERMINISM_TEST_WORKERS);
+    ASSERT(bDeterministic && "The CPU propagation differs between task splits or worker counts");
+
+    //	Without the coarse grid the far field would be missing entirely: error 1, energy 0. The measured values are 0.85 and 0.76.
+    float       farEnergy = 0.0f;
+    const float farError = compareCPUCoarseToFine(pAura, 12, &farEnergy);
+    ASSERT(farError < 0.95f && farEnergy > 0.6f && farEnergy < 1.25f && "The coarse to fine propagation lost the far field");
+#endif
 #endif
 }
 
@@ -215,7 +276,7 @@ void unloadCPUPropagationResources(Renderer* pRenderer, ITaskManager* pTaskManag
 #ifdef ENABLE_CPU_PROPAGATION
     for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
-        for (uint32_t j = 0; j < NUM_GRIDS_PER_CASCADE; ++j)
+        for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
         {
             pAura->m_CPUContexts[i][j].unload(pRenderer, pTaskManager);
         }
@@ -227,6 +288,64 @@ void unloadCPUPropagationResources(Renderer* pRenderer, ITaskManager* pTaskManag
 #endif
 }
 
+void tuneCPUPropagation(Aura* pAura, ITaskManager* pTaskManager)
+{
+#ifdef ENABLE_CPU_PROPAGATION
+    PropagationPartition* pPartition = &pAura->mPropagationPartition;
+    const uint32_t        workerCount = pTaskManager ? pTaskManager->getWorkerCount() : 0;
+    if (pPartition->bTuned && pPartition->mWorkerCount == workerCount)
+        return;
+
+    //	Any context will do, the tuning only borrows its domain
+    pAura->m_CPUContexts[0][0].tunePartition(pTaskManager, pPartition);
+#endif
+}
+
+bool verifyCPUPropagationDeterminism(Aura* pAura, uint32_t maxWorkerCount)
+{
+#ifdef ENABLE_CPU_PROPAGATION
+    //	A pool per worker count: the order in which workers pick up the tasks must not show in the result either
+    ITaskManager** ppTaskManagers = (ITaskManager**)aura::alloc(max(maxWorkerCount, 1u) * sizeof(ITaskManager*));
+    for (uint32_t i = 0; i < maxWorkerCount; ++i)
+        initTaskManager(&ppTaskManagers[i], i + 1);
+
+    //	A context of its own, the ones of the cascades may hold light waiting for propagation
+    LightPropagationCPUContext* pContext = (LightPropagationCPUContext*)aura::alloc(sizeof(LightPropagationCPUContext));
+    pContext->load(pAura->pRenderer, pAura->pCascades[0]->pLightGrids);
+
+    const bool bIdentical = pContext->verifyDeterminism(ppTaskManagers, maxWorkerCount);
+
+    //	Every task of the check was waited for, nothing is left for the unload to sync with
+    pContext->unload(pAura->pRenderer, NULL);
+    aura::dealloc(pContext);
+
+    for (uint32_t i = 0; i < maxWorkerCount; ++i)
+        removeTaskManager(ppTaskManagers[i]);
+    aura::dealloc(ppTaskManagers);
+    return bIdentical;
+#else
+    return true;
+#endif
+}
+
+float compareCPUCoarseToFine(Aura* pAura, int stepCount, float* pFarEnergy)
+{
+#ifdef ENABLE_CPU_PROPAGATION
+    LightPropagationCPUContext* pContext = (LightPropagationCPUContext*)aura::alloc(sizeof(LightPropagationCPUContext));
+    pContext->load(pAura->pRenderer, pAura->pCascades[0]->pLightGrids);
+
+    const float farError = pContext->compareCoarseToFine(stepCount, pFarEnergy);
+
+    pContext->unload(pAura->pRenderer, NULL);
+    aura::dealloc(pContext);
+    return farError;
+#else
+    if (pFarEnergy)
+        *pFarEnergy = 1.0f;
+    return 0.0f;
+#endif
+}
+
 void exitAura(Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura)
 {
     /************************************************************************/
@@ -242,6 +361,7 @@ void exitAura(Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura)
         aura::dealloc(pAura->pUniformBufferInjectRSM[i]);
 
         removeBuffer(pRenderer, pAura->pUniformBufferVisualizationData[i]);
+        removeBuffer(pRenderer, pAura->pBufferLightApplyCascades[i]);
     }
 
     /************************************************************************/
@@ -264,6 +384,9 @@ void exitAura(Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura)
     for (uint32_t i = 0; i < 6; ++i)
         removeLightPropagationGrid(pAura->pRenderer, pAura->pWorkingGrids[i]);
 
+    removeLightPropagationScheduler(pAura->pScheduler);
+    removeLightPropagationVoxelizer(pAura->pVoxelizer);
+
     aura::dealloc(pAura->pCascades);
     aura::dealloc(pAura);
 }
@@ -277,51 +400,239 @@ bool doAlternateGPUUpdates(Aura* pAura)
     );
 }
 
+bool isCascadeScheduled(Aura* pAura, uint32_t cascade) { return (pAura->pScheduler->mUpdateMask & (0x0001 << cascade)) != 0; }
+
+#ifdef ENABLE_CPU_PROPAGATION
+//	Returns the context of the cascade in the middle of a sliced propagation
+LightPropagationCPUContext* getPropagatingContext(Aura* pAura, uint32_t cascade)
+{
+    for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
+    {
+        if (LightPropagationCPUContext::PROPAGATING_LIGHT == pAura->m_CPUContexts[cascade][j].eState)
+            return &pAura->m_CPUContexts[cascade][j];
+    }
+
+    return NULL;
+}
+
+//	Seeds the border of the cascade from the next coarser enabled cascade, if its last propagated light is still around
+void setBorderSeed(Aura* pAura, uint32_t cascade, LightPropagationCPUContext* pContext)
+{
+    const LightPropagationCascade* pFine = pAura->pCascades[cascade];
+
+    int coarse = -1;
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+    {
+        if (!(pAura->mEnabledCascadeMask & (0x0001 << i)) || pAura->pCascades[i]->mGridSpan <= pFine->mGridSpan)
+            continue;
+        if (coarse < 0 || pAura->pCascades[i]->mGridSpan < pAura->pCascades[coarse]->mGridSpan)
+            coarse = (int)i;
+    }
+
+    if (coarse < 0 || !pAura->pLastAppliedContexts[coarse] || pAura->mParams.fLightScale[cascade] <= 0.0f)
+        return;
+
+    //	The last applied slot is not captured into again, see getFreeReadbackSlot, so its grids and its placement still match
+    const LightPropagationCPUContext* pCoarse = pAura->pLastAppliedContexts[coarse];
+    if (LightPropagationCPUContext::APPLIED_PROPAGATION != pCoarse->eState)
+        return;
+
+    //	Same light after applying both cascades with their light scales
+    float lightScale = pAura->mParams.fLightScale[coarse] / pAura->mParams.fLightScale[cascade];
+#ifdef PRESCALE_LIGHT_VALUES
+    lightScale *= pFine->mGridIntensity / pAura->pCascades[coarse]->mGridIntensity;
+#endif //	PRESCALE_LIGHT_VALUES
+
+    pContext->setBorderSeed(pCoarse, lightScale);
+}
+
+//	Returns NULL when the ring is full and at its maximum depth, the cascade then skips the capture.
+//	The last applied slot is kept, the finer cascades seed their borders from it.
+LightPropagationCPUContext* getFreeReadbackSlot(Renderer* pRenderer, Aura* pAura, uint32_t cascade)
+{
+    for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
+    {
+        LightPropagationCPUContext* pContext = &pAura->m_CPUContexts[cascade][j];
+        if (LightPropagationCPUContext::APPLIED_PROPAGATION == pContext->eState && pAura->pLastAppliedContexts[cascade] != pContext)
+            return pContext;
+    }
+
+    if (pAura->mReadbackSlotCount == MAX_READBACK_SLOTS)
+        return NULL;
+
+    //	The GPU takes longer than the ring covers. Slots are never shrunk, the GPU may still be writing to them.
+    loadReadbackSlot(pRenderer, pAura, pAura->mReadbackSlotCount);
+    return &pAura->m_CPUContexts[cascade][pAura->mReadbackSlotCount++];
+}
+
+//	The injection of a scheduled cascade replaces the light in its grids. Puts the last propagated light back in the
+//	frame being recorded when no newer result is applied. Frames the cascade is not scheduled in keep the grids as they
+//	are, and the texels were packed by the apply, so the restore is only a copy.
+void restoreAppliedLight(Cmd* pCmd, Aura* pAura, uint32_t cascade)
+{
+    LightPropagationCPUContext* pContext = pAura->pLastAppliedContexts[cascade];
+    if (!isCascadeScheduled(pAura, cascade) || !pContext)
+        return;
+
+    pContext->reapplyData(pCmd, pAura->pCascades[cascade]->pLightGrids);
+    pAura->pCascades[cascade]->mApplyState = pContext->getApplyState();
+}
+
+//	Newest capture the GPU is done with. Older complete captures are stale and dropped.
+LightPropagationCPUContext* getCompleteReadbackSlot(Renderer* pRenderer, Aura* pAura, uint32_t cascade)
+{
+    LightPropagationCPUContext* pNewest = NULL;
+    for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
+    {
+        LightPropagationCPUContext* pContext = &pAura->m_CPUContexts[cascade][j];
+        if (LightPropagationCPUContext::CAPTURED_LIGHT != pContext->eState ||
+            !pContext->isReadbackComplete(pRenderer, pAura->mFrameCounter, pAura->mInFlightFrameCount))
+            continue;
+
+        if (pNewest && pNewest->getCaptureFrame() > pContext->getCaptureFrame())
+        {
+            pContext->eState = LightPropagationCPUContext::APPLIED_PROPAGATION;
+            continue;
+        }
+
+        if (pNewest)
+            pNewest->eState = LightPropagationCPUContext::APPLIED_PROPAGATION;
+        pNewest = pContext;
+    }
+
+    return pNewest;
+}
+#endif
+
+//	Cascades which can not take new light this frame. The grids keep the last propagated light until
+//	the sliced CPU propagation of the cascade finishes.
+uint32_t getBusyCascadesMask(Aura* pAura)
+{
+    uint32_t mask = 0;
+#ifdef ENABLE_CPU_PROPAGATION
+    if (pAura->mParams.bUseCPUPropagation && pAura->bUseCPUPropagationPreviousFrame)
+    {
+        for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+        {
+            if (getPropagatingContext(pAura, i))
+                mask |= (0x0001 << i);
+        }
+    }
+#endif
+    return mask;
+}
+
 void beginFrame(Renderer* pRenderer, Aura* pAura, const vec3& camPos, const vec3& camDir)
 {
-    if (doAlternateGPUUpdates(pAura))
+    CascadeUpdateRequest* pRequests = (CascadeUpdateRequest*)alloca(pAura->mCascadeCount * sizeof(CascadeUpdateRequest));
+    vec3*                 pCenters = (vec3*)alloca(pAura->mCascadeCount * sizeof(vec3));
+
+    float minGridSpan = FLT_MAX;
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+        minGridSpan = min(minGridSpan, pAura->pCascades[i]->mGridSpan);
+
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
-        pAura->mGPUPropagationCurrentGrid = (pAura->mGPUPropagationCurrentGrid + 1) % pAura->mCascadeCount;
+        LightPropagationCascade* pCascade = pAura->pCascades[i];
 
-        beginFrame(pAura->pCascades[pAura->mGPUPropagationCurrentGrid], camPos, camDir);
+        pCenters[i] = isGridMoving(pCascade) ? getGridTargetCenter(pCascade, camPos, camDir) : getGridCenter(pCascade);
+
+        //	Fine cascades and cascades close to the camera matter the most
+        const Box   bounds = getGridBounds(pCascade, identity4());
+        const vec3  closest = clamp(camPos, bounds.vMin, bounds.vMax);
+        const float distance = length(camPos - closest);
+
+        pRequests[i].mMotionCells = length(pCenters[i] - pAura->pScheduler->pCascadeStats[i].mLastUpdateCenter) / getCellSize(pCascade);
+        pRequests[i].mDistanceWeight = (minGridSpan / pCascade->mGridSpan) / (1.0f + distance / pCascade->mGridSpan);
     }
-    else
+
+    scheduleCascadeUpdates(pAura->pScheduler, pAura->mSchedulerParams, pRequests, doAlternateGPUUpdates(pAura) ? 1 : 0,
+                           getBusyCascadesMask(pAura) | ~pAura->mEnabledCascadeMask);
+
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
-        for (size_t i = 0; i < pAura->mCascadeCount; ++i)
-            beginFrame(pAura->pCascades[i], camPos, camDir);
+        if (!isCascadeScheduled(pAura, i))
+            continue;
+
+        beginFrame(pAura->pCascades[i], camPos, camDir);
+        commitCascadeUpdate(pAura->pScheduler, i, pCenters[i]);
     }
 }
 
-void endFrame(Renderer* pRenderer, Aura* pAura) { pAura->mFrameIdx = (pAura->mFrameIdx + 1) % MAX_FRAMES; }
+void endFrame(Renderer* pRenderer, Aura* pAura)
+{
+    pAura->mFrameIdx = (pAura->mFrameIdx + 1) % MAX_FRAMES;
+#ifdef ENABLE_CPU_PROPAGATION
+    ++pAura->mFrameCounter;
+#endif
+}
+
+void setReadbackFence(Aura* pAura, Fence* pFence)
+{
+#ifdef ENABLE_CPU_PROPAGATION
+    pAura->pReadbackFence = pFence;
+#endif
+}
 
 void setCascadeCenter(Aura* pAura, uint32_t Cascade, const vec3& center) { setGridCenter(pAura->pCascades[Cascade], center); }
 
+void setCascadeEnabled(Aura* pAura, uint32_t cascade, bool enabled)
+{
+    ASSERT(cascade < pAura->mCascadeCount);
+
+    if (enabled)
+        pAura->mEnabledCascadeMask |= (0x0001 << cascade);
+    else
+        pAura->mEnabledCascadeMask &= ~(0x0001 << cascade);
+}
+
 void getGridBounds(Aura* pAura, const mat4& worldToLocal, Box* bounds)
 {
     for (size_t i = 0; i < pAura->mCascadeCount; ++i)
         bounds[i] = getGridBounds(pAura->pCascades[i], worldToLocal);
 }
 
-uint32_t getCascadesToUpdateMask(Aura* pAura)
+uint32_t getCascadesToUpdateMask(Aura* pAura) { return pAura->pScheduler->mUpdateMask; }
+
+void notifyLightChange(Aura* pAura, uint32_t cascadeMask, float amount)
 {
-    if (doAlternateGPUUpdates(pAura))
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
     {
-        return (0x0001 << pAura->mGPUPropagationCurrentGrid);
+        if (cascadeMask & (0x0001 << i))
+            notifyCascadeLightChange(pAura->pScheduler, i, amount);
     }
-    else
-    {
-        uint32_t res = 0;
-        for (uint i = 0; i < pAura->mCascadeCount; ++i)
-            res += (0x0001 << i);
+}
+
+void reportCascadeGPUCost(Aura* pAura, uint32_t cascade, float gpuMs)
+{
+    //	Measured costs would make the update order depend on timings
+    if (pAura->mCPUParams.bDeterministic)
+        return;
+
+    reportCascadeUpdateCost(pAura->pScheduler, cascade, -1.0f, gpuMs);
+}
 
-        return res;
+void voxelizeOccluders(Aura* pAura, ITaskManager* pTaskManager, const OccluderMeshDesc* pMeshes, uint32_t meshCount)
+{
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+    {
+        if (isCascadeScheduled(pAura, i))
+            voxelizeCascadeOccluders(pAura->pVoxelizer, pTaskManager, i, pAura->pCascades[i]->mInjectState, pMeshes, meshCount);
     }
 }
 
+void invalidateOccluderCache(Aura* pAura) { invalidateStaticOccluders(pAura->pVoxelizer); }
+
+void setAnalyticLights(Aura* pAura, const AnalyticLightDesc* pLights, uint32_t lightCount)
+{
+    pAura->pAnalyticLights = pLights;
+    pAura->mAnalyticLightCount = lightCount;
+}
+
 void injectRSM(Cmd* pCmd, Renderer* pRenderer, Aura* pAura, uint32_t iVolume, const mat4& invVP, const vec3& camDir, uint32_t rtWidth,
                uint32_t rtHeight, float viewAreaForUnitDepth, Texture* baseRT, Texture* normalRT, Texture* depthRT)
 {
-    if (doAlternateGPUUpdates(pAura) && ((uint32_t)pAura->mGPUPropagationCurrentGrid != iVolume))
+    if (!isCascadeScheduled(pAura, iVolume))
         return;
 
     float RSMSurfelAreaScaleFactor = viewAreaForUnitDepth / (float)(rtWidth * rtHeight);
@@ -582,71 +893,123 @@ void propagateLight(Cmd* pCmd, Renderer* pRenderer, Aura* pAura, uint32_t cascad
 void propagateLight(Cmd* pCmd, Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura)
 {
 #ifdef ENABLE_CPU_PROPAGATION
+    //	Captures of an earlier CPU propagation period are outdated. Their copies may still be in flight,
+    //	so the slots are only released, not reloaded.
     if (pAura->bUseCPUPropagationPreviousFrame != pAura->mParams.bUseCPUPropagation && pAura->mParams.bUseCPUPropagation)
     {
-        unloadCPUPropagationResources(pRenderer, pTaskManager, pAura);
-        loadCPUPropagationResources(pRenderer, pAura);
+        for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+        {
+            for (uint32_t j = 0; j < pAura->mReadbackSlotCount; ++j)
+                pAura->m_CPUContexts[i][j].eState = LightPropagationCPUContext::APPLIED_PROPAGATION;
+            pAura->pLastAppliedContexts[i] = NULL;
+        }
     }
     pAura->bUseCPUPropagationPreviousFrame = pAura->mParams.bUseCPUPropagation;
 
     if (pAura->mParams.bUseCPUPropagation)
     {
-        int readIndex = pAura->mFrameIdx % pAura->mInFlightFrameCount;
-
         for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
         {
-            pAura->m_CPUContexts[i][readIndex].readData(pCmd, pRenderer, pAura->pCascades[i]->pLightGrids, NUM_GRIDS_PER_CASCADE);
-            pAura->m_CPUContexts[i][readIndex].setApplyState(pAura->pCascades[i]->mInjectState);
-            pAura->m_CPUContexts[i][readIndex].eState = LightPropagationCPUContext::CAPTURED_LIGHT;
+            if (!isCascadeScheduled(pAura, i))
+                continue;
+
+            LightPropagationCPUContext* pSlot = getFreeReadbackSlot(pRenderer, pAura, i);
+            if (!pSlot)
+                continue;
+
+            pSlot->readData(pCmd, pRenderer, pAura->pCascades[i]->pLightGrids, NUM_GRIDS_PER_CASCADE);
+            //	Fence polling picks up the light a timing dependent number of frames later
+            pSlot->setReadbackTag(pAura->mFrameCounter, pAura->mCPUParams.bDeterministic ? NULL : pAura->pReadbackFence);
+            pSlot->setApplyState(pAura->pCascades[i]->mInjectState);
+            pSlot->setOccluders(getCascadeOccluders(pAura->pVoxelizer, i));
+            pSlot->setAnalyticLights(pAura->pAnalyticLights, pAura->mAnalyticLightCount);
+            pSlot->eState = LightPropagationCPUContext::CAPTURED_LIGHT;
         }
 
-        int propagateIndex = (pAura->mFrameIdx - pAura->mInFlightFrameCount) % pAura->mInFlightFrameCount;
+        //	Set again every frame, a stale fence would tag the next captures
+        pAura->pReadbackFence = NULL;
+
+        //	Multiple reflections are part of the CPU propagation params on this side
+        CPUPropagationParams cpuParams = pAura->mCPUParams;
+        cpuParams.iBounceCount = pAura->mParams.bUseMultipleReflections ? max(cpuParams.iBounceCount, 1U) : 0;
+
+        //	With a budget the propagation is sliced across frames, all the cascades share the budget
+        const bool    bSliced = pAura->mCPUParams.fPropagationBudgetMs > 0.0f && !pAura->mCPUParams.bDeterministic;
+        const int64_t deadline = bSliced ? getUSec(false) + (int64_t)(pAura->mCPUParams.fPropagationBudgetMs * 1000.0f) : 0;
+
         for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
         {
-            if (LightPropagationCPUContext::CAPTURED_LIGHT == pAura->m_CPUContexts[i][propagateIndex].eState)
+            LightPropagationCPUContext* pContext = getPropagatingContext(pAura, i);
+            if (!pContext)
             {
-                pAura->m_CPUContexts[i][propagateIndex].processData(pRenderer, pTaskManager, pAura->mCPUParams.eMTMode);
-                pAura->m_CPUContexts[i][propagateIndex].eState = LightPropagationCPUContext::PROPAGATED_LIGHT;
+                pContext = getCompleteReadbackSlot(pRenderer, pAura, i);
+                if (!pContext)
+                {
+                    //	The captures of the cascade are still in flight
+                    restoreAppliedLight(pCmd, pAura, i);
+                    continue;
+                }
 
-                pAura->m_CPUContexts[i][propagateIndex].applyData(pCmd, pRenderer, pAura->pCascades[i]->pLightGrids);
-                pAura->pCascades[i]->mApplyState = pAura->m_CPUContexts[i][propagateIndex].getApplyState();
-                pAura->m_CPUContexts[i][propagateIndex].eState = LightPropagationCPUContext::APPLIED_PROPAGATION;
+                pContext->updatePartition(pTaskManager, &pAura->mPropagationPartition);
+                if (cpuParams.bSeedCascadeBorders)
+                    setBorderSeed(pAura, i, pContext);
+
+                if (bSliced)
+                {
+                    pContext->beginPropagation(pRenderer, pTaskManager, cpuParams);
+                }
+                else
+                {
+                    pContext->processData(pRenderer, pTaskManager, cpuParams);
+                    pContext->eState = LightPropagationCPUContext::PROPAGATED_LIGHT;
+                }
             }
+
+            if (!pContext)
+                continue;
+
+            //	Keep slicing even if the mode was switched off meanwhile, the context is already half way through
+            if (LightPropagationCPUContext::PROPAGATING_LIGHT == pContext->eState && !pContext->continuePropagation(deadline))
+            {
+                restoreAppliedLight(pCmd, pAura, i);
+                continue;
+            }
+
+            const int64_t startTime = getUSec(false);
+
+            pContext->applyData(pCmd, pRenderer, pAura->pCascades[i]->pLightGrids);
+            pAura->pCascades[i]->mApplyState = pContext->getApplyState();
+            pContext->eState = LightPropagationCPUContext::APPLIED_PROPAGATION;
+            pAura->pLastAppliedContexts[i] = pContext;
+
+            const float applyMs = (float)(getUSec(false) - startTime) / 1000.0f;
+            if (!pAura->mCPUParams.bDeterministic)
+                reportCascadeUpdateCost(pAura->pScheduler, i, pContext->getPropagationTimeMs() + applyMs, -1.0f);
         }
     }
     else
 #endif
     {
-        if (doAlternateGPUUpdates(pAura))
+        RenderTargetBarrier* pSrvBarriers =
+            (RenderTargetBarrier*)alloca(pAura->mCascadeCount * NUM_GRIDS_PER_CASCADE * sizeof(RenderTargetBarrier));
+        uint32_t srvBarrierCount = 0;
+        for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
         {
-            RenderTargetBarrier srvBarriers[NUM_GRIDS_PER_CASCADE] = {};
-            for (uint32_t i = 0; i < NUM_GRIDS_PER_CASCADE; ++i)
-            {
-                srvBarriers[i] = { pAura->pCascades[pAura->mGPUPropagationCurrentGrid]->pLightGrids[i], RESOURCE_STATE_RENDER_TARGET,
-                                   RESOURCE_STATE_SHADER_RESOURCE };
-            }
-            cmdResourceBarrier(pCmd, 0, NULL, 0, NULL, NUM_GRIDS_PER_CASCADE, srvBarriers);
+            if (!isCascadeScheduled(pAura, i))
+                continue;
 
-            propagateLight(pCmd, pRenderer, pAura, pAura->mGPUPropagationCurrentGrid);
-        }
-        else
-        {
-            RenderTargetBarrier* pSrvBarriers =
-                (RenderTargetBarrier*)alloca(pAura->mCascadeCount * NUM_GRIDS_PER_CASCADE * sizeof(RenderTargetBarrier));
-            for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+            for (uint32_t j = 0; j < NUM_GRIDS_PER_CASCADE; ++j)
             {
-                for (uint32_t j = 0; j < NUM_GRIDS_PER_CASCADE; ++j)
-                {
-                    pSrvBarriers[i * NUM_GRIDS_PER_CASCADE + j] = { pAura->pCascades[i]->pLightGrids[j], RESOURCE_STATE_RENDER_TARGET,
-                                                                    RESOURCE_STATE_SHADER_RESOURCE };
-                }
+                pSrvBarriers[srvBarrierCount++] = { pAura->pCascades[i]->pLightGrids[j], RESOURCE_STATE_RENDER_TARGET,
+                                                    RESOURCE_STATE_SHADER_RESOURCE };
             }
-            cmdResourceBarrier(pCmd, 0, NULL, 0, NULL, pAura->mCascadeCount * NUM_GRIDS_PER_CASCADE, pSrvBarriers);
+        }
+        cmdResourceBarrier(pCmd, 0, NULL, 0, NULL, srvBarrierCount, pSrvBarriers);
 
-            for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
-            {
+        for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+        {
+            if (isCascadeScheduled(pAura, i))
                 propagateLight(pCmd, pRenderer, pAura, i);
-            }
         }
     }
 }
@@ -657,21 +1020,29 @@ void getLightApplyData(Aura* pAura, const mat4& invVP, const vec3& camPos, Light
     data->invMvp = transpose(invVP);
     data->lumScale = float3(pAura->mParams.fFresnel, pAura->mParams.fSpecScale, pAura->mParams.fSpecPow);
     data->normalScale = float3(1.0f / GridRes);
-    data->cascadeCount = pAura->mCascadeCount;
     data->GIStrength = pAura->mParams.fGIStrength;
 
+    LightApplyCascadeData* pCascadeData =
+        (LightApplyCascadeData*)pAura->pBufferLightApplyCascades[pAura->mFrameIdx]->pCpuMappedAddress;
+    uint32_t cascadeCount = 0;
+
     for (uint32_t i = 0; i < pAura->mCascadeCount; i++)
     {
+        if (!(pAura->mEnabledCascadeMask & (0x0001 << i)))
+            continue;
+
         LightPropagationCascade* pCascade = pAura->pCascades[i];
+        LightApplyCascadeData    cascadeData = {};
         const float              cellSize = (pCascade->mGridSpan / GridRes);
 
-        data->cascade[i].WorldToGridScale = pCascade->mApplyState.mWorldToGridScale;
-        data->cascade[i].WorldToGridTranslate = pCascade->mApplyState.mWorldToGridTranslate;
-        data->cascade[i].cellFalloff = float4(1.0f / sqrf(cellSize * 0.5f), 1.0f / sqrf(cellSize * 0.75f),
-                                              1.0f / (cellSize), // 1.0f/sqrf(cellSize*1.0f),
-                                              1.0f / sqrf(cellSize * 1.5f));
-        data->cascade[i].lightScale = pAura->mParams.fLightScale[i];
-        data->cascade[i].smoothGridPosOffset = pCascade->mApplyState.mSmoothTCOffset;
+        cascadeData.WorldToGridScale = pCascade->mApplyState.mWorldToGridScale;
+        cascadeData.WorldToGridTranslate = pCascade->mApplyState.mWorldToGridTranslate;
+        cascadeData.cellFalloff = float4(1.0f / sqrf(cellSize * 0.5f), 1.0f / sqrf(cellSize * 0.75f),
+                                         1.0f / (cellSize), // 1.0f/sqrf(cellSize*1.0f),
+                                         1.0f / sqrf(cellSize * 1.5f));
+        cascadeData.lightScale = pAura->mParams.fLightScale[i];
+        cascadeData.smoothGridPosOffset = pCascade->mApplyState.mSmoothTCOffset;
+        memcpy(&pCascadeData[cascadeCount++], &cascadeData, sizeof(cascadeData));
 
         //	The 'fairest' falloffs. But not the best.
         /*data.cellFalloff = float4(
@@ -691,6 +1062,30 @@ void getLightApplyData(Aura* pAura, const mat4& invVP, const vec3& camPos, Light
         1.0f/sqrf(cellSize*1.5f));
         */
     }
+
+    data->cascadeCount = cascadeCount;
+}
+
+Buffer* getLightApplyCascadesBuffer(Aura* pAura) { return pAura->pBufferLightApplyCascades[pAura->mFrameIdx]; }
+
+uint32_t getLightGridTextures(Aura* pAura, Texture** ppTextures)
+{
+    uint32_t cascadeCount = 0;
+    for (uint32_t i = 0; i < pAura->mCascadeCount; ++i)
+    {
+        if (!(pAura->mEnabledCascadeMask & (0x0001 << i)))
+            continue;
+
+        for (uint32_t j = 0; j < NUM_GRIDS_PER_CASCADE; ++j)
+            ppTextures[cascadeCount * NUM_GRIDS_PER_CASCADE + j] = pAura->pCascades[i]->pLightGrids[j]->pTexture;
+        ++cascadeCount;
+    }
+
+    //	Every descriptor of the array has to be valid
+    for (uint32_t i = cascadeCount * NUM_GRIDS_PER_CASCADE; i < MAX_CASCADE_COUNT * NUM_GRIDS_PER_CASCADE; ++i)
+        ppTextures[i] = pAura->pCascades[0]->pLightGrids[i % NUM_GRIDS_PER_CASCADE]->pTexture;
+
+    return cascadeCount;
 }
 
 void drawLpvVisualization(Cmd* cmd, Renderer* pRenderer, Aura* pAura, RenderTarget* renderTarget, RenderTarget* depthRenderTarget,
@@ -735,8 +1130,8 @@ void drawLpvVisualization(Cmd* cmd, Renderer* pRenderer, Aura* pAura, RenderTarg
     params[0].pName = "uniforms";
     params[0].ppBuffers = &pAura->pUniformBufferVisualizationData[pAura->mFrameIdx];
     params[1].pName = "LPVGrid";
-    params[1].ppTextures = &ppTextures[cascadeIndex * pAura->mCascadeCount + 0];
-    params[1].mCount = pAura->mCascadeCount;
+    params[1].ppTextures = &ppTextures[cascadeIndex * NUM_GRIDS_PER_CASCADE + 0];
+    params[1].mCount = NUM_GRIDS_PER_CASCADE;
     updateDescriptorSet(pRenderer, pAura->mFrameIdx, pAura->pDescriptorSetVisualizeLPV, 2, params);
     cmdBindDescriptorSet(cmd, pAura->mFrameIdx, pAura->pDescriptorSetVisualizeLPV);
 
@@ -834,7 +1229,7 @@ int i=0;
 
 // m_Cascades.push_back(LightPropagationCascade(3520.0f, 1280.0f));
 
-void addDescriptorSets()
+void addDescriptorSets(Aura* pAura)
 {
     DescriptorSetDesc setDesc = { pAura->pRootSignatureInjectRSMLight, DESCRIPTOR_UPDATE_FREQ_NONE, pAura->mCascadeCount * MAX_FRAMES };
     addDescriptorSet(pAura->pRenderer, &setDesc, &pAura->pDescriptorSetInjectRSMLight);
@@ -853,7 +1248,7 @@ void addDescriptorSets()
     addDescriptorSet(pAura->pRenderer, &setDesc, &pAura->pDescriptorSetVisualizeLPV);
 }
 
-void removeDescriptorSets()
+void removeDescriptorSets(Aura* pAura)
 {
     removeDescriptorSet(pAura->pRenderer, pAura->pDescriptorSetInjectRSMLight);
     removeDescriptorSet(pAura->pRenderer, pAura->pDescriptorSetLightPropagate1);
@@ -862,7 +1257,7 @@ void removeDescriptorSets()
     removeDescriptorSet(pAura->pRenderer, pAura->pDescriptorSetVisualizeLPV);
 }
 
-void addRootSignatures()
+void addRootSignatures(Aura* pAura)
 {
     const char* pStaticSamplerNames[] = {
         "pointBorder",
@@ -911,7 +1306,7 @@ void addRootSignatures()
     addRootSignature(pAura->pRenderer, &visualizeLPVRootDesc, &pAura->pRootSignatureVisualizeLPV);
 }
 
-void removeRootSignatures()
+void removeRootSignatures(Aura* pAura)
 {
     removeRootSignature(pAura->pRenderer, pAura->pRootSignatureInjectRSMLight);
     removeRootSignature(pAura->pRenderer, pAura->pRootSignatureLightPropagate1);
@@ -920,7 +1315,7 @@ void removeRootSignatures()
     removeRootSignature(pAura->pRenderer, pAura->pRootSignatureVisualizeLPV);
 }
 
-void addShaders()
+void addShaders(Aura* pAura)
 {
     ShaderLoadDesc injectRSMLightDesc = {};
     ShaderLoadDesc lightPropagate1Desc = {};
@@ -956,7 +1351,7 @@ void addShaders()
     addShader(pAura->pRenderer, &visualizeLPVDesc, &pAura->pShaderLPVVisualize);
 }
 
-void removeShaders()
+void removeShaders(Aura* pAura)
 {
     removeShader(pAura->pRenderer, pAura->pShaderInjectRSMLight);
     removeShader(pAura->pRenderer, pAura->pShaderLightPropagate1[0]);
@@ -965,8 +1360,8 @@ void removeShaders()
     removeShader(pAura->pRenderer, pAura->pShaderLPVVisualize);
 }
 
-void addPipelines(PipelineCache* pCache, TinyImageFormat visualizeFormat, TinyImageFormat visualizeDepthFormat, SampleCount sampleCount,
-                  uint32_t sampleQuality)
+void addPipelines(Aura* pAura, PipelineCache* pCache, TinyImageFormat visualizeFormat, TinyImageFormat visualizeDepthFormat,
+                  SampleCount sampleCount, uint32_t sampleQuality)
 {
     /************************************************************************/
     // Add pipelines
@@ -1104,7 +1499,7 @@ void addPipelines(PipelineCache* pCache, TinyImageFormat visualizeFormat, TinyIm
     addPipeline(pAura->pRenderer, &graphicsPipelineDesc, &pAura->pPipelineVisualizeLPV);
 }
 
-void removePipelines()
+void removePipelines(Aura* pAura)
 {
     removePipeline(pAura->pRenderer, pAura->pPipelineInjectRSMLight);
     removePipeline(pAura->pRenderer, pAura->pPipelineLightPropagate1[0]);
@@ -1113,7 +1508,7 @@ void removePipelines()
     removePipeline(pAura->pRenderer, pAura->pPipelineVisualizeLPV);
 }
 
-void prepareDescriptorSets()
+void prepareDescriptorSets(Aura* pAura)
 {
     for (uint32_t cascade = 0; cascade < pAura->mCascadeCount; ++cascade)
     {
@@ -1131,7 +1526,7 @@ void prepareDescriptorSets()
             DescriptorData params[4] = {};
             params[0].pName = "LPVGrid";
             params[0].ppTextures = &pTex[0];
-            params[0].mCount = pAura->mCascadeCount;
+            params[0].mCount = NUM_GRIDS_PER_CASCADE;
             params[1].pName = "workCoeffs0";
             params[1].ppTextures = &pWorkingTex[0];
             params[2].pName = "workCoeffs1";
@@ -1143,7 +1538,7 @@ void prepareDescriptorSets()
             DescriptorData params[1] = {};
             params[0].pName = "LPVGrid";
             params[0].ppTextures = &pTex[0];
-            params[0].mCount = pAura->mCascadeCount;
+            params[0].mCount = NUM_GRIDS_PER_CASCADE;
             updateDescriptorSet(pAura->pRenderer, cascade, pAura->pDescriptorSetLightPropagate1, 1, params);
 #endif
         }
@@ -1168,7 +1563,7 @@ void prepareDescriptorSets()
             DescriptorData params[3] = {};
             params[0].pName = "LPVGrid";
             params[0].ppTextures = &pWorkingTex[0];
-            params[0].mCount = pAura->mCascadeCount;
+            params[0].mCount = NUM_GRIDS_PER_CASCADE;
             updateDescriptorSet(pAura->pRenderer, cascade * 2 + 0, pAura->pDescriptorSetLightCopy, 1, params);
 
             params[0].ppTextures = &pWorkingTex[3];
@@ -1184,7 +1579,7 @@ void prepareDescriptorSets()
             DescriptorData params[7] = {};
             params[0].pName = "LPVGrid";
             params[0].ppTextures = pWorkingTex + 3 * ((i & 0x1)) + 0;
-            params[0].mCount = pAura->mCascadeCount;
+            params[0].mCount = NUM_GRIDS_PER_CASCADE;
             params[1].pName = "workCoeffs0";
             params[1].ppTextures = pWorkingTex + 3 * !(i & 0x1) + 0;
             params[2].pName = "workCoeffs1";
@@ -1202,7 +1597,7 @@ void prepareDescriptorSets()
             DescriptorData params[1] = {};
             params[0].pName = "LPVGrid";
             params[0].ppTextures = pWorkingTex + 3 * ((i & 0x1)) + 0;
-            params[0].mCount = pAura->mCascadeCount;
+            params[0].mCount = NUM_GRIDS_PER_CASCADE;
             updateDescriptorSet(pAura->pRenderer, cascade * 2 + i, pAura->pDescriptorSetLightPropagateN, 1, params);
 #endif
         }
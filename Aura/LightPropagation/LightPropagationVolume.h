@@ -26,6 +26,8 @@
 
 #include "LightPropagationCPUContext.h"
 #include "LightPropagationCascade.h"
+#include "LightPropagationScheduler.h"
+#include "LightPropagationVoxelizer.h"
 
 // #include "SSGI/SSGIHandler.h"
 
@@ -35,10 +37,14 @@
 namespace aura
 {
 static const uint32_t MAX_FRAMES = 2U;
+//	Readback ring of the CPU propagation per cascade. Grows up to this depth when the GPU lags behind.
+static const uint32_t MAX_READBACK_SLOTS = 4U;
 
 enum CascadeOptions
 {
     CASCADE_NOT_MOVING = 0x01,
+    //	CPU propagation with second order SH, sharper light transport for e.g. the near cascade. The grids stay first order.
+    CASCADE_SH_L2_PROPAGATION = 0x02,
 };
 
 struct Box
@@ -52,6 +58,7 @@ typedef struct LightPropagationCascadeDesc
     float    mGridSpan;
     float    mGridIntensity;
     uint32_t mFlags;
+    vec3     mCenter; //	Placement of CASCADE_NOT_MOVING cascades, e.g. a far region of the world
 } LightPropagationCascadeDesc;
 
 typedef struct Aura
@@ -60,19 +67,30 @@ typedef struct Aura
     LightPropagationVolumeParams mParams;
     CPUPropagationParams         mCPUParams;
 
-    //	Capture current, propagate current+1, apply current+2
+    //	Capture into a free slot, propagate the newest slot the GPU is done with, apply
 #ifdef ENABLE_CPU_PROPAGATION
     int32_t                      mCPUPropagationCurrentContext;
-    LightPropagationCPUContext** m_CPUContexts;
+    LightPropagationCPUContext** m_CPUContexts; //	MAX_READBACK_SLOTS per cascade, mReadbackSlotCount of them loaded
     bool                         bUseCPUPropagationPreviousFrame; // Used to detect if switching between CPU and GPU propagation.
-    // The CPU propagation runs behind the GPU by this many frames so that data is always available.
+    // Readbacks without a fence are assumed complete after this many frames.
     uint32_t                     mInFlightFrameCount;
+    PropagationPartition         mPropagationPartition;
+    uint32_t                     mReadbackSlotCount;
+    uint64_t                     mFrameCounter;
+    Fence*                       pReadbackFence; //	Fence of the current frame, see setReadbackFence
+    LightPropagationCPUContext*  pLastAppliedContexts[MAX_CASCADE_COUNT]; //	Source of the border seeding of finer cascades
+    uint32_t                     mCascadeDomains[MAX_CASCADE_COUNT];      //	Domain of getCPUTopology running the cascade
 #endif
-    int32_t mGPUPropagationCurrentGrid;
+    UpdateSchedulerParams      mSchedulerParams;
+    LightPropagationScheduler* pScheduler;
+    LightPropagationVoxelizer* pVoxelizer;
+    const AnalyticLightDesc*   pAnalyticLights;
+    uint32_t                   mAnalyticLightCount;
 
     RenderTarget*             pWorkingGrids[6];
     uint32_t                  mCascadeCount;
     LightPropagationCascade** pCascades;
+    uint32_t                  mEnabledCascadeMask; //	Disabled cascades are neither updated nor applied
 
     uint32_t mFrameIdx;
 
@@ -114,6 +132,7 @@ typedef struct Aura
 
     Buffer** pUniformBufferInjectRSM[MAX_FRAMES];
     Buffer*  pUniformBufferVisualizationData[MAX_FRAMES];
+    Buffer*  pBufferLightApplyCascades[MAX_FRAMES];
 
     Sampler* pSamplerLinearBorder;
     Sampler* pSamplerPointBorder;
@@ -123,25 +142,54 @@ void initAura(Renderer* pRenderer, uint32_t rtWidth, uint32_t rtHeight, LightPro
               uint32_t cascadeCount, LightPropagationCascadeDesc* pCascades, Aura** ppAura);
 void loadCPUPropagationResources(Renderer* pRenderer, Aura* pAura);
 void exitAura(Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura);
+//	Measures the task split of the CPU propagation on the running machine, the defaults are used until then. Takes a
+//	noticeable moment, call it while loading after loadCPUPropagationResources and again when the worker count changed.
+void tuneCPUPropagation(Aura* pAura, ITaskManager* pTaskManager);
+//	Runs the CPU propagation on synthetic light with every task split and compares the results bit for bit. The split
+//	runs on task managers of 1 to maxWorkerCount workers, created with initTaskManager(ppTaskManager, workerCount) for
+//	the check. 0 only checks the single threaded modes. Slow, debug builds run it at load, see AURA_DETERMINISM_TEST_WORKERS.
+bool verifyCPUPropagationDeterminism(Aura* pAura, uint32_t maxWorkerCount);
+//	Compares the coarse to fine mode with the full resolution propagation of stepCount steps on synthetic point lights.
+//	Returns the relative error of the light beyond the fine steps, pFarEnergy the ratio of that light to the full
+//	resolution one. Debug builds check it at load together with the determinism.
+float compareCPUCoarseToFine(Aura* pAura, int stepCount, float* pFarEnergy);
 
 void     setCascadeCenter(Aura* pAura, uint32_t Cascade, const vec3& center);
+//	Streams region cascades in and out. Disabled cascades keep their grids but are skipped by the scheduler and
+//	left out of the apply data.
+void     setCascadeEnabled(Aura* pAura, uint32_t cascade, bool enabled);
 void     getGridBounds(Aura* pAura, const mat4& worldToLocal, Box* bounds);
 uint32_t getCascadesToUpdateMask(Aura* pAura);
+//	Lets the update scheduler know that lighting inside of the cascades has changed, e.g. a light was moved
+void     notifyLightChange(Aura* pAura, uint32_t cascadeMask, float amount);
+//	Feeds the GPU timings measured by the client back into the update scheduler
+void     reportCascadeGPUCost(Aura* pAura, uint32_t cascade, float gpuMs);
+//	Builds the occluder grids of the cascades updated this frame, used by the CPU propagation.
+//	Call after beginFrame. Static meshes are cached until the cascade moves or the cache is invalidated.
+void     voxelizeOccluders(Aura* pAura, ITaskManager* pTaskManager, const OccluderMeshDesc* pMeshes, uint32_t meshCount);
+void     invalidateOccluderCache(Aura* pAura);
+//	Analytic lights injected by the CPU propagation, no RSM needed. They are bounced off the voxelized occluders
+//	when there are any. The array has to stay alive until propagateLight.
+void     setAnalyticLights(Aura* pAura, const AnalyticLightDesc* pLights, uint32_t lightCount);
+
+//	Fence signalled by the submission of the command buffer passed to propagateLight this frame. The CPU propagation
+//	then picks up the light as soon as the GPU is done instead of after the in-flight frame count. Call before propagateLight.
+void     setReadbackFence(Aura* pAura, Fence* pFence);
 
 void beginFrame(Renderer* pRenderer, Aura* pAura, const vec3& camPos, const vec3& camDir);
 void endFrame(Renderer* pRenderer, Aura* pAura);
 void mapAsyncResources(Renderer* pRenderer);
 
-void addDescriptorSets();
-void removeDescriptorSets();
-void addRootSignatures();
-void removeRootSignatures();
-void addShaders();
-void removeShaders();
-void addPipelines(PipelineCache* pCache, TinyImageFormat visualizeFormat, TinyImageFormat visualizeDepthFormat, SampleCount sampleCount,
-                  uint32_t sampleQuality);
-void removePipelines();
-void prepareDescriptorSets();
+void addDescriptorSets(Aura* pAura);
+void removeDescriptorSets(Aura* pAura);
+void addRootSignatures(Aura* pAura);
+void removeRootSignatures(Aura* pAura);
+void addShaders(Aura* pAura);
+void removeShaders(Aura* pAura);
+void addPipelines(Aura* pAura, PipelineCache* pCache, TinyImageFormat visualizeFormat, TinyImageFormat visualizeDepthFormat,
+                  SampleCount sampleCount, uint32_t sampleQuality);
+void removePipelines(Aura* pAura);
+void prepareDescriptorSets(Aura* pAura);
 
 void injectRSM(Cmd* pCmd, Renderer* pRenderer, Aura* pAura, uint32_t iVolume, const mat4& invVP, const vec3& camDir, uint32_t rtWidth,
                uint32_t rtHeight, float viewAreaForUnitDepth, Texture* baseRT, Texture* normalRT, Texture* depthRT);
@@ -151,7 +199,12 @@ void captureLight(Cmd* pCmd, Aura* pAura);
 void propagateLight(Cmd* pCmd, Renderer* pRenderer, ITaskManager* pTaskManager, Aura* pAura);
 void applyLight(Cmd* pCmd, Renderer* pRenderer, Aura* pAura, const mat4& invVP, const vec3& camPos, Texture* normalRT, Texture* depthRT,
                 Texture* ambientOcclusionRT);
-void getLightApplyData(Aura* pAura, const mat4& invVP, const vec3& camPos, LightApplyData* data);
+//	Also fills the LightApplyCascades structured buffer of the current frame, see getLightApplyCascadesBuffer
+void     getLightApplyData(Aura* pAura, const mat4& invVP, const vec3& camPos, LightApplyData* data);
+Buffer*  getLightApplyCascadesBuffer(Aura* pAura);
+//	Grids of the enabled cascades in LightApplyCascades order, for the LPVGridCascades binding.
+//	ppTextures needs room for NUM_GRIDS_PER_CASCADE * MAX_CASCADE_COUNT entries, unused entries repeat the first cascade.
+uint32_t getLightGridTextures(Aura* pAura, Texture** ppTextures);
 
 void drawLpvVisualization(Cmd* cmd, Renderer* pRenderer, Aura* pAura, RenderTarget* renderTarget, RenderTarget* depthRenderTarget,
                           const mat4& projection, const mat4& view, const mat4& inverseView, int cascadeIndex, float probeSize);
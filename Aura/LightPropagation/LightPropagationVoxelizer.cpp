@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "LightPropagationVoxelizer.h"
+
+#include <string.h>
+
+#include "../Interfaces/IAuraMemoryManager.h"
+
+#define NO_FSL_DEFINITIONS
+#include "../Shaders/FSL/lightPropagation.h"
+#include "../Shaders/FSL/lpvSHMaths.h"
+
+#if !defined(__linux__) && !defined(NX64) && !defined(__aarch64__)
+#define INTRIN_USE
+#endif
+
+#if defined(INTRIN_USE)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+namespace aura
+{
+static const uint32_t occluderElementCount = GridRes * GridRes * GridRes;
+
+//	Slabs along z are independent, so the tasks never write to the same cell
+static const uint32_t VOXELIZER_TASK_COUNT = 8;
+
+void addLightPropagationVoxelizer(uint32_t cascadeCount, LightPropagationVoxelizer** ppVoxelizer)
+{
+    LightPropagationVoxelizer* pVoxelizer = (LightPropagationVoxelizer*)aura::alloc(sizeof(*pVoxelizer));
+
+    pVoxelizer->mCascadeCount = cascadeCount;
+    pVoxelizer->pCascadeOccluders = (CascadeOccluders*)aura::alloc(cascadeCount * sizeof(*pVoxelizer->pCascadeOccluders));
+    for (uint32_t i = 0; i < cascadeCount; ++i)
+    {
+        CascadeOccluders& occluders = pVoxelizer->pCascadeOccluders[i];
+        //	Grids are allocated on first use, GPU propagation never needs them
+        occluders.pStaticOccluders = NULL;
+        occluders.pOccluders = NULL;
+        occluders.mStaticWorldToGrid = identity4();
+        occluders.bStaticValid = false;
+        occluders.bValid = false;
+    }
+
+    pVoxelizer->pTriangles = NULL;
+    pVoxelizer->mTriangleCapacity = 0;
+    pVoxelizer->mTriangleCount = 0;
+    pVoxelizer->pTarget = NULL;
+
+    *ppVoxelizer = pVoxelizer;
+}
+
+void removeLightPropagationVoxelizer(LightPropagationVoxelizer* pVoxelizer)
+{
+    for (uint32_t i = 0; i < pVoxelizer->mCascadeCount; ++i)
+    {
+        aura::dealloc(pVoxelizer->pCascadeOccluders[i].pStaticOccluders);
+        aura::dealloc(pVoxelizer->pCascadeOccluders[i].pOccluders);
+    }
+
+    aura::dealloc(pVoxelizer->pCascadeOccluders);
+    aura::dealloc(pVoxelizer->pTriangles);
+    aura::dealloc(pVoxelizer);
+}
+
+void invalidateStaticOccluders(LightPropagationVoxelizer* pVoxelizer)
+{
+    for (uint32_t i = 0; i < pVoxelizer->mCascadeCount; ++i)
+        pVoxelizer->pCascadeOccluders[i].bStaticValid = false;
+}
+
+const vec4* getCascadeOccluders(LightPropagationVoxelizer* pVoxelizer, uint32_t cascade)
+{
+    const CascadeOccluders& occluders = pVoxelizer->pCascadeOccluders[cascade];
+    return occluders.bValid ? occluders.pOccluders : NULL;
+}
+
+/************************************************************************/
+// Triangle setup
+/************************************************************************/
+static void reserveTriangles(LightPropagationVoxelizer* pVoxelizer, uint32_t count)
+{
+    if (count <= pVoxelizer->mTriangleCapacity)
+        return;
+
+    uint32_t capacity = pVoxelizer->mTriangleCapacity ? pVoxelizer->mTriangleCapacity : 1024;
+    while (capacity < count)
+        capacity *= 2;
+
+    VoxelizerTriangle* pTriangles = (VoxelizerTriangle*)aura::alloc(capacity * sizeof(VoxelizerTriangle));
+    if (pVoxelizer->mTriangleCount)
+        memcpy(pTriangles, pVoxelizer->pTriangles, pVoxelizer->mTriangleCount * sizeof(VoxelizerTriangle));
+
+    aura::dealloc(pVoxelizer->pTriangles);
+    pVoxelizer->pTriangles = pTriangles;
+    pVoxelizer->mTriangleCapacity = capacity;
+}
+
+//	Edge function of the 2D projection, offset to the critical corner of the cell to make the test conservative.
+static float3 setupEdge(float ex, float ey, float vx, float vy, float orientation)
+{
+    const float nx = -ey * orientation;
+    const float ny = ex * orientation;
+    return float3(nx, ny, -(nx * vx + ny * vy) + max(0.0f, nx) + max(0.0f, ny));
+}
+
+//	Vertices are in cell units, cell (k, j, i) covers [k, k+1] x [j, j+1] x [i, i+1]
+static bool setupTriangle(const vec3& v0, const vec3& v1, const vec3& v2, VoxelizerTriangle* pTriangle)
+{
+    const vec3 vMin = min(v0, min(v1, v2));
+    const vec3 vMax = max(v0, max(v1, v2));
+
+    const float* pMin = &vMin.x;
+    const float* pMax = &vMax.x;
+    for (int c = 0; c < 3; ++c)
+    {
+        pTriangle->mCellMin[c] = max((int32_t)floorf(pMin[c]), 0);
+        pTriangle->mCellMax[c] = min((int32_t)floorf(pMax[c]), (int32_t)GridRes - 1);
+
+        if (pTriangle->mCellMin[c] > pTriangle->mCellMax[c])
+            return false;
+    }
+
+    const vec3  e[3] = { v1 - v0, v2 - v1, v0 - v2 };
+    const vec3  v[3] = { v0, v1, v2 };
+    const vec3  n = cross(e[0], e[1]);
+    const float doubleArea = length(n);
+    if (doubleArea < 1e-8f)
+        return false;
+
+    pTriangle->mNormal = n;
+
+    //	Plane overlap: the plane has to pass between the two critical corners of the cell
+    const vec3  critical = vec3(n.x > 0.0f ? 1.0f : 0.0f, n.y > 0.0f ? 1.0f : 0.0f, n.z > 0.0f ? 1.0f : 0.0f);
+    const float d1 = dot(n, critical - v0);
+    const float d2 = dot(n, (vec3(1.0f) - critical) - v0);
+    pTriangle->mPlaneMin = min(-d1, -d2);
+    pTriangle->mPlaneMax = max(-d1, -d2);
+
+    const float orientXY = n.z >= 0.0f ? 1.0f : -1.0f;
+    const float orientYZ = n.x >= 0.0f ? 1.0f : -1.0f;
+    const float orientZX = n.y >= 0.0f ? 1.0f : -1.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        pTriangle->mEdgeXY[i] = setupEdge(e[i].x, e[i].y, v[i].x, v[i].y, orientXY);
+        pTriangle->mEdgeYZ[i] = setupEdge(e[i].y, e[i].z, v[i].y, v[i].z, orientYZ);
+        pTriangle->mEdgeZX[i] = setupEdge(e[i].z, e[i].x, v[i].z, v[i].x, orientZX);
+    }
+
+    //	Cosine lobe around the normal. Occlusion is evaluated in both directions, so the winding does not matter.
+    //	Triangles smaller than a cell face block the light only partially.
+    const vec3   normal = n / doubleArea;
+    const float2 vZHCoeffs = SHProjectionScale * float2(0.25f, 0.5f);
+    const float  coverage = min(0.5f * doubleArea, 1.0f);
+    pTriangle->mOccluderCoeffs =
+        float4(vZHCoeffs.x, -vZHCoeffs.y * normal.y, vZHCoeffs.y * normal.z, -vZHCoeffs.y * normal.x) * coverage;
+
+    return true;
+}
+
+static void gatherTriangles(LightPropagationVoxelizer* pVoxelizer, const LightPropagationCascade::State& state,
+                            const OccluderMeshDesc* pMeshes, uint32_t meshCount, bool bStatic)
+{
+    pVoxelizer->mTriangleCount = 0;
+
+    for (uint32_t m = 0; m < meshCount; ++m)
+    {
+        const OccluderMeshDesc& mesh = pMeshes[m];
+        if (mesh.bStatic != bStatic || !mesh.mTriangleCount)
+            continue;
+
+        reserveTriangles(pVoxelizer, pVoxelizer->mTriangleCount + mesh.mTriangleCount);
+
+        const mat4     localToCell = scale((float)GridRes, (float)GridRes, (float)GridRes) * state.mWorldToGrid * mesh.mLocalToWorld;
+        const uint32_t stride = mesh.mPositionStride ? mesh.mPositionStride : 3 * sizeof(float);
+        const uint8_t* pPositions = (const uint8_t*)mesh.pPositions;
+
+        for (uint32_t t = 0; t < mesh.mTriangleCount; ++t)
+        {
+            vec3 v[3];
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                const uint32_t index = mesh.pIndices ? mesh.pIndices[t * 3 + c] : t * 3 + c;
+                const float*   pPos = (const float*)(pPositions + (size_t)index * stride);
+                v[c] = (localToCell * float4(pPos[0], pPos[1], pPos[2], 1.0f)).xyz();
+            }
+
+            if (setupTriangle(v[0], v[1], v[2], &pVoxelizer->pTriangles[pVoxelizer->mTriangleCount]))
+                ++pVoxelizer->mTriangleCount;
+        }
+    }
+}
+
+/************************************************************************/
+// Rasterization
+/************************************************************************/
+static inline bool overlapsRowYZ(const VoxelizerTriangle& tri, float y, float z)
+{
+    for (int e = 0; e < 3; ++e)
+    {
+        if (tri.mEdgeYZ[e].x * y + tri.mEdgeYZ[e].y * z + tri.mEdgeYZ[e].z < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+#if defined(INTRIN_USE)
+//	Tests four consecutive cells of the row at once
+static inline void voxelizeRow(const VoxelizerTriangle& tri, vec4* __restrict pRow, float y, float z)
+{
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vPlaneMin = _mm_set1_ps(tri.mPlaneMin);
+    const __m128 vPlaneMax = _mm_set1_ps(tri.mPlaneMax);
+    const __m128 vPlaneRow = _mm_set1_ps(tri.mNormal.y * y + tri.mNormal.z * z);
+    const __m128 vPlaneStep = _mm_set1_ps(tri.mNormal.x);
+    const __m128 vCoeffs = _mm_loadu_ps(&tri.mOccluderCoeffs.x);
+
+    for (int32_t k = tri.mCellMin[0]; k <= tri.mCellMax[0]; k += 4)
+    {
+        const __m128 x = _mm_add_ps(_mm_set1_ps((float)k), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+
+        const __m128 plane = _mm_add_ps(vPlaneRow, _mm_mul_ps(vPlaneStep, x));
+        __m128       inside = _mm_and_ps(_mm_cmpge_ps(plane, vPlaneMin), _mm_cmple_ps(plane, vPlaneMax));
+
+        for (int e = 0; e < 3; ++e)
+        {
+            const float3& edgeXY = tri.mEdgeXY[e];
+            const float3& edgeZX = tri.mEdgeZX[e];
+            const __m128  xy = _mm_add_ps(_mm_set1_ps(edgeXY.y * y + edgeXY.z), _mm_mul_ps(_mm_set1_ps(edgeXY.x), x));
+            const __m128  zx = _mm_add_ps(_mm_set1_ps(edgeZX.x * z + edgeZX.z), _mm_mul_ps(_mm_set1_ps(edgeZX.y), x));
+            inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(xy, vZero), _mm_cmpge_ps(zx, vZero)));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int32_t l = 0; mask && l < 4 && k + l <= tri.mCellMax[0]; ++l, mask >>= 1)
+        {
+            if (mask & 1)
+                _mm_store_ps(&pRow[k + l].x, _mm_add_ps(_mm_load_ps(&pRow[k + l].x), vCoeffs));
+        }
+    }
+}
+#else
+static inline void voxelizeRow(const VoxelizerTriangle& tri, vec4* __restrict pRow, float y, float z)
+{
+    const float planeRow = tri.mNormal.y * y + tri.mNormal.z * z;
+
+    for (int32_t k = tri.mCellMin[0]; k <= tri.mCellMax[0]; ++k)
+    {
+        const float x = (float)k;
+        const float plane = planeRow + tri.mNormal.x * x;
+        if (plane < tri.mPlaneMin || plane > tri.mPlaneMax)
+            continue;
+
+        bool inside = true;
+        for (int e = 0; e < 3 && inside; ++e)
+        {
+            inside = tri.mEdgeXY[e].x * x + tri.mEdgeXY[e].y * y + tri.mEdgeXY[e].z >= 0.0f &&
+                     tri.mEdgeZX[e].x * z + tri.mEdgeZX[e].y * x + tri.mEdgeZX[e].z >= 0.0f;
+        }
+
+        if (inside)
+            pRow[k] += tri.mOccluderCoeffs;
+    }
+}
+#endif
+
+static void voxelizeSlab(const LightPropagationVoxelizer* pVoxelizer, int32_t iMinSlice, int32_t iMaxSlice)
+{
+    for (uint32_t t = 0; t < pVoxelizer->mTriangleCount; ++t)
+    {
+        const VoxelizerTriangle& tri = pVoxelizer->pTriangles[t];
+
+        const int32_t iMin = max(tri.mCellMin[2], iMinSlice);
+        const int32_t iMax = min(tri.mCellMax[2], iMaxSlice - 1);
+
+        for (int32_t i = iMin; i <= iMax; ++i)
+        {
+            for (int32_t j = tri.mCellMin[1]; j <= tri.mCellMax[1]; ++j)
+            {
+                //	The YZ projection does not depend on x, reject the whole row at once
+                if (!overlapsRowYZ(tri, (float)j, (float)i))
+                    continue;
+
+                voxelizeRow(tri, pVoxelizer->pTarget + (i * GridRes + j) * GridRes, (float)j, (float)i);
+            }
+        }
+    }
+}
+
+static void TaskVoxelizeSlab(void* pvInfo, int32_t iContext, uint32_t uTaskId, uint32_t uTaskCount)
+{
+    const int32_t iMinSlice = uTaskId * GridRes / uTaskCount;
+    const int32_t iMaxSlice = (uTaskId + 1) * GridRes / uTaskCount;
+
+    voxelizeSlab((const LightPropagationVoxelizer*)pvInfo, iMinSlice, iMaxSlice);
+}
+
+static void voxelizeTriangles(LightPropagationVoxelizer* pVoxelizer, ITaskManager* pTaskManager, vec4* pTarget)
+{
+    if (!pVoxelizer->mTriangleCount)
+        return;
+
+    pVoxelizer->pTarget = pTarget;
+
+    if (!pTaskManager)
+    {
+        voxelizeSlab(pVoxelizer, 0, GridRes);
+        return;
+    }
+
+    ITASKSETHANDLE hTask = ITASKSETHANDLE_INVALID;
+    pTaskManager->createTaskSet(0, TaskVoxelizeSlab, pVoxelizer, VOXELIZER_TASK_COUNT, NULL, 0, "Voxelize occluders", &hTask);
+    pTaskManager->waitForTaskSet(hTask);
+#if !defined(ORBIS_TASK_MANAGER)
+    pTaskManager->releaseTask(hTask);
+#endif
+}
+
+void voxelizeCascadeOccluders(LightPropagationVoxelizer* pVoxelizer, ITaskManager* pTaskManager, uint32_t cascade,
+                              const LightPropagationCascade::State& state, const OccluderMeshDesc* pMeshes, uint32_t meshCount)
+{
+    CascadeOccluders& occluders = pVoxelizer->pCascadeOccluders[cascade];
+
+    if (!occluders.pOccluders)
+    {
+        occluders.pStaticOccluders = (vec4*)aura::alloc(occluderElementCount * sizeof(vec4));
+        occluders.pOccluders = (vec4*)aura::alloc(occluderElementCount * sizeof(vec4));
+    }
+
+    //	Cascades are snapped to cells, so the static grid stays valid until the cascade moves by a whole cell
+    if (!occluders.bStaticValid || memcmp(&occluders.mStaticWorldToGrid, &state.mWorldToGrid, sizeof(mat4)) != 0)
+    {
+        memset(occluders.pStaticOccluders, 0, occluderElementCount * sizeof(vec4));
+
+        gatherTriangles(pVoxelizer, state, pMeshes, meshCount, true);
+        voxelizeTriangles(pVoxelizer, pTaskManager, occluders.pStaticOccluders);
+
+        occluders.mStaticWorldToGrid = state.mWorldToGrid;
+        occluders.bStaticValid = true;
+    }
+
+    memcpy(occluders.pOccluders, occluders.pStaticOccluders, occluderElementCount * sizeof(vec4));
+
+    gatherTriangles(pVoxelizer, state, pMeshes, meshCount, false);
+    voxelizeTriangles(pVoxelizer, pTaskManager, occluders.pOccluders);
+
+    occluders.bValid = true;
+}
+} // namespace aura
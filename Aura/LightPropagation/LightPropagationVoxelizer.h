@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Aura.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../Interfaces/IAuraTaskManager.h"
+
+#include "../Math/AuraVector.h"
+
+#include "LightPropagationCascade.h"
+
+namespace aura
+{
+typedef struct OccluderMeshDesc
+{
+    const float*    pPositions;      //	xyz triplets, mPositionStride bytes apart
+    uint32_t        mPositionStride; //	0 means tightly packed
+    const uint32_t* pIndices;        //	NULL for non-indexed triangle lists
+    uint32_t        mTriangleCount;
+    mat4            mLocalToWorld;
+    bool            bStatic; //	Static meshes are voxelized once per cascade position
+} OccluderMeshDesc;
+
+//	Triangle in grid space, set up for the conservative cell overlap test
+typedef struct VoxelizerTriangle
+{
+    float4   mOccluderCoeffs; //	Cosine lobe around the normal scaled by the coverage
+    float3   mNormal;
+    float    mPlaneMin;
+    float    mPlaneMax;
+    float3   mEdgeXY[3]; //	(nx, ny, d) of the edge functions in the XY projection
+    float3   mEdgeYZ[3];
+    float3   mEdgeZX[3];
+    int32_t  mCellMin[3];
+    int32_t  mCellMax[3];
+} VoxelizerTriangle;
+
+typedef struct CascadeOccluders
+{
+    vec4* pStaticOccluders;
+    vec4* pOccluders;
+    mat4  mStaticWorldToGrid; //	Grid placement the static occluders were voxelized for
+    bool  bStaticValid;
+    bool  bValid;
+} CascadeOccluders;
+
+typedef struct LightPropagationVoxelizer
+{
+    CascadeOccluders*  pCascadeOccluders;
+    uint32_t           mCascadeCount;
+    VoxelizerTriangle* pTriangles;
+    uint32_t           mTriangleCapacity;
+    uint32_t           mTriangleCount;
+    vec4*              pTarget;
+} LightPropagationVoxelizer;
+
+void addLightPropagationVoxelizer(uint32_t cascadeCount, LightPropagationVoxelizer** ppVoxelizer);
+void removeLightPropagationVoxelizer(LightPropagationVoxelizer* pVoxelizer);
+
+//	Voxelizes the meshes into the occluder grid of the cascade. Static meshes are only revoxelized when the cascade moves
+//	or after invalidateStaticOccluders() was called.
+void voxelizeCascadeOccluders(LightPropagationVoxelizer* pVoxelizer, ITaskManager* pTaskManager, uint32_t cascade,
+                              const LightPropagationCascade::State& state, const OccluderMeshDesc* pMeshes, uint32_t meshCount);
+void invalidateStaticOccluders(LightPropagationVoxelizer* pVoxelizer);
+
+//	Returns NULL if the cascade has no occluders
+const vec4* getCascadeOccluders(LightPropagationVoxelizer* pVoxelizer, uint32_t cascade);
+} // namespace aura
@@ -10,6 +10,9 @@
 #ifndef LIGHT_PROPAGATION_H
 #define LIGHT_PROPAGATION_H
 
+//	Must match MAX_CASCADE_COUNT on the CPU side
+#define LPV_MAX_CASCADES 8
+
 #ifdef NO_FSL_DEFINITIONS
 static const uint  WorkGroupSize = 4;
 static const uint  GridRes = 32;
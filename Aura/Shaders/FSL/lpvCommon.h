@@ -38,11 +38,14 @@ STRUCT(LightInjectionData)
 	DATA(uint2,         RSMRes,               None);
 };
 
+//	Explicitly padded, structured buffers are packed tightly
 STRUCT(LightApplyCascadeData)
 {
 	DATA(float4,        cellFalloff,          None);
-	DATA(float3,        WorldToGridScale,     None);
-	DATA(float3,        WorldToGridTranslate, None);
+	DATA(packed_float3, WorldToGridScale,     None);
+	DATA(float,         _pad0,                None);
+	DATA(packed_float3, WorldToGridTranslate, None);
+	DATA(float,         _pad1,                None);
 	DATA(packed_float3, smoothGridPosOffset,  None);
 	DATA(float,         lightScale,           None);
 };
@@ -55,8 +58,10 @@ STRUCT(LightApplyData)
 	DATA(packed_float3,         camPos,       None);
 	DATA(float,                 GIStrength,   None);
 	DATA(float3,                lumScale,     None);
-	DATA(LightApplyCascadeData, cascade[3],   None);
 };
+
+//	One entry per enabled cascade, LightApplyData.cascadeCount entries are valid
+RES(Buffer(LightApplyCascadeData), LightApplyCascades, UPDATE_FREQ_PER_FRAME, t129, binding = 109);
 #endif
 
 #if defined(ORBIS) || defined(PROSPERO)
@@ -114,8 +119,6 @@ struct LightApplyData
 	aura::float3          lumScale;
 	PAD(0);
 	//===================================
-	LightApplyCascadeData cascade[3];
-	//===================================
 };
 
 struct VisualizationData
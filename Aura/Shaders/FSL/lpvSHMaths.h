@@ -22,6 +22,8 @@ static const float  SHProjectionScale = SQRT_PI;
 #endif
 
 #ifndef NO_FSL_DEFINITIONS
+#include "lightPropagation.h"
+
 STATIC const float  SHBand1 = SQRT_3 / (2.0f * SQRT_PI);
 STATIC const float4 SHBasis = float4(1.0f / (2.0f * SQRT_PI), -SHBand1, SHBand1, -SHBand1);
 STATIC const float  SHProjectionScale = SQRT_PI;
@@ -39,10 +41,10 @@ STRUCT(SHSpectralCoeffs)
 };
 
 // Set to register value to avoid conflicts when using shaders compiled for permutations
-RES(Tex3D(float4), LPVGrid[3],             UPDATE_FREQ_NONE, t100, binding = 80);
-RES(Tex3D(float4), LPVGridCascades[3 * 3], UPDATE_FREQ_NONE, t103, binding = 83);
-RES(Tex3D(float4), GridOccluder,           UPDATE_FREQ_NONE, t112, binding = 92);
-RES(Tex3D(float4), GridOccluderSecondary,  UPDATE_FREQ_NONE, t113, binding = 93);
+RES(Tex3D(float4), LPVGrid[3],                            UPDATE_FREQ_NONE, t100, binding = 80);
+RES(Tex3D(float4), LPVGridCascades[3 * LPV_MAX_CASCADES], UPDATE_FREQ_NONE, t103, binding = 83);
+RES(Tex3D(float4), GridOccluder,                          UPDATE_FREQ_NONE, t127, binding = 107);
+RES(Tex3D(float4), GridOccluderSecondary,                 UPDATE_FREQ_NONE, t128, binding = 108);
 
 #ifdef VULKAN
 
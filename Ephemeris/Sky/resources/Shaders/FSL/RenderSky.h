@@ -158,6 +158,19 @@ float4 texture4D(Tex3D(float4) table, float r, float mu, float muS, float nu)
 #endif	//	USE_SAMPLELEVEL
 }
 
+//	Crossfades to the B table while the atmosphere changes. A table that is faded out is never read, it may be the one
+//	being replaced.
+float4 inscatterTable(float r, float mu, float muS, float nu)
+{
+	float weightB = Get(InScatterParams).z;
+	float4 result = f4(0.0f);
+	if (weightB < 1.0f)
+		result = texture4D(Get(InscatterTexture), r, mu, muS, nu);
+	if (weightB > 0.0f)
+		result = lerp(result, texture4D(Get(InscatterTextureB), r, mu, muS, nu), weightB);
+	return result;
+}
+
 //	Igor: this is an exact maths for GL's mod
 float mod0(float x, float y)
 {
@@ -233,11 +246,20 @@ float limit(float r, float mu)
 float3 transmittance(float r, float mu) 
 {
 	float2 uv = getTransmittanceUV(r, mu);
+	float weightB = Get(InScatterParams).z;
+	float3 result = f3(0.0f);
 #ifdef USE_SAMPLELEVEL
-	return SampleLvlTex2D(Get(TransmittanceTexture), Get(g_LinearClamp), uv, 0).rgb;
+	if (weightB < 1.0f)
+		result = SampleLvlTex2D(Get(TransmittanceTexture), Get(g_LinearClamp), uv, 0).rgb;
+	if (weightB > 0.0f)
+		result = lerp(result, SampleLvlTex2D(Get(TransmittanceTextureB), Get(g_LinearClamp), uv, 0).rgb, weightB);
 #else	//	USE_SAMPLELEVEL
-	return SampleTex2D(Get(TransmittanceTexture), Get(g_LinearClamp), uv).rgb;
+	if (weightB < 1.0f)
+		result = SampleTex2D(Get(TransmittanceTexture), Get(g_LinearClamp), uv).rgb;
+	if (weightB > 0.0f)
+		result = lerp(result, SampleTex2D(Get(TransmittanceTextureB), Get(g_LinearClamp), uv).rgb, weightB);
 #endif	//	USE_SAMPLELEVEL
+	return result;
 }
 
 // transmittance(=transparency) of atmosphere for infinite ray (r,mu)
@@ -389,7 +411,7 @@ float3 inscatter(inout(float3) x, inout(float) t, float3 v, float3 s, out(float)
 		float muS = dot(x, s) / r;
 		float phaseR = phaseFunctionR(nu);
 		float phaseM = phaseFunctionM(nu);
-		float4 inscatter_ = max(texture4D(Get(InscatterTexture), r, mu, muS, nu), 0.0f);
+		float4 inscatter_ = max(inscatterTable(r, mu, muS, nu), 0.0f);
 
 		if (t > 0.0f) 
 		{
@@ -407,7 +429,7 @@ float3 inscatter(inout(float3) x, inout(float) t, float3 v, float3 s, out(float)
 			if (r0 > Rg + 0.01f)
 			{
 				// computes S[L]-T(x,x0)S[L]|x0
-				inscatter_ = max(inscatter_ - attenuation.rgbr * texture4D(Get(InscatterTexture), r0, mu0, muS0, nu), 0.0f);
+				inscatter_ = max(inscatter_ - attenuation.rgbr * inscatterTable(r0, mu0, muS0, nu), 0.0f);
 #ifdef FIX
 				// avoids imprecision problems near horizon by interpolating between two points above and below horizon
 #ifdef IGOR_FIX_MU0
@@ -429,15 +451,15 @@ float3 inscatter(inout(float3) x, inout(float) t, float3 v, float3 s, out(float)
 					mu = muHoriz - EPS;
 					r0 = sqrt(r * r + t * t + 2.0f * r * t * mu);
 					mu0 = (r * mu + t) / r0;
-					float4 inScatter0 = texture4D(Get(InscatterTexture), r, mu, muS, nu);
-					float4 inScatter1 = texture4D(Get(InscatterTexture), r0, mu0, muS0, nu);
+					float4 inScatter0 = inscatterTable(r, mu, muS, nu);
+					float4 inScatter1 = inscatterTable(r0, mu0, muS0, nu);
 					float4 inScatterA = max(inScatter0 - attenuation.rgbr * inScatter1, 0.0f);
 
 					mu = muHoriz + EPS;
 					r0 = sqrt(r * r + t * t + 2.0f * r * t * mu);
 					mu0 = (r * mu + t) / r0;
-					inScatter0 = texture4D(Get(InscatterTexture), r, mu, muS, nu);
-					inScatter1 = texture4D(Get(InscatterTexture), r0, mu0, muS0, nu);
+					inScatter0 = inscatterTable(r, mu, muS, nu);
+					inScatter1 = inscatterTable(r0, mu0, muS0, nu);
 					float4 inScatterB = max(inScatter0 - attenuation.rgbr * inScatter1, 0.0f);
 
 					inscatter_ = lerp(inScatterA, inScatterB, a);
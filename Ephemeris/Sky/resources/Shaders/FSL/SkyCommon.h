@@ -40,6 +40,10 @@ RES(Tex2D(float4),    depthTexture,         UPDATE_FREQ_NONE, t5, binding = 5);
 RES(RWBuffer(float4), TransmittanceColor,   UPDATE_FREQ_NONE, u0, binding = 6);
 RES(SamplerState,     g_LinearClamp,        UPDATE_FREQ_NONE, s0, binding = 7);
 
+//	Tables that fade in while the atmosphere changes, InScatterParams.z is their weight
+RES(Tex2D(float4),    TransmittanceTextureB, UPDATE_FREQ_NONE, t6, binding = 8);
+RES(Tex3D(float4),    InscatterTextureB,     UPDATE_FREQ_NONE, t7, binding = 9);
+
 //STATIC const int TRANSMITTANCE_INTEGRAL_SAMPLES = 500;
 //STATIC const int INSCATTER_INTEGRAL_SAMPLES = 50;
 //STATIC const int IRRADIANCE_INTEGRAL_SAMPLES = 32;
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "AtmosphereCache.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
+
+static const uint32_t ATMOSPHERE_CACHE_MAGIC = 0x4f4d5441; //	"ATMO"
+static const uint32_t ATMOSPHERE_CACHE_VERSION = 1;
+
+//	32 bytes so that the texels that follow stay aligned in the mapping
+typedef struct AtmosphereCacheHeader
+{
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint64_t mHash;
+    uint32_t mTransmittanceTexels;
+    uint32_t mIrradianceTexels;
+    uint32_t mInscatterTexels;
+    uint32_t mPadding;
+} AtmosphereCacheHeader;
+
+static AtmosphereCacheHeader GetAtmosphereCacheHeader(uint64_t hash)
+{
+    AtmosphereCacheHeader header = {};
+    header.mMagic = ATMOSPHERE_CACHE_MAGIC;
+    header.mVersion = ATMOSPHERE_CACHE_VERSION;
+    header.mHash = hash;
+    header.mTransmittanceTexels = ATMOSPHERE_TRANSMITTANCE_TEXELS;
+    header.mIrradianceTexels = ATMOSPHERE_IRRADIANCE_TEXELS;
+    header.mInscatterTexels = ATMOSPHERE_INSCATTER_TEXELS;
+    return header;
+}
+
+void GetAtmosphereCacheFileName(uint64_t hash, char* pFileName)
+{
+    snprintf(pFileName, ATMOSPHERE_CACHE_FILE_NAME_LENGTH, "Atmosphere_%016llx.lut", (unsigned long long)hash);
+}
+
+bool OpenAtmosphereCache(ResourceDirectory resourceDir, uint64_t hash, AtmosphereCache* pCache)
+{
+    *pCache = {};
+
+    char fileName[ATMOSPHERE_CACHE_FILE_NAME_LENGTH];
+    GetAtmosphereCacheFileName(hash, fileName);
+    if (!fsOpenStreamFromPath(resourceDir, fileName, FM_READ, &pCache->mStream))
+        return false;
+
+    const size_t expectedSize = sizeof(AtmosphereCacheHeader) + ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t);
+    size_t       size = 0;
+    const void*  pData = NULL;
+    if (!fsStreamMemoryMap(&pCache->mStream, &size, &pData) || size != expectedSize)
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the atmosphere cache %s, the file is incomplete", fileName);
+        CloseAtmosphereCache(pCache);
+        return false;
+    }
+
+    //	The name already identifies the contents, the header catches files of another version or a hash collision of the name
+    const AtmosphereCacheHeader expected = GetAtmosphereCacheHeader(hash);
+    if (memcmp(pData, &expected, sizeof(expected)) != 0)
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the atmosphere cache %s, the header does not match", fileName);
+        CloseAtmosphereCache(pCache);
+        return false;
+    }
+
+    pCache->pTexels = (const uint16_t*)((const uint8_t*)pData + sizeof(AtmosphereCacheHeader));
+    return true;
+}
+
+void CloseAtmosphereCache(AtmosphereCache* pCache)
+{
+    fsCloseStream(&pCache->mStream);
+    *pCache = {};
+}
+
+bool SaveAtmosphereCache(ResourceDirectory resourceDir, uint64_t hash, const uint16_t* pTexels)
+{
+    char fileName[ATMOSPHERE_CACHE_FILE_NAME_LENGTH];
+    GetAtmosphereCacheFileName(hash, fileName);
+
+    FileStream stream = {};
+    if (!fsOpenStreamFromPath(resourceDir, fileName, FM_WRITE, &stream))
+    {
+        LOGF(LogLevel::eWARNING, "Could not create the atmosphere cache %s", fileName);
+        return false;
+    }
+
+    //	A partial write leaves a file of the wrong size, which OpenAtmosphereCache rejects
+    const AtmosphereCacheHeader header = GetAtmosphereCacheHeader(hash);
+    const size_t                texelsSize = ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t);
+    const bool                  bWritten =
+        fsWriteToStream(&stream, &header, sizeof(header)) == sizeof(header) && fsWriteToStream(&stream, pTexels, texelsSize) == texelsSize;
+    fsCloseStream(&stream);
+
+    if (!bWritten)
+        LOGF(LogLevel::eWARNING, "Could not write the atmosphere cache %s", fileName);
+    return bWritten;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IFileSystem.h"
+
+#include "AtmosphereTables.h"
+
+//	Generated tables on disk, named after GetAtmosphereTablesHash so a change of the parameters never finds a stale file.
+//	The file is a small header followed by the packed texels, which are uploaded straight from the mapped file.
+typedef struct AtmosphereCache
+{
+    FileStream      mStream;
+    const uint16_t* pTexels; //	ATMOSPHERE_PACKED_TEXELS, see PackAtmosphereTables
+} AtmosphereCache;
+
+//	Cache file of the given hash. pFileName must hold at least ATMOSPHERE_CACHE_FILE_NAME_LENGTH characters.
+static const uint32_t ATMOSPHERE_CACHE_FILE_NAME_LENGTH = 32;
+void                  GetAtmosphereCacheFileName(uint64_t hash, char* pFileName);
+
+//	Maps the cache file. Fails when the file is missing or was not written completely.
+bool OpenAtmosphereCache(ResourceDirectory resourceDir, uint64_t hash, AtmosphereCache* pCache);
+void CloseAtmosphereCache(AtmosphereCache* pCache);
+
+bool SaveAtmosphereCache(ResourceDirectory resourceDir, uint64_t hash, const uint16_t* pTexels);
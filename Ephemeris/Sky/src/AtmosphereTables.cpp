@@ -0,0 +1,882 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "AtmosphereTables.h"
+#include "SkyTasks.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+#include "../../../../The-Forge/Common_3/Utilities/Threading/Atomics.h"
+
+//	Port of the precomputation of Bruneton's reference implementation. The lookups follow RenderSky.h
+//	(TRANSMITTANCE_NON_LINEAR, INSCATTER_NON_LINEAR) so the shaders read the tables unchanged.
+//	Every texel is independent within a pass, the rgb channels are integrated together in one vec4.
+
+static const uint32_t INSCATTER_ROW_TEXELS = RES_MU_S * RES_NU;
+static const uint32_t INSCATTER_ROWS_PER_TASK = 8;
+static const uint32_t SPHERICAL_PHI_SAMPLES = 2 * INSCATTER_SPHERICAL_INTEGRAL_SAMPLES;
+static const uint32_t IRRADIANCE_PHI_SAMPLES = 2 * IRRADIANCE_INTEGRAL_SAMPLES;
+
+struct AtmosphereContext
+{
+    const AtmosphereParams* pParams;
+    AtmosphereTables*       pTables;
+
+    vec4* pDeltaE;  //	Irradiance of the current order
+    vec4* pDeltaSR; //	Rayleigh, or all of the scattering after the first order
+    vec4* pDeltaSM; //	Mie, first order only
+    vec4* pDeltaJ;  //	Radiance scattered towards the viewer
+    bool  bFirstOrder;
+
+    uint16_t* pPackedTexels; //	Optional output of the last step
+
+    vec4  mBetaR;
+    vec4  mBetaMSca;
+    vec4  mBetaMEx;
+
+    float mSphericalCosPhi[SPHERICAL_PHI_SAMPLES];
+    float mSphericalSinPhi[SPHERICAL_PHI_SAMPLES];
+    float mIrradianceCosPhi[IRRADIANCE_PHI_SAMPLES];
+    float mIrradianceSinPhi[IRRADIANCE_PHI_SAMPLES];
+};
+
+typedef void (*AtmosphereRowFunc)(const AtmosphereContext* pContext, uint32_t row);
+
+struct AtmospherePass
+{
+    const AtmosphereContext* pContext;
+    AtmosphereRowFunc        pRowFunc;
+    uint32_t                 mRowCount;
+    uint32_t                 mRowsPerTask;
+    uint32_t                 mTaskCount;
+    tfrg_atomic32_t          mCompletedTasks;
+};
+
+/************************************************************************/
+// Sampling, GPU conventions: texel centers at (i + 0.5) / size, clamp to edge
+/************************************************************************/
+static void GetLinearWeights(float u, int size, int* pI0, int* pI1, float* pFrac)
+{
+    const float x = u * (float)size - 0.5f;
+    const float x0 = floorf(x);
+    *pFrac = x - x0;
+    *pI0 = clamp((int)x0, 0, size - 1);
+    *pI1 = clamp((int)x0 + 1, 0, size - 1);
+}
+
+static vec4 SampleTable2D(const vec4* pTable, int width, int height, float u, float v)
+{
+    int   x0, x1, y0, y1;
+    float fx, fy;
+    GetLinearWeights(u, width, &x0, &x1, &fx);
+    GetLinearWeights(v, height, &y0, &y1, &fy);
+
+    const vec4 row0 = lerp(fx, pTable[y0 * width + x0], pTable[y0 * width + x1]);
+    const vec4 row1 = lerp(fx, pTable[y1 * width + x0], pTable[y1 * width + x1]);
+    return lerp(fy, row0, row1);
+}
+
+//	Texel offsets and weights of a 4D lookup. Shared when several tables are read at the same coordinates.
+struct Lookup4D
+{
+    int   mOffsets[2][8];
+    float mWeights[2][3];
+    float mNuLerp;
+};
+
+static void GetLookup3D(float u, float v, float w, int* pOffsets, float* pWeights)
+{
+    int x[2], y[2], z[2];
+    GetLinearWeights(u, INSCATTER_ROW_TEXELS, &x[0], &x[1], &pWeights[0]);
+    GetLinearWeights(v, RES_MU, &y[0], &y[1], &pWeights[1]);
+    GetLinearWeights(w, RES_R, &z[0], &z[1], &pWeights[2]);
+
+    for (int i = 0; i < 8; ++i)
+        pOffsets[i] = (z[(i >> 2) & 1] * RES_MU + y[(i >> 1) & 1]) * INSCATTER_ROW_TEXELS + x[i & 1];
+}
+
+//	texture4D of RenderSky.h, with the linear nu interpolation of the original precomputation
+static Lookup4D GetLookup4D(float r, float mu, float muS, float nu)
+{
+    r = clamp(r, Rg, Rt);
+
+    const float H = sqrtf(Rt * Rt - Rg * Rg);
+    const float rho = sqrtf(max(r * r - Rg * Rg, 0.0f));
+    const float rmu = r * mu;
+    const float delta = rmu * rmu - r * r + Rg * Rg;
+    const bool  bGround = rmu < 0.0f && delta > 0.0f;
+    const vec4  cst = bGround ? vec4(1.0f, 0.0f, 0.0f, 0.5f - 0.5f / float(RES_MU)) : vec4(-1.0f, H * H, H, 0.5f + 0.5f / float(RES_MU));
+
+    const float uR = 0.5f / float(RES_R) + rho / H * (1.0f - 1.0f / float(RES_R));
+    const float uMu = cst.getW() + (rmu * cst.getX() + sqrtf(max(delta + cst.getY(), 0.0f))) / max(rho + cst.getZ(), 1e-6f) *
+                                       (0.5f - 1.0f / float(RES_MU));
+    const float uMuS = 0.5f / float(RES_MU_S) +
+                       (atanf(max(muS, -0.1975f) * tanf(1.26f * 1.1f)) / 1.1f + (1.0f - 0.26f)) * 0.5f * (1.0f - 1.0f / float(RES_MU_S));
+
+    float       nuLerp = (nu + 1.0f) / 2.0f * (float(RES_NU) - 1.0f);
+    const float uNu = floorf(nuLerp);
+
+    Lookup4D lookup;
+    lookup.mNuLerp = nuLerp - uNu;
+    GetLookup3D((uNu + uMuS) / float(RES_NU), uMu, uR, lookup.mOffsets[0], lookup.mWeights[0]);
+    GetLookup3D((uNu + uMuS + 1.0f) / float(RES_NU), uMu, uR, lookup.mOffsets[1], lookup.mWeights[1]);
+    return lookup;
+}
+
+static vec4 SampleTable3D(const vec4* pTable, const int* pOffsets, const float* pWeights)
+{
+    const vec4 c00 = lerp(pWeights[0], pTable[pOffsets[0]], pTable[pOffsets[1]]);
+    const vec4 c01 = lerp(pWeights[0], pTable[pOffsets[2]], pTable[pOffsets[3]]);
+    const vec4 c10 = lerp(pWeights[0], pTable[pOffsets[4]], pTable[pOffsets[5]]);
+    const vec4 c11 = lerp(pWeights[0], pTable[pOffsets[6]], pTable[pOffsets[7]]);
+    return lerp(pWeights[2], lerp(pWeights[1], c00, c01), lerp(pWeights[1], c10, c11));
+}
+
+static vec4 SampleTable4D(const vec4* pTable, const Lookup4D& lookup)
+{
+    return lerp(lookup.mNuLerp, SampleTable3D(pTable, lookup.mOffsets[0], lookup.mWeights[0]),
+                SampleTable3D(pTable, lookup.mOffsets[1], lookup.mWeights[1]));
+}
+
+/************************************************************************/
+// Physical model, see RenderSky.h
+/************************************************************************/
+static vec4 ExpPerElem(const vec4& v) { return vec4(expf(v.getX()), expf(v.getY()), expf(v.getZ()), expf(v.getW())); }
+
+static float PhaseFunctionR(float mu) { return (3.0f / (16.0f * PI)) * (1.0f + mu * mu); }
+
+static float PhaseFunctionM(const AtmosphereParams* pParams, float mu)
+{
+    const float g = pParams->mMieG;
+    return 1.5f * 1.0f / (4.0f * PI) * (1.0f - g * g) * powf(fabsf(1.0f + (g * g) - 2.0f * g * mu), -1.5f) * (1.0f + mu * mu) /
+           (2.0f + g * g);
+}
+
+//	Nearest intersection of ray r,mu with the ground or the top atmosphere boundary
+static float Limit(float r, float mu)
+{
+    float dout = -r * mu + sqrtf(r * r * (mu * mu - 1.0f) + RL * RL);
+
+    const float delta2 = r * r * (mu * mu - 1.0f) + Rg * Rg;
+    if (delta2 >= 0.0f)
+    {
+        const float din = -r * mu - sqrtf(delta2);
+        if (din >= 0.0f)
+            dout = min(dout, din);
+    }
+
+    return dout;
+}
+
+static vec4 Transmittance(const AtmosphereContext* pContext, float r, float mu)
+{
+    const float uR = sqrtf(max((r - Rg) / (Rt - Rg), 0.0f));
+    const float uMu = atanf((mu + 0.15f) / (1.0f + 0.15f) * tanf(1.5f)) / 1.5f;
+    return SampleTable2D(pContext->pTables->pTransmittance, TRANSMITTANCE_W, TRANSMITTANCE_H, uMu, uR);
+}
+
+//	Transmittance between x and the point at distance d along mu, the segment must not intersect the ground
+static vec4 Transmittance(const AtmosphereContext* pContext, float r, float mu, float d)
+{
+    const float r1 = sqrtf(r * r + d * d + 2.0f * r * mu * d);
+    const float mu1 = (r * mu + d) / r1;
+
+    //	Unlike a texture fetch on the GPU, a NaN would spread through all the following orders
+    const vec4 epsilon = vec4(1e-30f);
+    const vec4 result = mu > 0.0f ? divPerElem(Transmittance(pContext, r, mu), maxPerElem(Transmittance(pContext, r1, mu1), epsilon))
+                                  : divPerElem(Transmittance(pContext, r1, -mu1), maxPerElem(Transmittance(pContext, r, -mu), epsilon));
+    return minPerElem(result, vec4(1.0f));
+}
+
+static vec4 Irradiance(const vec4* pTable, float r, float muS)
+{
+    const float uR = (r - Rg) / (Rt - Rg);
+    const float uMuS = (muS + 0.2f) / (1.0f + 0.2f);
+    return SampleTable2D(pTable, SKY_W, SKY_H, uMuS, uR);
+}
+
+//	getMuMuSNu of RenderSky.h for texel (x, y) of a layer
+static void GetMuMuSNu(float x, float y, float r, const vec4& dhdH, float* pMu, float* pMuS, float* pNu)
+{
+    if (y < float(RES_MU) / 2.0f)
+    {
+        float d = 1.0f - y / (float(RES_MU) / 2.0f - 1.0f);
+        d = min(max(dhdH.getZ(), d * dhdH.getW()), dhdH.getW() * 0.999f);
+        *pMu = (Rg * Rg - r * r - d * d) / (2.0f * r * d);
+        *pMu = min(*pMu, -sqrtf(1.0f - (Rg / r) * (Rg / r)) - 0.001f);
+    }
+    else
+    {
+        float d = (y - float(RES_MU) / 2.0f) / (float(RES_MU) / 2.0f - 1.0f);
+        d = min(max(dhdH.getX(), d * dhdH.getY()), dhdH.getY() * 0.999f);
+        *pMu = (Rt * Rt - r * r - d * d) / (2.0f * r * d);
+    }
+
+    const float muS = fmodf(x, float(RES_MU_S)) / (float(RES_MU_S) - 1.0f);
+    *pMuS = tanf((2.0f * muS - 1.0f + 0.26f) * 1.1f) / tanf(1.26f * 1.1f);
+    *pNu = -1.0f + floorf(x / float(RES_MU_S)) / (float(RES_NU) - 1.0f) * 2.0f;
+}
+
+//	Radius and distances to the boundaries of an inscatter layer
+static void GetLayer(uint32_t layer, float* pR, vec4* pDhdH)
+{
+    float r = (float)layer / (RES_R - 1.0f);
+    r = r * r;
+    r = sqrtf(Rg * Rg + r * (Rt * Rt - Rg * Rg)) + (layer == 0 ? 0.01f : (layer == RES_R - 1 ? -0.001f : 0.0f));
+
+    const float dmin = Rt - r;
+    const float dmax = sqrtf(r * r - Rg * Rg) + sqrtf(Rt * Rt - Rg * Rg);
+    const float dminp = r - Rg;
+    const float dmaxp = sqrtf(r * r - Rg * Rg);
+
+    *pR = r;
+    *pDhdH = vec4(dmin, dmax, dminp, dmaxp);
+}
+
+/************************************************************************/
+// Passes, one table row per call
+/************************************************************************/
+static float OpticalDepth(float H, float r, float mu)
+{
+    if (mu < -sqrtf(1.0f - (Rg / r) * (Rg / r)))
+        return 1e9f;
+
+    float       result = 0.0f;
+    const float dx = Limit(r, mu) / float(TRANSMITTANCE_INTEGRAL_SAMPLES);
+    float       yi = expf(-(r - Rg) / H);
+    for (int i = 1; i <= TRANSMITTANCE_INTEGRAL_SAMPLES; ++i)
+    {
+        const float xj = float(i) * dx;
+        const float yj = expf(-(sqrtf(r * r + xj * xj + 2.0f * xj * r * mu) - Rg) / H);
+        result += (yi + yj) / 2.0f * dx;
+        yi = yj;
+    }
+    return result;
+}
+
+static void ComputeTransmittanceRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    const AtmosphereParams* pParams = pContext->pParams;
+
+    float r = (row + 0.5f) / TRANSMITTANCE_H;
+    r = Rg + (r * r) * (Rt - Rg);
+
+    for (uint32_t x = 0; x < TRANSMITTANCE_W; ++x)
+    {
+        const float mu = -0.15f + tanf(1.5f * (x + 0.5f) / TRANSMITTANCE_W) / tanf(1.5f) * (1.0f + 0.15f);
+        const vec4  depth = pContext->mBetaR * OpticalDepth(pParams->mRayleighHeight, r, mu) +
+                           pContext->mBetaMEx * OpticalDepth(pParams->mMieHeight, r, mu);
+
+        vec4 transmittance = ExpPerElem(-depth);
+        transmittance.setW(0.0f);
+        pContext->pTables->pTransmittance[row * TRANSMITTANCE_W + x] = transmittance;
+    }
+}
+
+static void GetIrradianceRMuS(uint32_t x, uint32_t y, float* pR, float* pMuS)
+{
+    *pR = Rg + (y + 0.5f) / SKY_H * (Rt - Rg);
+    *pMuS = -0.2f + (x + 0.5f) / SKY_W * (1.0f + 0.2f);
+}
+
+//	Direct sun light reaching the ground, only the input of the second order
+static void ComputeIrradiance1Row(const AtmosphereContext* pContext, uint32_t row)
+{
+    for (uint32_t x = 0; x < SKY_W; ++x)
+    {
+        float r, muS;
+        GetIrradianceRMuS(x, row, &r, &muS);
+
+        vec4 irradiance = Transmittance(pContext, r, muS) * max(muS, 0.0f);
+        irradiance.setW(0.0f);
+        pContext->pDeltaE[row * SKY_W + x] = irradiance;
+    }
+}
+
+static void ComputeIrradianceNRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    const float dphi = PI / float(IRRADIANCE_INTEGRAL_SAMPLES);
+    const float dtheta = PI / float(IRRADIANCE_INTEGRAL_SAMPLES);
+
+    for (uint32_t x = 0; x < SKY_W; ++x)
+    {
+        float r, muS;
+        GetIrradianceRMuS(x, row, &r, &muS);
+
+        const vec3 s = vec3(max(sqrtf(1.0f - muS * muS), 0.0f), 0.0f, muS);
+        vec4       result = vec4(0.0f);
+
+        for (int itheta = 0; itheta < IRRADIANCE_INTEGRAL_SAMPLES / 2; ++itheta)
+        {
+            const float theta = (float(itheta) + 0.5f) * dtheta;
+            const float sinTheta = sinf(theta);
+            const float cosTheta = cosf(theta);
+            const float dw = dtheta * dphi * sinTheta;
+
+            for (uint32_t iphi = 0; iphi < IRRADIANCE_PHI_SAMPLES; ++iphi)
+            {
+                const vec3 w = vec3(pContext->mIrradianceCosPhi[iphi] * sinTheta, pContext->mIrradianceSinPhi[iphi] * sinTheta, cosTheta);
+                const float    nu = dot(s, w);
+                const Lookup4D lookup = GetLookup4D(r, w.getZ(), muS, nu);
+
+                vec4 radiance = SampleTable4D(pContext->pDeltaSR, lookup);
+                if (pContext->bFirstOrder)
+                {
+                    radiance = radiance * PhaseFunctionR(nu) +
+                               SampleTable4D(pContext->pDeltaSM, lookup) * PhaseFunctionM(pContext->pParams, nu);
+                }
+
+                result += radiance * (w.getZ() * dw);
+            }
+        }
+
+        result.setW(0.0f);
+        pContext->pDeltaE[row * SKY_W + x] = result;
+        pContext->pTables->pIrradiance[row * SKY_W + x] += result;
+    }
+}
+
+static void SingleScatteringIntegrand(const AtmosphereContext* pContext, float r, float mu, float muS, float nu, float t, vec4* pRay,
+                                      vec4* pMie)
+{
+    float       ri = sqrtf(r * r + t * t + 2.0f * r * mu * t);
+    const float muSi = (nu * t + muS * r) / ri;
+    ri = max(Rg, ri);
+
+    if (muSi >= -sqrtf(1.0f - Rg * Rg / (ri * ri)))
+    {
+        const vec4 ti = mulPerElem(Transmittance(pContext, r, mu, t), Transmittance(pContext, ri, muSi));
+        *pRay = ti * expf(-(ri - Rg) / pContext->pParams->mRayleighHeight);
+        *pMie = ti * expf(-(ri - Rg) / pContext->pParams->mMieHeight);
+    }
+    else
+    {
+        *pRay = vec4(0.0f);
+        *pMie = vec4(0.0f);
+    }
+}
+
+static void ComputeInscatter1Row(const AtmosphereContext* pContext, uint32_t row)
+{
+    float r;
+    vec4  dhdH;
+    GetLayer(row / RES_MU, &r, &dhdH);
+
+    const uint32_t offset = row * INSCATTER_ROW_TEXELS;
+    for (uint32_t x = 0; x < INSCATTER_ROW_TEXELS; ++x)
+    {
+        float mu, muS, nu;
+        GetMuMuSNu((float)x, (float)(row % RES_MU), r, dhdH, &mu, &muS, &nu);
+
+        vec4        ray = vec4(0.0f);
+        vec4        mie = vec4(0.0f);
+        const float dx = Limit(r, mu) / float(INSCATTER_INTEGRAL_SAMPLES);
+        vec4        rayi, miei;
+        SingleScatteringIntegrand(pContext, r, mu, muS, nu, 0.0f, &rayi, &miei);
+        for (int i = 1; i <= INSCATTER_INTEGRAL_SAMPLES; ++i)
+        {
+            vec4 rayj, miej;
+            SingleScatteringIntegrand(pContext, r, mu, muS, nu, float(i) * dx, &rayj, &miej);
+            ray += (rayi + rayj) * (0.5f * dx);
+            mie += (miei + miej) * (0.5f * dx);
+            rayi = rayj;
+            miei = miej;
+        }
+
+        ray = mulPerElem(ray, pContext->mBetaR);
+        mie = mulPerElem(mie, pContext->mBetaMSca);
+
+        pContext->pDeltaSR[offset + x] = ray;
+        pContext->pDeltaSM[offset + x] = mie;
+        pContext->pTables->pInscatter[offset + x] = vec4(ray.getX(), ray.getY(), ray.getZ(), mie.getX());
+    }
+}
+
+//	Light scattered towards the viewer at every point, from the previous order and the ground
+static vec4 ComputeScatteredRadiance(const AtmosphereContext* pContext, float r, float mu, float muS, float nu)
+{
+    const AtmosphereParams* pParams = pContext->pParams;
+
+    r = clamp(r, Rg, Rt);
+    mu = clamp(mu, -1.0f, 1.0f);
+    muS = clamp(muS, -1.0f, 1.0f);
+    const float var = sqrtf(1.0f - mu * mu) * sqrtf(1.0f - muS * muS);
+    nu = clamp(nu, muS * mu - var, muS * mu + var);
+
+    const float cthetamin = -sqrtf(1.0f - (Rg / r) * (Rg / r));
+
+    const vec3  v = vec3(sqrtf(1.0f - mu * mu), 0.0f, mu);
+    const float sx = v.getX() == 0.0f ? 0.0f : (nu - muS * mu) / v.getX();
+    const vec3  s = vec3(sx, sqrtf(max(0.0f, 1.0f - sx * sx - muS * muS)), muS);
+
+    const float dphi = PI / float(INSCATTER_SPHERICAL_INTEGRAL_SAMPLES);
+    const float dtheta = PI / float(INSCATTER_SPHERICAL_INTEGRAL_SAMPLES);
+
+    const vec4 scatteringR = pContext->mBetaR * expf(-(r - Rg) / pParams->mRayleighHeight);
+    const vec4 scatteringM = pContext->mBetaMSca * expf(-(r - Rg) / pParams->mMieHeight);
+
+    vec4 raymie = vec4(0.0f);
+
+    for (int itheta = 0; itheta < INSCATTER_SPHERICAL_INTEGRAL_SAMPLES; ++itheta)
+    {
+        const float theta = (float(itheta) + 0.5f) * dtheta;
+        const float ctheta = cosf(theta);
+        const float stheta = sinf(theta);
+        const float dw = dtheta * dphi * stheta;
+
+        float dground = 0.0f;
+        vec4  groundTransmittance = vec4(0.0f);
+        if (ctheta < cthetamin)
+        {
+            //	Ground reflectance / PI is folded in here
+            dground = -r * ctheta - sqrtf(r * r * (ctheta * ctheta - 1.0f) + Rg * Rg);
+            groundTransmittance =
+                Transmittance(pContext, Rg, -(r * ctheta + dground) / Rg, dground) * (pParams->mGroundReflectance / PI);
+        }
+
+        for (uint32_t iphi = 0; iphi < SPHERICAL_PHI_SAMPLES; ++iphi)
+        {
+            const vec3 w = vec3(pContext->mSphericalCosPhi[iphi] * stheta, pContext->mSphericalSinPhi[iphi] * stheta, ctheta);
+
+            const float nu1 = dot(s, w);
+            const float nu2 = dot(v, w);
+
+            vec4 raymie1 = vec4(0.0f);
+            if (dground > 0.0f)
+            {
+                const vec3 groundNormal = (vec3(0.0f, 0.0f, r) + w * dground) / Rg;
+                raymie1 = mulPerElem(Irradiance(pContext->pDeltaE, Rg, dot(groundNormal, s)), groundTransmittance);
+            }
+
+            const Lookup4D lookup = GetLookup4D(r, w.getZ(), muS, nu1);
+            if (pContext->bFirstOrder)
+            {
+                raymie1 += SampleTable4D(pContext->pDeltaSR, lookup) * PhaseFunctionR(nu1) +
+                           SampleTable4D(pContext->pDeltaSM, lookup) * PhaseFunctionM(pParams, nu1);
+            }
+            else
+            {
+                raymie1 += SampleTable4D(pContext->pDeltaSR, lookup);
+            }
+
+            raymie += mulPerElem(raymie1, scatteringR * PhaseFunctionR(nu2) + scatteringM * PhaseFunctionM(pParams, nu2)) * dw;
+        }
+    }
+
+    return raymie;
+}
+
+static void ComputeScatteredRadianceRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    float r;
+    vec4  dhdH;
+    GetLayer(row / RES_MU, &r, &dhdH);
+
+    const uint32_t offset = row * INSCATTER_ROW_TEXELS;
+    for (uint32_t x = 0; x < INSCATTER_ROW_TEXELS; ++x)
+    {
+        float mu, muS, nu;
+        GetMuMuSNu((float)x, (float)(row % RES_MU), r, dhdH, &mu, &muS, &nu);
+        pContext->pDeltaJ[offset + x] = ComputeScatteredRadiance(pContext, r, mu, muS, nu);
+    }
+}
+
+static vec4 MultipleScatteringIntegrand(const AtmosphereContext* pContext, float r, float mu, float muS, float nu, float t)
+{
+    const float ri = sqrtf(r * r + t * t + 2.0f * r * mu * t);
+    const float mui = (r * mu + t) / ri;
+    const float muSi = (nu * t + muS * r) / ri;
+    return mulPerElem(SampleTable4D(pContext->pDeltaJ, GetLookup4D(ri, mui, muSi, nu)), Transmittance(pContext, r, mu, t));
+}
+
+static void ComputeInscatterNRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    float r;
+    vec4  dhdH;
+    GetLayer(row / RES_MU, &r, &dhdH);
+
+    const uint32_t offset = row * INSCATTER_ROW_TEXELS;
+    for (uint32_t x = 0; x < INSCATTER_ROW_TEXELS; ++x)
+    {
+        float mu, muS, nu;
+        GetMuMuSNu((float)x, (float)(row % RES_MU), r, dhdH, &mu, &muS, &nu);
+
+        vec4        raymie = vec4(0.0f);
+        const float dx = Limit(r, mu) / float(INSCATTER_INTEGRAL_SAMPLES);
+        vec4        raymiei = MultipleScatteringIntegrand(pContext, r, mu, muS, nu, 0.0f);
+        for (int i = 1; i <= INSCATTER_INTEGRAL_SAMPLES; ++i)
+        {
+            const vec4 raymiej = MultipleScatteringIntegrand(pContext, r, mu, muS, nu, float(i) * dx);
+            raymie += (raymiei + raymiej) * (0.5f * dx);
+            raymiei = raymiej;
+        }
+
+        raymie.setW(0.0f);
+        pContext->pDeltaSR[offset + x] = raymie;
+        //	The table stores the Rayleigh phase function separately
+        pContext->pTables->pInscatter[offset + x] += raymie / PhaseFunctionR(nu);
+    }
+}
+
+/************************************************************************/
+// Packing
+/************************************************************************/
+static uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t  exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    const uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+        return (uint16_t)sign;
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7c00);
+
+    //	Round to nearest, a carry into the exponent is still the correct result
+    return (uint16_t)((sign | ((uint32_t)exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
+
+//	The packed texels are split in chunks of one inscatter row, every table is a whole number of them
+static const uint32_t PACK_CHUNK_TEXELS = INSCATTER_ROW_TEXELS;
+static const uint32_t PACK_CHUNK_COUNT = ATMOSPHERE_PACKED_TEXELS / PACK_CHUNK_TEXELS;
+
+static void PackAtmosphereChunk(const AtmosphereTables* pTables, uint16_t* pTexels, uint32_t chunk)
+{
+    uint32_t    first = chunk * PACK_CHUNK_TEXELS;
+    const vec4* pTable = pTables->pTransmittance;
+    if (first >= ATMOSPHERE_TRANSMITTANCE_TEXELS)
+    {
+        first -= ATMOSPHERE_TRANSMITTANCE_TEXELS;
+        pTable = pTables->pIrradiance;
+        if (first >= ATMOSPHERE_IRRADIANCE_TEXELS)
+        {
+            first -= ATMOSPHERE_IRRADIANCE_TEXELS;
+            pTable = pTables->pInscatter;
+        }
+    }
+
+    uint16_t* pDst = pTexels + chunk * PACK_CHUNK_TEXELS * 4;
+    for (uint32_t i = 0; i < PACK_CHUNK_TEXELS; ++i)
+    {
+        const vec4& texel = pTable[first + i];
+        pDst[i * 4 + 0] = FloatToHalf(texel.getX());
+        pDst[i * 4 + 1] = FloatToHalf(texel.getY());
+        pDst[i * 4 + 2] = FloatToHalf(texel.getZ());
+        pDst[i * 4 + 3] = FloatToHalf(texel.getW());
+    }
+}
+
+static void PackRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    PackAtmosphereChunk(pContext->pTables, pContext->pPackedTexels, row);
+}
+
+//	The irradiance table holds the sky light only, the higher orders are accumulated into it
+static void ClearIrradianceRow(const AtmosphereContext* pContext, uint32_t row)
+{
+    for (uint32_t x = 0; x < SKY_W; ++x)
+        pContext->pTables->pIrradiance[row * SKY_W + x] = vec4(0.0f);
+}
+
+/************************************************************************/
+// Scheduling
+/************************************************************************/
+struct AtmosphereStep
+{
+    AtmosphereRowFunc pRowFunc;
+    uint32_t          mRowCount;
+    uint32_t          mRowsPerTask;
+    bool              bFirstOrder;
+};
+
+struct AtmosphereGenerator
+{
+    AtmosphereContext* pContext;
+    AtmosphereParams   mParams;
+    ThreadSystem       mThreadSystem;
+    AtmospherePass     mPass;
+    uint32_t           mStep;
+    bool               bRunning;
+};
+
+//	Steps of a generation in order, false past the last one. Every step reads the results of the previous ones.
+static bool GetAtmosphereStep(const AtmosphereGenerator* pGenerator, uint32_t index, AtmosphereStep* pStep)
+{
+    const uint32_t inscatterRows = RES_MU * RES_R;
+    const uint32_t orderSteps = 3 * (max(pGenerator->mParams.mScatteringOrders, 1u) - 1);
+
+    const AtmosphereStep firstSteps[] = {
+        { ComputeTransmittanceRow, TRANSMITTANCE_H, 1, true },
+        { ComputeIrradiance1Row, SKY_H, 1, true },
+        { ComputeInscatter1Row, inscatterRows, INSCATTER_ROWS_PER_TASK, true },
+        { ClearIrradianceRow, SKY_H, SKY_H, true },
+    };
+    const uint32_t firstStepCount = sizeof(firstSteps) / sizeof(firstSteps[0]);
+
+    if (index < firstStepCount)
+    {
+        *pStep = firstSteps[index];
+        return true;
+    }
+
+    index -= firstStepCount;
+    if (index < orderSteps)
+    {
+        const AtmosphereStep orderStep[] = {
+            { ComputeScatteredRadianceRow, inscatterRows, INSCATTER_ROWS_PER_TASK, index < 3 },
+            { ComputeIrradianceNRow, SKY_H, 1, index < 3 },
+            { ComputeInscatterNRow, inscatterRows, INSCATTER_ROWS_PER_TASK, index < 3 },
+        };
+        *pStep = orderStep[index % 3];
+        return true;
+    }
+
+    index -= orderSteps;
+    if (index == 0 && pGenerator->pContext->pPackedTexels)
+    {
+        *pStep = { PackRow, PACK_CHUNK_COUNT, 64, false };
+        return true;
+    }
+
+    return false;
+}
+
+static void AtmospherePassTask(void* pUser, uint64_t index)
+{
+    AtmospherePass* pPass = (AtmospherePass*)pUser;
+    const uint32_t  firstRow = (uint32_t)index * pPass->mRowsPerTask;
+    const uint32_t  lastRow = min(firstRow + pPass->mRowsPerTask, pPass->mRowCount);
+
+    for (uint32_t row = firstRow; row < lastRow; ++row)
+        pPass->pRowFunc(pPass->pContext, row);
+
+    //	Publishes the rows to the thread that polls the pass
+    tfrg_memorybarrier_release();
+    tfrg_atomic32_add_relaxed(&pPass->mCompletedTasks, 1);
+}
+
+static void SetupAtmosphereStep(AtmosphereGenerator* pGenerator, const AtmosphereStep& step)
+{
+    pGenerator->pContext->bFirstOrder = step.bFirstOrder;
+
+    AtmospherePass* pPass = &pGenerator->mPass;
+    pPass->pContext = pGenerator->pContext;
+    pPass->pRowFunc = step.pRowFunc;
+    pPass->mRowCount = step.mRowCount;
+    pPass->mRowsPerTask = step.mRowsPerTask;
+    pPass->mTaskCount = (step.mRowCount + step.mRowsPerTask - 1) / step.mRowsPerTask;
+    pPass->mCompletedTasks = 0;
+}
+
+static void LaunchAtmosphereStep(AtmosphereGenerator* pGenerator, const AtmosphereStep& step)
+{
+    SetupAtmosphereStep(pGenerator, step);
+
+    AtmospherePass* pPass = &pGenerator->mPass;
+    pGenerator->bRunning = true;
+
+    if (!pGenerator->mThreadSystem)
+    {
+        for (uint32_t i = 0; i < pPass->mTaskCount; ++i)
+            AtmospherePassTask(pPass, i);
+        return;
+    }
+
+    threadSystemAddTaskGroup(pGenerator->mThreadSystem, AtmospherePassTask, pPass->mTaskCount, pPass);
+}
+
+void AddAtmosphereTables(AtmosphereTables* pTables)
+{
+    pTables->pTransmittance = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_TRANSMITTANCE_TEXELS * sizeof(vec4));
+    pTables->pIrradiance = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_IRRADIANCE_TEXELS * sizeof(vec4));
+    pTables->pInscatter = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_INSCATTER_TEXELS * sizeof(vec4));
+}
+
+void RemoveAtmosphereTables(AtmosphereTables* pTables)
+{
+    tf_free(pTables->pTransmittance);
+    tf_free(pTables->pIrradiance);
+    tf_free(pTables->pInscatter);
+    *pTables = {};
+}
+
+void AddAtmosphereGenerator(AtmosphereGenerator** ppGenerator)
+{
+    AtmosphereGenerator* pGenerator = tf_new(AtmosphereGenerator);
+    pGenerator->mThreadSystem = NULL;
+    pGenerator->mStep = 0;
+    pGenerator->bRunning = false;
+
+    AtmosphereContext* pContext = (AtmosphereContext*)tf_memalign(alignof(AtmosphereContext), sizeof(AtmosphereContext));
+    pContext->pParams = &pGenerator->mParams;
+    pContext->pTables = NULL;
+    pContext->pPackedTexels = NULL;
+    pContext->pDeltaE = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_IRRADIANCE_TEXELS * sizeof(vec4));
+    pContext->pDeltaSR = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_INSCATTER_TEXELS * sizeof(vec4));
+    pContext->pDeltaSM = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_INSCATTER_TEXELS * sizeof(vec4));
+    pContext->pDeltaJ = (vec4*)tf_memalign(alignof(vec4), ATMOSPHERE_INSCATTER_TEXELS * sizeof(vec4));
+    pContext->bFirstOrder = true;
+
+    for (uint32_t i = 0; i < SPHERICAL_PHI_SAMPLES; ++i)
+    {
+        const float phi = (float(i) + 0.5f) * PI / float(INSCATTER_SPHERICAL_INTEGRAL_SAMPLES);
+        pContext->mSphericalCosPhi[i] = cosf(phi);
+        pContext->mSphericalSinPhi[i] = sinf(phi);
+    }
+    for (uint32_t i = 0; i < IRRADIANCE_PHI_SAMPLES; ++i)
+    {
+        const float phi = (float(i) + 0.5f) * PI / float(IRRADIANCE_INTEGRAL_SAMPLES);
+        pContext->mIrradianceCosPhi[i] = cosf(phi);
+        pContext->mIrradianceSinPhi[i] = sinf(phi);
+    }
+
+    pGenerator->pContext = pContext;
+    *ppGenerator = pGenerator;
+}
+
+void RemoveAtmosphereGenerator(AtmosphereGenerator* pGenerator)
+{
+    //	The running pass still uses the context. Only its own tasks are waited for, other work on the thread system may go on.
+    if (pGenerator->bRunning)
+    {
+        while (tfrg_atomic32_load_acquire(&pGenerator->mPass.mCompletedTasks) < pGenerator->mPass.mTaskCount)
+        {
+        }
+    }
+
+    AtmosphereContext* pContext = pGenerator->pContext;
+    tf_free(pContext->pDeltaE);
+    tf_free(pContext->pDeltaSR);
+    tf_free(pContext->pDeltaSM);
+    tf_free(pContext->pDeltaJ);
+    tf_free(pContext);
+    tf_delete(pGenerator);
+}
+
+void StartAtmosphereGeneration(AtmosphereGenerator* pGenerator, ThreadSystem threadSystem, const AtmosphereParams& params,
+                               AtmosphereTables* pTables, uint16_t* pPackedTexels)
+{
+    ASSERT(!pGenerator->bRunning);
+
+    pGenerator->mParams = params;
+    pGenerator->mThreadSystem = threadSystem;
+    pGenerator->mStep = 0;
+
+    AtmosphereContext* pContext = pGenerator->pContext;
+    pContext->pTables = pTables;
+    pContext->pPackedTexels = pPackedTexels;
+    pContext->mBetaR = vec4(params.mRayleighScattering, 0.0f);
+    pContext->mBetaMSca = vec4(params.mMieScattering, 0.0f);
+    pContext->mBetaMEx = pContext->mBetaMSca / params.mMieAlbedo;
+}
+
+bool UpdateAtmosphereGeneration(AtmosphereGenerator* pGenerator)
+{
+    if (pGenerator->bRunning)
+    {
+        if (tfrg_atomic32_load_acquire(&pGenerator->mPass.mCompletedTasks) < pGenerator->mPass.mTaskCount)
+            return false;
+
+        pGenerator->bRunning = false;
+        ++pGenerator->mStep;
+    }
+
+    AtmosphereStep step;
+    if (!GetAtmosphereStep(pGenerator, pGenerator->mStep, &step))
+        return true;
+
+    LaunchAtmosphereStep(pGenerator, step);
+    return false;
+}
+
+void GenerateAtmosphereTables(ThreadSystem threadSystem, const AtmosphereParams& params, AtmosphereTables* pTables)
+{
+    AtmosphereGenerator* pGenerator = NULL;
+    AddAtmosphereGenerator(&pGenerator);
+    StartAtmosphereGeneration(pGenerator, threadSystem, params, pTables, NULL);
+
+    //	Every step waits for its own tasks only and the calling thread takes its share of the rows
+    AtmosphereStep step;
+    for (uint32_t index = 0; GetAtmosphereStep(pGenerator, index, &step); ++index)
+    {
+        SetupAtmosphereStep(pGenerator, step);
+        RunSkyTasks(threadSystem, AtmospherePassTask, pGenerator->mPass.mTaskCount, &pGenerator->mPass);
+    }
+
+    RemoveAtmosphereGenerator(pGenerator);
+}
+
+void PackAtmosphereTables(const AtmosphereTables* pTables, uint16_t* pTexels)
+{
+    for (uint32_t chunk = 0; chunk < PACK_CHUNK_COUNT; ++chunk)
+        PackAtmosphereChunk(pTables, pTexels, chunk);
+}
+
+//	Bumped whenever the generator changes its results
+static const uint32_t ATMOSPHERE_TABLES_VERSION = 1;
+
+static uint64_t HashAtmosphereValue(uint64_t hash, uint32_t value)
+{
+    //	FNV-1a
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint64_t HashAtmosphereValue(uint64_t hash, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return HashAtmosphereValue(hash, bits);
+}
+
+uint64_t GetAtmosphereTablesHash(const AtmosphereParams& params)
+{
+    const uint32_t layout[] = { ATMOSPHERE_TABLES_VERSION,
+                                TRANSMITTANCE_W,
+                                TRANSMITTANCE_H,
+                                SKY_W,
+                                SKY_H,
+                                RES_R,
+                                RES_MU,
+                                RES_MU_S,
+                                RES_NU,
+                                TRANSMITTANCE_INTEGRAL_SAMPLES,
+                                INSCATTER_INTEGRAL_SAMPLES,
+                                IRRADIANCE_INTEGRAL_SAMPLES,
+                                INSCATTER_SPHERICAL_INTEGRAL_SAMPLES };
+    const float    model[] = { Rg,
+                               Rt,
+                               RL,
+                               params.mRayleighScattering.getX(),
+                               params.mRayleighScattering.getY(),
+                               params.mRayleighScattering.getZ(),
+                               params.mRayleighHeight,
+                               params.mMieScattering.getX(),
+                               params.mMieScattering.getY(),
+                               params.mMieScattering.getZ(),
+                               params.mMieHeight,
+                               params.mMieAlbedo,
+                               params.mMieG,
+                               params.mGroundReflectance };
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < sizeof(layout) / sizeof(layout[0]); ++i)
+        hash = HashAtmosphereValue(hash, layout[i]);
+    for (uint32_t i = 0; i < sizeof(model) / sizeof(model[0]); ++i)
+        hash = HashAtmosphereValue(hash, model[i]);
+    return HashAtmosphereValue(hash, params.mScatteringOrders);
+}
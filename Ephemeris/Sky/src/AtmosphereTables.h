@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../../../../The-Forge/Common_3/Utilities/Math/MathTypes.h"
+#include "../../../../The-Forge/Common_3/Utilities/Threading/ThreadSystem.h"
+
+#include "SkyCommon.h"
+
+//	Physical model of the precomputed atmospheric scattering (Bruneton and Neyret 2008).
+//	Distances are in km. Rg and Rt are fixed by SkyCommon.h, the shaders map the tables with them.
+//	The defaults are the ones Transmittance.tex and Irradiance.tex were baked with.
+struct AtmosphereParams
+{
+    AtmosphereParams():
+        mRayleighScattering(5.8e-3f, 1.35e-2f, 3.31e-2f), mRayleighHeight(8.0f), mMieScattering(4e-3f, 4e-3f, 4e-3f),
+        mMieHeight(1.2f), mMieAlbedo(0.9f), mMieG(0.8f), mGroundReflectance(0.1f), mScatteringOrders(4)
+    {
+    }
+
+    vec3     mRayleighScattering; //	betaR
+    float    mRayleighHeight;     //	HR
+    vec3     mMieScattering;      //	betaMSca
+    float    mMieHeight;          //	HM
+    float    mMieAlbedo;          //	betaMSca / betaMEx
+    float    mMieG;
+    float    mGroundReflectance;
+    uint32_t mScatteringOrders; //	1 is single scattering only
+};
+
+//	Same layouts as Transmittance.tex, Irradiance.tex and Inscatter.tex, see RenderSky.h for the parameterization
+struct AtmosphereTables
+{
+    vec4* pTransmittance; //	TRANSMITTANCE_W x TRANSMITTANCE_H
+    vec4* pIrradiance;    //	SKY_W x SKY_H, sky light only, the sun light comes from the transmittance
+    vec4* pInscatter;     //	(RES_MU_S * RES_NU) x RES_MU x RES_R, rgb Rayleigh and multiple scattering, a single Mie red
+};
+
+static const uint32_t ATMOSPHERE_TRANSMITTANCE_TEXELS = TRANSMITTANCE_W * TRANSMITTANCE_H;
+static const uint32_t ATMOSPHERE_IRRADIANCE_TEXELS = SKY_W * SKY_H;
+static const uint32_t ATMOSPHERE_INSCATTER_TEXELS = RES_MU_S * RES_NU * RES_MU * RES_R;
+static const uint32_t ATMOSPHERE_PACKED_TEXELS =
+    ATMOSPHERE_TRANSMITTANCE_TEXELS + ATMOSPHERE_IRRADIANCE_TEXELS + ATMOSPHERE_INSCATTER_TEXELS;
+
+void AddAtmosphereTables(AtmosphereTables* pTables);
+void RemoveAtmosphereTables(AtmosphereTables* pTables);
+
+//	Fills all the tables, including the multiple scattering orders. Table rows are spread over the thread system,
+//	NULL computes everything on the calling thread. Blocks until done,
+//	but only on its own rows, which the calling thread helps with.
+void GenerateAtmosphereTables(ThreadSystem threadSystem, const AtmosphereParams& params, AtmosphereTables* pTables);
+
+//	Generation spread over several calls, for atmospheres that change at run time. Every step of the generation is one
+//	task group of table rows, UpdateAtmosphereGeneration launches the next one once the previous is done and never waits.
+//	Without a thread system every call computes a whole step on the calling thread.
+typedef struct AtmosphereGenerator AtmosphereGenerator;
+
+void AddAtmosphereGenerator(AtmosphereGenerator** ppGenerator);
+//	Waits for the tasks of the running step, not for the whole thread system
+void RemoveAtmosphereGenerator(AtmosphereGenerator* pGenerator);
+
+//	pTables must stay valid until the generation is complete. pPackedTexels is optional, see PackAtmosphereTables,
+//	the texels are then packed by the thread system as well.
+void StartAtmosphereGeneration(AtmosphereGenerator* pGenerator, ThreadSystem threadSystem, const AtmosphereParams& params,
+                               AtmosphereTables* pTables, uint16_t* pPackedTexels);
+//	Returns true once the tables are complete
+bool UpdateAtmosphereGeneration(AtmosphereGenerator* pGenerator);
+
+//	Identifies the tables GenerateAtmosphereTables computes: the parameters, the table sizes and the sample counts
+uint64_t GetAtmosphereTablesHash(const AtmosphereParams& params);
+
+//	Converts the tables to the RGBA 16 bit float texels that are uploaded, transmittance then irradiance then inscatter.
+//	pTexels holds ATMOSPHERE_PACKED_TEXELS * 4 halves.
+void PackAtmosphereTables(const AtmosphereTables* pTables, uint16_t* pTexels);
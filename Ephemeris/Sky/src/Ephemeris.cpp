@@ -54,7 +54,8 @@ void Ephemeris::Update(const Location& location, const LocalTime& localTime)
     Ry = rotateY(((float)location.getLatitude() - PI / 2.0f));
     //	TODO: B: check: Igor: changed this to make sun rotate correct side
     // Rz = rotateZ(LSTM);
-    Rz = rotateZ((float)-m_LSTM);
+    //	The sidereal angle grows by 2*PI a day, reduced first so that the float keeps its precision
+    Rz = rotateZ((float)-fmod(m_LSTM, 2.0 * PI));
     Rx = rotateX((float)e);
     m_EquatorialToHorizon = Ry * Rz * m_Precession;
     m_EclipticToHorizon = Ry * Rz * m_Precession * Rx;
@@ -9,8 +9,12 @@
  */
 
 #include "Icosahedron.h"
+#include "SkyTasks.h"
 
 #include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
+#include "../../../../The-Forge/Common_3/Utilities/Math/MathTypes.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
 
 static const float icosahedronA = 0.85065080835204f;   // sqrt(2.0f / (5.0f - sqrt(5.0f)))
 static const float icosahedronB = 0.5257311121191336f; // sqrt(2.0f / (5.0f + sqrt(5.0f)))
@@ -30,72 +34,100 @@ static const uint32_t icosahedronIndices[icosahedronTriangleCount * 3] = {
     3, 4, 9,  3, 2, 4, 3, 6, 2, 3, 8,  6, 3, 9,  8,  4, 5, 9, 2, 11, 4,  6,  10, 2,  8,  7, 6, 9, 1, 8,
 };
 
-struct EdgeNode
-{
-    uint64_t key;
-    uint32_t value;
-};
+//	Edges are pairs of vertices and every triangle knows the edges of its sides t0t1, t1t2 and t2t0. A subdivision splits
+//	edge e into 2e, the half at its first vertex, and 2e + 1, and adds three edges inside every triangle after them, so the
+//	midpoint of a side is found without any lookup.
+static const uint32_t ICOSPHERE_TRIANGLES_PER_TASK = 4096;
+static const uint32_t ICOSPHERE_EDGES_PER_TASK = 8192;
+static const uint32_t ICOSPHERE_NO_VERTEX = ~0u;
 
-typedef EdgeNode* EdgeMapStbDs;
+static const uint32_t ICOSPHERE_CACHE_MAGIC = 0x534f4349; //	"ICOS"
+static const uint32_t ICOSPHERE_CACHE_VERSION = 1;
+static const uint32_t ICOSPHERE_CACHE_FILE_NAME_LENGTH = 32;
 
-static uint32_t insertOrGetMidpoint(EdgeMapStbDs* midPointMap, VertexStbDsArray* vertices, uint32_t lIndex, uint32_t rIndex)
+typedef struct IcosphereCacheHeader
 {
-    ASSERT(midPointMap);
-    ASSERT(vertices && *vertices);
-
-    uint64_t li = lIndex;
-    uint64_t ri = rIndex;
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint32_t mSubdivisions;
+    uint32_t mVertexCount;
+    uint32_t mIndexCount;
+    uint32_t mPadding;
+} IcosphereCacheHeader;
 
-    if (lIndex > rIndex)
-        ri <<= 32;
-    else
-        li <<= 32;
-
-    uint64_t key = ri | li;
+typedef struct IcosphereLevel
+{
+    VertexF3*       pVertices; //	Of the last level, every level appends the midpoints of its edges
+    const uint32_t* pIndices;
+    const uint32_t* pTriangleEdges;
+    const uint32_t* pEdges;
+    const uint32_t* pMidpoints; //	Vertex of every edge
+    uint32_t*       pNewIndices;
+    uint32_t*       pNewTriangleEdges; //	NULL on the last level, which needs no edges
+    uint32_t*       pNewEdges;
+    uint32_t        mTriangleCount;
+    uint32_t        mEdgeCount;
+} IcosphereLevel;
 
-    EdgeNode* point = hmgetp_null(*midPointMap, key);
-    if (point)
-        return point->value;
+static void IcosphereEdgeTask(void* pUser, uint64_t index)
+{
+    const IcosphereLevel* pLevel = (const IcosphereLevel*)pUser;
+    const uint32_t        firstEdge = (uint32_t)index * ICOSPHERE_EDGES_PER_TASK;
+    const uint32_t        lastEdge = min(firstEdge + ICOSPHERE_EDGES_PER_TASK, pLevel->mEdgeCount);
 
-    VertexF3& a = (*vertices)[lIndex]; //-V595
-    VertexF3& b = (*vertices)[rIndex]; //-V595
+    for (uint32_t e = firstEdge; e < lastEdge; ++e)
+    {
+        const uint32_t  l = pLevel->pEdges[e * 2 + 0];
+        const uint32_t  r = pLevel->pEdges[e * 2 + 1];
+        const uint32_t  m = pLevel->pMidpoints[e];
+        const VertexF3& a = pLevel->pVertices[l];
+        const VertexF3& b = pLevel->pVertices[r];
 
-    VertexF3 c{ {
-        (a.pos[0] + b.pos[0]) / 2,
-        (a.pos[1] + b.pos[1]) / 2,
-        (a.pos[2] + b.pos[2]) / 2,
-    } };
+        VertexF3& c = pLevel->pVertices[m];
+        c.pos[0] = (a.pos[0] + b.pos[0]) / 2;
+        c.pos[1] = (a.pos[1] + b.pos[1]) / 2;
+        c.pos[2] = (a.pos[2] + b.pos[2]) / 2;
 
-    uint32_t index = (uint32_t)arrlen(*vertices);
-    hmput(*midPointMap, key, index);
-    arrpush(*vertices, c);
-    return index;
+        if (pLevel->pNewTriangleEdges)
+        {
+            uint32_t* pHalves = pLevel->pNewEdges + e * 4;
+            pHalves[0] = l;
+            pHalves[1] = m;
+            pHalves[2] = m;
+            pHalves[3] = r;
+        }
+    }
 }
 
-static void Subdivide(VertexStbDsArray* outVertices, IndexStbDsArray* outIndices)
+//	Half of edge e at vertex v
+static inline uint32_t GetHalfEdge(const IcosphereLevel* pLevel, uint32_t e, uint32_t v)
 {
-    EdgeMapStbDs midPointMap = NULL;
-
-    uint32_t* oldIndices = *outIndices;
+    return e * 2 + (pLevel->pEdges[e * 2] == v ? 0 : 1);
+}
 
-    uint32_t        numTriangles = (uint32_t)arrlen(*outIndices) / 3;
-    IndexStbDsArray newIndices = NULL;
-    arrsetlen(newIndices, numTriangles * 12);
-    ASSERT(newIndices);
+static void IcosphereTriangleTask(void* pUser, uint64_t index)
+{
+    const IcosphereLevel* pLevel = (const IcosphereLevel*)pUser;
+    const uint32_t        firstTriangle = (uint32_t)index * ICOSPHERE_TRIANGLES_PER_TASK;
+    const uint32_t        lastTriangle = min(firstTriangle + ICOSPHERE_TRIANGLES_PER_TASK, pLevel->mTriangleCount);
 
-    for (uint32_t i = 0; i < numTriangles; ++i)
+    for (uint32_t i = firstTriangle; i < lastTriangle; ++i)
     {
-        uint32_t t0 = oldIndices[i * 3 + 0];
-        uint32_t t1 = oldIndices[i * 3 + 1];
-        uint32_t t2 = oldIndices[i * 3 + 2];
+        uint32_t t0 = pLevel->pIndices[i * 3 + 0];
+        uint32_t t1 = pLevel->pIndices[i * 3 + 1];
+        uint32_t t2 = pLevel->pIndices[i * 3 + 2];
 
-        uint32_t m0 = insertOrGetMidpoint(&midPointMap, outVertices, t0, t1);
-        uint32_t m1 = insertOrGetMidpoint(&midPointMap, outVertices, t1, t2);
-        uint32_t m2 = insertOrGetMidpoint(&midPointMap, outVertices, t2, t0);
+        uint32_t e0 = pLevel->pTriangleEdges[i * 3 + 0];
+        uint32_t e1 = pLevel->pTriangleEdges[i * 3 + 1];
+        uint32_t e2 = pLevel->pTriangleEdges[i * 3 + 2];
 
-        uint32_t* ind = newIndices + i * 12;
+        uint32_t m0 = pLevel->pMidpoints[e0];
+        uint32_t m1 = pLevel->pMidpoints[e1];
+        uint32_t m2 = pLevel->pMidpoints[e2];
 
-        *(ind++) = t0; //-V769
+        uint32_t* ind = pLevel->pNewIndices + i * 12;
+
+        *(ind++) = t0;
         *(ind++) = m0;
         *(ind++) = m2;
         *(ind++) = m0;
@@ -107,27 +139,211 @@ static void Subdivide(VertexStbDsArray* outVertices, IndexStbDsArray* outIndices
         *(ind++) = m2;
         *(ind++) = m1;
         *(ind++) = t2;
-    }
 
-    hmfree(midPointMap);
-    arrfree(*outIndices);
-    *outIndices = newIndices;
+        if (!pLevel->pNewTriangleEdges)
+            continue;
+
+        //	Inner edges m0m2, m0m1 and m1m2
+        const uint32_t i0 = pLevel->mEdgeCount * 2 + i * 3;
+        const uint32_t i1 = i0 + 1;
+        const uint32_t i2 = i0 + 2;
+
+        uint32_t* pInner = pLevel->pNewEdges + i0 * 2;
+        pInner[0] = m0;
+        pInner[1] = m2;
+        pInner[2] = m0;
+        pInner[3] = m1;
+        pInner[4] = m1;
+        pInner[5] = m2;
+
+        uint32_t* edges = pLevel->pNewTriangleEdges + i * 12;
+
+        *(edges++) = GetHalfEdge(pLevel, e0, t0);
+        *(edges++) = i0;
+        *(edges++) = GetHalfEdge(pLevel, e2, t0);
+        *(edges++) = GetHalfEdge(pLevel, e0, t1);
+        *(edges++) = GetHalfEdge(pLevel, e1, t1);
+        *(edges++) = i1;
+        *(edges++) = i1;
+        *(edges++) = i2;
+        *(edges++) = i0;
+        *(edges++) = i2;
+        *(edges++) = GetHalfEdge(pLevel, e1, t2);
+        *(edges++) = GetHalfEdge(pLevel, e2, t2);
+    }
 }
 
-void CreateIcosphere(uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices)
+void CreateIcosphere(uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices, ThreadSystem threadSystem)
 {
     VertexStbDsArray vertices = NULL;
     IndexStbDsArray  indices = NULL;
-    arrsetlen(vertices, icosahedronVertexCount);
-    arrsetlen(indices, icosahedronTriangleCount * 3);
+    arrsetlen(vertices, GetIcosphereVertexCount(subdivisions));
+    arrsetlen(indices, GetIcosphereIndexCount(subdivisions));
     memcpy((VertexF3*)vertices, icosahedronVertices, icosahedronVertexCount * sizeof(*vertices));
-    memcpy(indices, icosahedronIndices, icosahedronTriangleCount * 3 * sizeof(*indices));
 
-    for (uint32_t i = 0; i < subdivisions; ++i)
+    //	The levels alternate between the two index buffers so that the last one lands in indices
+    const uint32_t maxEdgeCount = subdivisions > 0 ? GetIcosphereIndexCount(subdivisions - 1) / 2 : 0;
+    uint32_t*      pScratch = (uint32_t*)tf_malloc(GetIcosphereIndexCount(subdivisions) * sizeof(uint32_t));
+    uint32_t*      pMemory = (uint32_t*)tf_malloc(max(maxEdgeCount * 9, 1u) * sizeof(uint32_t));
+    uint32_t*      pIndexBuffers[2] = { indices, pScratch };
+    uint32_t*      pTriangleEdgeBuffers[2] = { pMemory, pMemory + maxEdgeCount * 2 };
+    uint32_t*      pEdgeBuffers[2] = { pMemory + maxEdgeCount * 4, pMemory + maxEdgeCount * 6 };
+    uint32_t*      pMidpoints = pMemory + maxEdgeCount * 8;
+
+    uint32_t* pIndices = pIndexBuffers[subdivisions % 2];
+    memcpy(pIndices, icosahedronIndices, icosahedronTriangleCount * 3 * sizeof(uint32_t));
+
+    //	Edges of the icosahedron in the order the triangles meet them
+    uint32_t* pTriangleEdges = pTriangleEdgeBuffers[0];
+    uint32_t* pEdges = pEdgeBuffers[0];
+    uint32_t  edgeCount = 0;
+    for (uint32_t i = 0; i < icosahedronTriangleCount * 3 && subdivisions > 0; ++i)
     {
-        Subdivide(&vertices, &indices);
+        const uint32_t l = icosahedronIndices[i];
+        const uint32_t r = icosahedronIndices[i % 3 == 2 ? i - 2 : i + 1];
+
+        uint32_t e = 0;
+        while (e < edgeCount && !((pEdges[e * 2] == l && pEdges[e * 2 + 1] == r) || (pEdges[e * 2] == r && pEdges[e * 2 + 1] == l)))
+            ++e;
+        if (e == edgeCount)
+        {
+            pEdges[edgeCount * 2 + 0] = l;
+            pEdges[edgeCount * 2 + 1] = r;
+            ++edgeCount;
+        }
+        pTriangleEdges[i] = e;
     }
 
+    uint32_t vertexCount = icosahedronVertexCount;
+    uint32_t triangleCount = icosahedronTriangleCount;
+    for (uint32_t level = 1; level <= subdivisions; ++level)
+    {
+        //	Midpoints are numbered in the order the triangles meet their edges, like the hash map of the previous version did
+        for (uint32_t e = 0; e < edgeCount; ++e)
+            pMidpoints[e] = ICOSPHERE_NO_VERTEX;
+        for (uint32_t i = 0; i < triangleCount * 3; ++i)
+        {
+            if (pMidpoints[pTriangleEdges[i]] == ICOSPHERE_NO_VERTEX)
+                pMidpoints[pTriangleEdges[i]] = vertexCount++;
+        }
+        ASSERT(vertexCount == GetIcosphereVertexCount(level));
+
+        IcosphereLevel context = {};
+        context.pVertices = vertices;
+        context.pIndices = pIndices;
+        context.pTriangleEdges = pTriangleEdges;
+        context.pEdges = pEdges;
+        context.pMidpoints = pMidpoints;
+        context.pNewIndices = pIndexBuffers[(subdivisions - level) % 2];
+        context.pNewTriangleEdges = level < subdivisions ? pTriangleEdgeBuffers[level % 2] : NULL;
+        context.pNewEdges = pEdgeBuffers[level % 2];
+        context.mTriangleCount = triangleCount;
+        context.mEdgeCount = edgeCount;
+
+        RunSkyTasks(threadSystem, IcosphereEdgeTask, (edgeCount + ICOSPHERE_EDGES_PER_TASK - 1) / ICOSPHERE_EDGES_PER_TASK,
+                          &context);
+        RunSkyTasks(threadSystem, IcosphereTriangleTask,
+                          (triangleCount + ICOSPHERE_TRIANGLES_PER_TASK - 1) / ICOSPHERE_TRIANGLES_PER_TASK, &context);
+
+        pIndices = context.pNewIndices;
+        pTriangleEdges = context.pNewTriangleEdges;
+        pEdges = context.pNewEdges;
+        edgeCount = edgeCount * 2 + triangleCount * 3;
+        triangleCount *= 4;
+    }
+
+    tf_free(pMemory);
+    tf_free(pScratch);
+
     *outVertices = vertices;
     *outIndices = indices;
 }
+
+static void GetIcosphereCacheFileName(uint32_t subdivisions, char* pFileName)
+{
+    snprintf(pFileName, ICOSPHERE_CACHE_FILE_NAME_LENGTH, "Icosphere_%02u.bin", subdivisions);
+}
+
+static bool LoadIcosphereCache(ResourceDirectory cacheDir, uint32_t subdivisions, VertexStbDsArray* outVertices,
+                               IndexStbDsArray* outIndices)
+{
+    char fileName[ICOSPHERE_CACHE_FILE_NAME_LENGTH];
+    GetIcosphereCacheFileName(subdivisions, fileName);
+
+    FileStream stream = {};
+    if (!fsOpenStreamFromPath(cacheDir, fileName, FM_READ, &stream))
+        return false;
+
+    const uint32_t vertexCount = GetIcosphereVertexCount(subdivisions);
+    const uint32_t indexCount = GetIcosphereIndexCount(subdivisions);
+    const size_t   verticesSize = vertexCount * sizeof(VertexF3);
+    const size_t   indicesSize = indexCount * sizeof(uint32_t);
+
+    size_t      size = 0;
+    const void* pData = NULL;
+    if (!fsStreamMemoryMap(&stream, &size, &pData) || size != sizeof(IcosphereCacheHeader) + verticesSize + indicesSize)
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the icosphere cache %s, the file is incomplete", fileName);
+        fsCloseStream(&stream);
+        return false;
+    }
+
+    const IcosphereCacheHeader expected = { ICOSPHERE_CACHE_MAGIC, ICOSPHERE_CACHE_VERSION, subdivisions, vertexCount, indexCount, 0 };
+    if (memcmp(pData, &expected, sizeof(expected)) != 0)
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the icosphere cache %s, the header does not match", fileName);
+        fsCloseStream(&stream);
+        return false;
+    }
+
+    const uint8_t* pVertices = (const uint8_t*)pData + sizeof(IcosphereCacheHeader);
+    VertexStbDsArray vertices = NULL;
+    IndexStbDsArray  indices = NULL;
+    arrsetlen(vertices, vertexCount);
+    arrsetlen(indices, indexCount);
+    memcpy((VertexF3*)vertices, pVertices, verticesSize);
+    memcpy(indices, pVertices + verticesSize, indicesSize);
+    fsCloseStream(&stream);
+
+    *outVertices = vertices;
+    *outIndices = indices;
+    return true;
+}
+
+static void SaveIcosphereCache(ResourceDirectory cacheDir, uint32_t subdivisions, const VertexStbDsArray vertices,
+                               const IndexStbDsArray indices)
+{
+    char fileName[ICOSPHERE_CACHE_FILE_NAME_LENGTH];
+    GetIcosphereCacheFileName(subdivisions, fileName);
+
+    FileStream stream = {};
+    if (!fsOpenStreamFromPath(cacheDir, fileName, FM_WRITE, &stream))
+    {
+        LOGF(LogLevel::eWARNING, "Could not create the icosphere cache %s", fileName);
+        return;
+    }
+
+    //	A partial write leaves a file of the wrong size, which LoadIcosphereCache rejects
+    const IcosphereCacheHeader header = { ICOSPHERE_CACHE_MAGIC, ICOSPHERE_CACHE_VERSION, subdivisions, (uint32_t)arrlen(vertices),
+                                          (uint32_t)arrlen(indices), 0 };
+    const size_t               verticesSize = arrlenu(vertices) * sizeof(VertexF3);
+    const size_t               indicesSize = arrlenu(indices) * sizeof(uint32_t);
+    const bool                 bWritten = fsWriteToStream(&stream, &header, sizeof(header)) == sizeof(header) &&
+                          fsWriteToStream(&stream, vertices, verticesSize) == verticesSize &&
+                          fsWriteToStream(&stream, indices, indicesSize) == indicesSize;
+    fsCloseStream(&stream);
+
+    if (!bWritten)
+        LOGF(LogLevel::eWARNING, "Could not write the icosphere cache %s", fileName);
+}
+
+void CreateCachedIcosphere(ResourceDirectory cacheDir, uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices,
+                           ThreadSystem threadSystem)
+{
+    if (subdivisions < ICOSPHERE_CACHE_LEVELS && LoadIcosphereCache(cacheDir, subdivisions, outVertices, outIndices))
+        return;
+
+    CreateIcosphere(subdivisions, outVertices, outIndices, threadSystem);
+    if (subdivisions < ICOSPHERE_CACHE_LEVELS)
+        SaveIcosphereCache(cacheDir, subdivisions, *outVertices, *outIndices);
+}
@@ -9,6 +9,8 @@
  */
 
 #pragma once
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IFileSystem.h"
+#include "../../../../The-Forge/Common_3/Utilities/Threading/ThreadSystem.h"
 #include "../../../../The-Forge/Common_3/Utilities/ThirdParty/OpenSource/Nothings/stb_ds.h"
 
 struct VertexF3
@@ -19,4 +21,16 @@ struct VertexF3
 typedef VertexF3* VertexStbDsArray;
 typedef uint32_t* IndexStbDsArray;
 
-void CreateIcosphere(uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices);
+//	Every subdivision splits each triangle in four, the vertices of a level are the first ones of the next level
+inline uint32_t GetIcosphereVertexCount(uint32_t subdivisions) { return 10 * (1u << (2 * subdivisions)) + 2; }
+inline uint32_t GetIcosphereIndexCount(uint32_t subdivisions) { return 60 * (1u << (2 * subdivisions)); }
+
+//	The triangles of a level are spread over the thread system, the result is the same without one
+void CreateIcosphere(uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices, ThreadSystem threadSystem = NULL);
+
+//	Same, but levels below ICOSPHERE_CACHE_LEVELS are loaded from cacheDir when a previous run saved them there, or built and
+//	saved. Nothing is kept in memory between calls. Calls for the same level at the same time may write the file twice,
+//	a file cut short by that is rejected and built again.
+static const uint32_t ICOSPHERE_CACHE_LEVELS = 10;
+void CreateCachedIcosphere(ResourceDirectory cacheDir, uint32_t subdivisions, VertexStbDsArray* outVertices, IndexStbDsArray* outIndices,
+                           ThreadSystem threadSystem = NULL);
@@ -34,6 +34,12 @@ public:
 
     void setDayLightSavingEnabled(bool bDSTEnabled) { m_isDST = bDSTEnabled; }
 
+    int    getLocalYear() const { return m_localYear; }
+    int    getLocalMonth() const { return m_localMonth; }
+    int    getLocalDay() const { return m_localDay; }
+    double getGMTOffset() const { return m_GMTOffset; }
+    bool   isDayLightSavingEnabled() const { return m_isDST; }
+
     double getJ200Centuries(bool bAtomic) const;
 
 private:
@@ -9,12 +9,23 @@
  */
 
 #include "Sky.h"
+#include "SkyTasks.h"
 
 #include "../../../../The-Forge/Common_3/Game/Interfaces/IScripting.h"
 #include "../../../../The-Forge/Common_3/Resources/ResourceLoader/Interfaces/IResourceLoader.h"
 #include "../../../../The-Forge/Common_3/Utilities/Interfaces/IFileSystem.h"
 #include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
 
+//	GetSunTransmittances works on 8 elements at once with AVX and on 4 with SSE, other targets go through the same math
+//	one element at a time
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SKY_SUN_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SKY_SUN_SSE
+#endif
+
 #include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
 
 #define SKY_NEAR     50.0f
@@ -73,6 +84,7 @@ static float NebulaScale = 9.453f;
 static float StarIntensity = 1.5f;
 static float StarDensity = 10.0f;
 static float StarDistribution = 20000000.0f;
+static uint32_t StarSeed = 0x2545F491u; // every star of the field is a function of it, see StarRandom
 // static float ParticleScale = 100.0f;
 static float ParticleSize = 1000000.0f;
 
@@ -169,6 +181,211 @@ void Sky::CalculateLookupData()
     waitForToken(&token);
 }
 
+//	pTexels are RGBA 16 bit floats, the format of the baked tables
+static void UpdateLookupTexture(Texture* pTexture, const uint16_t* pTexels, uint32_t width, uint32_t height, uint32_t depth)
+{
+    const uint32_t rowSize = width * 4 * sizeof(uint16_t);
+
+    TextureUpdateDesc updateDesc = { pTexture, 0, 1, 0, 1, RESOURCE_STATE_SHADER_RESOURCE };
+    beginUpdateResource(&updateDesc);
+    TextureSubresourceUpdate subresource = updateDesc.getSubresourceUpdateDesc(0, 0);
+    for (uint32_t z = 0; z < depth; ++z)
+    {
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            memcpy(subresource.pMappedData + z * subresource.mDstSliceStride + y * subresource.mDstRowStride,
+                   (const uint8_t*)pTexels + (z * height + y) * rowSize, rowSize);
+        }
+    }
+    endUpdateResource(&updateDesc);
+}
+
+//	Without texels the contents stay undefined
+static void AddLookupTexture(const char* pName, const uint16_t* pTexels, uint32_t width, uint32_t height, uint32_t depth,
+                             Texture** ppTexture)
+{
+    TextureDesc lookupDesc = {};
+    lookupDesc.mWidth = width;
+    lookupDesc.mHeight = height;
+    lookupDesc.mDepth = depth;
+    lookupDesc.mArraySize = 1;
+    lookupDesc.mMipLevels = 1;
+    lookupDesc.mSampleCount = SAMPLE_COUNT_1;
+    lookupDesc.mFormat = TinyImageFormat_R16G16B16A16_SFLOAT;
+    lookupDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
+    lookupDesc.mDescriptors = DESCRIPTOR_TYPE_TEXTURE;
+    lookupDesc.pName = pName;
+
+    SyncToken       token = {};
+    TextureLoadDesc lookupLoadDesc = {};
+    lookupLoadDesc.pDesc = &lookupDesc;
+    lookupLoadDesc.ppTexture = ppTexture;
+    addResource(&lookupLoadDesc, &token);
+    waitForToken(&token);
+
+    if (pTexels)
+        UpdateLookupTexture(*ppTexture, pTexels, width, height, depth);
+}
+
+static void RemoveLookupTextures(Sky* pSky)
+{
+    waitForAllResourceLoads();
+    if (pSky->pTransmittanceTexture)
+        removeResource(pSky->pTransmittanceTexture);
+    if (pSky->pIrradianceTexture)
+        removeResource(pSky->pIrradianceTexture);
+    if (pSky->pInscatterTexture)
+        removeResource(pSky->pInscatterTexture);
+
+    pSky->pTransmittanceTexture = NULL;
+    pSky->pIrradianceTexture = NULL;
+    pSky->pInscatterTexture = NULL;
+}
+
+//	The tables of LoadLookupData replace whatever the animation shows. A generation still running can not be stopped,
+//	it finishes into its own buffer and is dropped, see UpdateLookupAnimation.
+static void ResetLookupAnimation(LookupAnimation* pAnimation, uint64_t hash)
+{
+    pAnimation->mHash = hash;
+    pAnimation->bPending = false;
+    pAnimation->bGenerated = false;
+    pAnimation->mWeight = 0.0f;
+    pAnimation->mTargetWeight = 0.0f;
+    ++pAnimation->mLoadCount;
+}
+
+void Sky::LoadLookupData(const AtmosphereParams& params, ThreadSystem threadSystem, bool bGenerateOnMiss)
+{
+    //	RD_PIPELINE_CACHE is the writable directory for data that can be rebuilt at any time
+    const uint64_t  hash = GetAtmosphereTablesHash(params);
+    AtmosphereCache cache = {};
+    const bool      bCached = OpenAtmosphereCache(RD_PIPELINE_CACHE, hash, &cache);
+
+    if (!bCached && !bGenerateOnMiss)
+    {
+        RemoveLookupTextures(this);
+        ResetLookupAnimation(&gLookupAnimation, 0);
+        tf_free(pLookupTexels);
+        pLookupTexels = NULL;
+        CalculateLookupData();
+        return;
+    }
+
+    const uint16_t* pTexels = cache.pTexels;
+    uint16_t*       pGenerated = NULL;
+    if (!bCached)
+    {
+        AtmosphereTables tables = {};
+        AddAtmosphereTables(&tables);
+        GenerateAtmosphereTables(threadSystem, params, &tables);
+
+        pGenerated = (uint16_t*)tf_malloc(ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t));
+        PackAtmosphereTables(&tables, pGenerated);
+        RemoveAtmosphereTables(&tables);
+
+        SaveAtmosphereCache(RD_PIPELINE_CACHE, hash, pGenerated);
+        pTexels = pGenerated;
+    }
+
+    RemoveLookupTextures(this);
+    ResetLookupAnimation(&gLookupAnimation, hash);
+
+    AddLookupTexture("Sky Transmittance", pTexels, TRANSMITTANCE_W, TRANSMITTANCE_H, 1, &pTransmittanceTexture);
+    pTexels += ATMOSPHERE_TRANSMITTANCE_TEXELS * 4;
+    AddLookupTexture("Sky Irradiance", pTexels, SKY_W, SKY_H, 1, &pIrradianceTexture);
+    pTexels += ATMOSPHERE_IRRADIANCE_TEXELS * 4;
+    AddLookupTexture("Sky Inscatter", pTexels, RES_MU_S * RES_NU, RES_MU, RES_R, &pInscatterTexture);
+
+    //	CPU copy for GetSkyRadiance
+    tf_free(pLookupTexels);
+    pLookupTexels = pGenerated;
+    if (bCached)
+    {
+        pLookupTexels = (uint16_t*)tf_malloc(ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t));
+        memcpy(pLookupTexels, cache.pTexels, ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t));
+        CloseAtmosphereCache(&cache);
+    }
+}
+
+void Sky::AnimateLookupData(const AtmosphereParams& params, ThreadSystem threadSystem)
+{
+    LookupAnimation* pAnimation = &gLookupAnimation;
+
+    const uint64_t hash = GetAtmosphereTablesHash(params);
+    if (pAnimation->pGenerator && hash == pAnimation->mHash)
+        return;
+
+    if (!pAnimation->pGenerator)
+    {
+        AddAtmosphereGenerator(&pAnimation->pGenerator);
+        AddAtmosphereTables(&pAnimation->mTables);
+        pAnimation->pPackedTexels = (uint16_t*)tf_malloc(ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t));
+    }
+
+    //	Only the latest parameters are kept, they are generated once the running generation is shown
+    pAnimation->mThreadSystem = threadSystem;
+    pAnimation->mPendingParams = params;
+    pAnimation->mHash = hash;
+    pAnimation->bPending = true;
+}
+
+void Sky::UpdateLookupAnimation(float deltaTime)
+{
+    LookupAnimation* pAnimation = &gLookupAnimation;
+    if (!pAnimation->pGenerator)
+        return;
+
+    const float fadeStep = LookupCrossfadeTime > 0.0f ? deltaTime / LookupCrossfadeTime : 1.0f;
+    if (pAnimation->mWeight < pAnimation->mTargetWeight)
+        pAnimation->mWeight = min(pAnimation->mWeight + fadeStep, pAnimation->mTargetWeight);
+    else if (pAnimation->mWeight > pAnimation->mTargetWeight)
+        pAnimation->mWeight = max(pAnimation->mWeight - fadeStep, pAnimation->mTargetWeight);
+
+    if (pAnimation->mWeight == pAnimation->mTargetWeight)
+        pAnimation->mSettledFrames = min(pAnimation->mSettledFrames + 1, gDataBufferCount + 1);
+    else
+        pAnimation->mSettledFrames = 0;
+
+    if (pAnimation->bGenerating && UpdateAtmosphereGeneration(pAnimation->pGenerator))
+    {
+        pAnimation->bGenerating = false;
+        pAnimation->bGenerated = pAnimation->mGenerationLoadCount == pAnimation->mLoadCount;
+    }
+
+    //	The faded out tables are replaced once no frame in flight reads them, then the new ones fade in
+    if (pAnimation->bGenerated && pAnimation->mSettledFrames > gDataBufferCount)
+    {
+        const bool      bReplaceB = pAnimation->mTargetWeight == 0.0f;
+        const uint16_t* pTransmittanceTexels = pAnimation->pPackedTexels;
+        const uint16_t* pInscatterTexels =
+            pAnimation->pPackedTexels + (ATMOSPHERE_TRANSMITTANCE_TEXELS + ATMOSPHERE_IRRADIANCE_TEXELS) * 4;
+
+        UpdateLookupTexture(bReplaceB ? pTransmittanceTextureB : pTransmittanceTexture, pTransmittanceTexels, TRANSMITTANCE_W,
+                            TRANSMITTANCE_H, 1);
+        UpdateLookupTexture(bReplaceB ? pInscatterTextureB : pInscatterTexture, pInscatterTexels, RES_MU_S * RES_NU, RES_MU, RES_R);
+
+        //	The generated texels become the CPU copy of the replaced tables, the next generation reuses the old copy
+        uint16_t** ppLookupTexels = bReplaceB ? &pLookupTexelsB : &pLookupTexels;
+        uint16_t*  pReplacedTexels = *ppLookupTexels;
+        *ppLookupTexels = pAnimation->pPackedTexels;
+        pAnimation->pPackedTexels =
+            pReplacedTexels ? pReplacedTexels : (uint16_t*)tf_malloc(ATMOSPHERE_PACKED_TEXELS * 4 * sizeof(uint16_t));
+
+        pAnimation->mTargetWeight = bReplaceB ? 1.0f : 0.0f;
+        pAnimation->bGenerated = false;
+    }
+
+    if (pAnimation->bPending && !pAnimation->bGenerating && !pAnimation->bGenerated)
+    {
+        StartAtmosphereGeneration(pAnimation->pGenerator, pAnimation->mThreadSystem, pAnimation->mPendingParams, &pAnimation->mTables,
+                                  pAnimation->pPackedTexels);
+        UpdateAtmosphereGeneration(pAnimation->pGenerator);
+        pAnimation->bPending = false;
+        pAnimation->bGenerating = true;
+        pAnimation->mGenerationLoadCount = pAnimation->mLoadCount;
+    }
+}
+
 //	<https://www.shadertoy.com/view/4dS3Wd>
 //	By Morgan McGuire @morgan3d, http://graphicscodex.com
 //
@@ -244,105 +461,218 @@ float3 ColorTemperatureToRGB(float temperatureInKelvins)
     return retColor;
 }
 
-// Generates an array of vertices and normals for a sphere
-void Sky::GenerateIcosahedron(float** ppPoints, VertexStbDsArray& vertices, IndexStbDsArray& indices, int numberOfDivisions, float radius)
+/************************************************************************/
+// Star field of GenerateIcosahedron. Every random number is a hash of the seed, the vertex and the star instead of a draw
+// from rand(), so the field is the same on every platform however the vertices are split between the tasks.
+/************************************************************************/
+static const uint32_t STAR_FIELD_VERTICES_PER_TASK = 1024;
+
+typedef struct StarFieldContext
 {
-    CreateIcosphere(numberOfDivisions, &vertices, &indices);
+    const VertexF3* pVertices;
+    float3*         pPoints; //	Position, normal and nebula noise of every vertex
+    float*          pTaskNoiseRanges;
+    float           mMinNoise;
+    float           mNoiseRange;
+    uint32_t        mVertexCount;
+    uint32_t*          pStarOffsets; //	First star of every vertex, the count until the prefix sum
+    StarCatalogueStar* pStars;
+} StarFieldContext;
+
+//	SplitMix64 finalizer
+static inline uint64_t StarHash(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
-    int numVertex = (int)arrlen(vertices);
+//	Uniform in [0, 1] like rand() / RAND_MAX, stream tells the numbers of one star apart
+static inline float StarRandom(uint32_t vertex, uint32_t star, uint32_t stream)
+{
+    const uint64_t counter = ((uint64_t)vertex << 32) | ((uint64_t)star << 8) | stream;
+    return (float)(StarHash(counter ^ ((uint64_t)StarSeed << 32)) >> 40) * (1.0f / 16777215.0f);
+}
 
-    float3* pPoints = (float3*)tf_malloc(numVertex * (sizeof(float3) * 3));
+static void RunStarFieldTasks(ThreadSystem threadSystem, TaskFunc pTask, StarFieldContext* pContext)
+{
+    const uint32_t taskCount = (pContext->mVertexCount + STAR_FIELD_VERTICES_PER_TASK - 1) / STAR_FIELD_VERTICES_PER_TASK;
+    RunSkyTasks(threadSystem, pTask, taskCount, pContext);
+}
 
-    uint32_t vertexCounter = 0;
+static float StarFieldNoise(const vec3& position)
+{
+    vec3 normalizedPosition = position + vec3(1.0f, 1.0f, 1.0f);
+    normalizedPosition *= 0.5f;        // normalized to [0,1]
+    normalizedPosition *= NebulaScale; // scale it
+
+    return Perlin::perlinNoise3D(normalizedPosition.getX(), normalizedPosition.getY(), normalizedPosition.getZ());
+}
 
-    const float* position = vertices->pos;
+//	Points of a range of vertices and the range of their nebula noise
+static void StarFieldNoiseTask(void* pUser, uint64_t index)
+{
+    StarFieldContext* pContext = (StarFieldContext*)pUser;
+    const uint32_t    firstVertex = (uint32_t)index * STAR_FIELD_VERTICES_PER_TASK;
+    const uint32_t    lastVertex = min(firstVertex + STAR_FIELD_VERTICES_PER_TASK, pContext->mVertexCount);
 
     float minVal = 10.0f;
     float maxVal = -10.0f;
 
-    for (int i = 0; i < numVertex; ++i)
+    for (uint32_t i = firstVertex; i < lastVertex; ++i)
     {
-        vec3 tempPosition = vec3(position[i * 3], position[i * 3 + 1], position[i * 3 + 2]);
-        pPoints[vertexCounter] = v3ToF3(tempPosition) * SpaceScale;
-        pPoints[vertexCounter].setY(pPoints[vertexCounter].getY() - EARTH_RADIUS * 10.0f);
-        vertexCounter++;
-        vec3 normalizedPosition = normalize(tempPosition);
-        pPoints[vertexCounter++] = v3ToF3(normalizedPosition);
-
-        vec3 normalizedPosition01 = normalizedPosition + vec3(1.0f, 1.0f, 1.0f);
-        normalizedPosition01 *= 0.5f;        // normalized to [0,1]
-        normalizedPosition01 *= NebulaScale; // scale it
-
-        float NoiseValue01 =
-            noiseGenerator.perlinNoise3D(normalizedPosition01.getX(), normalizedPosition01.getY(), normalizedPosition01.getZ());
+        const float* position = pContext->pVertices[i].pos;
+        float3*      pPoints = pContext->pPoints + i * 3;
 
-        maxVal = max(maxVal, NoiseValue01);
-        minVal = min(minVal, NoiseValue01);
+        vec3 tempPosition = vec3(position[0], position[1], position[2]);
+        pPoints[0] = v3ToF3(tempPosition) * SpaceScale;
+        pPoints[0].setY(pPoints[0].getY() - EARTH_RADIUS * 10.0f);
+        vec3 normalizedPosition = normalize(tempPosition);
+        pPoints[1] = v3ToF3(normalizedPosition);
 
-        vec3 normalizedPosition02 =
-            vec3(normalizedPosition.getX(), -normalizedPosition.getY(), normalizedPosition.getZ()) + vec3(1.0f, 1.0f, 1.0f);
-        normalizedPosition02 *= 0.5f;        // normalized to [0,1]
-        normalizedPosition02 *= NebulaScale; // scale it
+        float NoiseValue01 = StarFieldNoise(normalizedPosition);
+        float NoiseValue02 = StarFieldNoise(vec3(normalizedPosition.getX(), -normalizedPosition.getY(), normalizedPosition.getZ()));
+        float NoiseValue03 = StarFieldNoise(vec3(-normalizedPosition.getX(), normalizedPosition.getY(), -normalizedPosition.getZ()));
 
-        float NoiseValue02 =
-            noiseGenerator.perlinNoise3D(normalizedPosition02.getX(), normalizedPosition02.getY(), normalizedPosition02.getZ());
+        maxVal = max(maxVal, max(NoiseValue01, max(NoiseValue02, NoiseValue03)));
+        minVal = min(minVal, min(NoiseValue01, min(NoiseValue02, NoiseValue03)));
 
-        maxVal = max(maxVal, NoiseValue02);
-        minVal = min(minVal, NoiseValue02);
+        pPoints[2] = float3(NoiseValue01, NoiseValue02, NoiseValue03);
+    }
 
-        vec3 normalizedPosition03 =
-            vec3(-normalizedPosition.getX(), normalizedPosition.getY(), -normalizedPosition.getZ()) + vec3(1.0f, 1.0f, 1.0f);
-        normalizedPosition03 *= 0.5f;        // normalized to [0,1]
-        normalizedPosition03 *= NebulaScale; // scale it
+    pContext->pTaskNoiseRanges[index * 2 + 0] = minVal;
+    pContext->pTaskNoiseRanges[index * 2 + 1] = maxVal;
+}
 
-        float NoiseValue03 =
-            noiseGenerator.perlinNoise3D(normalizedPosition03.getX(), normalizedPosition03.getY(), normalizedPosition03.getZ());
+//	Nebula density of a range of vertices and the number of stars it puts there
+static void StarFieldCountTask(void* pUser, uint64_t index)
+{
+    StarFieldContext* pContext = (StarFieldContext*)pUser;
+    const uint32_t    firstVertex = (uint32_t)index * STAR_FIELD_VERTICES_PER_TASK;
+    const uint32_t    lastVertex = min(firstVertex + STAR_FIELD_VERTICES_PER_TASK, pContext->mVertexCount);
+    const float       minVal = pContext->mMinNoise;
 
-        maxVal = max(maxVal, NoiseValue03);
-        minVal = min(minVal, NoiseValue03);
+    for (uint32_t i = firstVertex; i < lastVertex; ++i)
+    {
+        // Nebula Density
+        float3* pNoise = pContext->pPoints + i * 3 + 2;
+        *pNoise = (*pNoise - float3(minVal, minVal, minVal)) / pContext->mNoiseRange;
 
-        pPoints[vertexCounter++] = float3(NoiseValue01, NoiseValue02, NoiseValue03);
+        float Density = (pNoise->getX() + pNoise->getY() + pNoise->getZ()) / 3.0f;
+        Density = pow(Density, 1.5f);
+        pContext->pStarOffsets[i] = (uint32_t)max((int)(StarDensity * Density), 0);
     }
+}
 
-    float len = maxVal - minVal;
+static void StarFieldFillTask(void* pUser, uint64_t index)
+{
+    StarFieldContext* pContext = (StarFieldContext*)pUser;
+    const uint32_t    firstVertex = (uint32_t)index * STAR_FIELD_VERTICES_PER_TASK;
+    const uint32_t    lastVertex = min(firstVertex + STAR_FIELD_VERTICES_PER_TASK, pContext->mVertexCount);
 
-    for (int i = 0; i < numVertex; ++i)
+    for (uint32_t i = firstVertex; i < lastVertex; ++i)
     {
-        // Nebula Density
-        int index = i * 3 + 2;
-        pPoints[index] = (pPoints[index] - float3(minVal, minVal, minVal)) / len;
+        const vec3         normal = f3Tov3(pContext->pPoints[i * 3 + 1]);
+        const int          maxStar = (int)(pContext->pStarOffsets[i + 1] - pContext->pStarOffsets[i]);
+        StarCatalogueStar* pStar = pContext->pStars + pContext->pStarOffsets[i];
 
-        float Density = (pPoints[index].getX() + pPoints[index].getY() + pPoints[index].getZ()) / 3.0f;
-        Density = pow(Density, 1.5f);
-        int maxStar = (int)(StarDensity * Density);
-        for (int j = 0; j < maxStar; j++)
+        for (int j = 0; j < maxStar; j++, pStar++)
         {
-            vec3 Positions = f3Tov3(pPoints[index - 1]) * SpaceScale;
-            Positions += (vec3((float)rand() / (float)RAND_MAX, (float)rand() / (float)RAND_MAX, (float)rand() / (float)RAND_MAX) * 2.0f -
-                          vec3(1.0f, 1.0f, 1.0f)) *
+            vec3 Positions = normal * SpaceScale;
+            Positions += (vec3(StarRandom(i, j, 0), StarRandom(i, j, 1), StarRandom(i, j, 2)) * 2.0f - vec3(1.0f, 1.0f, 1.0f)) *
                          StarDistribution;
-            Positions = normalize(Positions) * SpaceScale;
-            Positions.setY(Positions.getY() - EARTH_RADIUS * 10.0f);
 
-            float temperature = ((float)rand() / (float)RAND_MAX) * 30000.0f + 3700.0f;
-            vec3  StarColor = f3Tov3(ColorTemperatureToRGB(temperature));
-            vec4  Colors = vec4(StarColor, (((float)rand() / (float)RAND_MAX * 0.9f) + 0.1f) * StarIntensity);
-
-            float starSize = (((float)rand() / (float)RAND_MAX * 1.1f) + 0.5f);
+            float brightness = (StarRandom(i, j, 4) * 0.9f) + 0.1f;
+            float starSize = ((StarRandom(i, j, 5) * 1.1f) + 0.5f);
             starSize *= starSize;
 
-            vec4 Info = vec4(temperature, starSize * ParticleSize, (float)rand() / (float)RAND_MAX, (float)rand() / (float)RAND_MAX);
+            StarCatalogueEntry entry;
+            entry.mDirection = normalize(Positions);
+            entry.mTemperature = StarRandom(i, j, 3) * 30000.0f + 3700.0f;
+            entry.mMagnitude = -2.5f * log10f(brightness);
+            entry.mSize = starSize;
+            entry.mTwinkleSeed = StarRandom(i, j, 6);
+            entry.mTwinkleScale = StarRandom(i, j, 7);
+            EncodeStar(entry, pStar);
+        }
+    }
+}
+
+//	Particles of the brightest stars of the catalogue, the same as the star field generated them before the quantization
+static void DecodeStarParticles(const StarCatalogue* pCatalogue, uint32_t count, ParticleData* pParticles)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        StarCatalogueEntry entry;
+        DecodeStar(pCatalogue->pStars[i], &entry);
+
+        vec3 Positions = entry.mDirection * SpaceScale;
+        Positions.setY(Positions.getY() - EARTH_RADIUS * 10.0f);
 
-            ParticleData tempParticleData;
-            tempParticleData.ParticlePositions = vec4(Positions, 1.0f);
-            tempParticleData.ParticleColors = Colors;
-            tempParticleData.ParticleInfo = Info;
+        vec3  StarColor = f3Tov3(ColorTemperatureToRGB(entry.mTemperature));
+        float brightness = powf(10.0f, -0.4f * entry.mMagnitude);
 
-            arrpush(gParticleSystem.particleDataSet, tempParticleData);
-        }
+        pParticles[i].ParticlePositions = vec4(Positions, 1.0f);
+        pParticles[i].ParticleColors = vec4(StarColor, brightness * StarIntensity);
+        pParticles[i].ParticleInfo = vec4(entry.mTemperature, entry.mSize * ParticleSize, entry.mTwinkleSeed, entry.mTwinkleScale);
     }
+}
 
-    (*ppPoints) = (float*)pPoints;
+// Generates an array of vertices and normals for a sphere
+void Sky::GenerateIcosahedron(float** ppPoints, VertexStbDsArray& vertices, IndexStbDsArray& indices, int numberOfDivisions, float radius,
+                              ThreadSystem threadSystem)
+{
+    CreateCachedIcosphere(RD_PIPELINE_CACHE, numberOfDivisions, &vertices, &indices, threadSystem);
+
+    StarFieldContext context = {};
+    context.pVertices = vertices;
+    context.mVertexCount = (uint32_t)arrlen(vertices);
+    context.pPoints = (float3*)tf_malloc(context.mVertexCount * (sizeof(float3) * 3));
+
+    const uint32_t taskCount = (context.mVertexCount + STAR_FIELD_VERTICES_PER_TASK - 1) / STAR_FIELD_VERTICES_PER_TASK;
+    context.pTaskNoiseRanges = (float*)tf_malloc(taskCount * 2 * sizeof(float));
+    RunStarFieldTasks(threadSystem, StarFieldNoiseTask, &context);
+
+    float minVal = 10.0f;
+    float maxVal = -10.0f;
+    for (uint32_t i = 0; i < taskCount; ++i)
+    {
+        minVal = min(minVal, context.pTaskNoiseRanges[i * 2 + 0]);
+        maxVal = max(maxVal, context.pTaskNoiseRanges[i * 2 + 1]);
+    }
+    tf_free(context.pTaskNoiseRanges);
+    context.mMinNoise = minVal;
+    context.mNoiseRange = maxVal - minVal;
+
+    //	Count, then fill the stars of every vertex at its offset in the preallocated array.
+    //	The count pass also normalizes the nebula density, so it runs for the stars of a catalogue file as well.
+    context.pStarOffsets = (uint32_t*)tf_malloc((context.mVertexCount + 1) * sizeof(uint32_t));
+    RunStarFieldTasks(threadSystem, StarFieldCountTask, &context);
+
+    if (gParticleSystem.mStars.pStars)
+    {
+        tf_free(context.pStarOffsets);
+        (*ppPoints) = (float*)context.pPoints;
+        return;
+    }
+
+    uint32_t starCount = 0;
+    for (uint32_t i = 0; i < context.mVertexCount; ++i)
+    {
+        const uint32_t count = context.pStarOffsets[i];
+        context.pStarOffsets[i] = starCount;
+        starCount += count;
+    }
+    context.pStarOffsets[context.mVertexCount] = starCount;
+
+    context.pStars = (StarCatalogueStar*)tf_malloc(max(starCount, 1u) * sizeof(StarCatalogueStar));
+    RunStarFieldTasks(threadSystem, StarFieldFillTask, &context);
+    AddStarCatalogue(context.pStars, starCount, &gParticleSystem.mStars);
+
+    tf_free(context.pStarOffsets);
+
+    (*ppPoints) = (float*)context.pPoints;
 }
 
 bool Sky::Init(Renderer* const renderer, PipelineCache* pCache)
@@ -371,13 +701,21 @@ bool Sky::Init(Renderer* const renderer, PipelineCache* pCache)
 
     CalculateLookupData();
 
+    AddLookupTexture("Sky Transmittance B", NULL, TRANSMITTANCE_W, TRANSMITTANCE_H, 1, &pTransmittanceTextureB);
+    AddLookupTexture("Sky Inscatter B", NULL, RES_MU_S * RES_NU, RES_MU, RES_R, &pInscatterTextureB);
+
     SyncToken token = {};
 
     // Generate sphere vertex buffer
     VertexStbDsArray IcosahedronVertices;
     IndexStbDsArray  IcosahedronIndices;
     {
-        GenerateIcosahedron(&pSpherePoints, IcosahedronVertices, IcosahedronIndices, gSphereResolution, gSphereDiameter);
+        if (pStarCatalogueFileName && !OpenStarCatalogue(RD_OTHER_FILES, pStarCatalogueFileName, &gParticleSystem.mStars))
+            LOGF(LogLevel::eWARNING, "Could not open the star catalogue %s, the stars are generated", pStarCatalogueFileName);
+
+        GenerateIcosahedron(&pSpherePoints, IcosahedronVertices, IcosahedronIndices, gSphereResolution, gSphereDiameter, mThreadSystem);
+        const uint32_t starCount = GetStarCatalogueCount(&gParticleSystem.mStars, StarMaxMagnitude);
+        gParticleSystem.mParticleCount = StarLimit > 0 ? min(StarLimit, starCount) : starCount;
         sphereIndexCount = (uint32_t)arrlen(IcosahedronIndices);
 
         BufferLoadDesc sphereVbDesc = {};
@@ -413,12 +751,21 @@ bool Sky::Init(Renderer* const renderer, PipelineCache* pCache)
     particleBufferDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER | DESCRIPTOR_TYPE_BUFFER;
     particleBufferDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
     particleBufferDesc.mDesc.mStructStride = sizeof(ParticleData);
-    particleBufferDesc.mDesc.mSize = arrlenu(gParticleSystem.particleDataSet) * sizeof(ParticleData);
+    particleBufferDesc.mDesc.mSize = max(gParticleSystem.mParticleCount, 1u) * sizeof(ParticleData);
     particleBufferDesc.mDesc.mElementCount = (uint32_t)(particleBufferDesc.mDesc.mSize / particleBufferDesc.mDesc.mStructStride);
-    particleBufferDesc.pData = gParticleSystem.particleDataSet;
+    particleBufferDesc.pData = NULL;
     particleBufferDesc.ppBuffer = &gParticleSystem.pParticleInstanceBuffer;
     addResource(&particleBufferDesc, &token);
 
+    //	The stars are expanded straight into the upload memory
+    if (gParticleSystem.mParticleCount)
+    {
+        BufferUpdateDesc particleUpdateDesc = { gParticleSystem.pParticleInstanceBuffer };
+        beginUpdateResource(&particleUpdateDesc);
+        DecodeStarParticles(&gParticleSystem.mStars, gParticleSystem.mParticleCount, (ParticleData*)particleUpdateDesc.pMappedData);
+        endUpdateResource(&particleUpdateDesc);
+    }
+
     BufferLoadDesc renderSkybDesc = {};
     renderSkybDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     renderSkybDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
@@ -597,12 +944,36 @@ void Sky::Exit()
     removeResource(gParticleSystem.pParticleVertexBuffer);
     removeResource(gParticleSystem.pParticleInstanceBuffer);
 
-    arrfree(gParticleSystem.particleDataSet);
-    gParticleSystem.particleDataSet = NULL;
+    if (gParticleSystem.mStars.pStars)
+        CloseStarCatalogue(&gParticleSystem.mStars);
+    gParticleSystem.mParticleCount = 0;
 
     removeResource(pTransmittanceTexture);
     removeResource(pIrradianceTexture);
     removeResource(pInscatterTexture);
+    removeResource(pTransmittanceTextureB);
+    removeResource(pInscatterTextureB);
+
+    if (gLookupAnimation.pGenerator)
+    {
+        RemoveAtmosphereGenerator(gLookupAnimation.pGenerator);
+        RemoveAtmosphereTables(&gLookupAnimation.mTables);
+        tf_free(gLookupAnimation.pPackedTexels);
+    }
+    gLookupAnimation = {};
+
+    tf_free(pLookupTexels);
+    tf_free(pLookupTexelsB);
+    pLookupTexels = NULL;
+    pLookupTexelsB = NULL;
+
+    if (pSkyIrradianceProbe)
+        RemoveSkyIrradianceProbe(pSkyIrradianceProbe);
+    pSkyIrradianceProbe = NULL;
+
+    if (pSkyTimeOfDay)
+        RemoveSkyTimeOfDay(pSkyTimeOfDay);
+    pSkyTimeOfDay = NULL;
 }
 
 bool Sky::Load(RenderTarget** rts, uint32_t count) { return false; }
@@ -613,6 +984,8 @@ void Sky::Update(float deltaTime)
 {
     g_ElapsedTime += deltaTime;
 
+    UpdateLookupAnimation(deltaTime);
+
     rotMat = mat4::translation(vec3(0.0f, -EARTH_RADIUS * 10.0f, 0.0f)) * (mat4::rotationY(-Azimuth) * mat4::rotationZ(Elevation)) *
              mat4::translation(vec3(0.0f, EARTH_RADIUS * 10.0f, 0.0f));
     rotMatStarField = (mat4::rotationY(-Azimuth) * mat4::rotationZ(Elevation));
@@ -794,7 +1167,11 @@ void Sky::prepareDescriptorSets(RenderTarget** ppPreStageRenderTargets, uint32_t
         ScParams[4].ppBuffers = &pTransmittanceBuffer;
         ScParams[5].pName = "depthTexture";
         ScParams[5].ppTextures = &pDepthBuffer->pTexture;
-        updateDescriptorSet(pRenderer, 0, pSkyDescriptorSet[0], 6, ScParams);
+        ScParams[6].pName = "TransmittanceTextureB";
+        ScParams[6].ppTextures = &pTransmittanceTextureB;
+        ScParams[7].pName = "InscatterTextureB";
+        ScParams[7].ppTextures = &pInscatterTextureB;
+        updateDescriptorSet(pRenderer, 0, pSkyDescriptorSet[0], 8, ScParams);
 
         for (uint32_t i = 0; i < gDataBufferCount; ++i)
         {
@@ -865,7 +1242,7 @@ void Sky::Draw(Cmd* cmd)
 
         _cbRootConstantStruct.CameraPosition = float4(localCamPosKM.getX(), localCamPosKM.getY(), localCamPosKM.getZ(), 1.0f);
         _cbRootConstantStruct.QNNear = QNNear;
-        _cbRootConstantStruct.InScatterParams = float4(inscatterParams.x, inscatterParams.y, 0.0f, 0.0f);
+        _cbRootConstantStruct.InScatterParams = float4(inscatterParams.x, inscatterParams.y, gLookupAnimation.mWeight, 0.0f);
         _cbRootConstantStruct.LightIntensity = LightColorAndIntensity;
 
         BufferUpdateDesc BufferUniformSettingDesc = { pRenderSkyUniformBuffer[gFrameIndex] };
@@ -1145,8 +1522,390 @@ float3 Sky::GetSunColor()
     return v3ToF3(transmittanceWithShadowSmooth(r, mu));
 }
 
+/************************************************************************/
+// Batched transmittanceWithShadowSmooth, for many sun directions or many points at once. acos/cos are replaced with the
+// angle sum identity and every block of SUN_BATCH_SIZE elements goes through the math without branches.
+/************************************************************************/
+static const uint32_t SUN_BATCH_SIZE = 16;
+
+#if defined(SKY_SUN_AVX) || defined(SKY_SUN_SSE)
+//	Thin wrapper over the vector registers, the batch math below is written once against it for both widths
+#if defined(SKY_SUN_AVX)
+typedef __m256        SunVec;
+static const uint32_t SUN_VEC_WIDTH = 8;
+
+static inline SunVec SunSet(float x) { return _mm256_set1_ps(x); }
+static inline SunVec SunLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline void   SunStore(float* p, SunVec x) { _mm256_storeu_ps(p, x); }
+static inline SunVec SunAdd(SunVec a, SunVec b) { return _mm256_add_ps(a, b); }
+static inline SunVec SunSub(SunVec a, SunVec b) { return _mm256_sub_ps(a, b); }
+static inline SunVec SunMul(SunVec a, SunVec b) { return _mm256_mul_ps(a, b); }
+static inline SunVec SunMin(SunVec a, SunVec b) { return _mm256_min_ps(a, b); }
+static inline SunVec SunMax(SunVec a, SunVec b) { return _mm256_max_ps(a, b); }
+static inline SunVec SunSqrt(SunVec x) { return _mm256_sqrt_ps(x); }
+static inline SunVec SunRcpEstimate(SunVec x) { return _mm256_rcp_ps(x); }
+static inline SunVec SunAnd(SunVec a, SunVec b) { return _mm256_and_ps(a, b); }
+static inline SunVec SunAbs(SunVec x) { return _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))); }
+static inline SunVec SunGreater(SunVec a, SunVec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline bool   SunAny(SunVec mask) { return _mm256_movemask_ps(mask) != 0; }
+
+//	Rounds x to the nearest integers k and returns them, *pScale gets 2^k
+static inline SunVec SunRoundPow2(SunVec x, SunVec* pScale)
+{
+    const __m256i k = _mm256_cvtps_epi32(x);
+
+    //	AVX has no 256 bit integer arithmetic, the exponent bits are built in two halves
+    const __m128i bias = _mm_set1_epi32(127);
+    const __m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(k), bias), 23);
+    const __m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(k, 1), bias), 23);
+    *pScale = _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    return _mm256_cvtepi32_ps(k);
+}
+#else
+typedef __m128        SunVec;
+static const uint32_t SUN_VEC_WIDTH = 4;
+
+static inline SunVec SunSet(float x) { return _mm_set1_ps(x); }
+static inline SunVec SunLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void   SunStore(float* p, SunVec x) { _mm_storeu_ps(p, x); }
+static inline SunVec SunAdd(SunVec a, SunVec b) { return _mm_add_ps(a, b); }
+static inline SunVec SunSub(SunVec a, SunVec b) { return _mm_sub_ps(a, b); }
+static inline SunVec SunMul(SunVec a, SunVec b) { return _mm_mul_ps(a, b); }
+static inline SunVec SunMin(SunVec a, SunVec b) { return _mm_min_ps(a, b); }
+static inline SunVec SunMax(SunVec a, SunVec b) { return _mm_max_ps(a, b); }
+static inline SunVec SunSqrt(SunVec x) { return _mm_sqrt_ps(x); }
+static inline SunVec SunRcpEstimate(SunVec x) { return _mm_rcp_ps(x); }
+static inline SunVec SunAnd(SunVec a, SunVec b) { return _mm_and_ps(a, b); }
+static inline SunVec SunAbs(SunVec x) { return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))); }
+static inline SunVec SunGreater(SunVec a, SunVec b) { return _mm_cmpgt_ps(a, b); }
+static inline bool   SunAny(SunVec mask) { return _mm_movemask_ps(mask) != 0; }
+
+//	Rounds x to the nearest integers k and returns them, *pScale gets 2^k
+static inline SunVec SunRoundPow2(SunVec x, SunVec* pScale)
+{
+    const __m128i k = _mm_cvtps_epi32(x);
+    *pScale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23));
+    return _mm_cvtepi32_ps(k);
+}
+#endif
+
+static inline SunVec BatchMad(SunVec a, SunVec b, SunVec c) { return SunAdd(SunMul(a, b), c); }
+
+//	Relative error below 3e-6, results beyond the float range saturate to 0 and FLT_MAX
+static inline SunVec BatchExp(SunVec x)
+{
+    x = SunMin(SunMax(x, SunSet(-87.0f)), SunSet(88.0f));
+
+    SunVec       scale;
+    const SunVec kf = SunRoundPow2(SunMul(x, SunSet(1.44269504f)), &scale);
+    const SunVec f = BatchMad(kf, SunSet(2.12194440e-4f), BatchMad(kf, SunSet(-0.693359375f), x));
+
+    SunVec p = SunSet(8.33333377e-3f);
+    p = BatchMad(p, f, SunSet(4.16666679e-2f));
+    p = BatchMad(p, f, SunSet(1.66666672e-1f));
+    p = BatchMad(p, f, SunSet(0.5f));
+    p = BatchMad(p, f, SunSet(1.0f));
+    p = BatchMad(p, f, SunSet(1.0f));
+
+    return SunMul(p, scale);
+}
+
+//	1 / x, refined to full precision
+static inline SunVec BatchRcp(SunVec x)
+{
+    const SunVec rcp = SunRcpEstimate(x);
+    return SunMul(rcp, SunSub(SunSet(2.0f), SunMul(x, rcp)));
+}
+
+static inline SunVec BatchSign(SunVec x)
+{
+    const SunVec one = SunSet(1.0f);
+    const SunVec zero = SunSet(0.0f);
+    return SunSub(SunAnd(SunGreater(x, zero), one), SunAnd(SunGreater(zero, x), one));
+}
+
+//	opticalDepth with the height falloff folded into the exponentials, exp(a0^2) alone overflows for low grazing rays.
+//	sqrtR = sqrt(r), invR = 1 / r
+static inline SunVec BatchOpticalDepth(float H, SunVec r, SunVec sqrtR, SunVec invR, SunVec mu, SunVec d)
+{
+    const SunVec a = SunMul(SunSet(sqrtf(0.5f / H)), sqrtR);
+    const SunVec a0 = SunMul(a, mu);
+    const SunVec a1 = SunMul(a, BatchMad(d, invR, mu));
+    const SunVec s0 = BatchSign(a0);
+    const SunVec s1 = BatchSign(a1);
+    const SunVec a0sq = SunMul(a0, a0);
+    const SunVec a1sq = SunMul(a1, a1);
+    const SunVec y0 = SunMul(s0, BatchRcp(BatchMad(SunSet(2.3193f), SunAbs(a0), SunSqrt(BatchMad(SunSet(1.52f), a0sq, SunSet(4.0f))))));
+    const SunVec y1 = SunMul(s1, BatchRcp(BatchMad(SunSet(2.3193f), SunAbs(a1), SunSqrt(BatchMad(SunSet(1.52f), a1sq, SunSet(4.0f))))));
+
+    const SunVec falloff = SunMul(SunSub(SunSet(Rg), r), SunSet(1.0f / H));
+    //	Only rays that pass their lowest point have the first term
+    const SunVec crossing = SunGreater(s1, s0);
+    const SunVec x = SunAny(crossing) ? SunAnd(crossing, BatchExp(SunAdd(a0sq, falloff))) : SunSet(0.0f);
+    const SunVec dh = SunMul(d, SunSet(1.0f / H));
+    const SunVec arg = SunSub(falloff, SunMul(dh, BatchMad(SunMul(d, SunSet(0.5f)), invR, mu)));
+    const SunVec sum = SunSub(BatchMad(y0, BatchExp(falloff), x), SunMul(y1, BatchExp(arg)));
+
+    return SunMul(SunMul(SunSet(sqrtf(6.2831f * H)), sqrtR), sum);
+}
+
+//	Transmittance of one color channel from the optical depths
+static inline SunVec BatchTransmittance(float betaRChannel, float betaMExChannel, SunVec depthR, SunVec depthM)
+{
+    return BatchExp(SunSub(SunMul(SunSet(-betaRChannel), depthR), SunMul(SunSet(betaMExChannel), depthM)));
+}
+
+static void GetSunTransmittanceBatch(const float* pR, const float* pMu, float* pRed, float* pGreen, float* pBlue)
+{
+    const SunVec zero = SunSet(0.0f);
+    const SunVec one = SunSet(1.0f);
+    const SunVec cosEps = SunSet(cosf(0.5f * PI / 180.0f));
+    const SunVec sinEps = SunSet(sinf(0.5f * PI / 180.0f));
+    const SunVec cosEps1 = SunSet(cosf(0.1f * PI / 180.0f));
+    const SunVec sinEps1 = SunSet(sinf(0.1f * PI / 180.0f));
+
+    for (uint32_t i = 0; i < SUN_BATCH_SIZE; i += SUN_VEC_WIDTH)
+    {
+        const SunVec r = SunLoad(pR + i);
+        const SunVec mu = SunLoad(pMu + i);
+        const SunVec sqrtR = SunSqrt(r);
+        const SunVec invR = BatchRcp(r);
+
+        //	cos(acos(horizMu) + eps), with sin(acos(horizMu)) = Rg / r
+        const SunVec sinHoriz = SunMul(SunSet(Rg), invR);
+        const SunVec horizMu = SunSub(zero, SunSqrt(SunMax(SunSub(one, SunMul(sinHoriz, sinHoriz)), zero)));
+        const SunVec horizMuMin = SunSub(SunMul(horizMu, cosEps), SunMul(sinHoriz, sinEps));
+        const SunVec horizMuMax = SunSub(SunMul(horizMu, cosEps1), SunMul(sinHoriz, sinEps1));
+
+        SunVec t = SunMul(SunSub(mu, horizMuMin), BatchRcp(SunSub(horizMuMax, horizMuMin)));
+        t = SunMin(SunMax(t, zero), one);
+        t = SunMul(SunMul(t, t), SunSub(SunSet(3.0f), SunAdd(t, t)));
+
+        const SunVec d = SunSub(SunSqrt(BatchMad(SunMul(r, r), SunSub(SunMul(mu, mu), one), SunSet(RL * RL))), SunMul(r, mu));
+        const SunVec depthR = BatchOpticalDepth(HR, r, sqrtR, invR, mu, d);
+        const SunVec depthM = BatchOpticalDepth(HM, r, sqrtR, invR, mu, d);
+        SunStore(pRed + i, SunMul(t, BatchTransmittance(betaR.getX(), betaMEx.getX(), depthR, depthM)));
+        SunStore(pGreen + i, SunMul(t, BatchTransmittance(betaR.getY(), betaMEx.getY(), depthR, depthM)));
+        SunStore(pBlue + i, SunMul(t, BatchTransmittance(betaR.getZ(), betaMEx.getZ(), depthR, depthM)));
+    }
+}
+#else
+static inline float BatchSign(float x) { return (float)(x > 0.0f) - (float)(x < 0.0f); }
+
+//	opticalDepth with the height falloff folded into the exponentials, exp(a0^2) alone overflows for low grazing rays
+static inline float BatchOpticalDepth(float H, float r, float mu, float d)
+{
+    const float a = sqrtf((0.5f / H) * r);
+    const float a0 = a * mu;
+    const float a1 = a * (mu + d / r);
+    const float s0 = BatchSign(a0);
+    const float s1 = BatchSign(a1);
+    const float y0 = s0 / (2.3193f * fabsf(a0) + sqrtf(1.52f * a0 * a0 + 4.0f));
+    const float y1 = s1 / (2.3193f * fabsf(a1) + sqrtf(1.52f * a1 * a1 + 4.0f));
+    const float falloff = (Rg - r) / H;
+    const float x = s1 > s0 ? expf(a0 * a0 + falloff) : 0.0f;
+
+    return sqrtf((6.2831f * H) * r) * (x + y0 * expf(falloff) - y1 * expf(falloff - d / H * (d / (2.0f * r) + mu)));
+}
+
+static void GetSunTransmittanceBatch(const float* pR, const float* pMu, float* pRed, float* pGreen, float* pBlue)
+{
+    const float cosEps = cosf(0.5f * PI / 180.0f);
+    const float sinEps = sinf(0.5f * PI / 180.0f);
+    const float cosEps1 = cosf(0.1f * PI / 180.0f);
+    const float sinEps1 = sinf(0.1f * PI / 180.0f);
+
+    for (uint32_t i = 0; i < SUN_BATCH_SIZE; ++i)
+    {
+        const float r = pR[i];
+        const float mu = pMu[i];
+
+        //	cos(acos(horizMu) + eps), with sin(acos(horizMu)) = Rg / r
+        const float sinHoriz = Rg / r;
+        const float horizMu = -sqrtf(max(1.0f - sinHoriz * sinHoriz, 0.0f));
+        const float horizMuMin = horizMu * cosEps - sinHoriz * sinEps;
+        const float horizMuMax = horizMu * cosEps1 - sinHoriz * sinEps1;
+
+        const float t = SmoothStep(horizMuMin, horizMuMax, mu);
+
+        const float d = -r * mu + sqrtf(r * r * (mu * mu - 1.0f) + RL * RL);
+        const float depthR = BatchOpticalDepth(HR, r, mu, d);
+        const float depthM = BatchOpticalDepth(HM, r, mu, d);
+
+        pRed[i] = t * expf(-betaR.getX() * depthR - betaMEx.getX() * depthM);
+        pGreen[i] = t * expf(-betaR.getY() * depthR - betaMEx.getY() * depthM);
+        pBlue[i] = t * expf(-betaR.getZ() * depthR - betaMEx.getZ() * depthM);
+    }
+}
+#endif
+
+void Sky::GetSunTransmittances(const float* pR, const float* pMu, uint32_t count, float* pRed, float* pGreen, float* pBlue)
+{
+    uint32_t i = 0;
+    for (; i + SUN_BATCH_SIZE <= count; i += SUN_BATCH_SIZE)
+        GetSunTransmittanceBatch(pR + i, pMu + i, pRed + i, pGreen + i, pBlue + i);
+
+    if (i == count)
+        return;
+
+    //	The tail goes through a padded batch
+    float          r[SUN_BATCH_SIZE], mu[SUN_BATCH_SIZE], red[SUN_BATCH_SIZE], green[SUN_BATCH_SIZE], blue[SUN_BATCH_SIZE];
+    const uint32_t tail = count - i;
+    for (uint32_t j = 0; j < SUN_BATCH_SIZE; ++j)
+    {
+        r[j] = j < tail ? pR[i + j] : Rt;
+        mu[j] = j < tail ? pMu[i + j] : 1.0f;
+    }
+
+    GetSunTransmittanceBatch(r, mu, red, green, blue);
+    memcpy(pRed + i, red, tail * sizeof(float));
+    memcpy(pGreen + i, green, tail * sizeof(float));
+    memcpy(pBlue + i, blue, tail * sizeof(float));
+}
+
+bool Sky::VerifySunTransmittances(float* pMaxError)
+{
+    //	Denser towards the ground and the horizon where the transmittance changes fastest, the odd count goes through the tail
+    const uint32_t heightCount = 64;
+    const uint32_t muCount = 255;
+    float          r[muCount], mu[muCount], red[muCount], green[muCount], blue[muCount];
+    float          maxError = 0.0f;
+    for (uint32_t i = 0; i < heightCount; ++i)
+    {
+        const float height = (float)i / (float)(heightCount - 1);
+        for (uint32_t j = 0; j < muCount; ++j)
+        {
+            const float s = 2.0f * (float)j / (float)(muCount - 1) - 1.0f;
+            r[j] = Rg + 0.001f + height * height * (Rt - Rg - 0.001f);
+            mu[j] = s * fabsf(s);
+        }
+
+        GetSunTransmittances(r, mu, muCount, red, green, blue);
+        for (uint32_t j = 0; j < muCount; ++j)
+        {
+            const vec3 expected = transmittanceWithShadowSmooth(r[j], mu[j]);
+            maxError = max(maxError, fabsf(expected.getX() - red[j]));
+            maxError = max(maxError, fabsf(expected.getY() - green[j]));
+            maxError = max(maxError, fabsf(expected.getZ() - blue[j]));
+        }
+    }
+
+    if (pMaxError)
+        *pMaxError = maxError;
+    return maxError <= 1e-3f;
+}
+
+void Sky::GetSunColors(const float* pDirX, const float* pDirY, const float* pDirZ, uint32_t count, float* pRed, float* pGreen,
+                       float* pBlue)
+{
+    //	Same origin as GetSunColor
+    const float fUnitsToKM = gSkySettings.SkyInfo.w * 0.001f;
+    float3      localCamPosKM = -gSkySettings.OriginLocation.getXYZ() * fUnitsToKM;
+    localCamPosKM.y += Rg + 0.001f;
+
+    const vec3  x = f3Tov3(localCamPosKM);
+    const float r = length(x);
+
+    float rBatch[SUN_BATCH_SIZE], muBatch[SUN_BATCH_SIZE];
+    for (uint32_t i = 0; i < count; i += SUN_BATCH_SIZE)
+    {
+        const uint32_t batchCount = min(count - i, SUN_BATCH_SIZE);
+        for (uint32_t j = 0; j < batchCount; ++j)
+        {
+            const float dirX = pDirX[i + j];
+            const float dirY = pDirY[i + j];
+            const float dirZ = pDirZ[i + j];
+            rBatch[j] = r;
+            muBatch[j] = (x.getX() * dirX + x.getY() * dirY + x.getZ() * dirZ) / (r * sqrtf(dirX * dirX + dirY * dirY + dirZ * dirZ));
+        }
+
+        GetSunTransmittances(rBatch, muBatch, batchCount, pRed + i, pGreen + i, pBlue + i);
+    }
+}
+
+//	Same inputs as the sky pass in Draw, false while the tables are not on the CPU
+static bool GetSkyRadianceInputs(const Sky* pSky, const vec3& origin, SkyRadianceTables* pTables, SkyRadianceQuery* pQuery)
+{
+    const float weightB = pSky->gLookupAnimation.mWeight;
+    if ((weightB < 1.0f && !pSky->pLookupTexels) || (weightB > 0.0f && !pSky->pLookupTexelsB))
+        return false;
+
+    const float fUnitsToKM = gSkySettings.SkyInfo.w * 0.001f;
+    float3      offsetKM = -gSkySettings.OriginLocation.getXYZ() * fUnitsToKM;
+    offsetKM.y += Rg + 0.001f;
+
+    pTables->pTexels = pSky->pLookupTexels;
+    pTables->pTexelsB = pSky->pLookupTexelsB;
+    pTables->mWeightB = weightB;
+    pQuery->mOrigin = origin * fUnitsToKM + f3Tov3(offsetKM);
+    pQuery->mSunDirection = normalize(f3Tov3(pSky->LightDirection));
+    pQuery->mIntensity = gSkySettings.SkyInfo.y;
+    pQuery->mDistanceScale = fUnitsToKM;
+    return true;
+}
+
+bool Sky::GetSkyRadiance(ThreadSystem threadSystem, const vec3& origin, const SkyRadianceRays& rays)
+{
+    SkyRadianceTables tables;
+    SkyRadianceQuery  query;
+    if (!GetSkyRadianceInputs(this, origin, &tables, &query))
+        return false;
+
+    ::GetSkyRadiance(threadSystem, tables, query, rays);
+    return true;
+}
+
+bool Sky::UpdateSkyIrradiance(ThreadSystem threadSystem, const vec3& origin, uint32_t sampleCount)
+{
+    SkyRadianceTables tables;
+    SkyRadianceQuery  query;
+    if (!GetSkyRadianceInputs(this, origin, &tables, &query))
+        return false;
+
+    if (!pSkyIrradianceProbe)
+        AddSkyIrradianceProbe(&pSkyIrradianceProbe);
+    UpdateSkyIrradianceProbe(pSkyIrradianceProbe, threadSystem, tables, query, sampleCount);
+    return true;
+}
+
+bool Sky::GetSkyIrradiance(bool bSun, SkyIrradiance* pIrradiance)
+{
+    if (!pSkyIrradianceProbe)
+        return false;
+
+    ::GetSkyIrradiance(pSkyIrradianceProbe, bSun, pIrradiance);
+    return true;
+}
+
+bool Sky::UpdateTimeOfDay(ThreadSystem threadSystem, const confetti::Location& location, const confetti::LocalTime& date)
+{
+    const LookupAnimation* pAnimation = &gLookupAnimation;
+    if (pAnimation->bPending || pAnimation->bGenerating || pAnimation->bGenerated || pAnimation->mWeight != pAnimation->mTargetWeight)
+        return false;
+
+    //	The light of the day is the one at the origin of the world
+    SkyRadianceTables tables;
+    SkyRadianceQuery  query;
+    if (!GetSkyRadianceInputs(this, vec3(0.0f, 0.0f, 0.0f), &tables, &query))
+        return false;
+
+    if (!pSkyTimeOfDay)
+        AddSkyTimeOfDay(&pSkyTimeOfDay);
+
+    SkyTimeOfDayParams params = { location, date, pAnimation->mHash, TimeOfDayExposureKey, TimeOfDayMinExposure, TimeOfDayMaxExposure };
+    return UpdateSkyTimeOfDay(pSkyTimeOfDay, threadSystem, params, tables, query);
+}
+
+bool Sky::GetTimeOfDay(float hours, SkyTimeOfDayState* pState)
+{
+    if (!pSkyTimeOfDay)
+        return false;
+
+    return GetSkyTimeOfDay(pSkyTimeOfDay, hours, pState);
+}
+
 Buffer* Sky::GetParticleVertexBuffer() { return gParticleSystem.pParticleVertexBuffer; }
 
 Buffer* Sky::GetParticleInstanceBuffer() { return gParticleSystem.pParticleInstanceBuffer; }
 
-uint32_t Sky::GetParticleCount() { return (uint32_t)arrlen(gParticleSystem.particleDataSet); }
+uint32_t Sky::GetParticleCount() { return gParticleSystem.mParticleCount; }
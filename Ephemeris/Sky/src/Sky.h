@@ -18,8 +18,11 @@
 
 #include "../../src/Perlin.h"
 
+#include "AtmosphereCache.h"
 #include "Icosahedron.h"
 #include "SkyCommon.h"
+#include "SkyTimeOfDay.h"
+#include "StarCatalogue.h"
 
 typedef struct ParticleData
 {
@@ -28,13 +31,31 @@ typedef struct ParticleData
     vec4 ParticleInfo; // x: temperature, y: particle size, z: blink time seed,
 } ParticleData;
 
-typedef ParticleData* ParticleStbDsArray;
+//	Background regeneration of the lookup tables, see Sky::AnimateLookupData
+typedef struct LookupAnimation
+{
+    AtmosphereGenerator* pGenerator;
+    AtmosphereTables     mTables;
+    uint16_t*            pPackedTexels;
+    ThreadSystem         mThreadSystem;
+    AtmosphereParams     mPendingParams;
+    uint64_t             mHash; //	Of the latest parameters
+    bool                 bPending;
+    bool                 bGenerating;
+    bool                 bGenerated; //	Waits until the tables it replaces are faded out
+    float                mWeight;    //	Of the B tables
+    float                mTargetWeight;
+    uint32_t             mSettledFrames;
+    uint32_t             mLoadCount;           //	Calls of Sky::LoadLookupData, which replace the animated tables
+    uint32_t             mGenerationLoadCount; //	mLoadCount when the running generation started
+} LookupAnimation;
 
 typedef struct ParticleSystem
 {
-    Buffer*            pParticleVertexBuffer;
-    Buffer*            pParticleInstanceBuffer;
-    ParticleStbDsArray particleDataSet;
+    Buffer*       pParticleVertexBuffer;
+    Buffer*       pParticleInstanceBuffer;
+    StarCatalogue mStars;         // brightest first
+    uint32_t      mParticleCount; // uploaded, the brightest ones
 } ParticleSystem;
 
 class Sky: public IMiddleware
@@ -65,9 +86,40 @@ public:
 
     bool   Load(int32_t width, int32_t height);
     void   CalculateLookupData();
+    //	Lookup tables of the given atmosphere instead of the baked ones. They come from the cache of generated tables, on a miss
+    //	they are generated (see GenerateAtmosphereTables) and cached, or the baked tables are loaded when bGenerateOnMiss is off.
+    //	Replaces the current tables, so the GPU must be idle and the descriptor sets have to be prepared again.
+    void   LoadLookupData(const AtmosphereParams& params, ThreadSystem threadSystem = NULL, bool bGenerateOnMiss = true);
+    //	Regenerates the tables on the thread system over several frames and crossfades to them over LookupCrossfadeTime,
+    //	so that a changing atmosphere never stalls a frame. Calls made while a generation runs only keep the latest parameters.
+    void   AnimateLookupData(const AtmosphereParams& params, ThreadSystem threadSystem);
+    void   UpdateLookupAnimation(float deltaTime);
     float3 GetSunColor();
+    //	GetSunColor for many directions at once, SoA, within 1e-3 of it
+    void   GetSunColors(const float* pDirX, const float* pDirY, const float* pDirZ, uint32_t count, float* pRed, float* pGreen,
+                        float* pBlue);
+    //	Same for arbitrary points: pR is the distance to the planet center in km, pMu the cosine of the sun zenith angle
+    static void GetSunTransmittances(const float* pR, const float* pMu, uint32_t count, float* pRed, float* pGreen, float* pBlue);
+    //	Compares GetSunTransmittances with the scalar transmittance of GetSunColor from the ground to the top of the atmosphere,
+    //	false when a channel is off by more than 1e-3. pMaxError receives the largest difference. Needs no Init, the example
+    //	runs it from Scripts/Test_Sun_Transmittances.lua.
+    static bool VerifySunTransmittances(float* pMaxError = NULL);
+    //	Sky colour along rays from origin as the sky pass shows it, see SkyRadiance.h. Origin and distances are in world units.
+    //	Needs the CPU copies of LoadLookupData and AnimateLookupData, returns false for the baked tables.
+    bool   GetSkyRadiance(ThreadSystem threadSystem, const vec3& origin, const SkyRadianceRays& rays);
+    //	Ambient light of the sky at origin, see SkyIrradiance.h. sampleCount spreads the update over frames, 0 updates everything.
+    //	Needs the same tables as GetSkyRadiance, GetSkyIrradiance returns false before the first update.
+    bool   UpdateSkyIrradiance(ThreadSystem threadSystem, const vec3& origin, uint32_t sampleCount);
+    bool   GetSkyIrradiance(bool bSun, SkyIrradiance* pIrradiance);
+    //	Keyframes of the day of date at location, see SkyTimeOfDay.h. Rebuilt when the location, the day or the atmosphere change,
+    //	a changing atmosphere keeps the previous keyframes until its crossfade is done. Returns whether they were rebuilt.
+    //	Needs the same tables as GetSkyRadiance.
+    bool   UpdateTimeOfDay(ThreadSystem threadSystem, const confetti::Location& location, const confetti::LocalTime& date);
+    bool   GetTimeOfDay(float hours, SkyTimeOfDayState* pState);
+    //	The star field is spread over the thread system, it is the same for any thread system or none.
+    //	The stars go to gParticleSystem.mStars unless a catalogue was opened there before.
     void   GenerateIcosahedron(float** ppPoints, VertexStbDsArray& vertices, IndexStbDsArray& indices, int numberOfDivisions,
-                               float radius = 1.0f);
+                               float radius = 1.0f, ThreadSystem threadSystem = NULL);
 
     Buffer*  GetParticleVertexBuffer();
     Buffer*  GetParticleInstanceBuffer();
@@ -77,6 +129,11 @@ public:
 
     Renderer*      pRenderer = NULL;
     PipelineCache* pPipelineCache = NULL;
+    ThreadSystem   mThreadSystem = NULL; // Optional, Init generates the star field on it
+
+    const char* pStarCatalogueFileName = NULL; // Optional catalogue in RD_OTHER_FILES that replaces the procedural stars
+    uint32_t    StarLimit = 0;                 // Brightest stars Init uploads, 0 uploads all of them
+    float       StarMaxMagnitude = FLT_MAX;    // Faintest magnitude Init uploads, applied before StarLimit
 
     // #NOTE: Two sets of resources (one in flight and one being used on CPU)
     static const uint32_t gDataBufferCount = 2;
@@ -89,6 +146,19 @@ public:
     Texture* pTransmittanceTexture = NULL;
     Texture* pIrradianceTexture = NULL; // unsigned int irradianceTexture;//unit 2, E table
     Texture* pInscatterTexture = NULL;  // unsigned int inscatterTexture;//unit 3, S table
+    Texture* pTransmittanceTextureB = NULL; // crossfade targets of AnimateLookupData
+    Texture* pInscatterTextureB = NULL;
+
+    LookupAnimation gLookupAnimation = {};
+    float           LookupCrossfadeTime = 2.0f; // seconds
+    uint16_t*       pLookupTexels = NULL;       // packed texels of the lookup textures for the CPU, NULL for the baked ones
+    uint16_t*       pLookupTexelsB = NULL;
+
+    SkyIrradianceProbe* pSkyIrradianceProbe = NULL;
+    SkyTimeOfDay*       pSkyTimeOfDay = NULL;
+    float               TimeOfDayExposureKey = 0.55f; // 0.12 at noon with the default settings
+    float               TimeOfDayMinExposure = 0.05f;
+    float               TimeOfDayMaxExposure = 1.0f;
 
     Sampler* pLinearClampSampler = NULL;
     Sampler* pLinearBorderSampler = NULL;
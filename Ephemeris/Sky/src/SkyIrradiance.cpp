@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "SkyIrradiance.h"
+
+//	The projection runs over 4 samples at once, other targets go through the same loop one sample at a time
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SKY_IRRADIANCE_SSE
+#endif
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+
+//	Coprime with SKY_IRRADIANCE_SAMPLES, so that consecutive samples land in distant strata
+static const uint32_t SKY_IRRADIANCE_SAMPLE_STRIDE = 149;
+
+struct SkyIrradianceProbe
+{
+    float*   pMemory;
+    float*   pDirection[3];
+    float*   pBasis[SKY_SH_COEFF_COUNT];
+    float*   pRadiance[3];
+    uint32_t mNextSample;
+    bool     bEvaluated;
+
+    vec3 mSkySH[SKY_SH_COEFF_COUNT];
+    vec3 mSunDirection;
+    vec3 mSunIrradiance;
+};
+
+//	Same as evaluateSHL2Basis of Aura
+static void EvaluateSHBasis(float x, float y, float z, float* pBasis)
+{
+    pBasis[0] = 0.282095f;
+    pBasis[1] = -0.488603f * y;
+    pBasis[2] = 0.488603f * z;
+    pBasis[3] = -0.488603f * x;
+    pBasis[4] = 1.092548f * x * y;
+    pBasis[5] = -1.092548f * y * z;
+    pBasis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    pBasis[7] = -1.092548f * x * z;
+    pBasis[8] = 0.546274f * (x * x - y * y);
+}
+
+//	Sum of radiance * basis over all the samples for every coefficient, the radiance is read once
+static void ProjectSamples(const float* pRadiance, float* const* ppBasis, float* pCoeffs)
+{
+#if defined(SKY_IRRADIANCE_SSE)
+    __m128 sums[SKY_SH_COEFF_COUNT];
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        sums[k] = _mm_setzero_ps();
+
+    for (uint32_t i = 0; i < SKY_IRRADIANCE_SAMPLES; i += 4)
+    {
+        const __m128 radiance = _mm_load_ps(pRadiance + i);
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+            sums[k] = _mm_add_ps(sums[k], _mm_mul_ps(radiance, _mm_load_ps(ppBasis[k] + i)));
+    }
+
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, sums[k]);
+        pCoeffs[k] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#else
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        pCoeffs[k] = 0.0f;
+
+    for (uint32_t i = 0; i < SKY_IRRADIANCE_SAMPLES; ++i)
+    {
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+            pCoeffs[k] += pRadiance[i] * ppBasis[k][i];
+    }
+#endif
+}
+
+void AddSkyIrradianceProbe(SkyIrradianceProbe** ppProbe)
+{
+    SkyIrradianceProbe* pProbe = tf_new(SkyIrradianceProbe);
+
+    const uint32_t planeCount = 3 + SKY_SH_COEFF_COUNT + 3;
+    pProbe->pMemory = (float*)tf_memalign(16, planeCount * SKY_IRRADIANCE_SAMPLES * sizeof(float));
+    memset(pProbe->pMemory, 0, planeCount * SKY_IRRADIANCE_SAMPLES * sizeof(float));
+
+    float* pPlane = pProbe->pMemory;
+    for (uint32_t c = 0; c < 3; ++c, pPlane += SKY_IRRADIANCE_SAMPLES)
+        pProbe->pDirection[c] = pPlane;
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k, pPlane += SKY_IRRADIANCE_SAMPLES)
+        pProbe->pBasis[k] = pPlane;
+    for (uint32_t c = 0; c < 3; ++c, pPlane += SKY_IRRADIANCE_SAMPLES)
+        pProbe->pRadiance[c] = pPlane;
+
+    for (uint32_t i = 0; i < SKY_IRRADIANCE_SAMPLES; ++i)
+    {
+        const uint32_t stratum = (i * SKY_IRRADIANCE_SAMPLE_STRIDE) % SKY_IRRADIANCE_SAMPLES;
+        const uint32_t thetaStratum = stratum / SKY_IRRADIANCE_PHI_STRATA;
+        const uint32_t phiStratum = stratum % SKY_IRRADIANCE_PHI_STRATA;
+
+        //	Center of the stratum, y is up
+        const float y = -1.0f + 2.0f * (float(thetaStratum) + 0.5f) / float(SKY_IRRADIANCE_THETA_STRATA);
+        const float phi = 2.0f * PI * (float(phiStratum) + 0.5f) / float(SKY_IRRADIANCE_PHI_STRATA);
+        const float sinTheta = sqrtf(max(1.0f - y * y, 0.0f));
+        const float x = sinTheta * cosf(phi);
+        const float z = sinTheta * sinf(phi);
+
+        float basis[SKY_SH_COEFF_COUNT];
+        EvaluateSHBasis(x, y, z, basis);
+
+        pProbe->pDirection[0][i] = x;
+        pProbe->pDirection[1][i] = y;
+        pProbe->pDirection[2][i] = z;
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+            pProbe->pBasis[k][i] = basis[k];
+    }
+
+    pProbe->mNextSample = 0;
+    pProbe->bEvaluated = false;
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        pProbe->mSkySH[k] = vec3(0.0f, 0.0f, 0.0f);
+    pProbe->mSunDirection = vec3(0.0f, 1.0f, 0.0f);
+    pProbe->mSunIrradiance = vec3(0.0f, 0.0f, 0.0f);
+
+    *ppProbe = pProbe;
+}
+
+void RemoveSkyIrradianceProbe(SkyIrradianceProbe* pProbe)
+{
+    tf_free(pProbe->pMemory);
+    tf_delete(pProbe);
+}
+
+void UpdateSkyIrradianceProbe(SkyIrradianceProbe* pProbe, ThreadSystem threadSystem, const SkyRadianceTables& tables,
+                              const SkyRadianceQuery& query, uint32_t sampleCount)
+{
+    uint32_t first = pProbe->mNextSample;
+    if (!pProbe->bEvaluated || sampleCount == 0 || sampleCount >= SKY_IRRADIANCE_SAMPLES)
+    {
+        first = 0;
+        sampleCount = SKY_IRRADIANCE_SAMPLES;
+    }
+
+    //	The range wraps around the end of the sample planes
+    while (sampleCount > 0)
+    {
+        SkyRadianceRays rays = {};
+        rays.mCount = min(sampleCount, SKY_IRRADIANCE_SAMPLES - first);
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            rays.pDirection[c] = pProbe->pDirection[c] + first;
+            rays.pRadiance[c] = pProbe->pRadiance[c] + first;
+        }
+        GetSkyRadiance(threadSystem, tables, query, rays);
+
+        first = (first + rays.mCount) % SKY_IRRADIANCE_SAMPLES;
+        sampleCount -= rays.mCount;
+    }
+    pProbe->mNextSample = first;
+    pProbe->bEvaluated = true;
+
+    //	Every sample stands for the same solid angle
+    const float weight = 4.0f * PI / float(SKY_IRRADIANCE_SAMPLES);
+    float       coeffs[3][SKY_SH_COEFF_COUNT];
+    for (uint32_t c = 0; c < 3; ++c)
+        ProjectSamples(pProbe->pRadiance[c], pProbe->pBasis, coeffs[c]);
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        pProbe->mSkySH[k] = vec3(coeffs[0][k], coeffs[1][k], coeffs[2][k]) * weight;
+
+    //	The sun disk of sunColor in RenderSky.h, its smoothstep between 2 and 2.5 degrees is taken at the middle.
+    //	The transmittance is the attenuation of the ray towards the sun, zero once the ground hides it.
+    const vec3& s = query.mSunDirection;
+    float       sunDirection[3] = { s.getX(), s.getY(), s.getZ() };
+    float       sunRadiance[3], sunTransmittance[3];
+
+    SkyRadianceRays sunRay = {};
+    sunRay.mCount = 1;
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        sunRay.pDirection[c] = &sunDirection[c];
+        sunRay.pRadiance[c] = &sunRadiance[c];
+        sunRay.pAttenuation[c] = &sunTransmittance[c];
+    }
+    GetSkyRadiance(NULL, tables, query, sunRay);
+
+    const float r = length(query.mOrigin);
+    const float mu = dot(query.mOrigin, s) / r;
+    const bool  bShadowed = mu < -sqrtf(max(1.0f - (Rg / r) * (Rg / r), 0.0f));
+    const float sunSolidAngle = 2.0f * PI * (1.0f - cosf(2.25f * PI / 180.0f));
+
+    pProbe->mSunDirection = s;
+    pProbe->mSunIrradiance =
+        bShadowed ? vec3(0.0f, 0.0f, 0.0f) : vec3(sunTransmittance[0], sunTransmittance[1], sunTransmittance[2]) * (ISun * sunSolidAngle);
+}
+
+void GetSkyIrradiance(const SkyIrradianceProbe* pProbe, bool bSun, SkyIrradiance* pIrradiance)
+{
+    float basis[SKY_SH_COEFF_COUNT];
+
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        pIrradiance->mSH[k] = pProbe->mSkySH[k];
+
+    //	The projection of a direction is its basis
+    if (bSun)
+    {
+        EvaluateSHBasis(pProbe->mSunDirection.getX(), pProbe->mSunDirection.getY(), pProbe->mSunDirection.getZ(), basis);
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+            pIrradiance->mSH[k] += pProbe->mSunIrradiance * basis[k];
+    }
+
+    //	Convolution with the clamped cosine divided by PI, per band
+    const float bandScale[SKY_SH_COEFF_COUNT] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    const float normals[6][3] = {
+        { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+    };
+
+    for (uint32_t face = 0; face < 6; ++face)
+    {
+        EvaluateSHBasis(normals[face][0], normals[face][1], normals[face][2], basis);
+
+        vec3 radiance = vec3(0.0f, 0.0f, 0.0f);
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+            radiance += pIrradiance->mSH[k] * (basis[k] * bandScale[k]);
+        pIrradiance->mAmbientCube[face] = maxPerElem(radiance, vec3(0.0f, 0.0f, 0.0f));
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "SkyRadiance.h"
+
+//	Ambient light of the sky on the CPU: the radiance of GetSkyRadiance over the whole sphere projected to second order
+//	spherical harmonics, and the ambient cube of the same light.
+
+//	The basis and its signs are the ones of Aura (LightPropagationSHL2), so the first four coefficients are its first order SH
+static const uint32_t SKY_SH_COEFF_COUNT = 9;
+
+//	Stratified directions, equal solid angle strata in cos(theta) and phi
+static const uint32_t SKY_IRRADIANCE_THETA_STRATA = 16;
+static const uint32_t SKY_IRRADIANCE_PHI_STRATA = 32;
+static const uint32_t SKY_IRRADIANCE_SAMPLES = SKY_IRRADIANCE_THETA_STRATA * SKY_IRRADIANCE_PHI_STRATA;
+
+struct SkyIrradiance
+{
+    vec3 mSH[SKY_SH_COEFF_COUNT]; //	Incoming radiance, rgb
+    vec3 mAmbientCube[6];         //	Irradiance / PI, the radiance of a white diffuse surface facing +X, -X, +Y, -Y, +Z, -Z
+};
+
+typedef struct SkyIrradianceProbe SkyIrradianceProbe;
+
+void AddSkyIrradianceProbe(SkyIrradianceProbe** ppProbe);
+void RemoveSkyIrradianceProbe(SkyIrradianceProbe* pProbe);
+
+//	Evaluates the sky radiance of the next sampleCount directions and projects all of them again, so that the cost of
+//	following the sun can be spread over frames. Consecutive samples are spread over the sphere. The first update evaluates
+//	every direction, so does a sampleCount of 0. The sun itself is updated every time.
+void UpdateSkyIrradianceProbe(SkyIrradianceProbe* pProbe, ThreadSystem threadSystem, const SkyRadianceTables& tables,
+                              const SkyRadianceQuery& query, uint32_t sampleCount);
+
+//	bSun adds the sun disk, leave it out when the sun is a separate direct light
+void GetSkyIrradiance(const SkyIrradianceProbe* pProbe, bool bSun, SkyIrradiance* pIrradiance);
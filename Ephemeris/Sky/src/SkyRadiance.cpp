@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "SkyRadiance.h"
+
+#include "AtmosphereTables.h"
+#include "SkyTasks.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+
+//	Port of inscatter() and transmittance() of RenderSky.h with the options the sky is compiled with (TRANSMITTANCE_NON_LINEAR,
+//	INSCATTER_NON_LINEAR, FIX, IGOR_FIX_MU0, IGOR_FIX_MOIRE). Texture reads emulate the linear clamp sampler.
+
+static const uint32_t SKY_RADIANCE_RAYS_PER_TASK = 256;
+
+static const uint32_t TRANSMITTANCE_OFFSET = 0;
+static const uint32_t INSCATTER_OFFSET = (ATMOSPHERE_TRANSMITTANCE_TEXELS + ATMOSPHERE_IRRADIANCE_TEXELS) * 4;
+
+//	Constants of the shader, whatever atmosphere the tables are generated for
+static const float HR = 8.0f;
+static const vec3  betaR = vec3(5.8e-3f, 1.35e-2f, 3.31e-2f);
+static const float HM = 1.2f;
+static const vec3  betaMEx = vec3(20e-3f / 0.9f, 20e-3f / 0.9f, 20e-3f / 0.9f);
+static const float mieG = 0.76f;
+
+struct SkyRadianceContext
+{
+    const SkyRadianceTables* pTables;
+    const SkyRadianceQuery*  pQuery;
+    const SkyRadianceRays*   pRays;
+};
+
+/************************************************************************/
+// Texture reads
+/************************************************************************/
+//	Finite values only, which is all the packed tables hold
+static float HalfToFloat(uint16_t half)
+{
+    const uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+    float          value;
+    memcpy(&value, &bits, sizeof(value));
+
+    //	Rebiases the exponent, denormals come out right as well
+    value *= 5.192296858534828e33f;
+    return (half & 0x8000) ? -value : value;
+}
+
+static vec4 FetchTexel(const uint16_t* pTexels, int index)
+{
+    const uint16_t* pTexel = pTexels + index * 4;
+    return vec4(HalfToFloat(pTexel[0]), HalfToFloat(pTexel[1]), HalfToFloat(pTexel[2]), HalfToFloat(pTexel[3]));
+}
+
+//	Texels and weight of the linear clamp sampler along one axis
+static void GetLinearTexels(float u, int size, int* pI0, int* pI1, float* pFrac)
+{
+    const float x = u * float(size) - 0.5f;
+    const float x0 = floorf(x);
+    *pFrac = x - x0;
+    *pI0 = clamp((int)x0, 0, size - 1);
+    *pI1 = clamp((int)x0 + 1, 0, size - 1);
+}
+
+static vec4 SampleTexture2D(const uint16_t* pTexels, int width, int height, float u, float v)
+{
+    int   x0, x1, y0, y1;
+    float fx, fy;
+    GetLinearTexels(u, width, &x0, &x1, &fx);
+    GetLinearTexels(v, height, &y0, &y1, &fy);
+
+    const vec4 row0 = lerp(fx, FetchTexel(pTexels, y0 * width + x0), FetchTexel(pTexels, y0 * width + x1));
+    const vec4 row1 = lerp(fx, FetchTexel(pTexels, y1 * width + x0), FetchTexel(pTexels, y1 * width + x1));
+    return lerp(fy, row0, row1);
+}
+
+static vec4 SampleTexture3D(const uint16_t* pTexels, int width, int height, int depth, float u, float v, float w)
+{
+    int   z0, z1;
+    float fz;
+    GetLinearTexels(w, depth, &z0, &z1, &fz);
+
+    const vec4 slice0 = SampleTexture2D(pTexels + z0 * width * height * 4, width, height, u, v);
+    const vec4 slice1 = SampleTexture2D(pTexels + z1 * width * height * 4, width, height, u, v);
+    return lerp(fz, slice0, slice1);
+}
+
+/************************************************************************/
+// RenderSky.h
+/************************************************************************/
+static float SmoothStep(float edge0, float edge1, float x)
+{
+    const float t = clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+static float Contrast(float input, float contrastPower)
+{
+    const bool  bAboveHalf = input > 0.5f;
+    const float toRaise = clamp(2.0f * (bAboveHalf ? 1.0f - input : input), 0.0f, 1.0f);
+    const float output = 0.5f * powf(toRaise, contrastPower);
+    return bAboveHalf ? 1.0f - output : output;
+}
+
+static vec4 Texture4D(const uint16_t* pTexels, float r, float mu, float muS, float nu)
+{
+    const float H = sqrtf(Rt * Rt - Rg * Rg);
+    const float rho = sqrtf(max(r * r - Rg * Rg, 0.0f));
+    const float rmu = r * mu;
+    const float delta = rmu * rmu - r * r + Rg * Rg;
+    const vec4  cst = rmu < 0.0f && delta > 0.0f ? vec4(1.0f, 0.0f, 0.0f, 0.5f - 0.5f / float(RES_MU))
+                                                 : vec4(-1.0f, H * H, H, 0.5f + 0.5f / float(RES_MU));
+    const float uR = 0.5f / float(RES_R) + rho / H * (1.0f - 1.0f / float(RES_R));
+    const float uMu =
+        cst.getW() + (rmu * cst.getX() + sqrtf(max(delta + cst.getY(), 0.0f))) / (rho + cst.getZ()) * (0.5f - 1.0f / float(RES_MU));
+    const float uMuS = 0.5f / float(RES_MU_S) +
+                       (atanf(max(muS, -0.1975f) * tanf(1.26f * 1.1f)) / 1.1f + (1.0f - 0.26f)) * 0.5f * (1.0f - 1.0f / float(RES_MU_S));
+
+    float       nuLerp = (nu + 1.0f) / 2.0f * (float(RES_NU) - 1.0f);
+    const float uNu = floorf(nuLerp);
+    nuLerp = Contrast(nuLerp - uNu, 3.0f);
+
+    const vec4 sample0 = SampleTexture3D(pTexels, RES_MU_S * RES_NU, RES_MU, RES_R, (uNu + uMuS) / float(RES_NU), uMu, uR);
+    const vec4 sample1 = SampleTexture3D(pTexels, RES_MU_S * RES_NU, RES_MU, RES_R, (uNu + uMuS + 1.0f) / float(RES_NU), uMu, uR);
+    return sample0 * (1.0f - nuLerp) + sample1 * nuLerp;
+}
+
+static vec4 InscatterTable(const SkyRadianceTables* pTables, float r, float mu, float muS, float nu)
+{
+    vec4 result = vec4(0.0f);
+    if (pTables->mWeightB < 1.0f)
+        result = Texture4D(pTables->pTexels + INSCATTER_OFFSET, r, mu, muS, nu);
+    if (pTables->mWeightB > 0.0f)
+        result = lerp(pTables->mWeightB, result, Texture4D(pTables->pTexelsB + INSCATTER_OFFSET, r, mu, muS, nu));
+    return result;
+}
+
+static vec3 Transmittance(const SkyRadianceTables* pTables, float r, float mu)
+{
+    const float uR = sqrtf(max((r - Rg) / (Rt - Rg), 0.0f));
+    const float uMu = atanf((mu + 0.15f) / (1.0f + 0.15f) * tanf(1.5f)) / 1.5f;
+
+    vec4 result = vec4(0.0f);
+    if (pTables->mWeightB < 1.0f)
+        result = SampleTexture2D(pTables->pTexels + TRANSMITTANCE_OFFSET, TRANSMITTANCE_W, TRANSMITTANCE_H, uMu, uR);
+    if (pTables->mWeightB > 0.0f)
+        result = lerp(pTables->mWeightB, result,
+                      SampleTexture2D(pTables->pTexelsB + TRANSMITTANCE_OFFSET, TRANSMITTANCE_W, TRANSMITTANCE_H, uMu, uR));
+    return result.getXYZ();
+}
+
+static float OpticalDepth(float H, float r, float mu, float d)
+{
+    const float a = sqrtf((0.5f / H) * r);
+    const float a0 = a * mu;
+    const float a1 = a * (mu + d / r);
+    const float s0 = a0 > 0.0f ? 1.0f : (a0 < 0.0f ? -1.0f : 0.0f);
+    const float s1 = a1 > 0.0f ? 1.0f : (a1 < 0.0f ? -1.0f : 0.0f);
+    const float x = s1 > s0 ? expf(a0 * a0) : 0.0f;
+    const float y0 = s0 / (2.3193f * fabsf(a0) + sqrtf(1.52f * a0 * a0 + 4.0f));
+    const float y1 = s1 / (2.3193f * fabsf(a1) + sqrtf(1.52f * a1 * a1 + 4.0f)) * expf(-d / H * (d / (2.0f * r) + mu));
+
+    return sqrtf((6.2831f * H) * r) * expf((Rg - r) / H) * (x + y0 - y1);
+}
+
+static vec3 AnalyticTransmittance(float r, float mu, float d)
+{
+    const vec3 arg = -betaR * OpticalDepth(HR, r, mu, d) - betaMEx * OpticalDepth(HM, r, mu, d);
+    return vec3(expf(arg.getX()), expf(arg.getY()), expf(arg.getZ()));
+}
+
+static float PhaseFunctionR(float mu) { return (3.0f / (16.0f * PI)) * (1.0f + mu * mu); }
+
+static float PhaseFunctionM(float mu)
+{
+    return 1.5f * 1.0f / (4.0f * PI) * (1.0f - mieG * mieG) * powf(fabsf(1.0f + (mieG * mieG) - 2.0f * mieG * mu), -1.5f) *
+           (1.0f + mu * mu) / (2.0f + mieG * mieG);
+}
+
+static vec3 GetMie(const vec4& rayMie)
+{
+    const vec3 ratio = vec3(betaR.getX() / betaR.getX(), betaR.getX() / betaR.getY(), betaR.getX() / betaR.getZ());
+    return mulPerElem(rayMie.getXYZ(), ratio) * (rayMie.getW() / max(rayMie.getX(), 1e-4f));
+}
+
+static vec4 AttenuateInscatter(const vec4& inscatter0, const vec3& attenuation, const vec4& inscatter1)
+{
+    const vec4 result = inscatter0 - mulPerElem(vec4(attenuation, attenuation.getX()), inscatter1);
+    return maxPerElem(result, vec4(0.0f));
+}
+
+//	inscatter() and the transmittance of the sky pixels in RenderSky.frag.fsl, v is normalized
+static void ComputeSkyRadiance(const SkyRadianceTables* pTables, const SkyRadianceQuery* pQuery, const vec3& v, float t,
+                               vec3* pRadiance, vec3* pAttenuation)
+{
+    const vec3& s = pQuery->mSunDirection;
+    vec3        result = vec3(0.0f);
+    vec3        attenuation = vec3(0.0f);
+
+    vec3  x = pQuery->mOrigin;
+    float r = length(x);
+    float mu = dot(x, v) / r;
+
+    //	Moves x from space to the top of the atmosphere
+    const float d = -r * mu - sqrtf(r * r * (mu * mu - 1.0f) + Rt * Rt);
+    if (d > 0.0f)
+    {
+        x += d * v;
+        t -= d;
+        mu = (r * mu + d) / Rt;
+        r = Rt;
+    }
+
+    if (r <= Rt)
+    {
+        const float nu = dot(v, s);
+        const float muS = dot(x, s) / r;
+        const float phaseR = PhaseFunctionR(nu);
+        const float phaseM = PhaseFunctionM(nu);
+        vec4        inscatter = maxPerElem(InscatterTable(pTables, r, mu, muS, nu), vec4(0.0f));
+
+        if (t > 0.0f)
+        {
+            const vec3  x0 = x + t * v;
+            float       r0 = length(x0);
+            float       mu0 = dot(x0, v) / r0;
+            const float muS0 = dot(x0, s) / r0;
+
+            attenuation = AnalyticTransmittance(r, mu, t);
+            if (r0 > Rg + 0.01f)
+            {
+                inscatter = AttenuateInscatter(inscatter, attenuation, InscatterTable(pTables, r0, mu0, muS0, nu));
+
+                //	Interpolates between two rays above and below the horizon
+                const float EPS = 0.006f;
+                float       muHoriz = -0.0022f;
+                const float muHoriz1 = -sqrtf(1.0f - (Rg / r) * (Rg / r));
+                if (fabsf(mu - muHoriz1) < EPS)
+                    muHoriz = muHoriz1;
+
+                if (fabsf(mu - muHoriz) < EPS)
+                {
+                    const float a = ((mu - muHoriz) + EPS) / (2.0f * EPS);
+
+                    mu = muHoriz - EPS;
+                    r0 = sqrtf(r * r + t * t + 2.0f * r * t * mu);
+                    mu0 = (r * mu + t) / r0;
+                    const vec4 inscatterA = AttenuateInscatter(InscatterTable(pTables, r, mu, muS, nu), attenuation,
+                                                               InscatterTable(pTables, r0, mu0, muS0, nu));
+
+                    mu = muHoriz + EPS;
+                    r0 = sqrtf(r * r + t * t + 2.0f * r * t * mu);
+                    mu0 = (r * mu + t) / r0;
+                    const vec4 inscatterB = AttenuateInscatter(InscatterTable(pTables, r, mu, muS, nu), attenuation,
+                                                               InscatterTable(pTables, r0, mu0, muS0, nu));
+
+                    inscatter = lerp(a, inscatterA, inscatterB);
+                }
+            }
+        }
+
+        //	Mie scattering when the sun is below the horizon is imprecise
+        inscatter.setW(inscatter.getW() * SmoothStep(0.0f, 0.02f, muS));
+        result = maxPerElem(inscatter.getXYZ() * phaseR + GetMie(inscatter) * phaseM, vec3(0.0f));
+    }
+
+    //	Hides the imprecision of low inscattering values
+    const float fixFactor = SmoothStep(0.0007f, 0.002f, dot(result, vec3(0.3f, 0.3f, 0.3f)));
+    *pRadiance = result * (ISun * fixFactor * pQuery->mIntensity);
+
+    //	The sky pixels are attenuated by the transmittance out of the atmosphere
+    if (t <= 0.0f)
+        attenuation = r <= Rt ? Transmittance(pTables, r, mu) : vec3(1.0f, 1.0f, 1.0f);
+    *pAttenuation = attenuation;
+}
+
+static void SkyRadianceTask(void* pUser, uint64_t index)
+{
+    const SkyRadianceContext* pContext = (const SkyRadianceContext*)pUser;
+    const SkyRadianceRays*    pRays = pContext->pRays;
+    const uint32_t            firstRay = (uint32_t)index * SKY_RADIANCE_RAYS_PER_TASK;
+    const uint32_t            lastRay = min(firstRay + SKY_RADIANCE_RAYS_PER_TASK, pRays->mCount);
+
+    //	The shader skips the sky once the sun is well below the horizon
+    const bool bNight = pContext->pQuery->mSunDirection.getY() < -0.3f;
+
+    for (uint32_t i = firstRay; i < lastRay; ++i)
+    {
+        const vec3  v = normalize(vec3(pRays->pDirection[0][i], pRays->pDirection[1][i], pRays->pDirection[2][i]));
+        const float t = pRays->pDistance ? pRays->pDistance[i] * pContext->pQuery->mDistanceScale : 0.0f;
+
+        vec3 radiance, attenuation;
+        ComputeSkyRadiance(pContext->pTables, pContext->pQuery, v, t, &radiance, &attenuation);
+        if (bNight)
+            radiance = vec3(0.0f, 0.0f, 0.0f);
+
+        pRays->pRadiance[0][i] = radiance.getX();
+        pRays->pRadiance[1][i] = radiance.getY();
+        pRays->pRadiance[2][i] = radiance.getZ();
+        if (pRays->pAttenuation[0])
+        {
+            pRays->pAttenuation[0][i] = attenuation.getX();
+            pRays->pAttenuation[1][i] = attenuation.getY();
+            pRays->pAttenuation[2][i] = attenuation.getZ();
+        }
+    }
+}
+
+void GetSkyRadiance(ThreadSystem threadSystem, const SkyRadianceTables& tables, const SkyRadianceQuery& query,
+                    const SkyRadianceRays& rays)
+{
+    ASSERT(tables.pTexels || tables.mWeightB >= 1.0f);
+    ASSERT(tables.pTexelsB || tables.mWeightB <= 0.0f);
+
+    SkyRadianceContext context = { &tables, &query, &rays };
+    const uint32_t     taskCount = (rays.mCount + SKY_RADIANCE_RAYS_PER_TASK - 1) / SKY_RADIANCE_RAYS_PER_TASK;
+
+    RunSkyTasks(threadSystem, SkyRadianceTask, taskCount, &context);
+}
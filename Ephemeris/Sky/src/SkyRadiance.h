@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../../../../The-Forge/Common_3/Utilities/Math/MathTypes.h"
+#include "../../../../The-Forge/Common_3/Utilities/Threading/ThreadSystem.h"
+
+#include "SkyCommon.h"
+
+//	CPU version of the sky shading of RenderSky.frag.fsl, for systems that need the colour of the sky without the GPU:
+//	probes, light baking, visibility heuristics. Reads the same tables as the shader, distances are in km.
+
+//	Packed texels as PackAtmosphereTables writes them. B is only read while it is faded in, like InScatterParams.z does
+//	in the shader.
+struct SkyRadianceTables
+{
+    const uint16_t* pTexels;
+    const uint16_t* pTexelsB;
+    float           mWeightB;
+};
+
+struct SkyRadianceQuery
+{
+    vec3  mOrigin;        //	Relative to the planet center, CameraPosition in the shader
+    vec3  mSunDirection;  //	Normalized
+    float mIntensity;     //	InScatterParams.x + InScatterParams.y
+    float mDistanceScale; //	Converts SkyRadianceRays::pDistance to km
+};
+
+//	Rays from the query origin, SoA
+struct SkyRadianceRays
+{
+    uint32_t     mCount;
+    const float* pDirection[3];   //	Need not be normalized
+    const float* pDistance;       //	Optional, distance to the surface the ray hits, 0 for rays that see the sky
+    float*       pRadiance[3];    //	Light scattered towards the origin along the ray, before exposure and tone mapping
+    float*       pAttenuation[3]; //	Optional, transmittance of the ray, what lies behind the ray is multiplied by it
+};
+
+//	Rays are spread over the thread system in chunks, NULL computes everything on the calling thread. Blocks until done.
+void GetSkyRadiance(ThreadSystem threadSystem, const SkyRadianceTables& tables, const SkyRadianceQuery& query,
+                    const SkyRadianceRays& rays);
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "SkyTasks.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Math/MathTypes.h"
+#include "../../../../The-Forge/Common_3/Utilities/Threading/Atomics.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+
+//	Lives on the heap: workers queued behind other work may start after the call returned, they find no task left then
+struct SkyTaskGroup
+{
+    TaskFunc        pTask;
+    void*           pUser;
+    uint32_t        mTaskCount;
+    tfrg_atomic32_t mNextTask;
+    tfrg_atomic32_t mCompletedTasks;
+    tfrg_atomic32_t mReferences; //	Queued workers and the calling thread, the last one frees the group
+};
+
+static void RunSkyTaskGroup(SkyTaskGroup* pGroup)
+{
+    for (;;)
+    {
+        const uint32_t index = tfrg_atomic32_add_relaxed(&pGroup->mNextTask, 1);
+        if (index >= pGroup->mTaskCount)
+            return;
+
+        pGroup->pTask(pGroup->pUser, index);
+
+        //	Publishes the results to the calling thread
+        tfrg_memorybarrier_release();
+        tfrg_atomic32_add_relaxed(&pGroup->mCompletedTasks, 1);
+    }
+}
+
+static void ReleaseSkyTaskGroup(SkyTaskGroup* pGroup)
+{
+    tfrg_memorybarrier_release();
+    if (tfrg_atomic32_add_relaxed(&pGroup->mReferences, -1) != 1)
+        return;
+
+    tfrg_memorybarrier_acquire();
+    tf_free(pGroup);
+}
+
+static void SkyTaskGroupWorker(void* pUser, uint64_t index)
+{
+    UNREF_PARAM(index);
+    SkyTaskGroup* pGroup = (SkyTaskGroup*)pUser;
+    RunSkyTaskGroup(pGroup);
+    ReleaseSkyTaskGroup(pGroup);
+}
+
+void RunSkyTasks(ThreadSystem threadSystem, TaskFunc pTask, uint32_t taskCount, void* pUser)
+{
+    if (!threadSystem || taskCount <= 1)
+    {
+        for (uint32_t i = 0; i < taskCount; ++i)
+            pTask(pUser, i);
+        return;
+    }
+
+    //	Every worker claims tasks until none are left, the calling thread is one of them
+    const uint32_t workerCount = min(taskCount - 1, max(threadSystemGetNumThreads(threadSystem), 1u));
+
+    SkyTaskGroup* pGroup = (SkyTaskGroup*)tf_malloc(sizeof(SkyTaskGroup));
+    pGroup->pTask = pTask;
+    pGroup->pUser = pUser;
+    pGroup->mTaskCount = taskCount;
+    pGroup->mNextTask = 0;
+    pGroup->mCompletedTasks = 0;
+    pGroup->mReferences = workerCount + 1;
+    threadSystemAddTaskGroup(threadSystem, SkyTaskGroupWorker, workerCount, pGroup);
+
+    RunSkyTaskGroup(pGroup);
+
+    //	Only the tasks already running on workers are left, pUser may go away once they are done
+    while (tfrg_atomic32_load_acquire(&pGroup->mCompletedTasks) < taskCount)
+    {
+    }
+
+    ReleaseSkyTaskGroup(pGroup);
+}
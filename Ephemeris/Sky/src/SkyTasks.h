@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../../../../The-Forge/Common_3/Utilities/Threading/ThreadSystem.h"
+
+//	Runs pTask for every index below taskCount on the thread system and on the calling thread, and returns once all of
+//	them finished. Unlike threadSystemWaitIdle it only waits for its own tasks: work queued by others on the same thread
+//	system, such as the background table generation of AnimateLookupData, does not hold the call up.
+void RunSkyTasks(ThreadSystem threadSystem, TaskFunc pTask, uint32_t taskCount, void* pUser);
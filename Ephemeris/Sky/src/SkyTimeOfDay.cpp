@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "SkyTimeOfDay.h"
+
+#include "Ephemeris.h"
+#include "Sky.h"
+#include "SkyTasks.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+
+//	Keyframe i is the minute i - 1, so that every minute of the day has the two neighbours the interpolation reads
+static const uint32_t SKY_TIME_OF_DAY_KEYFRAMES = SKY_TIME_OF_DAY_MINUTES + 3;
+static const uint32_t SKY_TIME_OF_DAY_KEYFRAMES_PER_TASK = 64;
+
+//	Keyframes are rows of floats, every value is interpolated the same way
+static const uint32_t KEYFRAME_SUN_DIRECTION = 0;
+static const uint32_t KEYFRAME_MOON_DIRECTION = 3;
+static const uint32_t KEYFRAME_SUN_COLOR = 6;
+static const uint32_t KEYFRAME_AMBIENT_SH = 9;
+static const uint32_t KEYFRAME_EXPOSURE = KEYFRAME_AMBIENT_SH + SKY_SH_COEFF_COUNT * 3;
+static const uint32_t KEYFRAME_FLOATS = KEYFRAME_EXPOSURE + 1;
+
+//	Everything the keyframes depend on, compared as a whole
+struct SkyTimeOfDayKey
+{
+    double   mLatitude;
+    double   mLongitude;
+    double   mGMTOffset;
+    int32_t  mYear;
+    int32_t  mMonth;
+    int32_t  mDay;
+    int32_t  mDayLightSaving;
+    uint64_t mAtmosphereHash;
+    float    mOrigin[3];
+    float    mIntensity;
+    float    mExposureKey;
+    float    mMinExposure;
+    float    mMaxExposure;
+};
+
+struct SkyTimeOfDay
+{
+    float*          pKeyframes;
+    SkyTimeOfDayKey mKey;
+    bool            bValid;
+};
+
+struct SkyTimeOfDayContext
+{
+    SkyTimeOfDay*             pTimeOfDay;
+    const SkyTimeOfDayParams* pParams;
+    const SkyRadianceTables*  pTables;
+    const SkyRadianceQuery*   pQuery;
+};
+
+static void GetSkyTimeOfDayKey(const SkyTimeOfDayParams& params, const SkyRadianceQuery& query, SkyTimeOfDayKey* pKey)
+{
+    //	No padding may differ between two keys
+    memset(pKey, 0, sizeof(SkyTimeOfDayKey));
+
+    pKey->mLatitude = params.mLocation.getLatitude();
+    pKey->mLongitude = params.mLocation.getLongitude();
+    pKey->mGMTOffset = params.mDate.getGMTOffset();
+    pKey->mYear = params.mDate.getLocalYear();
+    pKey->mMonth = params.mDate.getLocalMonth();
+    pKey->mDay = params.mDate.getLocalDay();
+    pKey->mDayLightSaving = params.mDate.isDayLightSavingEnabled() ? 1 : 0;
+    pKey->mAtmosphereHash = params.mAtmosphereHash;
+    pKey->mOrigin[0] = query.mOrigin.getX();
+    pKey->mOrigin[1] = query.mOrigin.getY();
+    pKey->mOrigin[2] = query.mOrigin.getZ();
+    pKey->mIntensity = query.mIntensity;
+    pKey->mExposureKey = params.mExposureKey;
+    pKey->mMinExposure = params.mMinExposure;
+    pKey->mMaxExposure = params.mMaxExposure;
+}
+
+//	Sky light of a range of keyframes, every task projects with its own probe
+static void SkyTimeOfDayTask(void* pUser, uint64_t index)
+{
+    const SkyTimeOfDayContext* pContext = (const SkyTimeOfDayContext*)pUser;
+    const SkyTimeOfDayParams*  pParams = pContext->pParams;
+    const uint32_t             firstKeyframe = (uint32_t)index * SKY_TIME_OF_DAY_KEYFRAMES_PER_TASK;
+    const uint32_t             lastKeyframe = min(firstKeyframe + SKY_TIME_OF_DAY_KEYFRAMES_PER_TASK, SKY_TIME_OF_DAY_KEYFRAMES);
+
+    SkyIrradianceProbe* pProbe = NULL;
+    AddSkyIrradianceProbe(&pProbe);
+
+    SkyRadianceQuery query = *pContext->pQuery;
+    for (uint32_t i = firstKeyframe; i < lastKeyframe; ++i)
+    {
+        float* pKeyframe = pContext->pTimeOfDay->pKeyframes + i * KEYFRAME_FLOATS;
+        query.mSunDirection = vec3(pKeyframe[KEYFRAME_SUN_DIRECTION + 0], pKeyframe[KEYFRAME_SUN_DIRECTION + 1],
+                                   pKeyframe[KEYFRAME_SUN_DIRECTION + 2]);
+        UpdateSkyIrradianceProbe(pProbe, NULL, *pContext->pTables, query, 0);
+
+        SkyIrradiance irradiance;
+        GetSkyIrradiance(pProbe, false, &irradiance);
+        for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+        {
+            pKeyframe[KEYFRAME_AMBIENT_SH + k * 3 + 0] = irradiance.mSH[k].getX();
+            pKeyframe[KEYFRAME_AMBIENT_SH + k * 3 + 1] = irradiance.mSH[k].getY();
+            pKeyframe[KEYFRAME_AMBIENT_SH + k * 3 + 2] = irradiance.mSH[k].getZ();
+        }
+
+        //	The exposure follows the light of sun and sky on the ground, the night keeps the largest one
+        GetSkyIrradiance(pProbe, true, &irradiance);
+        const float luminance = dot(irradiance.mAmbientCube[2], vec3(0.2126f, 0.7152f, 0.0722f));
+        pKeyframe[KEYFRAME_EXPOSURE] = pParams->mMaxExposure;
+        if (luminance > 0.0f)
+            pKeyframe[KEYFRAME_EXPOSURE] = clamp(pParams->mExposureKey / luminance, pParams->mMinExposure, pParams->mMaxExposure);
+    }
+
+    RemoveSkyIrradianceProbe(pProbe);
+}
+
+void AddSkyTimeOfDay(SkyTimeOfDay** ppTimeOfDay)
+{
+    SkyTimeOfDay* pTimeOfDay = tf_new(SkyTimeOfDay);
+    pTimeOfDay->pKeyframes = (float*)tf_malloc(SKY_TIME_OF_DAY_KEYFRAMES * KEYFRAME_FLOATS * sizeof(float));
+    memset(&pTimeOfDay->mKey, 0, sizeof(SkyTimeOfDayKey));
+    pTimeOfDay->bValid = false;
+
+    *ppTimeOfDay = pTimeOfDay;
+}
+
+void RemoveSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay)
+{
+    tf_free(pTimeOfDay->pKeyframes);
+    tf_delete(pTimeOfDay);
+}
+
+bool UpdateSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay, ThreadSystem threadSystem, const SkyTimeOfDayParams& params,
+                        const SkyRadianceTables& tables, const SkyRadianceQuery& query)
+{
+    SkyTimeOfDayKey key;
+    GetSkyTimeOfDayKey(params, query, &key);
+    if (pTimeOfDay->bValid && memcmp(&key, &pTimeOfDay->mKey, sizeof(SkyTimeOfDayKey)) == 0)
+        return false;
+
+    //	Directions first, the sun colours of all keyframes are one batch
+    float* pSunR = (float*)tf_malloc(SKY_TIME_OF_DAY_KEYFRAMES * 5 * sizeof(float));
+    float* pSunMu = pSunR + SKY_TIME_OF_DAY_KEYFRAMES;
+    float* pSunColor[3] = { pSunMu + SKY_TIME_OF_DAY_KEYFRAMES, pSunMu + SKY_TIME_OF_DAY_KEYFRAMES * 2,
+                            pSunMu + SKY_TIME_OF_DAY_KEYFRAMES * 3 };
+
+    confetti::Ephemeris ephemeris;
+    confetti::LocalTime localTime = params.mDate;
+    localTime.setLocalHours(0);
+    localTime.setLocalSeconds(0.0);
+
+    const float r = length(query.mOrigin);
+    for (uint32_t i = 0; i < SKY_TIME_OF_DAY_KEYFRAMES; ++i)
+    {
+        localTime.setLocalMinutes((int)i - 1);
+        ephemeris.Update(params.mLocation, localTime);
+
+        const vec3 sunDirection = normalize(f3Tov3(ephemeris.getSunDirection()));
+        const vec3 moonDirection = normalize(f3Tov3(ephemeris.getMoonDirection()));
+
+        float* pKeyframe = pTimeOfDay->pKeyframes + i * KEYFRAME_FLOATS;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            pKeyframe[KEYFRAME_SUN_DIRECTION + c] = sunDirection[c];
+            pKeyframe[KEYFRAME_MOON_DIRECTION + c] = moonDirection[c];
+        }
+
+        pSunR[i] = r;
+        pSunMu[i] = dot(query.mOrigin, sunDirection) / r;
+    }
+
+    Sky::GetSunTransmittances(pSunR, pSunMu, SKY_TIME_OF_DAY_KEYFRAMES, pSunColor[0], pSunColor[1], pSunColor[2]);
+    for (uint32_t i = 0; i < SKY_TIME_OF_DAY_KEYFRAMES; ++i)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            pTimeOfDay->pKeyframes[i * KEYFRAME_FLOATS + KEYFRAME_SUN_COLOR + c] = pSunColor[c][i];
+    }
+    tf_free(pSunR);
+
+    SkyTimeOfDayContext context = { pTimeOfDay, &params, &tables, &query };
+    const uint32_t      taskCount =
+        (SKY_TIME_OF_DAY_KEYFRAMES + SKY_TIME_OF_DAY_KEYFRAMES_PER_TASK - 1) / SKY_TIME_OF_DAY_KEYFRAMES_PER_TASK;
+    RunSkyTasks(threadSystem, SkyTimeOfDayTask, taskCount, &context);
+
+    pTimeOfDay->mKey = key;
+    pTimeOfDay->bValid = true;
+    return true;
+}
+
+void InvalidateSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay) { pTimeOfDay->bValid = false; }
+
+bool GetSkyTimeOfDay(const SkyTimeOfDay* pTimeOfDay, float hours, SkyTimeOfDayState* pState)
+{
+    if (!pTimeOfDay->bValid)
+        return false;
+
+    float minutes = fmodf(hours, 24.0f) * 60.0f;
+    if (minutes < 0.0f)
+        minutes += (float)SKY_TIME_OF_DAY_MINUTES;
+    const uint32_t minute = min((uint32_t)minutes, SKY_TIME_OF_DAY_MINUTES - 1);
+    const float    t = minutes - (float)minute;
+
+    //	Catmull-Rom, the tangents are the central differences of the neighbouring keyframes
+    const float* p0 = pTimeOfDay->pKeyframes + minute * KEYFRAME_FLOATS;
+    const float* p1 = p0 + KEYFRAME_FLOATS;
+    const float* p2 = p1 + KEYFRAME_FLOATS;
+    const float* p3 = p2 + KEYFRAME_FLOATS;
+
+    float state[KEYFRAME_FLOATS];
+    for (uint32_t i = 0; i < KEYFRAME_FLOATS; ++i)
+    {
+        const float a = 3.0f * (p1[i] - p2[i]) + p3[i] - p0[i];
+        const float b = 2.0f * p0[i] - 5.0f * p1[i] + 4.0f * p2[i] - p3[i];
+        state[i] = p1[i] + 0.5f * t * ((p2[i] - p0[i]) + t * (b + t * a));
+    }
+
+    pState->mSunDirection =
+        normalize(vec3(state[KEYFRAME_SUN_DIRECTION], state[KEYFRAME_SUN_DIRECTION + 1], state[KEYFRAME_SUN_DIRECTION + 2]));
+    pState->mMoonDirection =
+        normalize(vec3(state[KEYFRAME_MOON_DIRECTION], state[KEYFRAME_MOON_DIRECTION + 1], state[KEYFRAME_MOON_DIRECTION + 2]));
+    pState->mSunColor =
+        maxPerElem(vec3(state[KEYFRAME_SUN_COLOR], state[KEYFRAME_SUN_COLOR + 1], state[KEYFRAME_SUN_COLOR + 2]), vec3(0.0f, 0.0f, 0.0f));
+    for (uint32_t k = 0; k < SKY_SH_COEFF_COUNT; ++k)
+    {
+        const float* pSH = state + KEYFRAME_AMBIENT_SH + k * 3;
+        pState->mAmbientSH[k] = vec3(pSH[0], pSH[1], pSH[2]);
+    }
+    pState->mExposure = state[KEYFRAME_EXPOSURE];
+    return true;
+}
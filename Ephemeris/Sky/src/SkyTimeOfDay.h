@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "LocalTime.h"
+#include "Location.h"
+#include "SkyIrradiance.h"
+
+//	Sun, moon and sky light over one day with a keyframe per minute, so that following the time of day costs a lookup per frame.
+//	The keyframes are only rebuilt when the location, the day or the atmosphere change.
+static const uint32_t SKY_TIME_OF_DAY_MINUTES = 24 * 60;
+
+struct SkyTimeOfDayState
+{
+    vec3  mSunDirection; //	Normalized, y is up
+    vec3  mMoonDirection;
+    vec3  mSunColor;                      //	Transmittance towards the sun, see Sky::GetSunColor
+    vec3  mAmbientSH[SKY_SH_COEFF_COUNT]; //	Sky light without the sun disk, see SkyIrradiance
+    float mExposure;
+};
+
+struct SkyTimeOfDayParams
+{
+    confetti::Location  mLocation;
+    confetti::LocalTime mDate;           //	Day, GMT offset and daylight saving, the time of the day is ignored
+    uint64_t            mAtmosphereHash; //	GetAtmosphereTablesHash of the tables the query reads
+    float               mExposureKey;    //	mExposure maps the light on a white horizontal surface to this
+    float               mMinExposure;
+    float               mMaxExposure;
+};
+
+typedef struct SkyTimeOfDay SkyTimeOfDay;
+
+void AddSkyTimeOfDay(SkyTimeOfDay** ppTimeOfDay);
+void RemoveSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay);
+
+//	Rebuilds the keyframes when the parameters or the query differ from the previous build and returns whether it did.
+//	The sun direction of the query is ignored. The keyframes are spread over the thread system, blocks until done.
+bool UpdateSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay, ThreadSystem threadSystem, const SkyTimeOfDayParams& params,
+                        const SkyRadianceTables& tables, const SkyRadianceQuery& query);
+void InvalidateSkyTimeOfDay(SkyTimeOfDay* pTimeOfDay);
+
+//	Local time in hours, wrapped to the day. Hermite interpolation of the keyframes around it, false before the first build.
+bool GetSkyTimeOfDay(const SkyTimeOfDay* pTimeOfDay, float hours, SkyTimeOfDayState* pState);
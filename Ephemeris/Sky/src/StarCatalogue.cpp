@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#include "StarCatalogue.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/ILog.h"
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IMemory.h"
+
+static const uint32_t STAR_CATALOGUE_MAGIC = 0x52415453; //	"STAR"
+static const uint32_t STAR_CATALOGUE_VERSION = 1;
+
+typedef struct StarCatalogueHeader
+{
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint32_t mStarSize;
+    uint32_t mStarCount;
+    uint32_t mBucketEnds[STAR_CATALOGUE_BUCKETS];
+} StarCatalogueHeader;
+
+static inline float SignNotZero(float x) { return x >= 0.0f ? 1.0f : -1.0f; }
+
+static inline uint16_t QuantizeUnorm16(float x) { return (uint16_t)(clamp(x, 0.0f, 1.0f) * 65535.0f + 0.5f); }
+
+static inline uint8_t QuantizeUnorm8(float x) { return (uint8_t)(clamp(x, 0.0f, 1.0f) * 255.0f + 0.5f); }
+
+static inline int32_t QuantizeMagnitude(float magnitude) { return (int32_t)floorf(clamp(magnitude, -32.768f, 32.767f) * 1000.0f + 0.5f); }
+
+static inline uint32_t GetMagnitudeBucket(int32_t magnitude)
+{
+    const int32_t offset = magnitude - (int32_t)(STAR_CATALOGUE_MIN_MAGNITUDE * 1000.0f);
+    if (offset < 0)
+        return 0;
+    return min((uint32_t)offset / (uint32_t)(STAR_CATALOGUE_BUCKET_MAGNITUDES * 1000.0f), STAR_CATALOGUE_BUCKETS - 1);
+}
+
+void EncodeStar(const StarCatalogueEntry& entry, StarCatalogueStar* pStar)
+{
+    //	Octahedral mapping, the lower hemisphere is folded over the diagonals
+    const vec3& d = entry.mDirection;
+    const float l1 = fabsf(d.getX()) + fabsf(d.getY()) + fabsf(d.getZ());
+    float       u = d.getX() / l1;
+    float       v = d.getY() / l1;
+    if (d.getZ() < 0.0f)
+    {
+        const float foldedU = (1.0f - fabsf(v)) * SignNotZero(u);
+        const float foldedV = (1.0f - fabsf(u)) * SignNotZero(v);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    pStar->mDirection[0] = QuantizeUnorm16(u * 0.5f + 0.5f);
+    pStar->mDirection[1] = QuantizeUnorm16(v * 0.5f + 0.5f);
+    pStar->mTemperature = (uint16_t)clamp(entry.mTemperature + 0.5f, 0.0f, 65535.0f);
+    pStar->mMagnitude = (int16_t)QuantizeMagnitude(entry.mMagnitude);
+    pStar->mSize = QuantizeUnorm8(entry.mSize / STAR_CATALOGUE_MAX_SIZE);
+    pStar->mTwinkleSeed = QuantizeUnorm8(entry.mTwinkleSeed);
+    pStar->mTwinkleScale = QuantizeUnorm8(entry.mTwinkleScale);
+    pStar->mPadding = 0;
+}
+
+void DecodeStar(const StarCatalogueStar& star, StarCatalogueEntry* pEntry)
+{
+    const float u = (float)star.mDirection[0] * (2.0f / 65535.0f) - 1.0f;
+    const float v = (float)star.mDirection[1] * (2.0f / 65535.0f) - 1.0f;
+    const float w = 1.0f - fabsf(u) - fabsf(v);
+    if (w < 0.0f)
+        pEntry->mDirection = normalize(vec3((1.0f - fabsf(v)) * SignNotZero(u), (1.0f - fabsf(u)) * SignNotZero(v), w));
+    else
+        pEntry->mDirection = normalize(vec3(u, v, w));
+
+    pEntry->mTemperature = (float)star.mTemperature;
+    pEntry->mMagnitude = (float)star.mMagnitude * 0.001f;
+    pEntry->mSize = (float)star.mSize * (STAR_CATALOGUE_MAX_SIZE / 255.0f);
+    pEntry->mTwinkleSeed = (float)star.mTwinkleSeed * (1.0f / 255.0f);
+    pEntry->mTwinkleScale = (float)star.mTwinkleScale * (1.0f / 255.0f);
+}
+
+void AddStarCatalogue(StarCatalogueStar* pStars, uint32_t starCount, StarCatalogue* pCatalogue)
+{
+    *pCatalogue = {};
+
+    //	Counting sort on the quantized magnitude keeps stars of the same magnitude in their order, so the result is deterministic
+    const uint32_t     magnitudeCount = 1 << 16;
+    uint32_t*          pOffsets = (uint32_t*)tf_calloc(magnitudeCount, sizeof(uint32_t));
+    StarCatalogueStar* pSorted = (StarCatalogueStar*)tf_malloc(max(starCount, 1u) * sizeof(StarCatalogueStar));
+
+    for (uint32_t i = 0; i < starCount; ++i)
+        ++pOffsets[pStars[i].mMagnitude + 32768];
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < magnitudeCount; ++i)
+    {
+        const uint32_t count = pOffsets[i];
+        pOffsets[i] = offset;
+        offset += count;
+    }
+
+    for (uint32_t i = 0; i < starCount; ++i)
+        pSorted[pOffsets[pStars[i].mMagnitude + 32768]++] = pStars[i];
+
+    tf_free(pOffsets);
+    tf_free(pStars);
+
+    for (uint32_t i = 0; i < starCount; ++i)
+        ++pCatalogue->mBucketEnds[GetMagnitudeBucket(pSorted[i].mMagnitude)];
+    for (uint32_t i = 1; i < STAR_CATALOGUE_BUCKETS; ++i)
+        pCatalogue->mBucketEnds[i] += pCatalogue->mBucketEnds[i - 1];
+
+    pCatalogue->pStars = pSorted;
+    pCatalogue->pOwnedStars = pSorted;
+    pCatalogue->mStarCount = starCount;
+}
+
+//	GetStarCatalogueCount searches the buckets, it relies on the stars being sorted by magnitude and in their buckets
+static bool IsStarCatalogueSorted(const StarCatalogueHeader* pHeader, const StarCatalogueStar* pStars)
+{
+    uint32_t first = 0;
+    for (uint32_t bucket = 0; bucket < STAR_CATALOGUE_BUCKETS; ++bucket)
+    {
+        const uint32_t last = pHeader->mBucketEnds[bucket];
+        if (last < first)
+            return false;
+
+        for (uint32_t i = first; i < last; ++i)
+        {
+            if (GetMagnitudeBucket(pStars[i].mMagnitude) != bucket || (i > 0 && pStars[i - 1].mMagnitude > pStars[i].mMagnitude))
+                return false;
+        }
+        first = last;
+    }
+
+    return true;
+}
+
+bool OpenStarCatalogue(ResourceDirectory resourceDir, const char* pFileName, StarCatalogue* pCatalogue)
+{
+    *pCatalogue = {};
+
+    if (!fsOpenStreamFromPath(resourceDir, pFileName, FM_READ, &pCatalogue->mStream))
+        return false;
+
+    size_t      size = 0;
+    const void* pData = NULL;
+    if (!fsStreamMemoryMap(&pCatalogue->mStream, &size, &pData) || size < sizeof(StarCatalogueHeader))
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the star catalogue %s, the file is incomplete", pFileName);
+        CloseStarCatalogue(pCatalogue);
+        return false;
+    }
+
+    const StarCatalogueHeader* pHeader = (const StarCatalogueHeader*)pData;
+    if (pHeader->mMagic != STAR_CATALOGUE_MAGIC || pHeader->mVersion != STAR_CATALOGUE_VERSION ||
+        pHeader->mStarSize != sizeof(StarCatalogueStar) ||
+        size != sizeof(StarCatalogueHeader) + (size_t)pHeader->mStarCount * sizeof(StarCatalogueStar) ||
+        pHeader->mBucketEnds[STAR_CATALOGUE_BUCKETS - 1] != pHeader->mStarCount)
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the star catalogue %s, the header does not match", pFileName);
+        CloseStarCatalogue(pCatalogue);
+        return false;
+    }
+
+    const StarCatalogueStar* pStars = (const StarCatalogueStar*)((const uint8_t*)pData + sizeof(StarCatalogueHeader));
+    if (!IsStarCatalogueSorted(pHeader, pStars))
+    {
+        LOGF(LogLevel::eWARNING, "Ignoring the star catalogue %s, the stars are not sorted by magnitude", pFileName);
+        CloseStarCatalogue(pCatalogue);
+        return false;
+    }
+
+    pCatalogue->pStars = pStars;
+    pCatalogue->mStarCount = pHeader->mStarCount;
+    memcpy(pCatalogue->mBucketEnds, pHeader->mBucketEnds, sizeof(pCatalogue->mBucketEnds));
+    return true;
+}
+
+bool SaveStarCatalogue(ResourceDirectory resourceDir, const char* pFileName, const StarCatalogue* pCatalogue)
+{
+    FileStream stream = {};
+    if (!fsOpenStreamFromPath(resourceDir, pFileName, FM_WRITE, &stream))
+    {
+        LOGF(LogLevel::eWARNING, "Could not create the star catalogue %s", pFileName);
+        return false;
+    }
+
+    StarCatalogueHeader header = {};
+    header.mMagic = STAR_CATALOGUE_MAGIC;
+    header.mVersion = STAR_CATALOGUE_VERSION;
+    header.mStarSize = sizeof(StarCatalogueStar);
+    header.mStarCount = pCatalogue->mStarCount;
+    memcpy(header.mBucketEnds, pCatalogue->mBucketEnds, sizeof(header.mBucketEnds));
+
+    //	A partial write leaves a file of the wrong size, which OpenStarCatalogue rejects
+    const size_t starsSize = (size_t)pCatalogue->mStarCount * sizeof(StarCatalogueStar);
+    const bool   bWritten = fsWriteToStream(&stream, &header, sizeof(header)) == sizeof(header) &&
+                          fsWriteToStream(&stream, pCatalogue->pStars, starsSize) == starsSize;
+    fsCloseStream(&stream);
+
+    if (!bWritten)
+        LOGF(LogLevel::eWARNING, "Could not write the star catalogue %s", pFileName);
+    return bWritten;
+}
+
+void CloseStarCatalogue(StarCatalogue* pCatalogue)
+{
+    if (pCatalogue->pOwnedStars)
+        tf_free(pCatalogue->pOwnedStars);
+    else
+        fsCloseStream(&pCatalogue->mStream);
+    *pCatalogue = {};
+}
+
+uint32_t GetStarCatalogueCount(const StarCatalogue* pCatalogue, float maxMagnitude)
+{
+    //	The bucket of the magnitude bounds the search
+    const int32_t  magnitude = QuantizeMagnitude(maxMagnitude);
+    const uint32_t bucket = GetMagnitudeBucket(magnitude);
+    uint32_t       first = bucket > 0 ? pCatalogue->mBucketEnds[bucket - 1] : 0;
+    uint32_t       last = pCatalogue->mBucketEnds[bucket];
+
+    while (first < last)
+    {
+        const uint32_t middle = first + (last - first) / 2;
+        if (pCatalogue->pStars[middle].mMagnitude <= magnitude)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017-2024 The Forge Interactive Inc.
+ *
+ * This is a part of Ephemeris.
+ * This file(code) is licensed under a Creative Commons Attribution-NonCommercial 4.0 International License
+ * (https://creativecommons.org/licenses/by-nc/4.0/legalcode) Based on a work at https://github.com/ConfettiFX/The-Forge. You can not use
+ * this code for commercial purposes.
+ *
+ */
+
+#pragma once
+
+#include "../../../../The-Forge/Common_3/Utilities/Interfaces/IFileSystem.h"
+#include "../../../../The-Forge/Common_3/Utilities/Math/MathTypes.h"
+
+//	Stars in 12 bytes each, brightest first, so that the N brightest stars are the first N of the catalogue.
+//	A catalogue file is a header with the magnitude buckets followed by the stars, the stars are used straight from the mapping.
+
+//	Half magnitude buckets from STAR_CATALOGUE_MIN_MAGNITUDE, the last one holds all the fainter stars
+static const uint32_t STAR_CATALOGUE_BUCKETS = 32;
+static const float    STAR_CATALOGUE_MIN_MAGNITUDE = -2.0f;
+static const float    STAR_CATALOGUE_BUCKET_MAGNITUDES = 0.5f;
+
+static const float STAR_CATALOGUE_MAX_SIZE = 4.0f;
+
+typedef struct StarCatalogueStar
+{
+    uint16_t mDirection[2]; //	Octahedral
+    uint16_t mTemperature;  //	Kelvin
+    int16_t  mMagnitude;    //	Thousandths of a magnitude
+    uint8_t  mSize;         //	Up to STAR_CATALOGUE_MAX_SIZE
+    uint8_t  mTwinkleSeed;
+    uint8_t  mTwinkleScale;
+    uint8_t  mPadding;
+} StarCatalogueStar;
+
+//	A star before quantization
+typedef struct StarCatalogueEntry
+{
+    vec3  mDirection; //	Normalized
+    float mTemperature;
+    float mMagnitude; //	Relative to the brightness of ParticleData::ParticleColors.w, 0 is a brightness of 1
+    float mSize;
+    float mTwinkleSeed;  //	[0, 1]
+    float mTwinkleScale; //	[0, 1]
+} StarCatalogueEntry;
+
+typedef struct StarCatalogue
+{
+    FileStream               mStream;
+    const StarCatalogueStar* pStars;
+    StarCatalogueStar*       pOwnedStars; //	Stars of AddStarCatalogue, NULL for a mapped file
+    uint32_t                 mStarCount;
+    uint32_t                 mBucketEnds[STAR_CATALOGUE_BUCKETS]; //	Stars up to the end of every bucket
+} StarCatalogue;
+
+void EncodeStar(const StarCatalogueEntry& entry, StarCatalogueStar* pStar);
+void DecodeStar(const StarCatalogueStar& star, StarCatalogueEntry* pEntry);
+
+//	Sorts the stars brightest first and takes them over, pStars must come from tf_malloc
+void AddStarCatalogue(StarCatalogueStar* pStars, uint32_t starCount, StarCatalogue* pCatalogue);
+
+//	Maps a catalogue file. Fails when the file is missing, of another version or not written completely.
+bool OpenStarCatalogue(ResourceDirectory resourceDir, const char* pFileName, StarCatalogue* pCatalogue);
+//	For tools that bake a catalogue for OpenStarCatalogue, the runtime only reads them
+bool SaveStarCatalogue(ResourceDirectory resourceDir, const char* pFileName, const StarCatalogue* pCatalogue);
+void CloseStarCatalogue(StarCatalogue* pCatalogue);
+
+//	Number of stars up to the given magnitude, they are the first ones of the catalogue
+uint32_t GetStarCatalogueCount(const StarCatalogue* pCatalogue, float maxMagnitude);
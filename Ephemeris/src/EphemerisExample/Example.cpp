@@ -111,6 +111,14 @@ static uint  gPrevFrameIndex = 0;
 static bool  bSunMove = true;
 static float SunMovingSpeed = 5.0f;
 
+//	Sun of a summer day from the keyframes of Sky::UpdateTimeOfDay instead of the light direction sliders, so that the sun colour
+//	is a lookup instead of GetSunColor every frame. The keyframes need generated lookup tables, which the next reload loads.
+static bool                bTimeOfDay = false;
+static bool                bTimeOfDayTablesLoaded = false;
+static float               TimeOfDayHours = 8.0f;
+static confetti::Location  gTimeOfDayLocation(48.0 * PI / 180.0, 11.0 * PI / 180.0);
+static confetti::LocalTime gTimeOfDayDate;
+
 float mChildIndent = 25.0f;
 float mHeightOffset = 20.0f;
 
@@ -350,6 +358,42 @@ public:
         sliderFloat.mStep = 0.01f;
         luaRegisterWidget(uiCreateComponentWidget(pMainGuiWindow, "Sun Moving Speed", &sliderFloat, WIDGET_TYPE_SLIDER_FLOAT));
 
+        gTimeOfDayDate.setLocalMonth(6);
+        gTimeOfDayDate.setLocalDay(21);
+        gTimeOfDayDate.setGMTOffset(1);
+
+        checkbox.pData = &bTimeOfDay;
+        UIWidget* pTimeOfDay = uiCreateComponentWidget(pMainGuiWindow, "Time Of Day", &checkbox, WIDGET_TYPE_CHECKBOX);
+        uiSetWidgetOnEditedCallback(pTimeOfDay, nullptr,
+                                    [](void*)
+                                    {
+                                        if (bTimeOfDay && !bTimeOfDayTablesLoaded)
+                                        {
+                                            ReloadDesc reloadDesc = { RELOAD_TYPE_SHADER };
+                                            requestReload(&reloadDesc);
+                                        }
+                                    });
+        luaRegisterWidget(pTimeOfDay);
+
+        sliderFloat.pData = &TimeOfDayHours;
+        sliderFloat.mMin = 0.0f;
+        sliderFloat.mMax = 24.0f;
+        sliderFloat.mStep = 0.01f;
+        luaRegisterWidget(uiCreateComponentWidget(pMainGuiWindow, "Time Of Day Hours", &sliderFloat, WIDGET_TYPE_SLIDER_FLOAT));
+
+        ButtonWidget verifySun;
+        UIWidget*    pVerifySun = uiCreateComponentWidget(pMainGuiWindow, "Verify Sun Transmittances", &verifySun, WIDGET_TYPE_BUTTON);
+        uiSetWidgetOnEditedCallback(pVerifySun, nullptr,
+                                    [](void*)
+                                    {
+                                        float sunError = 0.0f;
+                                        if (Sky::VerifySunTransmittances(&sunError))
+                                            LOGF(LogLevel::eINFO, "GetSunTransmittances is within %f of GetSunColor", sunError);
+                                        else
+                                            LOGF(LogLevel::eERROR, "GetSunTransmittances is off by %f from GetSunColor", sunError);
+                                    });
+        luaRegisterWidget(pVerifySun);
+
         // App Actions
         InputActionDesc actionDesc = { DefaultInputActions::DUMP_PROFILE_DATA,
                                        [](InputActionContext* ctx)
@@ -522,6 +566,13 @@ public:
             addPipelines();
         }
 
+        //	Unload waited for the GPU, the descriptor sets are prepared below
+        if (bTimeOfDay && !bTimeOfDayTablesLoaded)
+        {
+            gSky.LoadLookupData(AtmosphereParams());
+            bTimeOfDayTablesLoaded = true;
+        }
+
         waitForAllResourceLoads();
 
         prepareDescriptorSets();
@@ -606,6 +657,25 @@ public:
         float cosElevation = cosf(Elevation);
         vec3  sunDirection = normalize(vec3(cosf(Azimuth) * cosElevation, sinf(Elevation), sinf(Azimuth) * cosElevation));
 
+        //	The keyframes are only rebuilt when the day or the atmosphere change, the speed is the same as for the elevation
+        SkyTimeOfDayState timeOfDay;
+        bool              bFollowTimeOfDay = false;
+        if (bTimeOfDay && bTimeOfDayTablesLoaded)
+        {
+            if (bSunMove)
+                TimeOfDayHours = fmodf(TimeOfDayHours + deltaTime * SunMovingSpeed / 15.0f + 24.0f, 24.0f);
+
+            gSky.UpdateTimeOfDay(NULL, gTimeOfDayLocation, gTimeOfDayDate);
+            bFollowTimeOfDay = gSky.GetTimeOfDay(TimeOfDayHours, &timeOfDay);
+        }
+
+        if (bFollowTimeOfDay)
+        {
+            sunDirection = timeOfDay.mSunDirection;
+            Azimuth = atan2f(sunDirection.getZ(), sunDirection.getX());
+            Elevation = asinf(clamp(sunDirection.getY(), -1.0f, 1.0f));
+        }
+
         gSky.Azimuth = Azimuth;
         gSky.Elevation = Elevation;
         gSky.LightDirection = v3ToF3(sunDirection);
@@ -625,7 +695,7 @@ public:
         gTerrain.volumetricCloudsShadowCB.ShadowInfo = gVolumetricClouds.g_ShadowInfo;
         gTerrain.LightDirection = v3ToF3(sunDirection);
         gTerrain.LightColorAndIntensity = LightColorAndIntensity;
-        gTerrain.SunColor = gSky.GetSunColor();
+        gTerrain.SunColor = bFollowTimeOfDay ? v3ToF3(timeOfDay.mSunColor) : gSky.GetSunColor();
         gTerrain.Update(deltaTime);
 
         gSpaceObjects.Azimuth = Azimuth;
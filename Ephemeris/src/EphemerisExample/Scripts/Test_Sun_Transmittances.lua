@@ -0,0 +1,5 @@
+--[[ Compares the batched sun transmittance of the sky with the scalar one, the result goes to the log --]]
+
+if loader.VerifySunTransmittancesOnEdited ~= nil then
+	loader.VerifySunTransmittancesOnEdited()
+end